@@ -5,6 +5,31 @@
  *
  */
  
+%rename(ClientStats) WsManClientStats;
+%immutable;
+/*
+ * Document-class: ClientStats
+ *
+ * Where the time of a Client's requests went, in microseconds, and
+ * how many bytes went each way. See Client.stats
+ *
+ */
+typedef struct {
+  unsigned long requests;
+  unsigned long long build_usec;
+  unsigned long long serialize_usec;
+  unsigned long long dns_usec;
+  unsigned long long connect_usec;
+  unsigned long long tls_usec;
+  unsigned long long first_byte_usec;
+  unsigned long long transfer_usec;
+  unsigned long long parse_usec;
+  unsigned long long total_usec;
+  unsigned long long request_bytes;
+  unsigned long long response_bytes;
+} WsManClientStats;
+%mutable;
+
 %rename(Client) _WsManClient;
 %nodefault _WsManClient;
 typedef struct _WsManClient {
@@ -605,4 +630,30 @@ typedef struct _WsManClient {
    int last_error() {
      return wsmc_get_last_error($self);
    }
+
+  %newobject stats;
+  /*
+   * Request statistics, summed up since the client was created or
+   * reset_stats was called
+   *
+   * call-seq:
+   *   client.stats -> ClientStats
+   *
+   */
+  WsManClientStats *stats() {
+    WsManClientStats *stats = (WsManClientStats *)calloc(1, sizeof(WsManClientStats));
+    wsmc_get_stats($self, stats);
+    return stats;
+  }
+
+  /*
+   * Reset the request statistics
+   *
+   * call-seq:
+   *   client.reset_stats
+   *
+   */
+  void reset_stats() {
+    wsmc_reset_stats($self);
+  }
 }
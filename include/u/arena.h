@@ -0,0 +1,23 @@
+#ifndef _U_LIBU_ARENA_H_
+#define _U_LIBU_ARENA_H_
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct u_arena_s;
+typedef struct u_arena_s u_arena_t;
+
+u_arena_t *u_arena_create(size_t size);
+void *u_arena_alloc(u_arena_t *arena, size_t size);
+void *u_arena_zalloc(u_arena_t *arena, size_t size);
+char *u_arena_strdup(u_arena_t *arena, const char *s);
+size_t u_arena_used(u_arena_t *arena);
+void u_arena_destroy(u_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,6 +15,7 @@ int u_buf_set(u_buf_t *buf, void *data, size_t size);
 int u_buf_load(u_buf_t *buf, char *fqn);
 int u_buf_free(u_buf_t *buf);
 int u_buf_create(u_buf_t **pbuf);
+int u_buf_create_sized(u_buf_t **pbuf, size_t size);
 int u_buf_reserve(u_buf_t *buf, size_t size);
 void* u_buf_ptr(u_buf_t *buf);
 size_t u_buf_len(u_buf_t *buf);
@@ -22,4 +23,5 @@ void u_buf_set_len(u_buf_t *buf, size_t len);
 size_t u_buf_size(u_buf_t *buf);
 int u_buf_construct(u_buf_t *buf, void *ptr, size_t size, size_t len);
 char *u_buf_steal(u_buf_t *ubuf);
+int u_buf_adopt(u_buf_t *ubuf, u_buf_t *from);
 #endif
@@ -15,6 +15,7 @@
 #include <u/memory.h>
 #include <u/misc.h>
 #include <u/buf.h>
+#include <u/arena.h>
 #include <u/os.h>
 
 
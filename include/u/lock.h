@@ -2,6 +2,12 @@
 #ifndef LOCKING_H
 #define LOCKING_H
 
+#include <u/pthreadx.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #if defined (__FreeBSD__)  || defined (__OpenBSD__) || defined (__NetBSD__) || defined (__APPLE__)
 /* Provide the Linux initializers for MacOS X */
 #define PTHREAD_MUTEX_RECURSIVE_NP                                      PTHREAD_MUTEX_RECURSIVE
@@ -11,6 +17,10 @@
 #endif
 
 
+/*
+ * Plain, non-recursive mutex on the pthread_mutex_t at data. Use the
+ * u_mutex_t calls below for locks shared by request threads.
+ */
 void u_unlock(void* data);
 void u_destroy_lock(void* data);
 void u_lock(void* data);
@@ -18,4 +28,81 @@ int u_try_lock(void* data);
 void u_init_lock(void *data);
 
 
+/*
+ * Contention profiling: every u_mutex_lock() and u_rwlock_*lock() call
+ * site counts its acquisitions, the time spent waiting and, for
+ * exclusive holders, the time the lock was held. Off unless turned on
+ * with u_lock_profile(), at the cost of a test per lock when off.
+ */
+typedef struct u_lock_site_s u_lock_site_t;
+
+struct u_lock_site_s
+{
+    const char *file;
+    int line;
+    const char *name;               /* of the lock, from its last use */
+    int registered;
+    unsigned long count;            /* acquisitions */
+    unsigned long contended;        /* acquisitions that had to wait */
+    unsigned long long wait_usec, wait_max;
+    unsigned long long hold_usec, hold_max;
+    u_lock_site_t *next;
+};
+
+#define U_LOCK_SITE_INIT { __FILE__, __LINE__, NULL, 0, 0, 0, 0, 0, 0, 0, NULL }
+
+typedef struct u_mutex_s
+{
+    pthread_mutex_t mutex;
+    const char *name;
+    u_lock_site_t *site;            /* profiled holder */
+    unsigned long long since;
+} u_mutex_t;
+
+/* shared for readers, exclusive for writers; a mutex where unsupported */
+typedef struct u_rwlock_s
+{
+#ifndef WIN32
+    pthread_rwlock_t rwlock;
+#else
+    pthread_mutex_t rwlock;
+#endif
+    const char *name;
+    u_lock_site_t *site;            /* profiled writer */
+    unsigned long long since;
+} u_rwlock_t;
+
+int u_mutex_init(u_mutex_t *m, const char *name);
+void u_mutex_destroy(u_mutex_t *m);
+void u_mutex_lock_at(u_mutex_t *m, u_lock_site_t *site);
+void u_mutex_unlock(u_mutex_t *m);
+
+int u_rwlock_init(u_rwlock_t *l, const char *name);
+void u_rwlock_destroy(u_rwlock_t *l);
+void u_rwlock_rdlock_at(u_rwlock_t *l, u_lock_site_t *site);
+void u_rwlock_wrlock_at(u_rwlock_t *l, u_lock_site_t *site);
+void u_rwlock_unlock(u_rwlock_t *l);
+
+#define u_mutex_lock(m) do { \
+    static u_lock_site_t u_lock_site_ = U_LOCK_SITE_INIT; \
+    u_mutex_lock_at((m), &u_lock_site_); \
+} while (0)
+
+#define u_rwlock_rdlock(l) do { \
+    static u_lock_site_t u_lock_site_ = U_LOCK_SITE_INIT; \
+    u_rwlock_rdlock_at((l), &u_lock_site_); \
+} while (0)
+
+#define u_rwlock_wrlock(l) do { \
+    static u_lock_site_t u_lock_site_ = U_LOCK_SITE_INIT; \
+    u_rwlock_wrlock_at((l), &u_lock_site_); \
+} while (0)
+
+void u_lock_profile(int on);
+char *u_lock_profile_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
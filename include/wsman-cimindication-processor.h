@@ -60,6 +60,8 @@
 #define CIMXML_PROPERTYARRAY "PROPERTY.ARRAY"
 #define CIMXML_VALUEARRAY "VALUE.ARRAY"
 
+#define CIMXML_INGEST_QUEUE_SIZE 1024 // indications waiting for conversion
+
 typedef struct {
         SoapH soap;
         char *uuid;
@@ -93,6 +95,8 @@ typedef struct {
 
 CimxmlMessage *cimxml_message_new(void);
 void cimxml_message_destroy(CimxmlMessage *msg);
+int cim_indication_ingest_init(unsigned int queue_size);
+void cim_indication_ingest_shutdown(void);
 void CIM_Indication_call(cimxml_context *cntx, CimxmlMessage *message, void *opaqueData);
 
 #endif
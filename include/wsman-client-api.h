@@ -174,6 +174,7 @@ typedef enum {
 #define FLAG_EVENT_SENDBOOKMARK		     0X8000
 #define FLAG_CIM_SCHEMA_OPT		    0X10000
 #define FLAG_EXCLUDE_NIL_PROPS		    0X20000
+#define FLAG_ENUMERATION_TUNE_MAX_ELEMENTS  0X40000 /* adaptive MaxElements of Pull requests */
 
 	typedef struct {
 		unsigned long flags;
@@ -195,7 +196,8 @@ typedef enum {
 		unsigned int max_elements;
 		hash_t *options; /* for WSM_OPTION_SET */
                 char *locale; /* Sect. 6.3: wsman:Locale */
-          char *__reserved[16]; /* reserved for future extensions */
+		unsigned int prefetch_depth; /* Pull responses fetched ahead of the caller */
+          char *__reserved[15]; /* reserved for future extensions */
 	} client_opt_t;
 
 	struct _WsManFault {
@@ -355,6 +357,42 @@ typedef enum {
 	 */
 	WS_LASTERR_Code wsmc_get_last_error(WsManClient * cl);
 
+	/*
+	 * Where the time of a client's requests went, in microseconds,
+	 * summed up since the client was created or its statistics reset.
+	 * Network times and byte counts cover every attempt, so a
+	 * request that had to authenticate again includes the exchange
+	 * answered with 401.
+	 */
+	typedef struct {
+		unsigned long requests;		/* requests sent */
+		unsigned long long build_usec;	/* request documents created */
+		unsigned long long serialize_usec; /* request documents to bytes */
+		unsigned long long dns_usec;	/* host name lookups */
+		unsigned long long connect_usec; /* TCP connects */
+		unsigned long long tls_usec;	/* TLS handshakes */
+		unsigned long long first_byte_usec; /* request sent until first response byte */
+		unsigned long long transfer_usec; /* first until last response byte */
+		unsigned long long parse_usec;	/* response bytes to documents, when not
+						 * parsed while receiving */
+		unsigned long long total_usec;	/* in the transport */
+		unsigned long long request_bytes;
+		unsigned long long response_bytes;
+	} WsManClientStats;
+
+	/**
+	 * Get request statistics
+	 * @param cl Client handle
+	 * @param stats Filled with the statistics
+	 */
+	void wsmc_get_stats(WsManClient * cl, WsManClientStats *stats);
+
+	/**
+	 * Reset request statistics
+	 * @param cl Client handle
+	 */
+	void wsmc_reset_stats(WsManClient * cl);
+
 
 	/**
 	 * Read XML file
@@ -456,7 +494,7 @@ typedef enum {
 	 * @param resource_uri Resource URI
 	 * @param client_opt_t Request options and flags
 	 * @param typeInfo Data type information
-	 * @param data  Pointer to data
+	 * @param data  Pointer to data, left to the caller to free
 	 * @return response document
 	 */
 	WsXmlDocH wsmc_action_put_serialized(WsManClient * cl,
@@ -506,7 +544,7 @@ typedef enum {
 	 * @param resource_uri Resource URI
 	 * @param client_opt_t Request options and flags
 	 * @param typeInfo Data type information
-	 * @param data  Pointer to data
+	 * @param data  Pointer to data, left to the caller to free
 	 * @return response document
 	 */
 	WsXmlDocH wsmc_action_create_serialized(WsManClient * cl,
@@ -643,7 +681,7 @@ typedef enum {
 	 * @param client_opt_t Request options and flags
 	 * @param method  Custom method name
 	 * @param typeInfo Data type information
-	 * @param data  Pointer to data
+	 * @param data  Pointer to data, left to the caller to free
 	 * @return response document
 	 */
 	WsXmlDocH wsmc_action_invoke_serialized(WsManClient * cl,
@@ -671,6 +709,45 @@ typedef enum {
 				      SoapResponseCallback callback,
 				      void *callback_data);
 
+	/*
+	 * Prefetching enumerator: a thread keeps sending Pull requests as
+	 * soon as the enumeration context of the previous response is known,
+	 * at most options->prefetch_depth responses ahead of the caller.
+	 * The thread sends through its own copy of the client, which does
+	 * not stream items to the item callback; the client stays free for
+	 * the caller and gets the statistics of the copy on
+	 * wsmc_enumerator_free(). options and filter must outlive it.
+	 */
+	typedef struct _WsManEnumerator WsManEnumerator;
+
+	/**
+	 * Start pulling from an enumeration context
+	 * @param cl Client handle
+	 * @param resource_uri Resource URI
+	 * @param client_opt_t Request options and flags
+	 * @param enumContext Context from the Enumerate response
+	 * @return enumerator handle
+	 */
+	WsManEnumerator *wsmc_enumerator_new(WsManClient * cl,
+				      const char *resource_uri,
+				      client_opt_t * options,
+				      filter_t *filter,
+				      const char *enumContext);
+
+	/**
+	 * Wait for the next Pull response
+	 * @param e Enumerator handle
+	 * @param doc Response document, owned by the caller (NULL if the request failed)
+	 * @param response_code HTTP code of that response
+	 * @param last_error Transport error of that request
+	 * @return 0 once all responses were handed out
+	 */
+	int wsmc_enumerator_next(WsManEnumerator *e, WsXmlDocH *doc,
+				      long *response_code, WS_LASTERR_Code *last_error);
+
+	/* sends Release if the enumeration did not reach its end */
+	void wsmc_enumerator_free(WsManEnumerator *e);
+
 	/**
 	 * Create a request envelope based on client data
 	 * @param cl Client handle
@@ -688,6 +765,42 @@ typedef enum {
 					      WsmanAction action,
 					      char *method, void *data);
 
+	typedef struct _WsManPreparedRequest WsManPreparedRequest;
+
+	/**
+	 * Build and serialize a request once, for sending it many times,
+	 * possibly through different clients. Only the To address, the
+	 * MessageID, the enumeration context and the selector values
+	 * change from one send to the next. UTF-8 clients only.
+	 * @param cl Client handle
+	 * @param resource_uri Resource URI
+	 * @param options Request options and flags
+	 * @param filter Filter, can be NULL
+	 * @param action Requested Action (e.g., Get, Pull, Release)
+	 * @return Prepared request, NULL on error
+	 */
+	WsManPreparedRequest *wsmc_prepare_request(WsManClient * cl,
+					      const char *resource_uri,
+					      client_opt_t * options,
+					      filter_t *filter,
+					      WsmanAction action);
+
+	/**
+	 * Send a prepared request
+	 * @param cl Client handle, gives the To address
+	 * @param r Prepared request
+	 * @param options Selector values for this call, can be NULL to
+	 * keep those the request was prepared with
+	 * @param enumContext Enumeration context of a Pull or Release
+	 * @return Response document
+	 */
+	WsXmlDocH wsmc_prepared_send(WsManClient * cl,
+					      WsManPreparedRequest *r,
+					      client_opt_t * options,
+					      const char *enumContext);
+
+	void wsmc_prepared_free(WsManPreparedRequest *r);
+
 	/**
 	 * Get enumeration context from response
 	 * @param doc Response document
@@ -785,6 +898,9 @@ typedef enum {
   void wsmc_set_locale(client_opt_t * options, const char *locale);
   char *wsmc_get_locale(client_opt_t * options);
 
+	/* number of Pull responses fetched ahead, 0 pulls one by one */
+	void wsmc_set_prefetch(client_opt_t * options, unsigned int depth);
+
 	/* Misc */
 
 	/* Place holder */
@@ -808,6 +924,18 @@ typedef enum {
 
 	FILE *wsmc_get_dumpfile(WsManClient *cl);
 
+	/**
+	 * Parse responses while they arrive and pass each enumeration item
+	 * to a callback as soon as it is complete, instead of keeping the
+	 * items in the response document. The item is freed when the
+	 * callback returns; a non-zero return aborts the transfer.
+	 * @param cl Client handle
+	 * @param callback Item callback, NULL to go back to whole documents
+	 * @param data Callback data
+	 */
+	void wsmc_set_item_callback(WsManClient *cl,
+				WsXmlEnumCallback callback, void *data);
+
 #ifndef _WIN32
 	void wsmc_set_conffile(WsManClient *cl, char * f);
 
@@ -45,6 +45,7 @@ extern "C" {
 #endif
 
 #include "wsman-client-api.h"
+#include "u/buf.h"
 
 
 #ifdef PACKAGE_STRING
@@ -62,6 +63,26 @@ extern "C" {
 
 int wsman_send_request(WsManClient *cl, WsXmlDocH request);
 
+int wsman_send_request_buf(WsManClient *cl, u_buf_t *request);
+
+/*
+ * Asynchronous requests, many of them driven by one thread.
+ * wsman_async_send_request() starts a request on a client, which stays
+ * busy until the callback is called from wsman_async_run(). The callback
+ * finds the outcome in the client, as after wsman_send_request().
+ * wsman_async_run() waits up to timeout msecs for network activity and
+ * returns the number of requests still in flight.
+ */
+typedef struct _WsManAsync WsManAsync;
+typedef void (*wsman_async_callback_t) (WsManClient *cl, void *data);
+
+WsManAsync *wsman_async_new(void);
+void wsman_async_destroy(WsManAsync *async);
+int wsman_async_send_request(WsManAsync *async, WsManClient *cl, WsXmlDocH request,
+		wsman_async_callback_t callback, void *data);
+int wsman_async_run(WsManAsync *async, int timeout);
+int wsman_async_pending(WsManAsync *async);
+
 /*
  * Set callback function to ask for username/password on authentication failure (http-401 returned)
  * If the callback returns an empty (or NULL) username, authentication is aborted.
@@ -77,6 +98,13 @@ extern int wsmc_transport_init(WsManClient *cl, void *arg);
 
 extern void wsman_transport_close_transport(WsManClient *cl);
 
+/*
+ * Released clients leave their connection behind for the next client
+ * talking to the same endpoint with the same credentials. This closes
+ * the idle ones, e.g. before the process exits.
+ */
+extern void wsman_transport_flush_connections(void);
+
 extern void wsmc_transport_fini(WsManClient *cl);
 
 extern void   wsman_transport_set_agent(WsManClient *cl, const char *agent);
@@ -145,10 +173,6 @@ extern char *wsman_transport_get_cert(WsManClient *cl);
 extern void  wsman_transport_set_key(WsManClient *cl, const char *key);
 extern char *wsman_transport_get_key(WsManClient *cl);
 
-#ifdef DEBUG_VERBOSE
-long long get_transfer_time(void);
-#endif
-
 #ifdef __cplusplus
 }
 #endif
@@ -52,6 +52,8 @@ extern "C" {
 	struct _WsManConnection {
 		u_buf_t *request;
 		u_buf_t *response;
+		WsXmlDocH response_doc;	/* parsed while receiving */
+		size_t response_size;	/* bytes of the response received, parsed or not */
 	};
 	typedef struct _WsManConnection WsManConnection;
 
@@ -126,6 +128,10 @@ extern "C" {
 #ifndef _WIN32
 		char *client_config_file;
 #endif
+		WsXmlEnumCallback item_callback;
+		void *item_data;
+		struct _WsManPullTuning *pull_tuning; /* FLAG_ENUMERATION_TUNE_MAX_ELEMENTS */
+		WsManClientStats stats;
 
 	};
 
@@ -135,6 +141,10 @@ extern "C" {
 	int wsmc_lock(WsManClient * cl);
 	void wsmc_unlock(WsManClient * cl);
 
+	/* microseconds since start, for WsManClientStats */
+	struct timeval;
+	unsigned long long wsmc_usec_since(const struct timeval *start);
+
 
 #ifdef __cplusplus
 }
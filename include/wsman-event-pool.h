@@ -69,6 +69,7 @@ typedef int (*EventPoolAddEvent) (char *, WsNotificationInfoH);
 typedef int (*EventPoolAddPullEvent) (char *, WsNotificationInfoH);
 typedef int (*EventPoolGetAndDeleteEvent) (char *, WsNotificationInfoH*);
 typedef int (*EventPoolClearEvent) (char *, clearproc);
+typedef int (*EventPoolCommitEvent) (char *);
 
 /*Event Source Function Table*/
 struct __EventPoolOpSet {
@@ -79,10 +80,22 @@ struct __EventPoolOpSet {
 	EventPoolAddPullEvent addpull;
 	EventPoolGetAndDeleteEvent remove;
 	EventPoolClearEvent clear;
+	EventPoolCommitEvent commit; //events handed out by remove() were delivered
 };
 typedef struct __EventPoolOpSet *EventPoolOpSetH;
 
+/*Configuration of the log backed event pool*/
+struct __LogEventPoolConfig {
+	char *path; //directory holding the segment files
+	unsigned long segment_size; //size of a segment file in bytes
+	int sync_batch; //records appended between two msync() calls
+	int max_segments; //sealed segments kept before live events are copied forward
+	int max_pull_events; //limit of pending events for pull subscriptions
+};
+typedef struct __LogEventPoolConfig LogEventPoolConfig;
+
 EventPoolOpSetH wsman_get_eventpool_opset(void);
+EventPoolOpSetH wsman_get_log_eventpool_opset(void);
 
 #ifdef __cplusplus
 }
@@ -49,6 +49,7 @@ void wsman_server_read_plugin_config(void *arg, char *config_file);
 void wsman_server_set_subscription_repos(char *repos);
 void *wsman_server_get_subscription_repos(void);
 void wsman_event_init(void *arg);
+void wsman_event_shutdown(void *arg);
 void wsman_receive_cim_indication(void *arg, char *uuid, void *msg);
 #ifdef __cplusplus
 }
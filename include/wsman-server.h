@@ -44,6 +44,7 @@ extern int continue_working;
 WsContextH wsman_init_plugins(WsManListenerH *listener);
 SubsRepositoryOpSetH wsman_init_subscription_repository(WsContextH cntx, char *uri);
 EventPoolOpSetH wsman_init_event_pool(WsContextH cntx, void*data);
+EventPoolOpSetH wsman_init_log_event_pool(WsContextH cntx, LogEventPoolConfig *config);
 WsManListenerH *wsman_dispatch_list_new(void);
 void *wsman_server_auxiliary_loop_thread(void *arg);
 int wsman_clean_subsrepository(SoapH soap, SubsRepositoryEntryH entry);
@@ -44,6 +44,37 @@
 /* special hash key to denote method args (where array elements have identical keys) */
 #define METHOD_ARGS_KEY "method_args"
 
+/* SOAP header elements looked up through wsman_get_header() */
+enum {
+	WSMAN_HEADER_ACTION,
+	WSMAN_HEADER_TO,
+	WSMAN_HEADER_MESSAGE_ID,
+	WSMAN_HEADER_REPLY_TO,
+	WSMAN_HEADER_FAULT_TO,
+	WSMAN_HEADER_RESOURCE_URI,
+	WSMAN_HEADER_SELECTOR_SET,
+	WSMAN_HEADER_OPTION_SET,
+	WSMAN_HEADER_MAX_ENVELOPE_SIZE,
+	WSMAN_HEADER_OPERATION_TIMEOUT,
+	WSMAN_HEADER_LOCALE,
+	WSMAN_HEADER_FRAGMENT_TRANSFER,
+	WSMAN_HEADER_REQUEST_TOTAL,
+	WSMAN_HEADER_COUNT
+};
+
+/*
+ * The SOAP header of an inbound envelope, indexed in a single pass when
+ * it is parsed. A single allocation, dropped by any change to the tree.
+ */
+struct _WsmanHeaderIndex {
+	WsXmlNodeH header;
+	WsXmlNodeH identify;	// wsmid:Identify in the body
+	WsXmlNodeH elements[WSMAN_HEADER_COUNT];
+	int mustUnderstandCount;
+	WsXmlNodeH mustUnderstand[1];
+};
+typedef struct _WsmanHeaderIndex WsmanHeaderIndex;
+
 int wsman_is_valid_envelope(WsmanMessage * msg, WsXmlDocH doc);
 
 char *wsman_get_soap_header_value( WsXmlDocH doc, const char *nsUri,
@@ -62,6 +93,18 @@ WsXmlDocH wsman_create_response_envelope(WsXmlDocH rqstDoc, const char *action);
 
 WsXmlDocH wsman_build_inbound_envelope( WsmanMessage * msg);
 
+WsXmlDocH wsman_build_inbound_header(WsmanMessage * msg,
+		WsXmlStreamParser **rest);
+
+WsXmlDocH wsman_build_inbound_body(WsmanMessage * msg, WsXmlDocH doc,
+		WsXmlStreamParser *rest);
+
+WsmanHeaderIndex *wsman_index_headers(WsXmlDocH doc);
+
+WsmanHeaderIndex *wsman_get_header_index(WsXmlDocH doc);
+
+WsXmlNodeH wsman_get_header(WsXmlDocH doc, int which);
+
 WsXmlDocH wsman_create_fault_envelope(
 				      WsXmlDocH rqstDoc,
 				      const char *code,
@@ -39,6 +39,8 @@
 #define WSMAN_SOAP_H_
 
 #include "u/hash.h"
+#include "u/arena.h"
+#include "u/lock.h"
 #include "u/list.h"
 #include "wsman-faults.h"
 #include "wsman-soap-message.h"
@@ -51,6 +53,11 @@
 #define SOAP_MAX_RESENT_COUNT       10
 #define PEDNING_EVENT_MAX_COUNT	10
 
+/* notification delivery retry policy, used unless wsman:ConnectionRetry is given */
+#define WSE_DELIVERY_RETRY_COUNT	3
+#define WSE_DELIVERY_RETRY_INTERVAL	5000	/* msecs, doubled after each failure */
+#define WSE_DELIVERY_RETRY_MAX_INTERVAL	300000	/* msecs */
+
 
 #define WS_DISP_TYPE_MASK               0xffff
 
@@ -95,8 +102,6 @@ struct __SoapOp {
 typedef struct __SoapOp *SoapOpH;
 
 struct __Soap {
-	/* do not move this field */
-	pthread_mutex_t lockData;
 	unsigned long   uniqueIdCounter;
 
 	list_t         *inboundFilterList;
@@ -105,10 +110,17 @@ struct __Soap {
 	list_t         *dispatchList;
 	list_t         *processedMsgIdList;
 
-	pthread_mutex_t lockSubs; //lock for Subscription Repository
+	u_mutex_t       lockDispatch; //dispatchList and the usage counts of its entries
+	u_mutex_t       lockMsgIds; //processedMsgIdList
+	u_mutex_t       lockEnum; //enumeration contexts of the runtime context
+	u_rwlock_t      lockEntries; //entries of the runtime context
+	u_mutex_t       lockSubs; //lock for Subscription Repository
 	char 			*uri_subsRepository; //URI of repository
 	SubsRepositoryOpSetH subscriptionOpSet; //Function talbe of Subscription Repository
 	EventPoolOpSetH eventpoolOpSet; //Function table of event source
+	unsigned int	deliveryRetryCount; //default count of notification delivery retries
+	unsigned long	deliveryRetryInterval; //default wait before the first retry, in msecs
+	unsigned long	deliveryRetryMaxInterval; //upper bound of the backoff, in msecs
 	WsContextH      cntx;
 	void           	*dispatcherData;
 	DispatcherCallback dispatcherProc;
@@ -119,6 +131,7 @@ typedef struct __Soap *SoapH;
 struct _WsXmlDoc {
 	void           *parserDoc;
 	unsigned long   prefixIndex; // to enumerate not well known namespaces
+	struct _WsmanHeaderIndex *headers; // inbound envelopes, dropped on change
 };
 
 
@@ -138,16 +151,31 @@ struct _WS_CONTEXT {
 	hash_t *entries;
 	WsSerializerContextH serializercntx;
 	list_t         	*subscriptionMemList; //memory Repository of Subscriptions
+	hash_t         	*subscriptionHash; //subscriptionMemList by identifier
 	/* to prevent user from destroying cntx he hasn't created */
 	int             owner;
+	/* request contexts: backs the context, its entries and serializer */
+	u_arena_t      *arena;
 };
 
 typedef struct __WsSubscribeInfo WsSubscribeInfo;
+
+// Serialized notification, ready to be sent
+struct __WsNotificationMessage {
+	u_buf_t *buf;
+	char messageId[EUIDLEN];
+};
+typedef struct __WsNotificationMessage *WsNotificationMessageH;
+
+// Pre-serialized notification envelope of a subscription
+typedef struct __WsNotificationTemplate *WsNotificationTemplateH;
+
 // EventThreadContext
 struct __WsEventThreadContext {
 	SoapH soap;
 	WsSubscribeInfo *subsInfo;
 	WsXmlDocH outdoc;
+	WsNotificationMessageH message;
 };
 typedef struct __WsEventThreadContext * WsEventThreadContextH;
 
@@ -230,6 +258,7 @@ typedef void   *(*WsEndPointGet) (WsContextH, WsmanStatus *, void *);
 #define WSE_NOTIFICATION_HEARTBEAT 2
 #define WSE_NOTIFICATION_NOACK 3
 #define WSE_NOTIFICATION_EVENTS_PENDING 4
+#define WSE_NOTIFICATION_DELIVERY_FAILED 5
 
 typedef int (*WsEndPointEventPoll) (WsEventThreadContextH);
 typedef int (*WsEndPointSubscriptionCancel) (WsEventThreadContextH);
@@ -334,6 +363,12 @@ struct __WsSubscribeInfo {
 	WsEndPointSubscriptionCancel cancel; //plugin related subscription cancel routine
 	WsXmlDocH templateDoc; //template notificaiton document
 	WsXmlDocH heartbeatDoc; //Fixed heartbeat document
+	WsNotificationTemplateH notificationTemplate; //templateDoc serialized, NULL if not usable
+	WsNotificationMessageH retryMessage; //notification whose delivery failed, sent again at retryTime
+	list_t *retryEvents; //events whose notification could not be built, built again at retryTime
+	unsigned int deliveryFailures; //failed attempts to deliver retryMessage or build retryEvents
+	unsigned long retryTime; //when to retry, in secs since the epoch
+	unsigned int refcount; //subscriptionMemList and lookups, under lockSubs
 };
 
 
@@ -443,6 +478,10 @@ WsContextH      ws_get_soap_context(SoapH soap);
 
 int             ws_destroy_context(WsContextH hCntx);
 
+void           *ws_context_alloc(WsContextH cntx, size_t size);
+
+char           *ws_context_strdup(WsContextH cntx, const char *str);
+
 const void     *get_context_val(WsContextH hCntx, const char *name);
 
 const void     *ws_get_context_val(WsContextH cntx, const char *name, int *size);
@@ -504,6 +543,16 @@ void *wse_heartbeat_sender(void * thrdcntx);
 
 void wse_notification_manager(void * cntx);
 
+WsSubscribeInfo *wse_get_subscription(SoapH soap, const char *uuid);
+
+void wse_put_subscription(SoapH soap, WsSubscribeInfo *subsInfo);
+
+void wse_create_notification_template(WsXmlDocH indoc, WsSubscribeInfo *subsInfo);
+
+void wse_destroy_notification_template(WsNotificationTemplateH t);
+
+WsNotificationMessageH wse_build_notification(WsSubscribeInfo *subsInfo, list_t *events);
+
 int outbound_addressing_filter(SoapOpH opHandle, void *data,
 			       void *opaqueData);
 
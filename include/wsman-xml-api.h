@@ -93,6 +93,25 @@ typedef int (*WsXmlEnumCallback) (WsXmlNodeH, void *);
 
 typedef int (*WsXmlNsEnumCallback) (WsXmlNodeH, WsXmlNsH, void *);
 
+typedef struct _WsXmlStreamParser WsXmlStreamParser;
+
+/* start tag at depth below the root, attributes as NULL ended name/value pairs */
+typedef int (*WsXmlScanCallback) (int depth, const char *name,
+				  const char **attrs, void *data);
+
+/*
+ * A qualified name prepared for matching against many nodes. The
+ * interned copies are set when the namespace URI or local name is one
+ * of the well-known names, nodes are then matched by pointer.
+ */
+struct _WsXmlQName {
+	const char *ns;
+	const char *name;
+	const char *internedNs;
+	const char *internedName;
+};
+typedef struct _WsXmlQName WsXmlQName;
+
 	// Dumping
 void ws_xml_dump_node_tree(FILE * f, WsXmlNodeH node);
 
@@ -181,6 +200,16 @@ WsXmlNodeH ws_xml_find_in_tree(WsXmlNodeH head, const char *nsUri,
 int ws_xml_is_node_qname(WsXmlNodeH node, const char *nsUri,
 			 const char *name);
 
+const char *ws_xml_intern(const char *str);
+
+void ws_xml_qname_init(WsXmlQName *qname, const char *nsUri,
+		       const char *name);
+
+int ws_xml_match_qname(WsXmlNodeH node, const WsXmlQName *qname);
+
+WsXmlNodeH ws_xml_get_child_qname(WsXmlNodeH parent, int index,
+				  const WsXmlQName *qname);
+
 char *ws_xml_get_node_local_name(WsXmlNodeH node);
 
 char *ws_xml_get_node_name_ns(WsXmlNodeH node);
@@ -35,6 +35,7 @@
 #ifndef XML_BINDING_LIBXML2_H_
 #define XML_BINDING_LIBXML2_H_
 
+#include "u/buf.h"
 
 struct __internalWsNode {
 	char *valText;
@@ -57,6 +58,25 @@ WsXmlDocH xml_parser_memory_to_doc( const char *buf, size_t size,
 				   const char *encoding,
 				   unsigned long options);
 
+WsXmlStreamParser *xml_parser_stream_new(const char *encoding,
+				WsXmlEnumCallback callback, void *data);
+
+int xml_parser_stream_push(WsXmlStreamParser *parser,
+				const char *buf, size_t size);
+
+WsXmlDocH xml_parser_stream_finish(WsXmlStreamParser *parser);
+
+WsXmlDocH xml_parser_envelope_head(const char *buf, size_t size,
+				const char *encoding, WsXmlStreamParser **rest);
+
+int xml_parser_envelope_rest(WsXmlStreamParser *parser);
+
+void xml_parser_envelope_abort(WsXmlStreamParser *parser);
+
+int xml_parser_scan_memory(const char *buf, size_t size,
+				const char *encoding, WsXmlScanCallback callback,
+				void *data);
+
 char *xml_parser_node_query(WsXmlNodeH node, int what);
 
 int xml_parser_node_set(WsXmlNodeH node, int what, const char *str);
@@ -108,6 +128,12 @@ void xml_parser_doc_dump_memory(WsXmlDocH doc, char **buf, int *ptrSize);
 
 void xml_parser_doc_dump_memory_enc(WsXmlDocH doc, char **buf, int *ptrSize, const char *encoding);
 
+int xml_parser_doc_dump_buf_enc(WsXmlDocH doc, u_buf_t *buf, const char *encoding);
+
+int xml_parser_doc_dump_size(WsXmlDocH doc, const char *encoding, size_t *size);
+
+WsXmlNodeH xml_parser_node_add_markup(WsXmlNodeH base, char *markup);
+
 void xml_parser_element_dump(FILE * f, WsXmlDocH doc, WsXmlNodeH node);
 
 int xml_parser_check_xpath(WsXmlDocH doc, const char *xpath_expr);
@@ -125,4 +151,11 @@ void xml_parser_node_set_lang(WsXmlNodeH node,  const char *lang);
 
 void xml_parser_copy_node(WsXmlNodeH src, WsXmlNodeH dst);
 
+const char *xml_parser_intern(const char *str);
+
+int xml_parser_node_is_qname(WsXmlNodeH node, const WsXmlQName *qname);
+
+WsXmlNodeH xml_parser_get_child_qname(WsXmlNodeH parent, int index,
+		const WsXmlQName *qname);
+
 #endif				/*XML_BINDING_LIBXML2_H_ */
@@ -36,6 +36,7 @@
 #ifndef WS_XML_SERIALIZATION_H
 #define WS_XML_SERIALIZATION_H
 
+#include "u/arena.h"
 #include "wsman-xml-serializer.h"
 
 
@@ -46,6 +47,16 @@
 #define XML_SMODE_FREE_MEM      5
 #define XML_SMODE_SKIP          6
 
+/* Last child found under a node, the next instance is searched from it */
+struct __XmlSerializerCursor
+{
+	WsXmlNodeH parent;
+	WsXmlNodeH child;
+	unsigned int index;
+	WsXmlQName qname;
+};
+typedef struct __XmlSerializerCursor XmlSerializerCursor;
+
 struct __XmlSerializationData
 {
 	WsSerializerContextH serctx;
@@ -57,6 +68,7 @@ struct __XmlSerializationData
 	WsXmlNodeH xmlNode;
 	XML_NODE_ATTR *attrs;
 	int skipFlag;
+	XmlSerializerCursor cursor;
 };
 typedef struct __XmlSerializationData XmlSerializationData;
 
@@ -86,6 +98,8 @@ typedef struct __NameAliase NameAliase;
 
 WsSerializerContextH ws_serializer_init(void);
 
+WsSerializerContextH ws_serializer_init_arena(u_arena_t *arena);
+
 int ws_serializer_cleanup(WsSerializerContextH serctx);
 
 void* ws_serializer_alloc(WsSerializerContextH serctx, int size);
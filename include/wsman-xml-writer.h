@@ -0,0 +1,86 @@
+/*******************************************************************************
+* Copyright (C) 2004-2006 Intel Corp. All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+*  - Redistributions of source code must retain the above copyright notice,
+*    this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright notice,
+*    this list of conditions and the following disclaimer in the documentation
+*    and/or other materials provided with the distribution.
+*
+*  - Neither the name of Intel Corp. nor the names of its
+*    contributors may be used to endorse or promote products derived from this
+*    software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL Intel Corp. OR THE CONTRIBUTORS
+* BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+#ifndef WS_XML_WRITER_H_
+#define WS_XML_WRITER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif				/* __cplusplus */
+
+#include <stddef.h>
+
+#include "wsman-types.h"
+#include "wsman-xml-api.h"
+
+/**
+ * @addtogroup XML
+ *
+ * @{
+ */
+
+/*
+ * Writes elements as text, for content too large to be worth a tree,
+ * and puts the text under a node of a document when done.
+ */
+typedef struct _WsXmlWriter WsXmlWriter;
+
+WsXmlWriter *ws_xml_writer_new(WsXmlNodeH parent);
+
+void ws_xml_writer_destroy(WsXmlWriter *writer);
+
+int ws_xml_writer_start_element(WsXmlWriter *writer,
+				const char *nsUri, const char *name);
+
+int ws_xml_writer_add_attr(WsXmlWriter *writer,
+			   const char *nsUri, const char *name,
+			   const char *val);
+
+int ws_xml_writer_add_text(WsXmlWriter *writer, const char *text);
+
+int ws_xml_writer_end_element(WsXmlWriter *writer);
+
+int ws_xml_writer_add_element(WsXmlWriter *writer,
+			      const char *nsUri, const char *name,
+			      const char *text);
+
+int ws_xml_writer_add_node(WsXmlWriter *writer, WsXmlNodeH node);
+
+size_t ws_xml_writer_get_size(WsXmlWriter *writer);
+
+int ws_xml_writer_set_size(WsXmlWriter *writer, size_t size);
+
+int ws_xml_writer_flush(WsXmlWriter *writer);
+
+/** @} */
+#ifdef __cplusplus
+}
+#endif				/* __cplusplus */
+#endif				/* WS_XML_WRITER_H_ */
@@ -43,6 +43,7 @@
 #ifndef XML_API_GENERIC_H_
 #define XML_API_GENERIC_H_
 
+#include "u/buf.h"
 #include "wsman-xml-api.h"
 
 
@@ -68,8 +69,7 @@ struct _WsXmlFindNsData {
 typedef struct _WsXmlFindNsData WsXmlFindNsData;
 
 struct _FindInTreeCallbackData {
-	const char *ns;
-	const char *name;
+	WsXmlQName qname;
 	WsXmlNodeH node;
 };
 typedef struct _FindInTreeCallbackData FindInTreeCallbackData;
@@ -101,9 +101,60 @@ char *ws_xml_get_node_name_ns_prefix(WsXmlNodeH node);
 WsXmlDocH ws_xml_read_file(const char *filename,
 			   const char *encoding, unsigned long options);
 
+int ws_xml_dump_buf_enc(WsXmlDocH doc, u_buf_t *buf, const char *encoding);
+
+/*
+ * A document serialized once, with slots for the values that change
+ * each time it is sent: markers put in as text before it is compiled.
+ */
+typedef struct {
+	size_t at, end;		/* of the marker in buf */
+	unsigned int id;
+} WsXmlTemplateSlot;
+
+typedef struct {
+	char *buf;
+	size_t len;
+	WsXmlTemplateSlot *slots;	/* in document order */
+	unsigned int nslots;
+	char marker[64];		/* prefix of the markers */
+} WsXmlTemplate;
+
+WsXmlTemplate *ws_xml_template_new(void);
+
+void ws_xml_template_destroy(WsXmlTemplate *t);
+
+char *ws_xml_template_marker(WsXmlTemplate *t, unsigned int id,
+			     char *buf, size_t size);
+
+int ws_xml_template_compile(WsXmlTemplate *t, WsXmlDocH doc,
+			    unsigned int nslots);
+
+const WsXmlTemplateSlot *ws_xml_template_slot(WsXmlTemplate *t,
+					      unsigned int id);
+
+void ws_xml_buf_append_escaped(u_buf_t *buf, const char *str);
+
 WsXmlDocH ws_xml_read_memory(const char *buf, size_t size,
 			     const char *encoding, unsigned long options);
 
+WsXmlStreamParser *ws_xml_stream_new(const char *encoding,
+			     WsXmlEnumCallback callback, void *data);
+
+int ws_xml_stream_push(WsXmlStreamParser *parser, const char *buf, size_t size);
+
+WsXmlDocH ws_xml_stream_finish(WsXmlStreamParser *parser);
+
+WsXmlDocH ws_xml_read_envelope_head(const char *buf, size_t size,
+			     const char *encoding, WsXmlStreamParser **rest);
+
+int ws_xml_read_envelope_rest(WsXmlStreamParser *rest);
+
+void ws_xml_read_envelope_abort(WsXmlStreamParser *rest);
+
+int ws_xml_scan_memory(const char *buf, size_t size, const char *encoding,
+			     WsXmlScanCallback callback, void *data);
+
 WsXmlDocH ws_xml_create_doc( const char *rootNsUri, const char *rootName);
 
 int ws_xml_check_xpath(WsXmlDocH doc, const char *xpath_expr);
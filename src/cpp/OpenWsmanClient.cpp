@@ -24,12 +24,14 @@ extern "C" {
 using namespace WsmanClientNamespace;
 
 static bool CheckWsmanResponse(WsManClient* cl, WsXmlDocH& doc);
+static bool CheckWsmanResponse(long lastError, long responseCode, WsXmlDocH& doc);
 static bool ResourceNotFound(WsManClient* cl, WsXmlDocH& enumerationRes);
 static string XmlDocToString(WsXmlDocH& doc);
 static client_opt_t *SetOptions(WsManClient* cl);
 static string GetSubscribeContext(WsXmlDocH& doc);
 static string ExtractPayload(WsXmlDocH& doc);
 static string ExtractItems(WsXmlDocH& doc);
+static bool VisitItems(WsXmlDocH& doc, EnumerationVisitor &visitor);
 
 // Construct from params.
 
@@ -135,6 +137,29 @@ void OpenWsmanClient::Enumerate(
 	enumContext = wsmc_get_enum_context(enum_response);
 	ws_xml_destroy_doc(enum_response);
 
+	if (((client_opt_t *)options)->prefetch_depth > 0 &&
+			enumContext != NULL && enumContext[0] != 0) {
+		WsManEnumerator *e = wsmc_enumerator_new(cl, resourceUri.c_str(),
+				options, NULL, enumContext);
+		long responseCode;
+		WS_LASTERR_Code lastError;
+		wsmc_free_enum_context(enumContext);
+		try {
+			while (wsmc_enumerator_next(e, &doc, &responseCode, &lastError)) {
+				CheckWsmanResponse(lastError, responseCode, doc);
+				string payload = ExtractItems(doc);
+				if (payload.length() > 0)
+					enumRes.push_back(payload);
+				ws_xml_destroy_doc(doc);
+			}
+		} catch (...) {
+			wsmc_enumerator_free(e);
+			throw;
+		}
+		wsmc_enumerator_free(e);
+		return;
+	}
+
 	while (enumContext != NULL && enumContext[0] != 0 ) {
 		doc = wsmc_action_pull(cl, resourceUri.c_str(), options, NULL, enumContext);
 		CheckWsmanResponse(cl, doc);
@@ -151,6 +176,64 @@ void OpenWsmanClient::Enumerate(
 	wsmc_free_enum_context(enumContext);
 }
 
+void OpenWsmanClient::Enumerate(
+	const string &resourceUri,
+	EnumerationVisitor &visitor,
+	const WsmanOptions &options,
+	const WsmanFilter &filter) const
+{
+	WsXmlDocH doc;
+	long responseCode;
+	WS_LASTERR_Code lastError;
+	bool more;
+	WsXmlDocH enum_response = wsmc_action_enumerate(cl, (char *)resourceUri.c_str(),  options, filter);
+
+	if(ResourceNotFound(cl, enum_response))
+		throw WsmanResourceNotFound(resourceUri.c_str());
+
+	char *enumContext = wsmc_get_enum_context(enum_response);
+	try {
+		more = VisitItems(enum_response, visitor);
+	} catch (...) {
+		wsmc_free_enum_context(enumContext);
+		ws_xml_destroy_doc(enum_response);
+		throw;
+	}
+	ws_xml_destroy_doc(enum_response);
+	if (enumContext == NULL || enumContext[0] == 0) {
+		wsmc_free_enum_context(enumContext);
+		return;
+	}
+	if (!more) {
+		// stopped on the Enumerate response, nothing to prefetch
+		ws_xml_destroy_doc(wsmc_action_release(cl, resourceUri.c_str(),
+				options, enumContext));
+		wsmc_free_enum_context(enumContext);
+		return;
+	}
+
+	// the enumerator releases what is left of the enumeration
+	WsManEnumerator *e = wsmc_enumerator_new(cl, resourceUri.c_str(),
+			options, NULL, enumContext);
+	wsmc_free_enum_context(enumContext);
+	try {
+		while (more && wsmc_enumerator_next(e, &doc, &responseCode, &lastError)) {
+			CheckWsmanResponse(lastError, responseCode, doc);
+			try {
+				more = VisitItems(doc, visitor);
+			} catch (...) {
+				ws_xml_destroy_doc(doc);
+				throw;
+			}
+			ws_xml_destroy_doc(doc);
+		}
+	} catch (...) {
+		wsmc_enumerator_free(e);
+		throw;
+	}
+	wsmc_enumerator_free(e);
+}
+
 void OpenWsmanClient::Enumerate(
 	const string &resourceUri,
 	vector<string> &enumRes,
@@ -391,6 +474,21 @@ string ExtractItems(WsXmlDocH& doc)
 	return payload;
 }
 
+// Items of a Pull response, or of an optimized Enumerate response
+bool VisitItems(WsXmlDocH& doc, EnumerationVisitor &visitor)
+{
+	WsXmlNodeH response = ws_xml_get_child(ws_xml_get_soap_body(doc), 0, NULL, NULL);
+	WsXmlNodeH itemsNode = ws_xml_get_child(response, 0, XML_NS_ENUMERATION, WSENUM_ITEMS);
+	if (itemsNode == NULL)
+		itemsNode = ws_xml_get_child(response, 0, XML_NS_WS_MAN, WSENUM_ITEMS);
+	WsXmlNodeH n;
+	for (int i = 0; (n = ws_xml_get_child(itemsNode, i, NULL, NULL)) != NULL; i++) {
+		if (!visitor.Visit(n))
+			return false;
+	}
+	return true;
+}
+
 string XmlDocToString(WsXmlDocH& doc) {
 	char *buf;
 	int  len;
@@ -407,7 +505,11 @@ string XmlDocToString(WsXmlDocH& doc) {
 
 bool CheckWsmanResponse(WsManClient* cl, WsXmlDocH& doc)
 {
-	long lastError = wsmc_get_last_error(cl);
+	return CheckWsmanResponse(wsmc_get_last_error(cl), wsmc_get_response_code(cl), doc);
+}
+
+bool CheckWsmanResponse(long lastError, long responseCode, WsXmlDocH& doc)
+{
 	string error;
 
 	if(lastError) {
@@ -419,7 +521,6 @@ bool CheckWsmanResponse(WsManClient* cl, WsXmlDocH& doc)
 		throw WsmanClientException(error.c_str(), WSMAN_CONNECT_ERROR);
 	}
 
-	long responseCode = wsmc_get_response_code(cl);
 	if (responseCode != 200 &&
 			responseCode != 400 &&
 			responseCode != 500)
@@ -458,6 +559,38 @@ bool CheckWsmanResponse(WsManClient* cl, WsXmlDocH& doc)
 	return true;
 }
 
+// Serialized items of a response
+class ItemCollector : public EnumerationVisitor
+{
+	public:
+		vector<string> &items;
+		ItemCollector(vector<string> &items) : items(items) {}
+		bool Visit(WsXmlNodeH item)
+		{
+			char *buf = NULL;
+			wsmc_node_to_buf(item, &buf);
+			items.push_back(string(buf));
+			u_free(buf);
+			return true;
+		}
+};
+
+void OpenWsmanClient::CheckResponse(long lastError, long responseCode, WsXmlDocH &doc)
+{
+	CheckWsmanResponse(lastError, responseCode, doc);
+}
+
+string OpenWsmanClient::Payload(WsXmlDocH &doc)
+{
+	return ExtractPayload(doc);
+}
+
+void OpenWsmanClient::Items(WsXmlDocH &doc, vector<string> &items)
+{
+	ItemCollector collector(items);
+	VisitItems(doc, collector);
+}
+
 bool ResourceNotFound(WsManClient* cl, WsXmlDocH& enumerationRes)
 {
 	long responseCode = wsmc_get_response_code(cl);
@@ -503,6 +636,16 @@ void OpenWsmanClient::SetTimeout(unsigned long mtime)
 	wsman_transport_set_timeout(cl,mtime);
 }
 
+void OpenWsmanClient::GetStats(WsManClientStats &stats) const
+{
+	wsmc_get_stats(cl, &stats);
+}
+
+void OpenWsmanClient::ResetStats()
+{
+	wsmc_reset_stats(cl);
+}
+
 void OpenWsmanClient::SetUserName(const string &user_name)
 {
 	if (user_name.empty())
@@ -20,6 +20,16 @@ struct WsManClientData;
 
 namespace WsmanClientNamespace
 {
+	// Receives enumerated items one at a time, as the Pull responses
+	// come in. The node is part of the response and only valid during
+	// Visit(). Returning false ends the enumeration early.
+	class EnumerationVisitor
+	{
+		public:
+			virtual ~EnumerationVisitor() {}
+			virtual bool Visit(WsXmlNodeH item) = 0;
+	};
+
 	class OpenWsmanClient : public WsmanClient
 	{
 		private:
@@ -28,6 +38,12 @@ namespace WsmanClientNamespace
 			OpenWsmanClient(const OpenWsmanClient& cl);
 			// operator = is declared private
 			OpenWsmanClient& operator =(const OpenWsmanClient& cl);
+
+			// WsmanFleet sends the requests of many clients itself
+			friend class WsmanFleet;
+			static void CheckResponse(long lastError, long responseCode, WsXmlDocH &doc);
+			static string Payload(WsXmlDocH &doc);
+			static void Items(WsXmlDocH &doc, vector<string> &items);
 		public:
 			// Construct from params.
 			OpenWsmanClient(
@@ -85,6 +101,11 @@ namespace WsmanClientNamespace
 				vector<string> &enumRes,
 				const WsmanOptions &options,
 				const WsmanFilter &filter = WsmanFilter()) const;
+			void Enumerate(
+				const string &resourceUri,
+				EnumerationVisitor &visitor,
+				const WsmanOptions &options,
+				const WsmanFilter &filter = WsmanFilter()) const;
 
 			// Retrieve a resource.
 			string Get(
@@ -140,6 +161,12 @@ namespace WsmanClientNamespace
 			
 			// Set timeout method
 			void SetTimeout(unsigned long mtime);
+
+			// Where the time of the requests went, summed up
+			// since construction or ResetStats()
+			void GetStats(WsManClientStats &stats) const;
+			void ResetStats();
+
 			// Set user name
 			void SetUserName(const string &user_name);
 
@@ -0,0 +1,242 @@
+//----------------------------------------------------------------------------
+//
+//  File:       WsmanFleet.cpp
+//
+//  License:    BSD-3-Clause
+//
+//  Contents:   Runs one operation against many WS-Management endpoints
+//              concurrently
+//
+//----------------------------------------------------------------------------
+
+#include <list>
+
+#include "WsmanFleet.h"
+
+extern "C" {
+#include "u/libu.h"
+#include "wsman-api.h"
+}
+
+#include "wsman-client-transport.h"
+
+#define WSMAN_ENCODING		"UTF-8"
+
+using namespace WsmanClientNamespace;
+
+struct WsmanFleet::Operation
+{
+	WsmanAction action;
+	const string *resourceUri;
+	const string *methodName;
+	const string *content;
+	const WsmanOptions *options;
+	const WsmanFilter *filter;
+	WsmanFleetHandler *handler;
+};
+
+// An endpoint with a request in flight
+struct FleetRequest
+{
+	size_t index;
+	WsManClient *cl;
+	WsXmlDocH request;
+	unsigned int attempts;
+	list<FleetRequest *> *done;
+};
+
+static void RequestDone(WsManClient *cl, void *data)
+{
+	FleetRequest *req = (FleetRequest *)data;
+	req->done->push_back(req);
+}
+
+static WsXmlDocH CreateRequest(WsManClient *cl, const WsmanFleet::Operation &op,
+		const char *enumContext)
+{
+	if (enumContext)
+		return wsmc_create_request(cl, op.resourceUri->c_str(), *op.options,
+				NULL, WSMAN_ACTION_PULL, NULL, (void *)enumContext);
+	if (op.action == WSMAN_ACTION_CUSTOM) {
+		WsXmlDocH request = wsmc_create_request(cl, op.resourceUri->c_str(),
+				*op.options, NULL, WSMAN_ACTION_CUSTOM,
+				(char *)op.methodName->c_str(), NULL);
+		if (request == NULL || op.content->empty())
+			return request;
+		WsXmlDocH doc = wsmc_read_memory((char *)op.content->c_str(),
+				op.content->length(), (char *)WSMAN_ENCODING, 0);
+		if (doc == NULL) {
+			ws_xml_destroy_doc(request);
+			return NULL;
+		}
+		ws_xml_duplicate_tree(ws_xml_get_soap_body(request), ws_xml_get_doc_root(doc));
+		ws_xml_destroy_doc(doc);
+		return request;
+	}
+	return wsmc_create_request(cl, op.resourceUri->c_str(), *op.options,
+			op.filter ? (filter_t *)*op.filter : NULL, op.action, NULL, NULL);
+}
+
+// A request that could not go out completes right away. The transport
+// takes the timeout when the request is set up, the client keeps its own.
+static void SendRequest(WsManAsync *async, FleetRequest *req, unsigned long timeout)
+{
+	unsigned long saved = wsman_transport_get_timeout(req->cl);
+	int failed = 1;
+
+	if (req->request != NULL) {
+		if (timeout)
+			wsman_transport_set_timeout(req->cl, timeout);
+		failed = wsman_async_send_request(async, req->cl, req->request,
+				RequestDone, req);
+		wsman_transport_set_timeout(req->cl, saved);
+	}
+	if (failed)
+		req->done->push_back(req);
+}
+
+static void FreeRequest(FleetRequest *req)
+{
+	ws_xml_destroy_doc(req->request);
+	delete req;
+}
+
+WsmanFleet::WsmanFleet(
+	const vector<OpenWsmanClient *> &clients,
+	unsigned int maxInFlight,
+	unsigned long timeout,
+	unsigned int retries)
+	: clients(clients), maxInFlight(maxInFlight ? maxInFlight : 1),
+	  timeout(timeout), retries(retries)
+{
+}
+
+void WsmanFleet::Run(Operation &op) const
+{
+	WsManAsync *async = wsman_async_new();
+	list<FleetRequest *> done;
+	size_t next = 0;
+	unsigned int inFlight = 0;
+
+	if (async == NULL)
+		throw WsmanClientException("Could not start asynchronous requests");
+	try {
+		while (next < clients.size() || inFlight > 0) {
+			while (next < clients.size() && inFlight < maxInFlight) {
+				FleetRequest *req = new FleetRequest();
+				req->index = next;
+				req->cl = clients[next]->cl;
+				req->done = &done;
+				req->request = CreateRequest(req->cl, op, NULL);
+				next++;
+				inFlight++;
+				SendRequest(async, req, timeout);
+			}
+			if (done.empty())
+				wsman_async_run(async, 1000);
+
+			while (!done.empty()) {
+				FleetRequest *req = done.front();
+				done.pop_front();
+				size_t index = req->index;
+				if (req->request == NULL) {
+					inFlight--;
+					FreeRequest(req);
+					op.handler->OnError(index,
+						WsmanClientException("Could not create the request"));
+					continue;
+				}
+				long lastError = wsmc_get_last_error(req->cl);
+				long responseCode = wsmc_get_response_code(req->cl);
+
+				if ((lastError || (responseCode != 200 && responseCode != 400 &&
+						responseCode != 500)) && req->attempts < retries) {
+					req->attempts++;
+					SendRequest(async, req, timeout);
+					continue;
+				}
+				inFlight--;
+				WsXmlDocH doc = lastError ? NULL : wsmc_build_envelope_from_response(req->cl);
+				try {
+					OpenWsmanClient::CheckResponse(lastError, responseCode, doc);
+				} catch (WsmanClientException &e) {
+					FreeRequest(req);
+					op.handler->OnError(index, e);
+					continue;
+				}
+				if (op.action != WSMAN_ACTION_ENUMERATION) {
+					string payload = OpenWsmanClient::Payload(doc);
+					ws_xml_destroy_doc(doc);
+					FreeRequest(req);
+					op.handler->OnResult(index, payload);
+					op.handler->OnDone(index);
+					continue;
+				}
+
+				vector<string> items;
+				OpenWsmanClient::Items(doc, items);
+				char *enumContext = wsmc_get_enum_context(doc);
+				bool more = enumContext && enumContext[0] != 0;
+				ws_xml_destroy_doc(doc);
+				ws_xml_destroy_doc(req->request);
+				req->request = NULL;
+				if (more) {
+					// pull the rest
+					req->request = CreateRequest(req->cl, op, enumContext);
+					req->attempts = 0;
+					inFlight++;
+					SendRequest(async, req, timeout);
+				} else {
+					FreeRequest(req);
+				}
+				wsmc_free_enum_context(enumContext);
+				for (size_t i = 0; i < items.size(); i++)
+					op.handler->OnResult(index, items[i]);
+				if (!more)
+					op.handler->OnDone(index);
+			}
+		}
+	} catch (...) {
+		// the handler gave up, abort what is still in flight
+		wsman_async_destroy(async);
+		while (!done.empty()) {
+			FreeRequest(done.front());
+			done.pop_front();
+		}
+		throw;
+	}
+	wsman_async_destroy(async);
+}
+
+void WsmanFleet::Get(
+	const string &resourceUri,
+	const WsmanOptions &options,
+	WsmanFleetHandler &handler) const
+{
+	Operation op = { WSMAN_ACTION_TRANSFER_GET, &resourceUri, NULL, NULL,
+		&options, NULL, &handler };
+	Run(op);
+}
+
+void WsmanFleet::Invoke(
+	const string &resourceUri,
+	const string &methodName,
+	const string &content,
+	const WsmanOptions &options,
+	WsmanFleetHandler &handler) const
+{
+	Operation op = { WSMAN_ACTION_CUSTOM, &resourceUri, &methodName, &content,
+		&options, NULL, &handler };
+	Run(op);
+}
+
+void WsmanFleet::Enumerate(
+	const string &resourceUri,
+	const WsmanOptions &options,
+	WsmanFleetHandler &handler,
+	const WsmanFilter &filter) const
+{
+	Operation op = { WSMAN_ACTION_ENUMERATION, &resourceUri, NULL, NULL,
+		&options, &filter, &handler };
+	Run(op);
+}
@@ -0,0 +1,86 @@
+//----------------------------------------------------------------------------
+//
+//  File:       WsmanFleet.h
+//
+//  License:    BSD-3-Clause
+//
+//  Contents:   Runs one operation against many WS-Management endpoints
+//              concurrently
+//
+//----------------------------------------------------------------------------
+
+#ifndef __WSMAN_FLEET_H
+#define __WSMAN_FLEET_H
+
+#include "OpenWsmanClient.h"
+
+namespace WsmanClientNamespace
+{
+	// Receives the outcome of each endpoint as soon as it is known.
+	// Called from the thread running the WsmanFleet operation.
+	class WsmanFleetHandler
+	{
+		public:
+			virtual ~WsmanFleetHandler() {}
+			// Get and Invoke: the response payload. Enumerate: one
+			// call per item.
+			virtual void OnResult(size_t endpoint, const string &result) = 0;
+			// The endpoint failed, after all retries for connection
+			// and HTTP errors. SOAP faults are not retried.
+			virtual void OnError(size_t endpoint, const WsmanClientException &e) = 0;
+			// The endpoint succeeded, after its last OnResult().
+			virtual void OnDone(size_t endpoint) {}
+	};
+
+	// Sends the same request to a set of clients, at most maxInFlight
+	// at a time, from a single thread. An operation returns once every
+	// endpoint is done. The clients are identified by their position
+	// and must not be used elsewhere while an operation runs.
+	class WsmanFleet
+	{
+		public:
+			struct Operation;
+
+		private:
+			vector<OpenWsmanClient *> clients;
+			unsigned int maxInFlight;
+			unsigned long timeout;
+			unsigned int retries;
+
+			void Run(Operation &op) const;
+
+			// Copy constructor is declared private
+			WsmanFleet(const WsmanFleet &fleet);
+			// operator = is declared private
+			WsmanFleet &operator =(const WsmanFleet &fleet);
+
+		public:
+			// timeout is the transport timeout of every request, 0
+			// keeps what the clients have; retries is the number of
+			// extra attempts after a connection or HTTP error.
+			WsmanFleet(
+				const vector<OpenWsmanClient *> &clients,
+				unsigned int maxInFlight = 16,
+				unsigned long timeout = 0,
+				unsigned int retries = 0);
+
+			void Get(
+				const string &resourceUri,
+				const WsmanOptions &options,
+				WsmanFleetHandler &handler) const;
+
+			void Invoke(
+				const string &resourceUri,
+				const string &methodName,
+				const string &content,
+				const WsmanOptions &options,
+				WsmanFleetHandler &handler) const;
+
+			void Enumerate(
+				const string &resourceUri,
+				const WsmanOptions &options,
+				WsmanFleetHandler &handler,
+				const WsmanFilter &filter = WsmanFilter()) const;
+	};
+} // namespace WsmanClientNamespace
+#endif
@@ -85,6 +85,11 @@ void WsmanOptions::setHeartbeatInterval(const float heartbeat_interval)
 	options->heartbeat_interval = heartbeat_interval;
 }
 
+void WsmanOptions::setPrefetch(unsigned int depth)
+{
+	wsmc_set_prefetch(options, depth);
+}
+
 void WsmanOptions::addProperty(const char *key, const char *value)
 {
 	wsmc_add_property(options, key, value);
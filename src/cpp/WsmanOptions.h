@@ -47,6 +47,7 @@ namespace WsmanClientNamespace {
 			void setReference(const string &reference);
 			void setExpires(const float expires);
 			void setHeartbeatInterval(const float heartbeat_interval);
+			void setPrefetch(unsigned int depth);
 
 			void addProperty(const char *key, const char *value);
 			void addProperty(const string &key, const string &value);
@@ -0,0 +1,151 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <u/libu.h>
+
+/* data held in the buffer object itself, see u/buf.c */
+#define INLINE_SIZE 255
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+
+static void
+fill(u_buf_t *buf, size_t len, char c)
+{
+	char piece[64];
+	size_t n;
+
+	memset(piece, c, sizeof(piece));
+	while (len) {
+		n = len < sizeof(piece) ? len : sizeof(piece);
+		u_buf_append(buf, piece, n);
+		len -= n;
+	}
+}
+
+static int
+holds(u_buf_t *buf, size_t len, char c)
+{
+	char *p = u_buf_ptr(buf);
+	size_t i;
+
+	if (u_buf_len(buf) != len || strlen(p) != len)
+		return 0;
+	for (i = 0; i < len; i++)
+		if (p[i] != c)
+			return 0;
+	return 1;
+}
+
+/* exactly full, one byte short and one byte over the inline region */
+static void
+test_boundary(void)
+{
+	size_t sizes[] = { INLINE_SIZE - 1, INLINE_SIZE, INLINE_SIZE + 1,
+		1023, 1024, 1025 };
+	size_t i;
+	u_buf_t *buf;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		u_buf_create(&buf);
+		fill(buf, sizes[i], 'a');
+		check(holds(buf, sizes[i], 'a'));
+		check(u_buf_size(buf) >= sizes[i]);
+		u_buf_free(buf);
+	}
+
+	/* full inline buffer, then shrunk and grown again */
+	u_buf_create(&buf);
+	fill(buf, INLINE_SIZE, 'b');
+	u_buf_set_len(buf, 10);
+	check(holds(buf, 10, 'b'));
+	fill(buf, INLINE_SIZE, 'b');
+	check(holds(buf, INLINE_SIZE + 10, 'b'));
+	u_buf_clear(buf);
+	check(holds(buf, 0, 0));
+	u_buf_free(buf);
+
+	u_buf_create_sized(&buf, 4096);
+	check(u_buf_size(buf) >= 4096);
+	fill(buf, 4096, 'c');
+	check(holds(buf, 4096, 'c'));
+	u_buf_free(buf);
+}
+
+static void
+test_steal(void)
+{
+	u_buf_t *buf;
+	char *s;
+
+	u_buf_create(&buf);
+	check(u_buf_steal(buf) == NULL);
+
+	fill(buf, INLINE_SIZE, 'd');
+	s = u_buf_steal(buf);
+	check(s && strlen(s) == INLINE_SIZE && s[0] == 'd');
+	u_free(s);
+	check(u_buf_len(buf) == 0);
+
+	fill(buf, 5000, 'e');
+	s = u_buf_steal(buf);
+	check(s && strlen(s) == 5000 && s[4999] == 'e');
+	u_free(s);
+
+	/* usable again afterwards */
+	fill(buf, 3, 'f');
+	check(holds(buf, 3, 'f'));
+	u_buf_free(buf);
+}
+
+static void
+test_adopt(void)
+{
+	u_buf_t *a, *b;
+
+	u_buf_create(&a);
+	u_buf_create(&b);
+
+	/* heap data moves over */
+	fill(a, 5000, 'g');
+	fill(b, 10, 'x');
+	u_buf_adopt(b, a);
+	check(holds(b, 5000, 'g'));
+	check(holds(a, 0, 0));
+
+	/* inline data is copied, replacing heap data */
+	fill(a, INLINE_SIZE, 'h');
+	u_buf_adopt(b, a);
+	check(holds(b, INLINE_SIZE, 'h'));
+	check(holds(a, 0, 0));
+
+	/* empty source empties the target */
+	u_buf_adopt(b, a);
+	check(holds(b, 0, 0));
+
+	fill(b, 7, 'i');
+	check(holds(b, 7, 'i'));
+	u_buf_free(a);
+	u_buf_free(b);
+}
+
+int main(int argc, char **argv)
+{
+	test_boundary();
+	test_steal();
+	test_adopt();
+	if (failed)
+		printf("%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <u/libu.h>
+#include "wsman-xml-api.h"
+#include "wsman-xml.h"
+#include "wsman-names.h"
+#include "wsman-soap.h"
+#include "wsman-event-pool.h"
+#include "wsman-cimindication-processor.h"
+
+#define UUID "3e4d0c3a-5e2d-1d2d-8002-3d5b5f1f5b01"
+
+#define EXPREQ \
+	"<SIMPLEEXPREQ><EXPMETHODCALL NAME=\"ExportIndication\">" \
+	"<EXPPARAMVALUE NAME=\"NewIndication\"><INSTANCE CLASSNAME=\"CIM_Alert\">" \
+	"<PROPERTY NAME=\"Severity\" TYPE=\"uint16\"><VALUE>2</VALUE></PROPERTY>" \
+	"</INSTANCE></EXPPARAMVALUE></EXPMETHODCALL></SIMPLEEXPREQ>"
+
+#define EXPORT(body) \
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+	"<CIM CIMVERSION=\"2.0\" DTDVERSION=\"2.0\">" \
+	"<MESSAGE ID=\"a&amp;b\" PROTOCOLVERSION=\"1.0\">" body "</MESSAGE></CIM>"
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+static SoapH soap;
+
+/* an event pool that holds its adder until let go */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static int pool_closed;
+static int pool_waiting;
+static int pool_added;
+
+static int
+pool_add(char *uuid, WsNotificationInfoH info)
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_waiting++;
+	pthread_cond_broadcast(&pool_cond);
+	while (pool_closed)
+		pthread_cond_wait(&pool_cond, &pool_lock);
+	pool_waiting--;
+	pool_added++;
+	pthread_mutex_unlock(&pool_lock);
+	u_free(info->EventAction);
+	ws_xml_destroy_doc(info->EventContent);
+	u_free(info);
+	return 0;
+}
+
+static int
+added(void)
+{
+	int n;
+	pthread_mutex_lock(&pool_lock);
+	n = pool_added;
+	pthread_mutex_unlock(&pool_lock);
+	return n;
+}
+
+static void
+pool_close(int closed)
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_closed = closed;
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* until the worker is held in the pool */
+static void
+pool_wait(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	while (!pool_waiting)
+		pthread_cond_wait(&pool_cond, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static struct __EventPoolOpSet pool = {
+	NULL, NULL, NULL, pool_add, pool_add, NULL, NULL, NULL
+};
+
+/* send a request, the response document or NULL and the HTTP status */
+static WsXmlDocH
+call(const char *uuid, const char *request, int *status)
+{
+	CimxmlMessage *msg = cimxml_message_new();
+	cimxml_context *cntx = u_malloc(sizeof(*cntx));
+	WsXmlDocH doc = NULL;
+
+	cntx->soap = soap;
+	cntx->uuid = (char *)uuid;
+	msg->charset = u_strdup("UTF-8");
+	u_buf_set(msg->request, (char *)request, strlen(request));
+	CIM_Indication_call(cntx, msg, NULL);
+	*status = msg->http_code;
+	if (u_buf_len(msg->response))
+		doc = ws_xml_read_memory(u_buf_ptr(msg->response),
+					 u_buf_len(msg->response), "UTF-8", 0);
+	cimxml_message_destroy(msg);
+	return doc;
+}
+
+static void
+test_response(void)
+{
+	WsXmlDocH doc;
+	WsXmlNodeH node;
+	int status;
+
+	/* the response takes the attributes of MESSAGE as they read */
+	doc = call(UUID, EXPORT(EXPREQ), &status);
+	check(status == WSMAN_STATUS_OK && doc != NULL);
+	node = ws_xml_get_child(ws_xml_get_doc_root(doc), 0, NULL, CIMXML_MESSAGE);
+	check(!strcmp(ws_xml_find_attr_value(node, NULL, CIMXML_ID), "a&b"));
+	node = ws_xml_get_child(node, 0, NULL, CIMXML_SIMPLEEXPRSP);
+	node = ws_xml_get_child(node, 0, NULL, CIMXML_EXPMETHODRESPONSE);
+	check(ws_xml_get_child(node, 0, NULL, CIMXML_IRETURNVALUE) != NULL);
+	ws_xml_destroy_doc(doc);
+
+	/* one response for each request in a MULTIEXPREQ */
+	doc = call(UUID, EXPORT("<MULTIEXPREQ>" EXPREQ "<!-- x -->" EXPREQ
+				"</MULTIEXPREQ><MULTIEXPREQ>" EXPREQ "</MULTIEXPREQ>"),
+		   &status);
+	check(status == WSMAN_STATUS_OK && doc != NULL);
+	node = ws_xml_get_child(ws_xml_get_doc_root(doc), 0, NULL, CIMXML_MESSAGE);
+	node = ws_xml_get_child(node, 0, NULL, CIMXML_MULTIEXPRSQ);
+	check(ws_xml_get_child_count(node) == 2);
+	ws_xml_destroy_doc(doc);
+
+	doc = call(UUID, EXPORT(EXPREQ) "<", &status);
+	check(status == WSMAN_STATUS_BAD_REQUEST && doc == NULL);
+	doc = call(UUID, EXPORT("<EXPREQ/>"), &status);
+	check(status == WSMAN_STATUS_FORBIDDEN && doc == NULL);
+	doc = call("uuid:none", EXPORT(EXPREQ), &status);
+	check(status == WSMAN_STATUS_NOT_FOUND && doc == NULL);
+	/* without a worker the events are in the pool right away */
+	check(added() == 3);
+}
+
+static void *
+shutdown_worker(void *arg)
+{
+	cim_indication_ingest_shutdown();
+	return NULL;
+}
+
+static void
+test_queue(void)
+{
+	WsXmlDocH doc;
+	pthread_t stopper;
+	int status;
+
+	pool_added = 0;
+	check(cim_indication_ingest_init(1) == 0);
+	pool_close(1);
+	doc = call(UUID, EXPORT(EXPREQ), &status);
+	check(status == WSMAN_STATUS_OK && doc != NULL);
+	ws_xml_destroy_doc(doc);
+	pool_wait();
+	/* the worker is busy, one more fits in the queue */
+	doc = call(UUID, EXPORT(EXPREQ), &status);
+	check(status == WSMAN_STATUS_OK && doc != NULL);
+	ws_xml_destroy_doc(doc);
+	doc = call(UUID, EXPORT(EXPREQ), &status);
+	check(status == WSMAN_STATUS_SERVICE_UNAVAILABLE && doc == NULL);
+	check(added() == 0);
+
+	/* what was acknowledged is in the pool once shutdown returns */
+	pthread_create(&stopper, NULL, shutdown_worker, NULL);
+	pool_close(0);
+	pthread_join(stopper, NULL);
+	check(added() == 2);
+	doc = call(UUID, EXPORT(EXPREQ), &status);
+	check(status == WSMAN_STATUS_OK && doc != NULL);
+	ws_xml_destroy_doc(doc);
+	check(added() == 3);
+}
+
+int main(int argc, char **argv)
+{
+	WsSubscribeInfo subs;
+	WsContextH cntx;
+
+	soap = ws_soap_initialize();
+	soap->eventpoolOpSet = &pool;
+	cntx = ws_get_soap_context(soap);
+	memset(&subs, 0, sizeof(subs));
+	strcpy(subs.subsId, UUID);
+	subs.uri = XML_NS_CIM_CLASS "/CIM_Alert";
+	subs.deliveryMode = WS_EVENT_DELIVERY_MODE_PUSH;
+	/* held here, lookups never drop the last reference */
+	subs.refcount = 1;
+	hash_alloc_insert(cntx->subscriptionHash, subs.subsId, &subs);
+
+	test_response();
+	test_queue();
+
+	hash_delete_free(cntx->subscriptionHash,
+			 hash_lookup(cntx->subscriptionHash, subs.subsId));
+	soap->eventpoolOpSet = NULL;
+	soap_destroy(soap);
+	if (failed)
+		printf("%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <u/libu.h>
+#include "wsman-xml-api.h"
+#include "wsman-xml.h"
+#include "wsman-event-pool.h"
+
+#define SUBS "3e4d0c3a-5e2d-1d2d-8002-3d5b5f1f5b01"
+
+static WsNotificationInfoH
+make_event(int i)
+{
+	WsNotificationInfoH info = u_zalloc(sizeof(*info));
+	info->EventAction = u_strdup_printf("http://example.com/event/%d", i);
+	info->EventContent = ws_xml_create_doc("http://example.com/test", "Report");
+	ws_xml_add_child_format(ws_xml_get_doc_root(info->EventContent),
+			"http://example.com/test", "Index", "%d", i);
+	return info;
+}
+
+static int
+event_index(WsNotificationInfoH info)
+{
+	WsXmlNodeH node = ws_xml_get_doc_root(info->EventContent);
+	node = ws_xml_get_child(node, 0, "http://example.com/test", "Index");
+	return atoi(ws_xml_get_node_text(node));
+}
+
+static void
+free_event(WsNotificationInfoH info)
+{
+	ws_xml_destroy_doc(info->EventContent);
+	ws_xml_destroy_doc(info->headerOpaqueData);
+	u_free(info->EventAction);
+	u_free(info);
+}
+
+/* the log keeps its segments directly in its directory */
+static int
+remove_dir(const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+	char *path;
+	int r = 0;
+
+	if (d == NULL)
+		return -1;
+	while ((entry = readdir(d)) != NULL) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+		path = u_strdup_printf("%s/%s", dir, entry->d_name);
+		if (unlink(path))
+			r = -1;
+		u_free(path);
+	}
+	closedir(d);
+	if (rmdir(dir))
+		r = -1;
+	return r;
+}
+
+static int
+expect_next(EventPoolOpSetH ops, int expected)
+{
+	WsNotificationInfoH info = NULL;
+	int i;
+	if (ops->remove(SUBS, &info)) {
+		printf("expected event %d, pool is empty\n", expected);
+		return 1;
+	}
+	i = event_index(info);
+	free_event(info);
+	if (i != expected) {
+		printf("expected event %d, got %d\n", expected, i);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+expect_count(EventPoolOpSetH ops, int expected)
+{
+	int count = ops->count(SUBS);
+	if (count != expected) {
+		printf("expected %d pending events, got %d\n", expected, count);
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/owevXXXXXX";
+	LogEventPoolConfig config;
+	EventPoolOpSetH ops = wsman_get_log_eventpool_opset();
+	WsNotificationInfoH info;
+	int i, failed = 0;
+
+	if (mkdtemp(dir) == NULL)
+		return 1;
+	ws_xml_parser_initialize();
+	memset(&config, 0, sizeof(config));
+	config.path = dir;
+	/* small segments so compaction kicks in */
+	config.segment_size = 4096;
+	config.max_segments = 2;
+
+	if (ops->init(&config))
+		return 1;
+	for (i = 0; i < 100; i++)
+		ops->add(SUBS, make_event(i));
+	failed += expect_count(ops, 100);
+	/* deliver the first 60, hand out 10 more without committing */
+	for (i = 0; i < 60; i++)
+		failed += expect_next(ops, i);
+	failed += expect_count(ops, 40);
+	ops->commit(SUBS);
+	failed += expect_count(ops, 40);
+	for (i = 60; i < 70; i++)
+		failed += expect_next(ops, i);
+	failed += expect_count(ops, 30);
+	ops->finalize(NULL);
+
+	/* uncommitted events come back after a restart */
+	if (ops->init(&config))
+		return 1;
+	if (ops->count(SUBS) != 40) {
+		printf("expected 40 events after restart, got %d\n", ops->count(SUBS));
+		failed++;
+	}
+	for (i = 60; i < 100; i++)
+		failed += expect_next(ops, i);
+	ops->commit(SUBS);
+	failed += expect_count(ops, 0);
+	if (ops->remove(SUBS, &info) == 0) {
+		printf("pool should be empty\n");
+		free_event(info);
+		failed++;
+	}
+	ops->add(SUBS, make_event(100));
+	ops->clear(SUBS, NULL);
+	ops->finalize(NULL);
+
+	if (ops->init(&config))
+		return 1;
+	if (ops->count(SUBS) != 0) {
+		printf("cleared events came back\n");
+		failed++;
+	}
+	ops->finalize(NULL);
+
+	ws_xml_parser_destroy();
+	if (!failed && remove_dir(dir))
+		failed++;
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <u/libu.h>
+#include "wsman-xml-api.h"
+#include "wsman-xml.h"
+#include "wsman-names.h"
+#include "wsman-soap.h"
+#include "wsman-event-pool.h"
+
+#define NS "http://example.com/event"
+#define NS2 "http://example.com/other"
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+
+/* reference parameters end up in the header of every notification */
+static const char *subscribe =
+	"<s:Envelope xmlns:s=\"" XML_NS_SOAP_1_2 "\" "
+	"xmlns:wse=\"" XML_NS_EVENTING "\" xmlns:wsa=\"" XML_NS_ADDRESSING "\">"
+	"<s:Header/><s:Body><wse:Subscribe><wse:Delivery><wse:NotifyTo>"
+	"<wsa:Address>http://sink/</wsa:Address><wsa:ReferenceParameters>"
+	"<Id xmlns=\"" NS "\">42</Id>"
+	"<wsman:Key xmlns:wsman=\"" NS2 "\">k</wsman:Key>"
+	"</wsa:ReferenceParameters></wse:NotifyTo></wse:Delivery>"
+	"</wse:Subscribe></s:Body></s:Envelope>";
+
+/* default namespaces, prefixes the envelope binds otherwise, text to escape */
+static const char *contents[] = {
+	"<Event xmlns=\"" NS "\"><Name>disk</Name><Plain xmlns=\"\">x</Plain></Event>",
+	"<s:Event xmlns:s=\"" NS "\" xmlns:wsman=\"" NS2 "\">"
+	"<wsman:Value s:unit=\"MB\">1 &lt; 2 &gt; 0</wsman:Value>"
+	"<s:Inner xmlns:s=\"" NS2 "\"><s:Leaf/></s:Inner></s:Event>",
+	"<e:Event xmlns:e=\"" NS "\"/>",
+};
+
+#define NEVENTS (sizeof(contents) / sizeof(contents[0]))
+
+static const char *header =
+	"<h:Opaque xmlns:h=\"" NS "\" xmlns:wsa=\"" NS2 "\"><wsa:Id>7</wsa:Id></h:Opaque>";
+
+/* the same names, attributes and text at every level, in the same order */
+static int
+same_tree(WsXmlNodeH a, WsXmlNodeH b)
+{
+	WsXmlNodeH ca, cb;
+	WsXmlAttrH aa, ab;
+	char *ta, *tb;
+	int i;
+
+	if (strcmp(ws_xml_get_node_local_name(a), ws_xml_get_node_local_name(b)))
+		return 0;
+	ta = ws_xml_get_node_name_ns(a);
+	tb = ws_xml_get_node_name_ns(b);
+	if (strcmp(ta ? ta : "", tb ? tb : ""))
+		return 0;
+	for (i = 0; (aa = ws_xml_get_node_attr(a, i)) != NULL; i++) {
+		ab = ws_xml_find_node_attr(b, ws_xml_get_attr_ns(aa),
+					   ws_xml_get_attr_name(aa));
+		if (ab == NULL ||
+		    strcmp(ws_xml_get_attr_value(aa), ws_xml_get_attr_value(ab)))
+			return 0;
+	}
+	if (ws_xml_get_node_attr(b, i) != NULL)
+		return 0;
+	for (i = 0; (ca = ws_xml_get_child(a, i, NULL, NULL)) != NULL; i++) {
+		cb = ws_xml_get_child(b, i, NULL, NULL);
+		if (cb == NULL || !same_tree(ca, cb))
+			return 0;
+	}
+	if (ws_xml_get_child(b, i, NULL, NULL) != NULL)
+		return 0;
+	ta = ws_xml_get_node_text(a);
+	tb = ws_xml_get_node_text(b);
+	return i > 0 || !strcmp(ta ? ta : "", tb ? tb : "");
+}
+
+/* the message as the sink reads it, MessageIDs aside */
+static WsXmlDocH
+received(WsNotificationMessageH msg)
+{
+	WsXmlDocH doc;
+	WsXmlNodeH node;
+
+	if (msg == NULL)
+		return NULL;
+	doc = ws_xml_read_memory(u_buf_ptr(msg->buf), u_buf_len(msg->buf),
+				 "UTF-8", 0);
+	check(doc != NULL);
+	node = ws_xml_get_child(ws_xml_get_soap_header(doc), 0,
+				XML_NS_ADDRESSING, WSA_MESSAGE_ID);
+	check(node != NULL && !strcmp(ws_xml_get_node_text(node), msg->messageId));
+	if (node)
+		ws_xml_set_node_text(node, "uuid:0");
+	u_buf_free(msg->buf);
+	u_free(msg);
+	return doc;
+}
+
+static void
+test_mode(WsXmlDocH indoc, list_t *events, int mode)
+{
+	WsSubscribeInfo subs;
+	WsNotificationTemplateH t;
+	WsXmlDocH rendered, built;
+
+	memset(&subs, 0, sizeof(subs));
+	strcpy(subs.subsId, "uuid:1");
+	subs.epr_notifyto = "http://sink/";
+	subs.deliveryMode = mode;
+	wse_create_notification_template(indoc, &subs);
+	t = subs.notificationTemplate;
+	check(t != NULL);
+	rendered = received(wse_build_notification(&subs, events));
+	subs.notificationTemplate = NULL;
+	built = received(wse_build_notification(&subs, events));
+	check(rendered != NULL && built != NULL);
+	if (rendered && built)
+		check(same_tree(ws_xml_get_doc_root(rendered),
+				ws_xml_get_doc_root(built)));
+	ws_xml_destroy_doc(rendered);
+	ws_xml_destroy_doc(built);
+	wse_destroy_notification_template(t);
+	ws_xml_destroy_doc(subs.templateDoc);
+	ws_xml_destroy_doc(subs.heartbeatDoc);
+}
+
+static WsXmlDocH
+read_doc(const char *xml)
+{
+	WsXmlDocH doc = ws_xml_read_memory(xml, strlen(xml), "UTF-8", 0);
+	check(doc != NULL);
+	return doc;
+}
+
+int main(int argc, char **argv)
+{
+	struct __WsNotificationInfo infos[NEVENTS];
+	WsXmlDocH indoc;
+	list_t *events = list_create(LISTCOUNT_T_MAX);
+	unsigned int i;
+
+	ws_xml_parser_initialize();
+	indoc = read_doc(subscribe);
+	for (i = 0; i < NEVENTS; i++) {
+		infos[i].headerOpaqueData = i == 0 ? read_doc(header) : NULL;
+		infos[i].EventAction = i == 1 ? "http://example.com/a?b&c" : NULL;
+		infos[i].EventContent = read_doc(contents[i]);
+		list_append(events, lnode_create(&infos[i]));
+	}
+	test_mode(indoc, events, WS_EVENT_DELIVERY_MODE_PUSH);
+	test_mode(indoc, events, WS_EVENT_DELIVERY_MODE_PUSHWITHACK);
+	test_mode(indoc, events, WS_EVENT_DELIVERY_MODE_EVENTS);
+	/* the action of the first event goes in the header */
+	infos[0].EventAction = "http://example.com/first<>";
+	test_mode(indoc, events, WS_EVENT_DELIVERY_MODE_PUSH);
+
+	while (!list_isempty(events))
+		lnode_destroy(list_del_first(events));
+	list_destroy(events);
+	for (i = 0; i < NEVENTS; i++) {
+		ws_xml_destroy_doc(infos[i].headerOpaqueData);
+		ws_xml_destroy_doc(infos[i].EventContent);
+	}
+	ws_xml_destroy_doc(indoc);
+	ws_xml_parser_destroy();
+	if (failed)
+		printf("%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
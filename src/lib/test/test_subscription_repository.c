@@ -0,0 +1,257 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <u/libu.h>
+#include "wsman-soap.h"
+#include "wsman-subscription-repository.h"
+
+#define LEGACY "3e4d0c3a-5e2d-1d2d-8002-3d5b5f1f5b01"
+
+#define SUBSCRIBE(id, expires) \
+	"<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\" " \
+	"xmlns:e=\"http://schemas.xmlsoap.org/ws/2004/08/eventing\">" \
+	"<s:Header><e:Identifier>" id "</e:Identifier></s:Header><s:Body>" \
+	"<e:Subscribe><e:Expires>" expires "</e:Expires></e:Subscribe>" \
+	"</s:Body></s:Envelope>"
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+static char dir[] = "/tmp/owsubsXXXXXX";
+static SubsRepositoryOpSetH ops;
+
+static char *
+db_path(void)
+{
+	return u_strdup_printf("%s/subscriptions.db", dir);
+}
+
+static off_t
+db_size(void)
+{
+	char *path = db_path();
+	struct stat st;
+	off_t size = stat(path, &st) ? -1 : st.st_size;
+	u_free(path);
+	return size;
+}
+
+static void
+reopen(void)
+{
+	ops->finalize_subscription(dir, NULL);
+	check(ops->init_subscription(dir, NULL) == 0);
+}
+
+/* the stored document contains text */
+static int
+stored(const char *uuid, const char *text)
+{
+	unsigned char *doc = NULL;
+	int len = 0, r;
+	if (ops->get_subscription(dir, (char *)uuid, &doc, &len))
+		return 0;
+	r = (int)strlen((char *)doc) == len && strstr((char *)doc, text) != NULL;
+	u_free(doc);
+	return r;
+}
+
+static int
+count(void)
+{
+	list_t *list = list_create(LISTCOUNT_T_MAX);
+	lnode_t *node;
+	int n;
+	ops->load_subscription(dir, list);
+	n = list_count(list);
+	while (!list_isempty(list)) {
+		SubsRepositoryEntryH entry;
+		node = list_del_first(list);
+		entry = (SubsRepositoryEntryH)lnode_get(node);
+		u_free(entry->strdoc);
+		u_free(entry->uuid);
+		u_free(entry);
+		lnode_destroy(node);
+	}
+	list_destroy(list);
+	return n;
+}
+
+/* overwrite a byte at offset from the start of the document holding text */
+static void
+damage(const char *text, long offset)
+{
+	char *path = db_path();
+	FILE *f = fopen(path, "r+b");
+	off_t size = db_size(), i, doc = -1;
+	size_t len = strlen(text);
+	char *buf = u_malloc(size);
+
+	if (fread(buf, 1, size, f) == (size_t)size) {
+		for (i = 0; i + (off_t)len <= size; i++) {
+			if (!strncmp(buf + i, "<s:Envelope", 11))
+				doc = i;
+			if (!memcmp(buf + i, text, len))
+				break;
+		}
+		if (i + (off_t)len <= size && doc >= 0) {
+			fseek(f, doc + offset, SEEK_SET);
+			fputc(0x5a, f);
+		} else {
+			check(!"text to damage not found");
+		}
+	}
+	fclose(f);
+	u_free(buf);
+	u_free(path);
+}
+
+static void
+truncate_db(off_t by)
+{
+	char *path = db_path();
+	check(truncate(path, db_size() - by) == 0);
+	u_free(path);
+}
+
+static void
+test_operations(void)
+{
+	off_t size;
+	int i;
+
+	check(ops->save_subscritption(dir, "a", (unsigned char *)SUBSCRIBE("a", "PT10S")) == 0);
+	check(ops->save_subscritption(dir, "b", (unsigned char *)SUBSCRIBE("b", "PT10S")) == 0);
+	check(ops->save_subscritption(dir, "c", (unsigned char *)SUBSCRIBE("c", "PT10S")) == 0);
+	check(ops->search_subscription(dir, "a") == 0);
+	check(ops->search_subscription(dir, "x") != 0);
+
+	/* a renewal appends the expiration time, nothing else */
+	size = db_size();
+	check(ops->update_subscription(dir, "b", "2030-01-01T00:00:00Z") == 0);
+	check(db_size() - size < 256);
+	check(stored("b", "<e:Expires>2030-01-01T00:00:00Z</e:Expires></e:Subscribe>"));
+	check(ops->update_subscription(dir, "x", "PT20S") != 0);
+
+	check(ops->delete_subscription(dir, "c") == 0);
+	check(ops->search_subscription(dir, "c") != 0);
+	/* the latest Subscribe wins */
+	check(ops->save_subscritption(dir, "a", (unsigned char *)SUBSCRIBE("a2", "PT30S")) == 0);
+
+	reopen();
+	check(count() == 2);
+	check(stored("a", "<e:Identifier>a2</e:Identifier>"));
+	check(stored("b", "<e:Expires>2030-01-01T00:00:00Z</e:Expires>"));
+	check(ops->search_subscription(dir, "c") != 0);
+
+	/* renewals of another length, then enough of them to compact */
+	check(ops->update_subscription(dir, "b", "PT5S") == 0);
+	check(stored("b", "<e:Expires>PT5S</e:Expires>"));
+	for (i = 0; i < 1000; i++)
+		ops->update_subscription(dir, "b", i % 2 ? "PT100S" : "PT200S");
+	check(db_size() < 64 * 1024);
+	reopen();
+	check(stored("b", "<e:Expires>PT100S</e:Expires>"));
+	check(stored("a", "<e:Identifier>a2</e:Identifier>"));
+	check(count() == 2);
+}
+
+static void
+test_damage(void)
+{
+	check(ops->save_subscritption(dir, "d", (unsigned char *)SUBSCRIBE("d", "PT10S")) == 0);
+	check(ops->save_subscritption(dir, "e", (unsigned char *)SUBSCRIBE("e", "PT10S")) == 0);
+	check(ops->save_subscritption(dir, "f", (unsigned char *)SUBSCRIBE("f", "PT10S")) == 0);
+	ops->finalize_subscription(dir, NULL);
+
+	/* a bad payload costs that record only */
+	damage("<e:Identifier>d</e:Identifier>", 2);
+	/* as does a bad header, the type just before the document */
+	damage("<e:Identifier>e</e:Identifier>", -92);
+	check(ops->init_subscription(dir, NULL) == 0);
+	check(ops->search_subscription(dir, "d") != 0);
+	check(ops->search_subscription(dir, "e") != 0);
+	check(stored("f", "<e:Identifier>f</e:Identifier>"));
+	check(stored("a", "<e:Identifier>a2</e:Identifier>"));
+
+	/* a torn append at the end */
+	check(ops->save_subscritption(dir, "g", (unsigned char *)SUBSCRIBE("g", "PT10S")) == 0);
+	ops->finalize_subscription(dir, NULL);
+	truncate_db(10);
+	check(ops->init_subscription(dir, NULL) == 0);
+	check(ops->search_subscription(dir, "g") != 0);
+	check(stored("f", "<e:Identifier>f</e:Identifier>"));
+	check(ops->save_subscritption(dir, "h", (unsigned char *)SUBSCRIBE("h", "PT10S")) == 0);
+	reopen();
+	check(stored("h", "<e:Identifier>h</e:Identifier>"));
+	check(count() == 4);
+}
+
+static void
+test_legacy(void)
+{
+	char *path = u_strdup_printf("%s/uuid:" LEGACY, dir);
+	FILE *f = fopen(path, "w");
+
+	fputs(SUBSCRIBE("legacy", "PT10S"), f);
+	fclose(f);
+	reopen();
+	check(stored(LEGACY, "<e:Identifier>legacy</e:Identifier>"));
+	check(access(path, F_OK) != 0);
+	u_free(path);
+}
+
+static int
+remove_dir(const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+	char *path;
+	int r = 0;
+
+	if (d == NULL)
+		return -1;
+	while ((entry = readdir(d)) != NULL) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+		path = u_strdup_printf("%s/%s", dir, entry->d_name);
+		if (unlink(path))
+			r = -1;
+		u_free(path);
+	}
+	closedir(d);
+	if (rmdir(dir))
+		r = -1;
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	if (mkdtemp(dir) == NULL)
+		return 1;
+	ops = wsman_get_subsrepos_opset();
+	if (ops->init_subscription(dir, NULL))
+		return 1;
+	test_operations();
+	test_damage();
+	test_legacy();
+	ops->finalize_subscription(dir, NULL);
+	if (failed)
+		printf("%d checks failed\n", failed);
+	else if (remove_dir(dir))
+		failed++;
+	return failed ? 1 : 0;
+}
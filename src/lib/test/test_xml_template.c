@@ -0,0 +1,144 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <u/libu.h>
+#include "wsman-xml-api.h"
+#include "wsman-xml.h"
+
+#define NS "http://example.com/test"
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+
+/* the template with each slot filled with its value, escaped */
+static char *
+render(WsXmlTemplate *t, const char **values)
+{
+	u_buf_t *buf;
+	size_t from = 0;
+	unsigned int i;
+	char *s;
+
+	u_buf_create(&buf);
+	for (i = 0; i < t->nslots; i++) {
+		u_buf_append(buf, t->buf + from, t->slots[i].at - from);
+		ws_xml_buf_append_escaped(buf, values[t->slots[i].id]);
+		from = t->slots[i].end;
+	}
+	u_buf_append(buf, t->buf + from, t->len - from);
+	s = u_strdup(u_buf_ptr(buf));
+	u_buf_free(buf);
+	return s;
+}
+
+static void
+test_render(void)
+{
+	WsXmlTemplate *t = ws_xml_template_new();
+	WsXmlDocH doc = ws_xml_create_doc(NS, "Request");
+	WsXmlNodeH root = ws_xml_get_doc_root(doc);
+	WsXmlNodeH node;
+	const char *values[] = { "a<b & \"c\">", "@@openwsman-To@@" };
+	char marker[128];
+	WsXmlDocH out;
+	char *s;
+
+	/* text that looks like an older marker is left alone */
+	ws_xml_add_child(root, NS, "Uri", "http://x/@@openwsman-Selector-0@@");
+	ws_xml_add_child(root, NS, "Value",
+		ws_xml_template_marker(t, 1, marker, sizeof(marker)));
+	node = ws_xml_add_child(root, NS, "Item", NULL);
+	ws_xml_add_node_attr(node, NULL, "Name",
+		ws_xml_template_marker(t, 0, marker, sizeof(marker)));
+	check(ws_xml_template_compile(t, doc, 2) == 0);
+	check(t->nslots == 2);
+	check(t->slots[0].id == 1 && t->slots[1].id == 0);
+	check(ws_xml_template_slot(t, 0) == &t->slots[1]);
+	check(ws_xml_template_slot(t, 2) == NULL);
+
+	s = render(t, values);
+	out = ws_xml_read_memory(s, strlen(s), "UTF-8", 0);
+	check(out != NULL);
+	if (out) {
+		root = ws_xml_get_doc_root(out);
+		check(!strcmp(ws_xml_get_node_text(ws_xml_get_child(root, 0, NS, "Uri")),
+			"http://x/@@openwsman-Selector-0@@"));
+		check(!strcmp(ws_xml_get_node_text(ws_xml_get_child(root, 0, NS, "Value")),
+			values[1]));
+		node = ws_xml_get_child(root, 0, NS, "Item");
+		check(!strcmp(ws_xml_find_attr_value(node, NULL, "Name"), values[0]));
+		ws_xml_destroy_doc(out);
+	}
+	u_free(s);
+	ws_xml_destroy_doc(doc);
+	ws_xml_template_destroy(t);
+}
+
+/* every slot exactly once */
+static void
+test_reject(void)
+{
+	WsXmlTemplate *t = ws_xml_template_new();
+	WsXmlTemplate *other = ws_xml_template_new();
+	WsXmlDocH doc = ws_xml_create_doc(NS, "Request");
+	WsXmlNodeH root = ws_xml_get_doc_root(doc);
+	char marker[128];
+
+	check(strcmp(t->marker, other->marker) != 0);
+	ws_xml_add_child(root, NS, "A",
+		ws_xml_template_marker(t, 0, marker, sizeof(marker)));
+	check(ws_xml_template_compile(t, doc, 2) != 0);	/* missing */
+	check(ws_xml_template_compile(t, doc, 0) != 0);	/* out of range */
+	ws_xml_add_child(root, NS, "B", marker);
+	check(ws_xml_template_compile(t, doc, 2) != 0);	/* repeated */
+	ws_xml_add_child(root, NS, "C", "x");
+	ws_xml_set_node_text(ws_xml_get_child(root, 0, NS, "B"),
+		ws_xml_template_marker(other, 1, marker, sizeof(marker)));
+	check(ws_xml_template_compile(t, doc, 2) != 0);	/* not its own */
+	check(ws_xml_template_compile(other, doc, 2) != 0);
+	ws_xml_set_node_text(ws_xml_get_child(root, 0, NS, "B"),
+		ws_xml_template_marker(t, 1, marker, sizeof(marker)));
+	check(ws_xml_template_compile(t, doc, 2) == 0);
+	ws_xml_destroy_doc(doc);
+	ws_xml_template_destroy(t);
+	ws_xml_template_destroy(other);
+}
+
+/* entities next to each other and at the ends leave no empty runs */
+static void
+test_escape(void)
+{
+	u_buf_t *buf;
+
+	u_buf_create(&buf);
+	ws_xml_buf_append_escaped(buf, "");
+	check(u_buf_len(buf) == 0);
+	ws_xml_buf_append_escaped(buf, "<&\">");
+	ws_xml_buf_append_escaped(buf, "a<b");
+	u_buf_append(buf, "", 1);
+	check(!strcmp(u_buf_ptr(buf), "&lt;&amp;&quot;&gt;a&lt;b"));
+	u_buf_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	ws_xml_parser_initialize();
+	test_render();
+	test_reject();
+	test_escape();
+	ws_xml_parser_destroy();
+	if (failed)
+		printf("%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
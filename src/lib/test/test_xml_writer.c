@@ -0,0 +1,194 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <u/libu.h>
+#include "wsman-xml-api.h"
+#include "wsman-xml.h"
+#include "wsman-names.h"
+#include "wsman-xml-writer.h"
+
+#define NS "http://example.com/event"
+#define NS2 "http://example.com/other"
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+
+/* events of the kinds the pull path hands out */
+static const char *events[] = {
+	/* default namespace, children without one */
+	"<Event xmlns=\"" NS "\"><Name>disk</Name><Plain xmlns=\"\">x</Plain></Event>",
+	/* prefixes the response uses for other namespaces */
+	"<s:Event xmlns:s=\"" NS "\" xmlns:wsen=\"" NS2 "\">"
+	"<wsen:Value s:unit=\"MB\">10</wsen:Value></s:Event>",
+	/* a prefix bound again below, text to escape, xsi:nil */
+	"<a:Event xmlns:a=\"" NS "\" xmlns:xsi=\"" XML_NS_SCHEMA_INSTANCE "\">"
+	"<a:Text>1 &lt; 2 &gt; \"3\"</a:Text>"
+	"<a:Inner xmlns:a=\"" NS2 "\"><a:Empty xsi:nil=\"true\"/></a:Inner>"
+	"<Empty/></a:Event>",
+	/* names the response uses itself */
+	"<wsen:Items xmlns:wsen=\"" XML_NS_ENUMERATION "\"><wsen:Item a=\"&#10;\"/></wsen:Items>",
+};
+
+#define NEVENTS (sizeof(events) / sizeof(events[0]))
+
+/* the same names, attributes and text at every level */
+static int
+same_tree(WsXmlNodeH a, WsXmlNodeH b)
+{
+	WsXmlNodeH ca, cb;
+	WsXmlAttrH aa, ab;
+	char *ta, *tb;
+	int i;
+
+	if (strcmp(ws_xml_get_node_local_name(a), ws_xml_get_node_local_name(b)))
+		return 0;
+	ta = ws_xml_get_node_name_ns(a);
+	tb = ws_xml_get_node_name_ns(b);
+	if (strcmp(ta ? ta : "", tb ? tb : ""))
+		return 0;
+	for (i = 0; (aa = ws_xml_get_node_attr(a, i)) != NULL; i++) {
+		ta = ws_xml_get_attr_ns(aa);
+		ab = ws_xml_find_node_attr(b, ta, ws_xml_get_attr_name(aa));
+		if (ab == NULL ||
+		    strcmp(ws_xml_get_attr_value(aa), ws_xml_get_attr_value(ab)))
+			return 0;
+	}
+	if (ws_xml_get_node_attr(b, i) != NULL)
+		return 0;
+	for (i = 0; (ca = ws_xml_get_child(a, i, NULL, NULL)) != NULL; i++) {
+		cb = ws_xml_get_child(b, i, NULL, NULL);
+		if (cb == NULL || !same_tree(ca, cb))
+			return 0;
+	}
+	if (ws_xml_get_child(b, i, NULL, NULL) != NULL)
+		return 0;
+	ta = ws_xml_get_node_text(a);
+	tb = ws_xml_get_node_text(b);
+	return i > 0 || !strcmp(ta ? ta : "", tb ? tb : "");
+}
+
+/* a pull response with the events as items, copied or written */
+static WsXmlDocH
+pull_response(WsXmlDocH *docs, int write)
+{
+	WsXmlDocH doc = ws_xml_create_envelope();
+	WsXmlNodeH node = ws_xml_get_soap_body(doc);
+	WsXmlWriter *writer;
+	unsigned int i;
+
+	node = ws_xml_add_child(node, XML_NS_ENUMERATION, WSENUM_PULL_RESP, NULL);
+	ws_xml_add_child(node, XML_NS_ENUMERATION, WSENUM_ENUMERATION_CONTEXT,
+			 "uuid:1");
+	node = ws_xml_add_child(node, XML_NS_ENUMERATION, WSENUM_ITEMS, NULL);
+	if (!write) {
+		for (i = 0; i < NEVENTS; i++)
+			ws_xml_duplicate_tree(node, ws_xml_get_doc_root(docs[i]));
+		return doc;
+	}
+	writer = ws_xml_writer_new(node);
+	check(writer != NULL);
+	for (i = 0; i < NEVENTS; i++)
+		check(ws_xml_writer_add_node(writer, ws_xml_get_doc_root(docs[i])) == 0);
+	check(ws_xml_writer_flush(writer) == 0);
+	ws_xml_writer_destroy(writer);
+	return doc;
+}
+
+/* dumped and read again, as the client sees it */
+static WsXmlDocH
+reread(WsXmlDocH doc)
+{
+	char *buf = NULL;
+	int len = 0;
+	WsXmlDocH out;
+
+	ws_xml_dump_memory_enc(doc, &buf, &len, "UTF-8");
+	out = ws_xml_read_memory(buf, len, "UTF-8", 0);
+	check(out != NULL);
+	u_free(buf);
+	return out;
+}
+
+static void
+test_pull_items(void)
+{
+	WsXmlDocH docs[NEVENTS], dom, written, a, b;
+	unsigned int i;
+
+	for (i = 0; i < NEVENTS; i++) {
+		docs[i] = ws_xml_read_memory((char *)events[i],
+					     strlen(events[i]), "UTF-8", 0);
+		check(docs[i] != NULL);
+	}
+	dom = pull_response(docs, 0);
+	written = pull_response(docs, 1);
+	a = reread(dom);
+	b = reread(written);
+	if (a && b)
+		check(same_tree(ws_xml_get_doc_root(a), ws_xml_get_doc_root(b)));
+	/* each event is the same as the one it came from */
+	if (b) {
+		WsXmlNodeH items = ws_xml_get_soap_body(b);
+		items = ws_xml_get_child(items, 0, XML_NS_ENUMERATION, WSENUM_PULL_RESP);
+		items = ws_xml_get_child(items, 0, XML_NS_ENUMERATION, WSENUM_ITEMS);
+		for (i = 0; i < NEVENTS; i++)
+			check(same_tree(ws_xml_get_child(items, i, NULL, NULL),
+					ws_xml_get_doc_root(docs[i])));
+	}
+	for (i = 0; i < NEVENTS; i++)
+		ws_xml_destroy_doc(docs[i]);
+	ws_xml_destroy_doc(dom);
+	ws_xml_destroy_doc(written);
+	ws_xml_destroy_doc(a);
+	ws_xml_destroy_doc(b);
+}
+
+static void
+test_set_size(void)
+{
+	WsXmlDocH doc = ws_xml_create_doc(NS, "Items");
+	WsXmlWriter *writer = ws_xml_writer_new(ws_xml_get_doc_root(doc));
+	WsXmlDocH out;
+	size_t size;
+
+	check(ws_xml_writer_add_element(writer, NS, "Item", "a & b") == 0);
+	size = ws_xml_writer_get_size(writer);
+	check(ws_xml_writer_start_element(writer, NS, "Item") == 0);
+	/* not while an element is open */
+	check(ws_xml_writer_set_size(writer, size) != 0);
+	check(ws_xml_writer_flush(writer) != 0);
+	check(ws_xml_writer_end_element(writer) == 0);
+	check(ws_xml_writer_set_size(writer, size) == 0);
+	check(ws_xml_writer_flush(writer) == 0);
+	ws_xml_writer_destroy(writer);
+
+	out = reread(doc);
+	if (out) {
+		WsXmlNodeH root = ws_xml_get_doc_root(out);
+		check(!strcmp(ws_xml_get_node_text(
+			ws_xml_get_child(root, 0, NS, "Item")), "a & b"));
+		check(ws_xml_get_child(root, 1, NS, "Item") == NULL);
+	}
+	ws_xml_destroy_doc(out);
+	ws_xml_destroy_doc(doc);
+}
+
+int main(int argc, char **argv)
+{
+	test_pull_items();
+	test_set_size();
+	if (failed)
+		printf("%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
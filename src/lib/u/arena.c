@@ -0,0 +1,166 @@
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <string.h>
+#include <u/libu.h>
+#include <u/arena.h>
+
+/* every block handed out is aligned for any scalar type */
+#define U_ARENA_ALIGN       (2 * sizeof(void *))
+#define U_ARENA_ROUND(sz)   (((sz) + U_ARENA_ALIGN - 1) & ~(U_ARENA_ALIGN - 1))
+
+typedef struct u_arena_chunk_s
+{
+    struct u_arena_chunk_s *next;
+    size_t size, len;
+} u_arena_chunk_t;
+
+#define U_ARENA_HDR  U_ARENA_ROUND(sizeof(u_arena_chunk_t))
+
+struct u_arena_s
+{
+    u_arena_chunk_t *chunks;
+    size_t chunk_size;
+    size_t used;
+};
+
+/**
+ *  \defgroup arena Arena
+ *  \{
+ */
+
+static u_arena_chunk_t *arena_chunk_new(size_t size)
+{
+    u_arena_chunk_t *c = u_malloc(U_ARENA_HDR + size);
+
+    if (c == NULL)
+        return NULL;
+    c->size = size;
+    c->len = 0;
+    return c;
+}
+
+/**
+ * \brief  Create an arena
+ *
+ * Memory is taken from the system in chunks of \a size bytes and given
+ * back all at once by u_arena_destroy(); there is no way to free a
+ * single allocation.
+ *
+ * \param size  chunk size, 0 for the default
+ *
+ * \return the arena, or \c NULL on failure
+ */
+u_arena_t *u_arena_create(size_t size)
+{
+    u_arena_t *arena;
+
+    if (size == 0)
+        size = 4096;
+    size = U_ARENA_ROUND(size);
+
+    /* the arena lives at the start of its first chunk */
+    arena = u_malloc(U_ARENA_ROUND(sizeof(u_arena_t)) + U_ARENA_HDR + size);
+    if (arena == NULL)
+        return NULL;
+    arena->chunks = (u_arena_chunk_t *)((char *)arena +
+            U_ARENA_ROUND(sizeof(u_arena_t)));
+    arena->chunks->next = NULL;
+    arena->chunks->size = size;
+    arena->chunks->len = 0;
+    arena->chunk_size = size;
+    arena->used = 0;
+    return arena;
+}
+
+/**
+ * \brief  Allocate \a size bytes from the arena
+ *
+ * Requests larger than a quarter of the chunk size get a chunk of their
+ * own so that they do not waste the tail of the current one.
+ *
+ * \return the memory block, or \c NULL on failure
+ */
+void *u_arena_alloc(u_arena_t *arena, size_t size)
+{
+    u_arena_chunk_t *c = arena->chunks;
+    void *p;
+
+    size = U_ARENA_ROUND(size ? size : 1);
+    if (c->size - c->len < size) {
+        if (size > arena->chunk_size / 4) {
+            u_arena_chunk_t *big = arena_chunk_new(size);
+            if (big == NULL)
+                return NULL;
+            /* keep filling the current chunk */
+            big->len = size;
+            big->next = c->next;
+            c->next = big;
+            arena->used += size;
+            return (char *)big + U_ARENA_HDR;
+        }
+        c = arena_chunk_new(arena->chunk_size);
+        if (c == NULL)
+            return NULL;
+        c->next = arena->chunks;
+        arena->chunks = c;
+    }
+    p = (char *)c + U_ARENA_HDR + c->len;
+    c->len += size;
+    arena->used += size;
+    return p;
+}
+
+/** \brief Allocate \a size zero-filled bytes from the arena */
+void *u_arena_zalloc(u_arena_t *arena, size_t size)
+{
+    void *p = u_arena_alloc(arena, size);
+
+    if (p)
+        memset(p, 0, size);
+    return p;
+}
+
+/** \brief Copy the string \a s into the arena */
+char *u_arena_strdup(u_arena_t *arena, const char *s)
+{
+    size_t len;
+    char *p;
+
+    if (s == NULL)
+        return NULL;
+    len = strlen(s) + 1;
+    p = u_arena_alloc(arena, len);
+    if (p)
+        memcpy(p, s, len);
+    return p;
+}
+
+/** \brief Number of bytes handed out by the arena */
+size_t u_arena_used(u_arena_t *arena)
+{
+    return arena->used;
+}
+
+/** \brief Release the arena and everything allocated from it */
+void u_arena_destroy(u_arena_t *arena)
+{
+    u_arena_chunk_t *c, *next;
+    u_arena_chunk_t *first;
+
+    if (arena == NULL)
+        return;
+    first = (u_arena_chunk_t *)((char *)arena +
+            U_ARENA_ROUND(sizeof(u_arena_t)));
+    for (c = arena->chunks; c; c = next) {
+        next = c->next;
+        if (c != first)
+            u_free(c);
+    }
+    u_free(arena);
+}
+
+/**
+ *      \}
+ */
@@ -18,12 +18,30 @@ static const char rcsid[] =
 #include <u/buf.h>
 
 
+/* bytes held in the buffer object itself before going to the heap */
+#define U_BUF_INLINE 256
+
+/* smallest heap block a growing buffer asks for */
+#define U_BUF_MIN_ALLOC 1024
+
 struct u_buf_s
 {
     char *data;
     size_t size, len;
+    char small[U_BUF_INLINE];
 };
 
+#define U_BUF_IS_INLINE(ubuf) ((ubuf)->data == (ubuf)->small)
+
+/* point the buffer back at its inline region, dropping the heap block */
+static void u_buf_reset(u_buf_t *ubuf)
+{
+    ubuf->data = ubuf->small;
+    ubuf->size = U_BUF_INLINE - 1;
+    ubuf->len = 0;
+    ubuf->small[0] = 0;
+}
+
 /**
  *  \defgroup string String
  *  \{
@@ -49,8 +67,15 @@ int u_buf_reserve(u_buf_t *ubuf, size_t size)
         return 0; /* nothing to do */
    
     /* size plus 1 char to store a '\0' */
-    nbuf = u_realloc(ubuf->data, size+1);
-    dbg_err_if(nbuf == NULL);
+    if(U_BUF_IS_INLINE(ubuf))
+    {
+        nbuf = u_malloc(size+1);
+        dbg_err_if(nbuf == NULL);
+        memcpy(nbuf, ubuf->data, ubuf->len);
+    } else {
+        nbuf = u_realloc(ubuf->data, size+1);
+        dbg_err_if(nbuf == NULL);
+    }
 
     /* buffer data will always be zero-terminated (but the len field will not
      * count the last '\0') */
@@ -68,7 +93,8 @@ err:
  * \brief  Append some data to the buffer
  *
  * Append \a data of size \a size to the given buffer. If needed the buffer
- * will be enlarged.
+ * will be enlarged, at least doubling its size so that appending in small
+ * pieces stays linear.
  *
  * \param ubuf  buffer object
  * \param data  the data block to append
@@ -84,15 +110,19 @@ int u_buf_append(u_buf_t *ubuf, void *data, size_t size)
 
     if(ubuf->size - ubuf->len < size)
     {   /* buffer too small, need to resize */
-        dbg_err_if(u_buf_reserve(ubuf, ubuf->size + ubuf->len + 2*size));
+        size_t nsize = ubuf->size * 2;
+
+        if(nsize < U_BUF_MIN_ALLOC)
+            nsize = U_BUF_MIN_ALLOC;
+        if(nsize < ubuf->len + size)
+            nsize = ubuf->len + size;
+        dbg_err_if(u_buf_reserve(ubuf, nsize));
     }
    
+    /* the terminating '\0' is written by u_buf_ptr() and u_buf_steal() */
     if (data) {
         memcpy(ubuf->data + ubuf->len, data, size);
         ubuf->len += size;
-
-        /* zero term the buffer so it can be used (when applicable) as a string */
-        ubuf->data[ubuf->len] = 0;
     }
 
     return 0;
@@ -152,7 +182,8 @@ err:
  *
  * Release the underlaying memory block of the given buffer without 
  * calling free() on it. The caller must free the buffer later on (probably
- * after using it somwhow). 
+ * after using it somwhow). Data small enough to live in the buffer object
+ * itself is simply dropped; use u_buf_steal() to always get a heap copy.
  *
  * Use u_buf_ptr() to get the pointer of the memory block, u_buf_size() to
  * get its size and u_buf_len() to get its length.
@@ -165,9 +196,7 @@ int u_buf_detach(u_buf_t *ubuf)
 {
     dbg_err_if(ubuf == NULL);
 
-    ubuf->data = NULL;
-    ubuf->size = 0;
-    ubuf->len = 0;
+    u_buf_reset(ubuf);
 
     return 0;
 err:
@@ -258,20 +287,78 @@ err:
     return ~0;
 }
 
+/**
+ * \brief  Take the data of a buffer
+ *
+ * Return the zero-terminated data of \a ubuf as a block the caller must
+ * u_free(), and leave the buffer empty. Nothing is copied unless the data
+ * still fits in the buffer object itself.
+ *
+ * \param ubuf     buffer object
+ *
+ * \return the data, or \c NULL if the buffer never held any
+ */
 char *u_buf_steal(u_buf_t *ubuf)
 {
-    char *buf = ubuf->data;
-    ubuf->data = NULL;
-    ubuf->size = 0;
-    ubuf->len = 0;
+    char *buf;
+
+    if(U_BUF_IS_INLINE(ubuf))
+    {
+        if(ubuf->len == 0)
+            return NULL;
+        buf = u_malloc(ubuf->len + 1);
+        if(buf == NULL)
+            return NULL;
+        memcpy(buf, ubuf->data, ubuf->len);
+    } else
+        buf = ubuf->data;
+    buf[ubuf->len] = 0;
+    u_buf_reset(ubuf);
     return buf;
 }
 
+/**
+ * \brief  Move the data of a buffer into another one
+ *
+ * Replace the content of \a ubuf with the content of \a from, handing
+ * over the memory block instead of copying it, and leave \a from empty.
+ *
+ * \param ubuf  buffer object
+ * \param from  buffer whose data is taken
+ *
+ * \return \c 0 on success, not zero on failure
+ */
+int u_buf_adopt(u_buf_t *ubuf, u_buf_t *from)
+{
+    dbg_err_if(ubuf == NULL);
+    dbg_err_if(from == NULL);
+
+    if(U_BUF_IS_INLINE(from))
+    {
+        dbg_err_if(u_buf_clear(ubuf));
+        if(from->len)
+            dbg_err_if(u_buf_append(ubuf, from->data, from->len));
+        return u_buf_clear(from);
+    }
+    if(!U_BUF_IS_INLINE(ubuf))
+        u_free(ubuf->data);
+    ubuf->data = from->data;
+    ubuf->size = from->size;
+    ubuf->len = from->len;
+    u_buf_reset(from);
+
+    return 0;
+err:
+    return ~0;
+}
+
 
 /**
  * \brief  Return a pointer to the buffer internal momory block
  *
  * Return a void* pointer to the memory block allocated by the buffer object.
+ * The data is zero-terminated so it can be used (when applicable) as a
+ * string.
  *
  * \param ubuf     buffer object
  *
@@ -280,6 +367,9 @@ char *u_buf_steal(u_buf_t *ubuf)
 void* u_buf_ptr(u_buf_t *ubuf)
 {
     dbg_err_if(ubuf == NULL);
+
+    /* there is always room for it past size, see u_buf_reserve() */
+    ubuf->data[ubuf->len] = 0;
     
     return ubuf->data;
 err:
@@ -299,7 +389,7 @@ int u_buf_free(u_buf_t *ubuf)
 {
     dbg_err_if(ubuf == NULL);
 
-    if(ubuf->data)
+    if(!U_BUF_IS_INLINE(ubuf))
         u_free(ubuf->data);
 
     u_free(ubuf);
@@ -323,20 +413,62 @@ int u_buf_create(u_buf_t **pubuf)
 
     dbg_err_if(pubuf == NULL);
 
-    ubuf = (u_buf_t*)u_zalloc(sizeof(u_buf_t));
+    ubuf = (u_buf_t*)u_malloc(sizeof(u_buf_t));
     dbg_err_if(ubuf == NULL);
 
+    u_buf_reset(ubuf);
+
+    *pubuf = ubuf;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/**
+ * \brief  Create a new buffer for an expected amount of data
+ *
+ * Like u_buf_create(), but make room for \a size bytes up front so that
+ * filling the buffer does not need to enlarge it.
+ *
+ * \param pubuf    on success will get the new buffer object
+ * \param size     expected size of the data
+ *
+ * \return \c 0 on success, not zero on failure
+ */
+int u_buf_create_sized(u_buf_t **pubuf, size_t size)
+{
+    u_buf_t *ubuf = NULL;
+
+    dbg_err_if(u_buf_create(&ubuf));
+    dbg_err_if(u_buf_reserve(ubuf, size));
+
     *pubuf = ubuf;
 
     return 0;
 err:
+    if(ubuf)
+        u_buf_free(ubuf);
     return ~0;
 }
 
 
+/**
+ * \brief  Hand a memory block over to a buffer
+ *
+ * The buffer takes \a ptr, which must come from malloc() and have room
+ * for \a size bytes plus the terminating '\0', and holds \a len bytes.
+ *
+ * \param ubuf  buffer object
+ * \param ptr   the memory block
+ * \param size  size of \a ptr, not counting the '\0'
+ * \param len   length of the data in \a ptr
+ *
+ * \return \c 0
+ */
 int u_buf_construct(u_buf_t *ubuf, void *ptr, size_t size, size_t len)
 {
-    if (ubuf->data) {
+    if (!U_BUF_IS_INLINE(ubuf)) {
         free(ubuf->data);
     }
     ubuf->data = ptr;
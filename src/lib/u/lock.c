@@ -39,28 +39,23 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 
 #include <u/pthreadx.h>
 #include <u/lock.h>
 #include <u/memory.h>
-
-
+#include <u/buf.h>
+#include <u/gettimeofday.h>
 #ifndef WIN32
-extern int pthread_mutexattr_settype(pthread_mutexattr_t *attr, int type);
+#include <sys/time.h>
 #endif
 
-#if defined (__SVR4) && defined (__sun)
-#define PTHREAD_MUTEX_RECURSIVE_NP PTHREAD_MUTEX_RECURSIVE
-#endif
 
 void u_init_lock(void *data)
 {
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init( &attr );
-    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
     if ( data != NULL )
-        pthread_mutex_init((pthread_mutex_t*)data, &attr);
+        pthread_mutex_init((pthread_mutex_t*)data, NULL);
 }
 
 int u_try_lock(void* data)
@@ -99,4 +94,272 @@ void u_unlock(void* data)
 }
 
 
+/* contention profiling, see u_lock_profile() */
+static int profiling = 0;
+static int profile_ready = 0;
+static pthread_mutex_t profile_lock;
+static u_lock_site_t *profile_sites = NULL;
+
+#ifndef WIN32
+#define rw_init(l)      pthread_rwlock_init(&(l)->rwlock, NULL)
+#define rw_destroy(l)   pthread_rwlock_destroy(&(l)->rwlock)
+#define rw_rdlock(l)    pthread_rwlock_rdlock(&(l)->rwlock)
+#define rw_tryrdlock(l) pthread_rwlock_tryrdlock(&(l)->rwlock)
+#define rw_wrlock(l)    pthread_rwlock_wrlock(&(l)->rwlock)
+#define rw_trywrlock(l) pthread_rwlock_trywrlock(&(l)->rwlock)
+#define rw_unlock(l)    pthread_rwlock_unlock(&(l)->rwlock)
+#else
+#define rw_init(l)      pthread_mutex_init(&(l)->rwlock, NULL)
+#define rw_destroy(l)   pthread_mutex_destroy(&(l)->rwlock)
+#define rw_rdlock(l)    pthread_mutex_lock(&(l)->rwlock)
+#define rw_tryrdlock(l) pthread_mutex_trylock(&(l)->rwlock)
+#define rw_wrlock(l)    pthread_mutex_lock(&(l)->rwlock)
+#define rw_trywrlock(l) pthread_mutex_trylock(&(l)->rwlock)
+#define rw_unlock(l)    pthread_mutex_unlock(&(l)->rwlock)
+#endif
+
+static unsigned long long now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void site_acquired(u_lock_site_t *site, const char *name,
+        int contended, unsigned long long wait)
+{
+    pthread_mutex_lock(&profile_lock);
+    if (!site->registered)
+    {
+        site->registered = 1;
+        site->next = profile_sites;
+        profile_sites = site;
+    }
+    site->name = name;
+    site->count++;
+    if (contended)
+    {
+        site->contended++;
+        site->wait_usec += wait;
+        if (wait > site->wait_max)
+            site->wait_max = wait;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+static void site_released(u_lock_site_t *site, unsigned long long hold)
+{
+    pthread_mutex_lock(&profile_lock);
+    site->hold_usec += hold;
+    if (hold > site->hold_max)
+        site->hold_max = hold;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+int u_mutex_init(u_mutex_t *m, const char *name)
+{
+    m->name = name;
+    m->site = NULL;
+    m->since = 0;
+    return pthread_mutex_init(&m->mutex, NULL);
+}
+
+void u_mutex_destroy(u_mutex_t *m)
+{
+    pthread_mutex_destroy(&m->mutex);
+}
+
+void u_mutex_lock_at(u_mutex_t *m, u_lock_site_t *site)
+{
+    unsigned long long start = 0;
+    int contended;
+
+    if (!profiling)
+    {
+        pthread_mutex_lock(&m->mutex);
+        return;
+    }
+    contended = pthread_mutex_trylock(&m->mutex) != 0;
+    if (contended)
+    {
+        start = now_usec();
+        pthread_mutex_lock(&m->mutex);
+    }
+    site_acquired(site, m->name, contended, contended ? now_usec() - start : 0);
+    m->site = site;
+    m->since = now_usec();
+}
+
+void u_mutex_unlock(u_mutex_t *m)
+{
+    u_lock_site_t *site = m->site;
+    unsigned long long hold = 0;
+
+    if (site)
+    {
+        hold = now_usec() - m->since;
+        m->site = NULL;
+    }
+    pthread_mutex_unlock(&m->mutex);
+    if (site)
+        site_released(site, hold);
+}
+
+int u_rwlock_init(u_rwlock_t *l, const char *name)
+{
+    l->name = name;
+    l->site = NULL;
+    l->since = 0;
+    return rw_init(l);
+}
+
+void u_rwlock_destroy(u_rwlock_t *l)
+{
+    rw_destroy(l);
+}
+
+void u_rwlock_rdlock_at(u_rwlock_t *l, u_lock_site_t *site)
+{
+    unsigned long long start = 0;
+    int contended;
+
+    if (!profiling)
+    {
+        rw_rdlock(l);
+        return;
+    }
+    contended = rw_tryrdlock(l) != 0;
+    if (contended)
+    {
+        start = now_usec();
+        rw_rdlock(l);
+    }
+    /* readers share the lock, only their waits are counted */
+    site_acquired(site, l->name, contended, contended ? now_usec() - start : 0);
+}
+
+void u_rwlock_wrlock_at(u_rwlock_t *l, u_lock_site_t *site)
+{
+    unsigned long long start = 0;
+    int contended;
+
+    if (!profiling)
+    {
+        rw_wrlock(l);
+        return;
+    }
+    contended = rw_trywrlock(l) != 0;
+    if (contended)
+    {
+        start = now_usec();
+        rw_wrlock(l);
+    }
+    site_acquired(site, l->name, contended, contended ? now_usec() - start : 0);
+    l->site = site;
+    l->since = now_usec();
+}
+
+void u_rwlock_unlock(u_rwlock_t *l)
+{
+    /* only set while a writer holds the lock, so never for readers */
+    u_lock_site_t *site = l->site;
+    unsigned long long hold = 0;
+
+    if (site)
+    {
+        hold = now_usec() - l->since;
+        l->site = NULL;
+    }
+    rw_unlock(l);
+    if (site)
+        site_released(site, hold);
+}
+
+/**
+ * \brief  Turn lock contention profiling on or off
+ *
+ * Call it before the threads using the locks are started. Statistics
+ * are kept when profiling is turned off and on again.
+ *
+ * \param on    non zero to profile
+ */
+void u_lock_profile(int on)
+{
+    if (on && !profile_ready)
+    {
+        pthread_mutex_init(&profile_lock, NULL);
+        profile_ready = 1;
+    }
+    profiling = on;
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+    const u_lock_site_t *sa = *(const u_lock_site_t * const *)a;
+    const u_lock_site_t *sb = *(const u_lock_site_t * const *)b;
+
+    if (sa->wait_usec != sb->wait_usec)
+        return sa->wait_usec < sb->wait_usec ? 1 : -1;
+    if (sa->hold_usec != sb->hold_usec)
+        return sa->hold_usec < sb->hold_usec ? 1 : -1;
+    return 0;
+}
 
+/**
+ * \brief  Describe the lock sites seen while profiling
+ *
+ * One line per call site, most waited on first: acquisitions, how many
+ * had to wait, total and longest wait, total and longest exclusive hold,
+ * times in microseconds.
+ *
+ * \return the report, to be released with u_free(), or \c NULL if
+ *         profiling never ran
+ */
+char *u_lock_profile_report(void)
+{
+    u_lock_site_t **sites = NULL;
+    u_lock_site_t *site;
+    u_buf_t *buf = NULL;
+    char line[512];
+    char *report = NULL;
+    size_t i, n = 0;
+
+    if (!profile_ready)
+        return NULL;
+    pthread_mutex_lock(&profile_lock);
+    for (site = profile_sites; site; site = site->next)
+        n++;
+    if (u_buf_create(&buf) || (n && (sites = u_malloc(n * sizeof(*sites))) == NULL))
+        goto out;
+    n = 0;
+    for (site = profile_sites; site; site = site->next)
+        sites[n++] = site;
+    qsort(sites, n, sizeof(*sites), compare_sites);
+
+    snprintf(line, sizeof(line), "%-32s %-16s %10s %10s %12s %10s %12s %10s\n",
+            "site", "lock", "count", "waited", "wait", "max", "hold", "max");
+    u_buf_append(buf, line, strlen(line));
+    for (i = 0; i < n; i++)
+    {
+        const char *file = strrchr(sites[i]->file, '/');
+        char where[64];
+
+        snprintf(where, sizeof(where), "%s:%d",
+                file ? file + 1 : sites[i]->file, sites[i]->line);
+        snprintf(line, sizeof(line),
+                "%-32s %-16s %10lu %10lu %12llu %10llu %12llu %10llu\n",
+                where, sites[i]->name ? sites[i]->name : "-",
+                sites[i]->count, sites[i]->contended,
+                sites[i]->wait_usec, sites[i]->wait_max,
+                sites[i]->hold_usec, sites[i]->hold_max);
+        u_buf_append(buf, line, strlen(line));
+    }
+    report = u_buf_steal(buf);
+out:
+    pthread_mutex_unlock(&profile_lock);
+    if (buf)
+        u_buf_free(buf);
+    u_free(sites);
+    return report;
+}
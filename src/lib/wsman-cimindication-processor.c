@@ -42,6 +42,28 @@
 #include "wsman-event-pool.h"
 #include "wsman-cimindication-processor.h"
 
+/*
+ * Indications are checked on the HTTP worker with a scan that builds no
+ * tree, acknowledged to the CIMOM and queued as they came; a worker
+ * thread parses and converts them into the event pool. When the queue
+ * is full the CIMOM is told to back off with 503. At shutdown the worker
+ * empties the queue before it exits, so an acknowledged indication is
+ * in the event pool by the time cim_indication_ingest_shutdown() returns.
+ */
+typedef struct {
+	SoapH soap;
+	char *uuid;
+	char *charset;
+	u_buf_t *request;
+} cim_indication_entry;
+
+static list_t *ingest_queue = NULL;
+static unsigned int ingest_queue_max;
+static int ingest_stopping;
+static pthread_t ingest_worker;
+static pthread_mutex_t ingest_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ingest_cond = PTHREAD_COND_INITIALIZER;
+
 static int isvalidCIMIndicationExport(WsXmlDocH doc){
 	if(doc == NULL) return 0;
 	WsXmlNodeH node = ws_xml_get_doc_root(doc);
@@ -55,50 +77,76 @@ static int isvalidCIMIndicationExport(WsXmlDocH doc){
 	return 1;
 }
 
-static void cimxml_build_response_msg(WsXmlDocH indoc, WsXmlDocH *outdoc) {
-	WsXmlDocH doc = NULL;
+/* what the response needs from an export request, read without a tree */
+typedef struct {
+	WsXmlDocH response;
+	WsXmlNodeH message;
+	int inMessage;
+	int simple;
+	int multi;
+	int inMulti;
+	int count;
+} cimxml_export_scan;
+
+static int cimxml_scan_element(int depth, const char *name, const char **attrs, void *data) {
+	cimxml_export_scan *scan = (cimxml_export_scan *)data;
+	WsXmlNodeH node;
+	int i;
+	switch(depth) {
+	case 1:
+		/* the first MESSAGE, the response takes its attributes */
+		scan->inMessage = scan->message == NULL && !strcmp(name, CIMXML_MESSAGE);
+		if(!scan->inMessage)
+			break;
+		scan->response = ws_xml_create_doc(NULL, CIMXML_CIM);
+		node = ws_xml_get_doc_root(scan->response);
+		ws_xml_add_node_attr(node, NULL, CIMXML_CIMVERSION, "2.0");
+		ws_xml_add_node_attr(node, NULL, CIMXML_DTDVERSION, "2.0");
+		scan->message = ws_xml_add_child(node, NULL, CIMXML_MESSAGE, NULL);
+		for(i = 0; attrs[i]; i += 2)
+			ws_xml_add_node_attr(scan->message, NULL, attrs[i], attrs[i + 1]);
+		break;
+	case 2:
+		scan->inMulti = 0;
+		if(!scan->inMessage)
+			break;
+		if(!strcmp(name, CIMXML_SIMPLEEXPREQ))
+			scan->simple = 1;
+		else if(!scan->multi && !strcmp(name, CIMXML_MULTIEXPREQ))
+			scan->multi = scan->inMulti = 1;
+		break;
+	case 3:
+		if(scan->inMulti)
+			scan->count++;
+		break;
+	}
+	return 0;
+}
+
+static int isvalidCIMIndicationScan(cimxml_export_scan *scan) {
+	return scan->message && (scan->simple || scan->multi);
+}
+
+static void cimxml_build_response_msg(cimxml_export_scan *scan, WsXmlDocH *outdoc) {
 	WsXmlNodeH outnode = NULL;
-	WsXmlNodeH innode = NULL;
 	WsXmlNodeH temp = NULL;
-	WsXmlNodeH temp2 = NULL;
-	doc = ws_xml_create_doc(NULL, CIMXML_CIM);
-	outnode = ws_xml_get_doc_root(doc);
-	innode = ws_xml_get_doc_root(indoc);
-//	char *value = ws_xml_get_node_attr(WsXmlNodeH node, int index)
-	ws_xml_add_node_attr(outnode, NULL, CIMXML_CIMVERSION, "2.0");
-	ws_xml_add_node_attr(outnode, NULL, CIMXML_DTDVERSION, "2.0");
-	outnode = ws_xml_add_child(outnode, NULL, CIMXML_MESSAGE, NULL);
-	innode = ws_xml_get_child(innode, 0, NULL, CIMXML_MESSAGE);
-	int n = ws_xml_get_node_attr_count(innode);
-	int i = 0;
-	while(i < n) {
-		WsXmlAttrH attr = ws_xml_get_node_attr(innode, i);
-	 	char *name = ws_xml_get_attr_name(attr);
-	 	char *value = ws_xml_get_attr_value(attr);
-	 	ws_xml_add_node_attr(outnode, NULL, name, value);
-	 	i++;
-	}
-	temp = ws_xml_get_child(innode, 0, NULL, CIMXML_SIMPLEEXPREQ);
-	if(temp) {
-		outnode = ws_xml_add_child(outnode, NULL, CIMXML_SIMPLEEXPRSP, NULL);
+	int i;
+	if(scan->simple) {
+		outnode = ws_xml_add_child(scan->message, NULL, CIMXML_SIMPLEEXPRSP, NULL);
 		outnode = ws_xml_add_child(outnode, NULL, CIMXML_EXPMETHODRESPONSE, NULL);
 		ws_xml_add_node_attr(outnode, NULL, CIMXML_NAME, "ExportIndication");
 		ws_xml_add_child(outnode, NULL, CIMXML_IRETURNVALUE, NULL);
 	}
 	else {
-		temp = ws_xml_get_child(innode, 0, NULL, CIMXML_MULTIEXPREQ);
-		outnode = ws_xml_add_child(outnode, NULL, CIMXML_MULTIEXPRSQ, NULL);
-		n = ws_xml_get_child_count(temp);
-		i = 0;
-		while(i < n) {
-			innode = ws_xml_get_child(temp, i, NULL, CIMXML_SIMPLEEXPREQ);
-			temp2 = ws_xml_add_child(outnode, NULL, CIMXML_EXPMETHODRESPONSE, NULL);
-			ws_xml_add_node_attr(temp2, NULL, CIMXML_NAME, "ExportIndication");
-			ws_xml_add_child(temp2, NULL, CIMXML_IRETURNVALUE, NULL);
-			i++;
+		outnode = ws_xml_add_child(scan->message, NULL, CIMXML_MULTIEXPRSQ, NULL);
+		for(i = 0; i < scan->count; i++) {
+			temp = ws_xml_add_child(outnode, NULL, CIMXML_EXPMETHODRESPONSE, NULL);
+			ws_xml_add_node_attr(temp, NULL, CIMXML_NAME, "ExportIndication");
+			ws_xml_add_child(temp, NULL, CIMXML_IRETURNVALUE, NULL);
 		}
 	}
-	*outdoc = doc;
+	*outdoc = scan->response;
+	scan->response = NULL;
 }
 
 static
@@ -285,6 +333,90 @@ void cimxml_set_fault(CimxmlMessage *message, CIMXMLKnownStatusCode status) {
     }
 }
 
+static void cim_indication_entry_free(cim_indication_entry *entry) {
+	u_free(entry->uuid);
+	u_free(entry->charset);
+	u_buf_free(entry->request);
+	u_free(entry);
+}
+
+static void cim_indication_convert(SoapH soap, const char *uuid, WsXmlDocH indoc) {
+	WsSubscribeInfo *subsInfo = wse_get_subscription(soap, uuid);
+	if(subsInfo == NULL) {
+		debug("uuid:%s gone, indication dropped", uuid);
+		return;
+	}
+	create_indication_event(indoc, subsInfo, soap->eventpoolOpSet);
+	wse_put_subscription(soap, subsInfo);
+}
+
+static void *cim_indication_worker(void *arg) {
+	cim_indication_entry *entry;
+	lnode_t *node;
+	WsXmlDocH indoc;
+	while(1) {
+		pthread_mutex_lock(&ingest_lock);
+		while(list_isempty(ingest_queue) && !ingest_stopping)
+			pthread_cond_wait(&ingest_cond, &ingest_lock);
+		if(list_isempty(ingest_queue)) {
+			pthread_mutex_unlock(&ingest_lock);
+			break;
+		}
+		node = list_del_first(ingest_queue);
+		pthread_mutex_unlock(&ingest_lock);
+		entry = (cim_indication_entry *)lnode_get(node);
+		lnode_destroy(node);
+		indoc = ws_xml_read_memory(u_buf_ptr(entry->request), u_buf_len(entry->request),
+			entry->charset, 0);
+		if(isvalidCIMIndicationExport(indoc))
+			cim_indication_convert(entry->soap, entry->uuid, indoc);
+		else
+			debug("indication for uuid:%s cannot be parsed, dropped", entry->uuid);
+		ws_xml_destroy_doc(indoc);
+		cim_indication_entry_free(entry);
+	}
+	return NULL;
+}
+
+int cim_indication_ingest_init(unsigned int queue_size) {
+	int r;
+	if(ingest_queue)
+		return 0;
+	ingest_queue_max = queue_size ? queue_size : CIMXML_INGEST_QUEUE_SIZE;
+	ingest_queue = list_create(LISTCOUNT_T_MAX);
+	ingest_stopping = 0;
+	if ((r = pthread_create(&ingest_worker, NULL, cim_indication_worker, NULL)) != 0) {
+		error("cim indication worker not started = %d", r);
+		list_destroy(ingest_queue);
+		ingest_queue = NULL;
+		return 1;
+	}
+	debug("cim indication queue of %u requests", ingest_queue_max);
+	return 0;
+}
+
+void cim_indication_ingest_shutdown(void) {
+	list_t *queue;
+	pthread_mutex_lock(&ingest_lock);
+	if(ingest_queue == NULL || ingest_stopping) {
+		pthread_mutex_unlock(&ingest_lock);
+		return;
+	}
+	debug("cim indication worker stopping, %lu queued",
+		(unsigned long)list_count(ingest_queue));
+	ingest_stopping = 1;
+	pthread_cond_signal(&ingest_cond);
+	pthread_mutex_unlock(&ingest_lock);
+	pthread_join(ingest_worker, NULL);
+	/* later requests are converted on their HTTP worker */
+	pthread_mutex_lock(&ingest_lock);
+	queue = ingest_queue;
+	ingest_queue = NULL;
+	ingest_stopping = 0;
+	pthread_mutex_unlock(&ingest_lock);
+	list_destroy(queue);
+}
+
 void CIM_Indication_call(cimxml_context *cntx, CimxmlMessage *message, void *opaqueData) {
 	char *response = NULL;
 	int len;
@@ -292,44 +424,68 @@ void CIM_Indication_call(cimxml_context *cntx, CimxmlMessage *message, void *opa
 	WsXmlDocH indicationResponse = NULL;
 	SoapH soap = cntx->soap;
 	char *uuid = cntx->uuid;
-	WsContextH soapCntx = ws_get_soap_context(soap);
+	WsSubscribeInfo *subsInfo = NULL;
+	cim_indication_entry *entry;
+	cimxml_export_scan scan;
 	debug("**********in CIM_Indication_call:: %s", u_buf_ptr(message->request));
-	indicationRequest = ws_xml_read_memory(u_buf_ptr(message->request), u_buf_len(message->request),
-		message->charset, 0);
-	if(indicationRequest == NULL) {
+	memset(&scan, 0, sizeof(scan));
+	if(!ws_xml_scan_memory(u_buf_ptr(message->request), u_buf_len(message->request),
+			message->charset, cimxml_scan_element, &scan)) {
 		debug("error, request cannot be parsed !");
 		message->http_code = WSMAN_STATUS_BAD_REQUEST;
 		cimxml_set_fault(message, CIMXML_STATUS_REQUEST_NOT_VALID);
 		goto DONE;
 	}
-	if(!isvalidCIMIndicationExport(indicationRequest)) {
+	if(!isvalidCIMIndicationScan(&scan)) {
 		debug("error, invalid cim indication");
 		message->http_code = WSMAN_STATUS_FORBIDDEN;
 		cimxml_set_fault(message, CIMXML_STATUS_UNSUPPORTED_OPERATION);
 		goto DONE;
 	}
-	//to do here: put indication in event pool
-	WsSubscribeInfo *subsInfo = NULL;
-	list_t *subslist = soapCntx->subscriptionMemList;
-	lnode_t *node = list_first(subslist);
-	while(node) {
-		subsInfo = (WsSubscribeInfo *)node->list_data;
-		if(!strcmp(subsInfo->subsId, uuid)) break;
-		node = list_next(subslist, node);
-	}
-	if(node == NULL) {
+	subsInfo = wse_get_subscription(soap, uuid);
+	if(subsInfo == NULL) {
 		message->http_code = WSMAN_STATUS_NOT_FOUND;
 		cimxml_set_fault(message, CIMXML_STATUS_REQUEST_NOT_VALID);
 		debug("error. uuid:%s not registered!", uuid);
 		goto DONE;
 	}
-	EventPoolOpSetH opset = soap->eventpoolOpSet;
-	create_indication_event(indicationRequest, subsInfo, opset);
-	cimxml_build_response_msg(indicationRequest, &indicationResponse);
+	pthread_mutex_lock(&ingest_lock);
+	if(ingest_queue && !ingest_stopping) {
+		if(list_count(ingest_queue) >= ingest_queue_max) {
+			pthread_mutex_unlock(&ingest_lock);
+			debug("cim indication queue full, uuid:%s told to retry", uuid);
+			message->http_code = WSMAN_STATUS_SERVICE_UNAVAILABLE;
+			u_buf_clear(message->response);
+			goto DONE;
+		}
+		entry = u_zalloc(sizeof(*entry));
+		entry->soap = soap;
+		entry->uuid = u_strdup(uuid);
+		entry->charset = message->charset ? u_strdup(message->charset) : NULL;
+		/* the worker owns the request from here on */
+		entry->request = message->request;
+		u_buf_create(&message->request);
+		list_append(ingest_queue, lnode_create(entry));
+		pthread_cond_signal(&ingest_cond);
+		pthread_mutex_unlock(&ingest_lock);
+	}
+	else {
+		pthread_mutex_unlock(&ingest_lock);
+		/* no worker, convert right here */
+		indicationRequest = ws_xml_read_memory(u_buf_ptr(message->request),
+			u_buf_len(message->request), message->charset, 0);
+		if(indicationRequest)
+			create_indication_event(indicationRequest, subsInfo, soap->eventpoolOpSet);
+	}
+	cimxml_build_response_msg(&scan, &indicationResponse);
+	message->http_code = WSMAN_STATUS_OK;
 	ws_xml_dump_memory_enc(indicationResponse, &response, &len, "utf-8");
 	u_buf_construct(message->response, response, len, len);
 DONE:
+	if(subsInfo)
+		wse_put_subscription(soap, subsInfo);
 	u_free(cntx);
 	ws_xml_destroy_doc(indicationRequest);
 	ws_xml_destroy_doc(indicationResponse);
+	ws_xml_destroy_doc(scan.response);
 }
@@ -64,17 +64,9 @@ static char *auth_methods[] = {
 extern void wsmc_handler(WsManClient * cl, WsXmlDocH rqstDoc,
 				 void *user_data);
 
-#ifdef BENCHMARK
-static long long transfer_time = 0;
-#endif
-
-int wsman_send_request(WsManClient * cl, WsXmlDocH request)
+static int wsman_send(WsManClient * cl, WsXmlDocH request, u_buf_t *buf)
 {
         int ret = 0;
-#ifdef BENCHMARK
-	struct timeval tv0, tv1;
-	long long t0, t1;
-#endif
 
 	if (wsmc_lock(cl) != 0 ) {
 		error("Client busy");
@@ -82,33 +74,27 @@ int wsman_send_request(WsManClient * cl, WsXmlDocH request)
 	}
 	wsmc_reinit_conn(cl);
 
-#ifdef BENCHMARK
-	gettimeofday(&tv0, NULL);
-#endif
-
-	wsmc_handler(cl, request, NULL);
+	wsmc_handler(cl, request, buf);
         if (cl->last_error != WS_LASTERR_OK) {
           warning("Couldn't send request to client: %s\n", cl->fault_string);
           ret = 1;
         }
-#ifdef BENCHMARK
-	gettimeofday(&tv1, NULL);
-	t0 = tv0.tv_sec * 10000000 + tv0.tv_usec;
-	t1 = tv1.tv_sec * 10000000 + tv1.tv_usec;
-	transfer_time += t1 - t0;
-#endif
 	wsmc_unlock(cl);
 	return ret;
 }
 
-#ifdef BENCHMARK
-long long get_transfer_time()
+int wsman_send_request(WsManClient * cl, WsXmlDocH request)
 {
-	long long l = transfer_time;
-	transfer_time = 0;
-	return l;
+	return wsman_send(cl, request, NULL);
+}
+
+/*
+ * Send a request serialized by the caller, in the client's content encoding
+ */
+int wsman_send_request_buf(WsManClient * cl, u_buf_t *request)
+{
+	return wsman_send(cl, NULL, request);
 }
-#endif
 
 
 const char *wsmc_transport_get_auth_name(wsman_auth_type_t auth)
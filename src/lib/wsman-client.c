@@ -65,6 +65,14 @@ wsmc_get_dumpfile(WsManClient *cl)
     return cl->dumpfile;
 }
 
+void
+wsmc_set_item_callback(WsManClient *cl, WsXmlEnumCallback callback,
+		void *data)
+{
+	cl->item_callback = callback;
+	cl->item_data = data;
+}
+
 
 #ifndef _WIN32
 void
@@ -215,6 +223,29 @@ wsmc_get_last_error(WsManClient * cl)
 }
 
 
+void
+wsmc_get_stats(WsManClient * cl, WsManClientStats *stats)
+{
+	*stats = cl->stats;
+}
+
+void
+wsmc_reset_stats(WsManClient * cl)
+{
+	memset(&cl->stats, 0, sizeof(cl->stats));
+}
+
+unsigned long long
+wsmc_usec_since(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000LL +
+		(now.tv_usec - start->tv_usec);
+}
+
+
 long
 wsmc_get_response_code(WsManClient * cl)
 {
@@ -653,6 +684,12 @@ wsmc_get_locale(client_opt_t * options)
   return options->locale;
 }
 
+void
+wsmc_set_prefetch(client_opt_t * options, unsigned int depth)
+{
+	options->prefetch_depth = depth;
+}
+
 void
 wsmc_add_selector_from_uri(WsXmlDocH doc,
 		const char *resource_uri)
@@ -978,8 +1015,8 @@ add_subscription_context(WsXmlNodeH node, char *context)
 	ws_xml_duplicate_children(node, subsnode);
 }
 
-WsXmlDocH
-wsmc_create_request(WsManClient * cl, const char *resource_uri,
+static WsXmlDocH
+create_request(WsManClient * cl, const char *resource_uri,
 		client_opt_t *options, filter_t *filter,
 		WsmanAction action, char *method, void *data)
 {
@@ -1149,6 +1186,218 @@ wsmc_create_request(WsManClient * cl, const char *resource_uri,
 	return request;
 }
 
+WsXmlDocH
+wsmc_create_request(WsManClient * cl, const char *resource_uri,
+		client_opt_t *options, filter_t *filter,
+		WsmanAction action, char *method, void *data)
+{
+	WsXmlDocH request;
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	request = create_request(cl, resource_uri, options, filter, action,
+			method, data);
+	cl->stats.build_usec += wsmc_usec_since(&tv);
+	return request;
+}
+
+
+/*
+ * A request serialized once, with slots for the parts that change from
+ * call to call: the To address, the MessageID, the selector values and
+ * the enumeration context.
+ */
+enum {
+	PREPARED_SLOT_TO,
+	PREPARED_SLOT_MESSAGE_ID,
+	PREPARED_SLOT_SELECTOR	/* one per selector, then the context */
+};
+
+struct _WsManPreparedRequest {
+	WsXmlTemplate *t;
+	char **selector_keys;
+	char **selector_values;	/* from the options it was prepared with */
+	unsigned int nselectors;
+	int needs_context;
+	int dump;
+};
+
+void
+wsmc_prepared_free(WsManPreparedRequest *r)
+{
+	unsigned int i;
+
+	if (r == NULL)
+		return;
+	for (i = 0; i < r->nselectors; i++) {
+		u_free(r->selector_keys[i]);
+		u_free(r->selector_values[i]);
+	}
+	u_free(r->selector_keys);
+	u_free(r->selector_values);
+	ws_xml_template_destroy(r->t);
+	u_free(r);
+}
+
+/* selector values become markers, EPR selectors stay as they are */
+static list_t *
+prepared_selectors(WsManPreparedRequest *r, list_t *selectors)
+{
+	list_t *markers = NULL;
+	lnode_t *node;
+	key_value_t *kv;
+	char marker[128];
+
+	if (selectors == NULL)
+		return NULL;
+	r->selector_keys = u_zalloc(list_count(selectors) * sizeof(char *));
+	r->selector_values = u_zalloc(list_count(selectors) * sizeof(char *));
+	for (node = list_first(selectors); node; node = list_next(selectors, node)) {
+		kv = (key_value_t *)node->list_data;
+		if (kv->type == 0) {
+			ws_xml_template_marker(r->t,
+				PREPARED_SLOT_SELECTOR + r->nselectors,
+				marker, sizeof(marker));
+			r->selector_keys[r->nselectors] = u_strdup(kv->key);
+			r->selector_values[r->nselectors] = u_strdup(kv->v.text);
+			r->nselectors++;
+			_wsmc_add_key_value(&markers, kv->key, marker, NULL, false);
+		} else {
+			_wsmc_add_key_value(&markers, kv->key, NULL, kv->v.epr, false);
+		}
+	}
+	return markers;
+}
+
+WsManPreparedRequest *
+wsmc_prepare_request(WsManClient * cl,
+		const char *resource_uri,
+		client_opt_t *options,
+		filter_t *filter,
+		WsmanAction action)
+{
+	WsManPreparedRequest *r;
+	WsXmlDocH request;
+	WsXmlNodeH header, node;
+	client_opt_t opts = *options;
+	char context[128], marker[128];
+	unsigned int nslots;
+
+	if (cl->content_encoding && strcasecmp(cl->content_encoding, "UTF-8")) {
+		error("prepared requests are UTF-8 only");
+		return NULL;
+	}
+	r = u_zalloc(sizeof(*r));
+	if ((r->t = ws_xml_template_new()) == NULL) {
+		u_free(r);
+		return NULL;
+	}
+	r->needs_context = (action == WSMAN_ACTION_PULL ||
+			action == WSMAN_ACTION_RELEASE);
+	r->dump = (options->flags & FLAG_DUMP_REQUEST) == FLAG_DUMP_REQUEST;
+
+	/* the caller's options are left alone */
+	opts.selectors = prepared_selectors(r, options->selectors);
+	opts.flags &= ~FLAG_DUMP_REQUEST;
+	nslots = PREPARED_SLOT_SELECTOR + r->nselectors;
+	if (r->needs_context)
+		ws_xml_template_marker(r->t, nslots++, context, sizeof(context));
+	request = wsmc_create_request(cl, resource_uri, &opts, filter, action,
+			NULL, r->needs_context ? context : NULL);
+	_wsmc_kvl_destroy(opts.selectors);
+	if (request == NULL) {
+		wsmc_prepared_free(r);
+		return NULL;
+	}
+
+	header = ws_xml_get_soap_header(request);
+	node = ws_xml_get_child(header, 0, XML_NS_ADDRESSING, WSA_TO);
+	ws_xml_set_node_text(node, ws_xml_template_marker(r->t,
+			PREPARED_SLOT_TO, marker, sizeof(marker)));
+	node = ws_xml_get_child(header, 0, XML_NS_ADDRESSING, WSA_MESSAGE_ID);
+	ws_xml_set_node_text(node, ws_xml_template_marker(r->t,
+			PREPARED_SLOT_MESSAGE_ID, marker, sizeof(marker)));
+	if (ws_xml_template_compile(r->t, request, nslots)) {
+		error("could not prepare request for %s", resource_uri);
+		ws_xml_destroy_doc(request);
+		wsmc_prepared_free(r);
+		return NULL;
+	}
+	ws_xml_destroy_doc(request);
+	return r;
+}
+
+static const char *
+prepared_selector_value(WsManPreparedRequest *r, client_opt_t *options,
+		unsigned int i)
+{
+	lnode_t *node = NULL;
+	key_value_t *kv;
+
+	if (options && options->selectors)
+		node = list_find(options->selectors, r->selector_keys[i],
+				_list_key_compare);
+	if (node) {
+		kv = (key_value_t *)node->list_data;
+		if (kv->type == 0)
+			return kv->v.text;
+	}
+	return r->selector_values[i];
+}
+
+WsXmlDocH
+wsmc_prepared_send(WsManClient * cl,
+		WsManPreparedRequest *r,
+		client_opt_t *options,
+		const char *enumContext)
+{
+	WsXmlTemplate *t = r->t;
+	const WsXmlTemplateSlot *slot;
+	u_buf_t *buf;
+	char uuidBuf[100];
+	size_t from = 0;
+	unsigned int i;
+	struct timeval tv;
+
+	if (cl->content_encoding && strcasecmp(cl->content_encoding, "UTF-8")) {
+		error("prepared requests are UTF-8 only");
+		return NULL;
+	}
+	if (r->needs_context && enumContext == NULL) {
+		error("No enumeration context ???");
+		return NULL;
+	}
+	gettimeofday(&tv, NULL);
+	generate_uuid(uuidBuf, sizeof(uuidBuf), 0);
+	u_buf_create_sized(&buf, t->len + 256);
+	for (i = 0; i < t->nslots; i++) {
+		slot = &t->slots[i];
+		u_buf_append(buf, t->buf + from, slot->at - from);
+		if (slot->id == PREPARED_SLOT_TO)
+			ws_xml_buf_append_escaped(buf, cl->data.endpoint);
+		else if (slot->id == PREPARED_SLOT_MESSAGE_ID)
+			u_buf_append(buf, uuidBuf, strlen(uuidBuf));
+		else if (slot->id < PREPARED_SLOT_SELECTOR + r->nselectors)
+			ws_xml_buf_append_escaped(buf, prepared_selector_value(r,
+				options, slot->id - PREPARED_SLOT_SELECTOR));
+		else
+			ws_xml_buf_append_escaped(buf, enumContext);
+		from = slot->end;
+	}
+	u_buf_append(buf, t->buf + from, t->len - from);
+	/* patching the copy is what serializing the request comes down to */
+	cl->stats.serialize_usec += wsmc_usec_since(&tv);
+	if (r->dump && cl->dumpfile)
+		fwrite(u_buf_ptr(buf), 1, u_buf_len(buf), cl->dumpfile);
+
+	if (wsman_send_request_buf(cl, buf)) {
+		u_buf_free(buf);
+		return NULL;
+	}
+	u_buf_free(buf);
+	return wsmc_build_envelope_from_response(cl);
+}
+
 
 
 static void
@@ -1162,8 +1411,7 @@ handle_resource_request(WsManClient * cl, WsXmlDocH request,
 		ws_serialize(cl->serctx, ws_xml_get_soap_body(request),
 				data, (XmlSerializerInfo *) typeInfo,
 				class, resource_uri, NULL, 1);
-		ws_serializer_free_mem(cl->serctx, data,
-				(XmlSerializerInfo *) typeInfo);
+		/* data belongs to the caller */
 		u_free(class);
 	} else if (data != NULL) {
 		if (wsman_is_valid_xml_envelope((WsXmlDocH) data)) {
@@ -1600,20 +1848,43 @@ wsmc_action_enumerate_and_pull(WsManClient * cl,
 		return 0;
 	}
 
+	if (options->prefetch_depth > 0 && enumContext != NULL && enumContext[0] != 0) {
+		WsManEnumerator *e = wsmc_enumerator_new(cl, resource_uri,
+				options, filter, enumContext);
+		long rc;
+		WS_LASTERR_Code err;
+		int ret = 1;
+		wsmc_free_enum_context(enumContext);
+		while (wsmc_enumerator_next(e, &doc, &rc, &err)) {
+			/* the enumerator pulls through a client of its own */
+			cl->response_code = rc;
+			cl->last_error = err;
+			if (doc == NULL || (rc != 200 && rc != 400 && rc != 500)) {
+				ws_xml_destroy_doc(doc);
+				ret = 0;
+				break;
+			}
+			callback(cl, doc, callback_data);
+			ws_xml_destroy_doc(doc);
+		}
+		wsmc_enumerator_free(e);
+		return ret;
+	}
+
 	while (enumContext != NULL && enumContext[0] != 0) {
-		long rc = wsmc_get_response_code(cl);
+		long rc;
 		doc = wsmc_action_pull(cl, resource_uri, options, filter, enumContext);
+		rc = wsmc_get_response_code(cl);
 
-		if (rc != 200 && rc != 400 && rc != 500) {
+		if (doc == NULL || (rc != 200 && rc != 400 && rc != 500)) {
+			ws_xml_destroy_doc(doc);
 			wsmc_free_enum_context(enumContext);
 			return 0;
 		}
 		callback(cl, doc, callback_data);
 		wsmc_free_enum_context(enumContext);
 		enumContext = wsmc_get_enum_context(doc);
-		if (doc) {
-			ws_xml_destroy_doc(doc);
-		}
+		ws_xml_destroy_doc(doc);
 	}
 	wsmc_free_enum_context(enumContext);
 	return 1;
@@ -1622,6 +1893,242 @@ wsmc_action_enumerate_and_pull(WsManClient * cl,
 
 
 
+typedef struct {
+	WsXmlDocH doc;
+	long response_code;
+	WS_LASTERR_Code last_error;
+} enumerator_response;
+
+struct _WsManEnumerator {
+	WsManClient *owner;
+	WsManClient *cl;		/* private to the enumerator */
+	char *resource_uri;
+	client_opt_t *options;
+	filter_t *filter;
+	char *context;
+	unsigned int depth;
+	list_t *responses;
+	int done;
+	int stop;
+	int started;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static char *
+copy_str(const char *s)
+{
+	return s ? u_strdup(s) : NULL;
+}
+
+/*
+ * Copy of a client's endpoint, credentials and transport settings, so
+ * that the enumerator thread never touches the caller's client. Items
+ * are not streamed to the item callback, they stay in the responses.
+ */
+static WsManClient *
+enumerator_client(WsManClient *cl)
+{
+	WsManClient *c = wsmc_create(cl->data.hostname, cl->data.port,
+			cl->data.path, cl->data.scheme, cl->data.user,
+			cl->data.pwd);
+
+	if (c == NULL)
+		return NULL;
+#ifndef _WIN32
+	wsmc_set_conffile(c, wsmc_get_conffile(cl));
+#endif
+	c->data.auth_method = cl->data.auth_method;
+	c->data.auth_set = cl->data.auth_set;
+	c->authentication.cainfo = copy_str(cl->authentication.cainfo);
+	c->authentication.caoid = copy_str(cl->authentication.caoid);
+	memcpy(c->authentication.certificatethumbprint,
+			cl->authentication.certificatethumbprint,
+			sizeof(c->authentication.certificatethumbprint));
+#ifdef _WIN32
+	c->authentication.calocal = cl->authentication.calocal;
+#endif
+	c->authentication.capath = copy_str(cl->authentication.capath);
+	c->authentication.sslcert = copy_str(cl->authentication.sslcert);
+	c->authentication.sslkey = copy_str(cl->authentication.sslkey);
+	c->authentication.verify_peer = cl->authentication.verify_peer;
+	c->authentication.verify_host = cl->authentication.verify_host;
+	c->authentication.auth_request_func = cl->authentication.auth_request_func;
+	c->authentication.method = copy_str(cl->authentication.method);
+	c->authentication.crl_check = cl->authentication.crl_check;
+	c->authentication.crl_file = copy_str(cl->authentication.crl_file);
+	c->proxy_data.proxy = copy_str(cl->proxy_data.proxy);
+	c->proxy_data.proxy_auth = copy_str(cl->proxy_data.proxy_auth);
+	c->proxy_data.proxy_username = copy_str(cl->proxy_data.proxy_username);
+	c->proxy_data.proxy_password = copy_str(cl->proxy_data.proxy_password);
+	wsmc_set_encoding(c, cl->content_encoding);
+	c->cim_ns = copy_str(cl->cim_ns);
+	c->transport_timeout = cl->transport_timeout;
+	wsman_transport_set_agent(c, cl->user_agent);
+	c->dumpfile = cl->dumpfile;
+	return c;
+}
+
+static void
+add_stats(WsManClientStats *to, const WsManClientStats *from)
+{
+	to->requests += from->requests;
+	to->build_usec += from->build_usec;
+	to->serialize_usec += from->serialize_usec;
+	to->dns_usec += from->dns_usec;
+	to->connect_usec += from->connect_usec;
+	to->tls_usec += from->tls_usec;
+	to->first_byte_usec += from->first_byte_usec;
+	to->transfer_usec += from->transfer_usec;
+	to->parse_usec += from->parse_usec;
+	to->total_usec += from->total_usec;
+	to->request_bytes += from->request_bytes;
+	to->response_bytes += from->response_bytes;
+}
+
+static void *
+enumerator_thread(void *arg)
+{
+	WsManEnumerator *e = (WsManEnumerator *)arg;
+	enumerator_response *r;
+	char *next;
+	int failed;
+
+	while (1) {
+		pthread_mutex_lock(&e->lock);
+		while (!e->stop && list_count(e->responses) >= e->depth)
+			pthread_cond_wait(&e->cond, &e->lock);
+		if (e->stop) {
+			pthread_mutex_unlock(&e->lock);
+			break;
+		}
+		pthread_mutex_unlock(&e->lock);
+
+		r = u_zalloc(sizeof(*r));
+		r->doc = wsmc_action_pull(e->cl, e->resource_uri, e->options,
+				e->filter, e->context);
+		r->response_code = wsmc_get_response_code(e->cl);
+		r->last_error = wsmc_get_last_error(e->cl);
+		failed = r->doc == NULL || (r->response_code != 200 &&
+				r->response_code != 400 && r->response_code != 500);
+		next = failed ? NULL : wsmc_get_enum_context(r->doc);
+
+		pthread_mutex_lock(&e->lock);
+		list_append(e->responses, lnode_create(r));
+		wsmc_free_enum_context(e->context);
+		e->context = next;
+		if (next == NULL || next[0] == 0)
+			e->done = 1;
+		pthread_cond_broadcast(&e->cond);
+		pthread_mutex_unlock(&e->lock);
+		if (e->done)
+			break;
+	}
+	pthread_mutex_lock(&e->lock);
+	e->done = 1;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->lock);
+	return NULL;
+}
+
+WsManEnumerator *
+wsmc_enumerator_new(WsManClient * cl,
+		const char *resource_uri,
+		client_opt_t *options,
+		filter_t *filter,
+		const char *enumContext)
+{
+	WsManEnumerator *e = u_zalloc(sizeof(*e));
+
+	e->owner = cl;
+	e->cl = enumerator_client(cl);
+	e->resource_uri = u_strdup(resource_uri);
+	e->options = options;
+	e->filter = filter;
+	e->context = u_strdup(enumContext);
+	e->depth = options->prefetch_depth ? options->prefetch_depth : 1;
+	e->responses = list_create(LISTCOUNT_T_MAX);
+	pthread_mutex_init(&e->lock, NULL);
+	pthread_cond_init(&e->cond, NULL);
+	if (e->cl == NULL) {
+		error("no client for the enumerator");
+		e->done = 1;
+	} else if (pthread_create(&e->thread, NULL, enumerator_thread, e) == 0) {
+		e->started = 1;
+	} else {
+		error("enumerator thread not started");
+		e->done = 1;
+	}
+	return e;
+}
+
+int
+wsmc_enumerator_next(WsManEnumerator *e, WsXmlDocH *doc,
+		long *response_code, WS_LASTERR_Code *last_error)
+{
+	enumerator_response *r;
+	lnode_t *node;
+
+	pthread_mutex_lock(&e->lock);
+	while (list_isempty(e->responses) && !e->done)
+		pthread_cond_wait(&e->cond, &e->lock);
+	if (list_isempty(e->responses)) {
+		pthread_mutex_unlock(&e->lock);
+		return 0;
+	}
+	node = list_del_first(e->responses);
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->lock);
+	r = (enumerator_response *)lnode_get(node);
+	lnode_destroy(node);
+	*doc = r->doc;
+	if (response_code)
+		*response_code = r->response_code;
+	if (last_error)
+		*last_error = r->last_error;
+	u_free(r);
+	return 1;
+}
+
+void
+wsmc_enumerator_free(WsManEnumerator *e)
+{
+	enumerator_response *r;
+	lnode_t *node;
+
+	if (e == NULL)
+		return;
+	pthread_mutex_lock(&e->lock);
+	e->stop = 1;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->lock);
+	if (e->started)
+		pthread_join(e->thread, NULL);
+	/* the caller stopped early, let the server drop the enumeration */
+	if (e->cl && e->context && e->context[0] != 0)
+		ws_xml_destroy_doc(wsmc_action_release(e->cl, e->resource_uri,
+				e->options, e->context));
+	if (e->cl) {
+		add_stats(&e->owner->stats, &e->cl->stats);
+		wsmc_release(e->cl);
+	}
+	while (!list_isempty(e->responses)) {
+		node = list_del_first(e->responses);
+		r = (enumerator_response *)lnode_get(node);
+		ws_xml_destroy_doc(r->doc);
+		u_free(r);
+		lnode_destroy(node);
+	}
+	list_destroy(e->responses);
+	pthread_mutex_destroy(&e->lock);
+	pthread_cond_destroy(&e->cond);
+	wsmc_free_enum_context(e->context);
+	u_free(e->resource_uri);
+	u_free(e);
+}
+
+
 WsXmlDocH
 wsmc_action_enumerate(WsManClient * cl,
 		const char *resource_uri,
@@ -1644,6 +2151,129 @@ wsmc_action_enumerate(WsManClient * cl,
 }
 
 
+/* envelope size MaxElements is tuned for, unless the request sets one */
+#define WSMC_TUNE_ENVELOPE_SIZE		153600
+#define WSMC_TUNE_MAX_ELEMENTS		1024
+/* Pull round trip MaxElements is tuned for, unless a timeout sets one */
+#define WSMC_TUNE_PULL_TIME		5000
+
+/*
+ * Adaptive MaxElements of a client's Pull requests, learnt anew for
+ * every resource.
+ */
+struct _WsManPullTuning {
+	char *resource_uri;
+	unsigned int max_elements;	/* asked for in the next Pull */
+	unsigned int floor;		/* largest value that got a full batch */
+	unsigned int ceiling;		/* smallest value that faulted, 0 if none */
+};
+
+/* passes streamed items on to the caller's callback, counting them */
+typedef struct {
+	WsXmlEnumCallback callback;
+	void *data;
+	int items;
+} pull_item_counter;
+
+static int
+pull_count_item(WsXmlNodeH node, void *data)
+{
+	pull_item_counter *counter = data;
+
+	counter->items++;
+	return counter->callback(node, counter->data);
+}
+
+static struct _WsManPullTuning *
+pull_tuning_get(WsManClient *cl, const char *resource_uri,
+		client_opt_t *options)
+{
+	struct _WsManPullTuning *t = cl->pull_tuning;
+
+	if (t && resource_uri && t->resource_uri &&
+			strcmp(t->resource_uri, resource_uri) == 0)
+		return t;
+	if (t == NULL)
+		t = cl->pull_tuning = u_zalloc(sizeof(*t));
+	u_free(t->resource_uri);
+	t->resource_uri = u_strdup(resource_uri);
+	/* start from what the caller asked for, or low */
+	t->max_elements = options->max_elements ? options->max_elements : 1;
+	if (t->max_elements > WSMC_TUNE_MAX_ELEMENTS)
+		t->max_elements = WSMC_TUNE_MAX_ELEMENTS;
+	t->floor = 0;
+	t->ceiling = 0;
+	return t;
+}
+
+static int
+is_encoding_limit_fault(WsXmlDocH doc)
+{
+	WsManFault fault;
+	const char *p;
+
+	memset(&fault, 0, sizeof(fault));
+	wsmc_get_fault_data(doc, &fault);
+	if (fault.subcode == NULL)
+		return 0;
+	p = strchr(fault.subcode, ':');
+	return strcmp(p ? p + 1 : fault.subcode, "EncodingLimit") == 0;
+}
+
+/*
+ * Pick MaxElements of the next Pull from the last response: at most
+ * twice as many items, or halfway to a value that hit the server's
+ * EncodingLimit; no more than fit in three quarters of the envelope at
+ * the size seen per item, and no more than can come back within the
+ * round trip budget at the time seen per item.
+ */
+static void
+pull_tuning_update(WsManClient *cl, struct _WsManPullTuning *t,
+		client_opt_t *options, WsXmlDocH doc, int items,
+		unsigned long msecs)
+{
+	unsigned long envelope = options->max_envelope_size ?
+		options->max_envelope_size : WSMC_TUNE_ENVELOPE_SIZE;
+	unsigned long budget = WSMC_TUNE_PULL_TIME;
+	unsigned long per_item, next = t->max_elements;
+	size_t size = cl->connection->response_size ?
+		cl->connection->response_size : u_buf_len(cl->connection->response);
+
+	if (items < 0) {
+		WsXmlNodeH node = ws_xml_get_child(ws_xml_get_soap_body(doc),
+				0, XML_NS_ENUMERATION, WSENUM_PULL_RESP);
+		items = ws_xml_get_child_count(ws_xml_get_child(node, 0,
+					XML_NS_ENUMERATION, WSENUM_ITEMS));
+	}
+	if (items <= 0)
+		return;
+	if (options->timeout)
+		budget = options->timeout / 2;
+	else if (cl->transport_timeout)
+		budget = cl->transport_timeout * 1000 / 2;
+
+	/* a short batch is the end of the enumeration or the server's own limit */
+	if ((unsigned int)items >= t->max_elements) {
+		t->floor = t->max_elements;
+		next = 2 * t->max_elements;
+		if (t->ceiling && next >= t->ceiling)
+			next = (t->max_elements + t->ceiling) / 2;
+	}
+	per_item = size / items + 1;
+	if (next > envelope / 4 * 3 / per_item)
+		next = envelope / 4 * 3 / per_item;
+	per_item = msecs / items;
+	if (per_item > 0 && next > budget / per_item)
+		next = budget / per_item;
+	if (next > WSMC_TUNE_MAX_ELEMENTS)
+		next = WSMC_TUNE_MAX_ELEMENTS;
+	if (next < 1)
+		next = 1;
+	debug("%d items, %lu bytes in %lu ms, MaxElements now %lu", items,
+			(unsigned long) size, msecs, next);
+	t->max_elements = next;
+}
+
 WsXmlDocH
 wsmc_action_pull(WsManClient * cl,
 		const char *resource_uri,
@@ -1653,20 +2283,64 @@ wsmc_action_pull(WsManClient * cl,
 {
 	WsXmlDocH       response;
 	WsXmlNodeH      node;
+	struct _WsManPullTuning *t = NULL;
+	struct timeval tv0, tv1;
+	pull_item_counter counter;
+	unsigned int max_elements = options->max_elements;
 
-	if (enumContext || (enumContext && enumContext[0] == 0)) {
-		WsXmlDocH request = wsmc_create_request(cl, resource_uri, options, filter,
-				WSMAN_ACTION_PULL,	NULL, (char *)enumContext);
+	if (enumContext == NULL) {
+		error("No enumeration context ???");
+		return NULL;
+	}
+	if (options->flags & FLAG_ENUMERATION_TUNE_MAX_ELEMENTS)
+		t = pull_tuning_get(cl, resource_uri, options);
+	counter.callback = cl->item_callback;
+	counter.data = cl->item_data;
+	while (1) {
+		WsXmlDocH request;
+
+		if (t)
+			options->max_elements = t->max_elements;
+		request = wsmc_create_request(cl, resource_uri, options, filter,
+				WSMAN_ACTION_PULL, NULL, (char *)enumContext);
+		options->max_elements = max_elements;
+		/* streamed items leave no trace in the response, count them */
+		if (t && counter.callback) {
+			counter.items = 0;
+			cl->item_callback = pull_count_item;
+			cl->item_data = &counter;
+		}
+		gettimeofday(&tv0, NULL);
 		if (wsman_send_request(cl, request)) {
+			cl->item_callback = counter.callback;
+			cl->item_data = counter.data;
 			ws_xml_destroy_doc(request);
 			return NULL;
 		}
-
+		gettimeofday(&tv1, NULL);
 		response = wsmc_build_envelope_from_response(cl);
+		cl->item_callback = counter.callback;
+		cl->item_data = counter.data;
 		ws_xml_destroy_doc(request);
-	} else {
-		error("No enumeration context ???");
-		return NULL;
+		if (t == NULL || response == NULL)
+			break;
+		if (!is_encoding_limit_fault(response)) {
+			pull_tuning_update(cl, t, options, response,
+					counter.callback ? counter.items : -1,
+					(tv1.tv_sec - tv0.tv_sec) * 1000 +
+					(tv1.tv_usec - tv0.tv_usec) / 1000);
+			break;
+		}
+		if (t->max_elements <= 1)
+			break;
+		/* too big for the server, go back to what worked */
+		t->ceiling = t->max_elements;
+		if (t->floor && t->floor < t->ceiling)
+			t->max_elements = t->floor;
+		else
+			t->max_elements /= 2;
+		debug("EncodingLimit, MaxElements now %u", t->max_elements);
+		ws_xml_destroy_doc(response);
 	}
 
 	node = ws_xml_get_child(ws_xml_get_soap_body(response),
@@ -1819,12 +2493,31 @@ wsmc_build_envelope_from_response(WsManClient * cl)
 {
 	WsXmlDocH       doc = NULL;
 	u_buf_t        *buffer = cl->connection->response;
+	WsXmlStreamParser *parser;
+	struct timeval  tv;
 
-	if (!buffer || !u_buf_ptr(buffer)) {
+	if (cl->connection->response_doc) {
+		/* the transport parsed it on the way in */
+		doc = cl->connection->response_doc;
+		cl->connection->response_doc = NULL;
+		return doc;
+	}
+	if (!buffer || u_buf_len(buffer) == 0) {
 		error("NULL response");
 		return NULL;
 	}
-	doc = ws_xml_read_memory( u_buf_ptr(buffer), u_buf_len(buffer), cl->content_encoding, 0);
+	gettimeofday(&tv, NULL);
+	if (cl->item_callback) {
+		parser = ws_xml_stream_new(cl->content_encoding,
+				cl->item_callback, cl->item_data);
+		if (parser) {
+			ws_xml_stream_push(parser, u_buf_ptr(buffer), u_buf_len(buffer));
+			doc = ws_xml_stream_finish(parser);
+		}
+	} else {
+		doc = ws_xml_read_memory( u_buf_ptr(buffer), u_buf_len(buffer), cl->content_encoding, 0);
+	}
+	cl->stats.parse_usec += wsmc_usec_since(&tv);
 	if (doc == NULL) {
 		error("could not create xmldoc from response");
 	}
@@ -1846,6 +2539,10 @@ wsmc_release_conn(WsManConnection * conn)
 		u_buf_free(conn->response);
 		conn->response = NULL;
 	}
+	if (conn->response_doc) {
+		ws_xml_destroy_doc(conn->response_doc);
+		conn->response_doc = NULL;
+	}
 	u_free(conn);
 }
 
@@ -1856,6 +2553,11 @@ wsmc_reinit_conn(WsManClient * cl)
 {
 	u_buf_clear(cl->connection->response);
 	u_buf_clear(cl->connection->request);
+	cl->connection->response_size = 0;
+	if (cl->connection->response_doc) {
+		ws_xml_destroy_doc(cl->connection->response_doc);
+		cl->connection->response_doc = NULL;
+	}
 	cl->response_code = 0;
 	cl->last_error = 0;
 	if (cl->fault_string) {
@@ -2117,6 +2819,11 @@ wsmc_release(WsManClient * cl)
 		u_free(cl->cim_ns);
 		cl->cim_ns = NULL;
 	}
+	if (cl->pull_tuning) {
+		u_free(cl->pull_tuning->resource_uri);
+		u_free(cl->pull_tuning);
+		cl->pull_tuning = NULL;
+	}
 	if (cl->authentication.crl_file != NULL) {
 		u_free(cl->authentication.crl_file);
 		cl->authentication.crl_file = NULL;
@@ -2141,6 +2848,12 @@ wsmc_release(WsManClient * cl)
           u_free(cl->proxy_data.proxy_password);
           cl->proxy_data.proxy_password = NULL;
         }
+	u_free(cl->authentication.capath);
+	u_free(cl->authentication.sslcert);
+	u_free(cl->authentication.sslkey);
+	u_free(cl->proxy_data.proxy);
+	u_free(cl->proxy_data.proxy_auth);
+	u_free(cl->user_agent);
         pthread_mutex_destroy(&cl->mutex);
 
 	wsman_transport_close_transport(cl);
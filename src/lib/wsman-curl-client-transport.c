@@ -49,6 +49,9 @@
 #ifdef ENABLE_EVENTING_SUPPORT
 #include <openssl/opensslv.h>
 #include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define X509_STORE_CTX_get0_cert(ctx) ((ctx)->cert)
+#endif
 #endif
 
 #include "u/libu.h"
@@ -61,6 +64,12 @@
 
 #define DEFAULT_TRANSFER_LEN 32000
 
+/* easy handles of released clients kept around for their connections */
+#define CURL_CACHE_IDLE_MAX 16
+
+/* most room made up front from the Content-Length of a response */
+#define MAX_RESPONSE_PREALLOC (16 * 1024 * 1024)
+
 #ifndef CURLOPT_CRLFILE
 	#define CURLOPT_CRLFILE 10169
 #endif
@@ -74,6 +83,23 @@ void wsmc_handler( WsManClient *cl, WsXmlDocH rqstDoc, void* user_data);
 
 static pthread_mutex_t curl_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Process wide connection cache. Every easy handle is listed with the
+ * endpoint and settings it was made for; a released client leaves its
+ * handle behind, warm connection included, for the next client with the
+ * same key. All handles share DNS, TLS sessions and connections.
+ * Guarded by curl_mutex.
+ */
+typedef struct {
+	char *key;
+	CURL *curl;
+	int in_use;
+} curl_cache_entry;
+
+static list_t *curl_cache = NULL;
+static CURLSH *curl_share = NULL;
+static pthread_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST];
+
 
 static long
 reauthenticate(WsManClient *cl,
@@ -194,8 +220,11 @@ convert_to_last_error(CURLcode r)
 		return WS_LASTERR_SSL_ENGINE_SETFAILED;
 	case CURLE_SSL_CERTPROBLEM:
 		return WS_LASTERR_SSL_CERTPROBLEM;
+#if LIBCURL_VERSION_NUM < 0x073E00
+	/* since 7.62.0 CURLE_SSL_CACERT is an alias of CURLE_SSL_PEER_CERTIFICATE */
 	case CURLE_SSL_CACERT:
 		return WS_LASTERR_SSL_CACERT;
+#endif
 #if LIBCURL_VERSION_NUM > 0x70C01
 	case CURLE_SSL_ENGINE_INITFAILED:
 		return WS_LASTERR_SSL_ENGINE_INITFAILED;
@@ -225,27 +254,19 @@ convert_to_last_error(CURLcode r)
 	return WS_LASTERR_OTHER_ERROR;
 }
 
-static size_t
-write_handler( void *ptr, size_t size, size_t nmemb, void *data)
-{
-	u_buf_t *buf = data;
-	size_t len;
-
-	len = size * nmemb;
-	u_buf_append(buf, ptr, len);
-	debug("write_handler: recieved %d bytes, all = %d\n", len, u_buf_len(buf));
-	return len;
-}
 
 #ifdef ENABLE_EVENTING_SUPPORT
 static int ssl_certificate_thumbprint_verify_callback(X509_STORE_CTX *ctx, void *arg)
 {
 	unsigned char *thumbprint = (unsigned char *)arg;
-	X509 *cert = ctx->cert;
+	/* the current cert is only set while verifying a chain */
+	X509 *cert = X509_STORE_CTX_get0_cert(ctx);
 	EVP_MD                                  *tempDigest;
 
 	unsigned char   tempFingerprint[EVP_MAX_MD_SIZE];
 	unsigned int      tempFingerprintLen;
+	if (cert == NULL)
+		return 0;
 	tempDigest = (EVP_MD*)EVP_sha1( );
 	if ( X509_digest(cert, tempDigest, tempFingerprint, &tempFingerprintLen ) <= 0)
 		return 0;
@@ -265,8 +286,8 @@ sslctxfun(CURL *curl, void *sslctx, void *parm)
 }
 #endif
 
-static void *
-init_curl_transport(WsManClient *cl)
+static CURL *
+create_curl_transport(WsManClient *cl)
 {
 	CURL *curl;
 	CURLcode r = CURLE_OK;
@@ -311,9 +332,16 @@ init_curl_transport(WsManClient *cl)
 		curl_err("Could notcurl_easy_setopt(curl, CURLOPT_PROXY, ...)");
 		goto DONE;
 	}
-	r = curl_easy_setopt(curl, CURLOPT_TIMEOUT, cl->transport_timeout);
+
+	/* offer every encoding curl can decode, responses are
+	 * decompressed before they reach write_handler() */
+#if LIBCURL_VERSION_NUM >= 0x071506
+	r = curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+#else
+	r = curl_easy_setopt(curl, CURLOPT_ENCODING, "");
+#endif
 	if (r != 0) {
-		curl_err("Could notcurl_easy_setopt(curl, CURLOPT_TIMEOUT, ...)");
+		curl_err("Could notcurl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ...)");
 		goto DONE;
 	}
 
@@ -416,7 +444,7 @@ init_curl_transport(WsManClient *cl)
         }
 
         iniparser_free(ini);
-	return (void *)curl;
+	return curl;
  DONE:
 	cl->last_error = convert_to_last_error(r);
 	curl_easy_cleanup(curl);
@@ -425,37 +453,293 @@ init_curl_transport(WsManClient *cl)
 #undef curl_err
 }
 
-void
-wsmc_handler( WsManClient *cl,
-		WsXmlDocH rqstDoc,
-		void* user_data)
+static void
+curl_share_lock(CURL *curl, curl_lock_data data, curl_lock_access access,
+		void *userptr)
+{
+	pthread_mutex_lock(&curl_share_locks[data]);
+}
+
+static void
+curl_share_unlock(CURL *curl, curl_lock_data data, void *userptr)
+{
+	pthread_mutex_unlock(&curl_share_locks[data]);
+}
+
+/* called with curl_mutex held */
+static CURLSH *
+get_curl_share(void)
+{
+	int i;
+
+	if (curl_share)
+		return curl_share;
+	/* the cache outlives the clients, keep curl initialized for it */
+	if (curl_global_init(CURL_GLOBAL_SSL | CURL_GLOBAL_WIN32) != CURLE_OK)
+		return NULL;
+	curl_share = curl_share_init();
+	if (curl_share == NULL) {
+		debug("Could not init curl share");
+		curl_global_cleanup();
+		return NULL;
+	}
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&curl_share_locks[i], NULL);
+	curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, curl_share_lock);
+	curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, curl_share_unlock);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	return curl_share;
+}
+
+static int
+curl_thumbprint_pinned(WsManClient *cl)
+{
+	return strlen((char *)cl->authentication.certificatethumbprint) > 0 &&
+		cl->authentication.verify_peer;
+}
+
+#define KEY_STR(s) ((s) ? (s) : "")
+
+static md5_byte_t curl_cache_salt[16];
+static pthread_once_t curl_cache_salt_once = PTHREAD_ONCE_INIT;
+
+static void
+curl_cache_salt_init(void)
+{
+	struct timeval tv;
+	pid_t pid = getpid();
+	FILE *f = fopen("/dev/urandom", "rb");
+	md5_state_t state;
+
+	if (f) {
+		size_t n = fread(curl_cache_salt, 1, sizeof(curl_cache_salt), f);
+		fclose(f);
+		if (n == sizeof(curl_cache_salt))
+			return;
+	}
+	gettimeofday(&tv, NULL);
+	md5_init(&state);
+	md5_append(&state, (const md5_byte_t *)&tv, sizeof(tv));
+	md5_append(&state, (const md5_byte_t *)&pid, sizeof(pid));
+	md5_finish(&state, curl_cache_salt);
+}
+
+/*
+ * The cache outlives the clients, so it keeps a salted digest of
+ * their credentials rather than the credentials themselves.
+ */
+static void
+curl_cache_secret(WsManClient *cl, char secret[33])
+{
+	md5_state_t state;
+	md5_byte_t digest[16];
+	int i;
+
+	pthread_once(&curl_cache_salt_once, curl_cache_salt_init);
+	md5_init(&state);
+	md5_append(&state, curl_cache_salt, sizeof(curl_cache_salt));
+	md5_append(&state, (const md5_byte_t *)KEY_STR(cl->data.user),
+			strlen(KEY_STR(cl->data.user)) + 1);
+	md5_append(&state, (const md5_byte_t *)KEY_STR(cl->data.pwd),
+			strlen(KEY_STR(cl->data.pwd)) + 1);
+	md5_append(&state, (const md5_byte_t *)KEY_STR(cl->proxy_data.proxy_auth),
+			strlen(KEY_STR(cl->proxy_data.proxy_auth)) + 1);
+	md5_finish(&state, digest);
+	for (i = 0; i < 16; i++)
+		sprintf(secret + 2 * i, "%02x", digest[i]);
+}
+
+/*
+ * everything init_curl_transport() puts into a handle; the timeout is
+ * set again for every request
+ */
+static char *
+curl_cache_key(WsManClient *cl)
+{
+	char thumbprint[41];
+	char secret[33];
+	int i;
+
+	for (i = 0; i < 20; i++)
+		sprintf(thumbprint + 2 * i, "%02x",
+				cl->authentication.certificatethumbprint[i]);
+	curl_cache_secret(cl, secret);
+	return u_strdup_printf("%s://%s:%u|%s|%s|%u|%u|%s|%u|%s|%s|%s|%s|%s|%s",
+			KEY_STR(cl->data.scheme), KEY_STR(cl->data.hostname),
+			cl->data.port, secret,
+			KEY_STR(wsmc_get_conffile(cl)),
+			cl->authentication.verify_peer, cl->authentication.verify_host,
+			KEY_STR(cl->proxy_data.proxy), cl->authentication.crl_check,
+			KEY_STR(cl->authentication.crl_file),
+			KEY_STR(cl->authentication.capath),
+			KEY_STR(cl->authentication.cainfo), thumbprint,
+			KEY_STR(cl->authentication.sslkey),
+			KEY_STR(cl->authentication.sslcert));
+}
+
+#undef KEY_STR
+
+static void *
+init_curl_transport(WsManClient *cl)
+{
+	char *key = curl_cache_key(cl);
+	curl_cache_entry *entry = NULL;
+	CURLSH *share = NULL;
+	CURL *curl = NULL;
+	lnode_t *node;
+
+	pthread_mutex_lock(&curl_mutex);
+	if (curl_cache) {
+		for (node = list_first(curl_cache); node;
+				node = list_next(curl_cache, node)) {
+			entry = (curl_cache_entry *)lnode_get(node);
+			if (!entry->in_use && strcmp(entry->key, key) == 0) {
+				entry->in_use = 1;
+				curl = entry->curl;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&curl_mutex);
+	if (curl) {
+		debug("reusing cached curl handle for %s", cl->data.endpoint);
+		u_free(key);
+#if defined(ENABLE_EVENTING_SUPPORT) && !defined(NO_SSL_CALLBACK)
+		if (curl_thumbprint_pinned(cl))
+			curl_easy_setopt(curl, CURLOPT_SSL_CTX_DATA,
+					(void *)cl->authentication.certificatethumbprint);
+#endif
+		return curl;
+	}
+
+	curl = create_curl_transport(cl);
+	if (curl == NULL) {
+		u_free(key);
+		return NULL;
+	}
+	entry = u_zalloc(sizeof(*entry));
+	entry->key = key;
+	entry->curl = curl;
+	entry->in_use = 1;
+	pthread_mutex_lock(&curl_mutex);
+	if (curl_cache == NULL)
+		curl_cache = list_create(LISTCOUNT_T_MAX);
+	list_append(curl_cache, lnode_create(entry));
+	/*
+	 * A resumed TLS session or a shared connection skips the
+	 * thumbprint check, so pinned handles keep to themselves.
+	 */
+	if (!curl_thumbprint_pinned(cl))
+		share = get_curl_share();
+	if (share)
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	pthread_mutex_unlock(&curl_mutex);
+	return curl;
+}
+
+static void
+curl_cache_entry_free(curl_cache_entry *entry)
 {
+	curl_easy_cleanup(entry->curl);
+	u_free(entry->key);
+	u_free(entry);
+}
+
+/*
+ * State of one request while curl works on it, shared by the
+ * synchronous handler and the asynchronous engine.
+ */
+typedef struct {
+	WsManClient *cl;
+	struct curl_slist *headers;
+	char *usag;
+	char *upwd;
+	char *user;
+	char *pass;
+	char *buf;
+	u_buf_t *response;
+	WsXmlStreamParser *stream;
+	int no_transport;
+	wsman_async_callback_t callback;
+	void *data;
+	lnode_t *node;
+} curl_request;
+
 #define curl_err(str)  debug("Error = %d (%s); %s", \
 		r, curl_easy_strerror(r), str);
-	WsManConnection *con = cl->connection;
+
+/*
+ * Responses that make it to the caller go straight into the parser
+ * when the client wants items as they arrive.
+ */
+static size_t
+write_handler( void *ptr, size_t size, size_t nmemb, void *data)
+{
+	curl_request *req = data;
+	WsManClient *cl = req->cl;
+	u_buf_t *buf = req->response;
+	long http_code = 0;
+	size_t len;
+
+	len = size * nmemb;
+	cl->connection->response_size += len;
+	if (cl->item_callback && req->stream == NULL && u_buf_len(buf) == 0) {
+		curl_easy_getinfo((CURL *)cl->transport, CURLINFO_RESPONSE_CODE, &http_code);
+		if (http_code == 200 || http_code == 400 || http_code == 500)
+			req->stream = ws_xml_stream_new(cl->content_encoding,
+					cl->item_callback, cl->item_data);
+	}
+	if (req->stream) {
+		if (ws_xml_stream_push(req->stream, ptr, len))
+			return 0;
+		debug("write_handler: parsed %d bytes\n", len);
+		return len;
+	}
+	if (u_buf_len(buf) == 0) {
+		/* make room for the whole body once */
+#if LIBCURL_VERSION_NUM >= 0x073700
+		curl_off_t content_length = 0;
+		curl_easy_getinfo((CURL *)cl->transport,
+				CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+#else
+		double content_length = 0;
+		curl_easy_getinfo((CURL *)cl->transport,
+				CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_length);
+#endif
+		if (content_length > (long)len &&
+				content_length < MAX_RESPONSE_PREALLOC)
+			u_buf_reserve(buf, (size_t)content_length);
+	}
+	u_buf_append(buf, ptr, len);
+	debug("write_handler: recieved %d bytes, all = %d\n", len, u_buf_len(buf));
+	return len;
+}
+
+static CURLcode
+request_setup(WsManClient *cl, WsXmlDocH rqstDoc, void *user_data,
+		curl_request *req)
+{
 	CURL *curl = NULL;
 	CURLcode r;
-	char *upwd = NULL;
-	char *usag = NULL;
-	struct curl_slist *headers=NULL;
-	char *buf = NULL;
+	char *post = NULL;
 	int len;
-	char *soapact_header = NULL;
-	long http_code;
-	long auth_avail = 0;
-	char *_user = NULL, *_pass = NULL;
-	u_buf_t *response = NULL;
-	//char *soapaction;
 	char *tmp_str = NULL;
 
+	req->cl = cl;
 	if (!cl->initialized && wsmc_transport_init(cl, NULL)) {
 		cl->last_error = WS_LASTERR_FAILED_INIT;
-		return;
+		req->no_transport = 1;
+		return CURLE_FAILED_INIT;
 	}
 	if (cl->transport == NULL) {
 		cl->transport = init_curl_transport(cl);
                 if (cl->transport == NULL) {
-                        return;
+			req->no_transport = 1;
+                        return CURLE_FAILED_INIT;
                 }
 	}
 	curl = (CURL *)cl->transport;
@@ -464,227 +748,462 @@ wsmc_handler( WsManClient *cl,
 	if (r != CURLE_OK) {
 		cl->fault_string = u_strdup(curl_easy_strerror(r));
 		curl_err("Could not curl_easy_setopt(curl, CURLOPT_URL, ...)");
-		goto DONE;
+		return r;
+	}
+
+	/* a cached handle keeps the timeout of whoever used it last */
+	r = curl_easy_setopt(curl, CURLOPT_TIMEOUT, cl->transport_timeout);
+	if (r != CURLE_OK) {
+		cl->fault_string = u_strdup(curl_easy_strerror(r));
+		curl_err("Could not curl_easy_setopt(curl, CURLOPT_TIMEOUT, ...)");
+		return r;
 	}
 
 	r = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_handler);
 	if (r != CURLE_OK) {
 		cl->fault_string = u_strdup(curl_easy_strerror(r));
 		curl_err("Could not curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ..)");
-		goto DONE;
+		return r;
 	}
-	u_buf_create(&response);
-	r = curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+	u_buf_create(&req->response);
+	r = curl_easy_setopt(curl, CURLOPT_WRITEDATA, req);
 	if (r != CURLE_OK) {
 		cl->fault_string = u_strdup(curl_easy_strerror(r));
 		curl_err("Could not curl_easy_setopt(curl, CURLOPT_WRITEDATA, ..)");
-		goto DONE;
+		return r;
 	}
 	char content_type[64];
 	snprintf(content_type, 64, "Content-Type: application/soap+xml;charset=%s", cl->content_encoding);
-	headers = curl_slist_append(headers, content_type);
+	req->headers = curl_slist_append(req->headers, content_type);
 	tmp_str = wsman_transport_get_agent(cl);
-	usag = malloc(12 + strlen(tmp_str) + 1);
-	if (usag == NULL) {
+	req->usag = malloc(12 + strlen(tmp_str) + 1);
+	if (req->usag == NULL) {
 		r = CURLE_OUT_OF_MEMORY;
+		free(tmp_str);
 		cl->fault_string = u_strdup("Could not malloc memory");
 		curl_err("Could not malloc memory");
-		goto DONE;
+		return r;
 	}
 
-	sprintf(usag, "User-Agent: %s", tmp_str);
+	sprintf(req->usag, "User-Agent: %s", tmp_str);
 	free(tmp_str);
-	headers = curl_slist_append(headers, usag);
-
-#if 0
-	soapaction = ws_xml_get_xpath_value(rqstDoc, "/s:Envelope/s:Header/wsa:Action");
-	if (soapaction) {
-		soapact_header = malloc(12 + strlen(soapaction) + 1);
-		if (soapact_header) {
-			sprintf(soapact_header, "SOAPAction: %s", soapaction);
-			headers = curl_slist_append(headers, soapact_header);
-		}
-		u_free(soapaction);
-	}
-#endif
+	req->headers = curl_slist_append(req->headers, req->usag);
 
-	r = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	r = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req->headers);
 	if (r != CURLE_OK) {
 		cl->fault_string = u_strdup(curl_easy_strerror(r));
 		curl_err("Could not curl_easy_setopt(curl, CURLOPT_HTTPHEADER, ..)");
-		goto DONE;
+		return r;
 	}
 
-	ws_xml_dump_memory_enc(rqstDoc, &buf, &len, cl->content_encoding);
-#if 0
-	int count = 0;
-	while(count < len) {
-		printf("%c",buf[count++]);
+	if (rqstDoc) {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		ws_xml_dump_memory_enc(rqstDoc, &req->buf, &len, cl->content_encoding);
+		cl->stats.serialize_usec += wsmc_usec_since(&tv);
+		post = req->buf;
+	} else {
+		/* already serialized by the caller */
+		u_buf_t *request = (u_buf_t *)user_data;
+		post = u_buf_ptr(request);
+		len = u_buf_len(request);
 	}
-#endif
 	debug("*****set post buf len = %d******",len);
-	r = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, buf);
+	r = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
 	if (r != CURLE_OK) {
 		cl->fault_string = u_strdup(curl_easy_strerror(r));
 		curl_err("Could not curl_easy_setopt(curl, CURLOPT_POSTFIELDS, ..)");
-		goto DONE;
+		return r;
 	}
 	r = curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
 	if (r != CURLE_OK) {
 		cl->fault_string = u_strdup(curl_easy_strerror(r));
 		curl_err("Could not curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, ..)");
-		goto DONE;
+		return r;
 	}
+	return CURLE_OK;
+}
 
-	int iDone = 0;
-	while (1) {
-		u_free(_user);
-		u_free(_pass);
-		_user = wsmc_get_user(cl);
-		_pass = wsmc_get_password(cl);
-		if (_user && _pass && cl->data.auth_set) {
-			r = curl_easy_setopt(curl, CURLOPT_HTTPAUTH, cl->data.auth_set);
-			if (r != CURLE_OK) {
-				cl->fault_string = u_strdup(curl_easy_strerror(r));
-				curl_err("curl_easy_setopt(CURLOPT_HTTPAUTH) failed");
-				goto DONE;
-			}
-			u_free(upwd);
-			upwd = u_strdup_printf(  "%s:%s", _user ,  _pass);
-			if (!upwd) {
-				r = CURLE_OUT_OF_MEMORY;
-				cl->fault_string = u_strdup("Could not malloc memory");
-				curl_err("Could not malloc memory");
-				goto DONE;
-			}
-			r = curl_easy_setopt(curl, CURLOPT_USERPWD, upwd);
-			if (r != CURLE_OK) {
-				cl->fault_string = u_strdup(curl_easy_strerror(r));
-				curl_err("curl_easy_setopt(curl, CURLOPT_USERPWD, ..) failed");
-				goto DONE;
-			}
-		}
-
-		if (wsman_debug_level_debugged(DEBUG_LEVEL_MESSAGE)) {
-			curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-		}
+/* credentials for the next attempt */
+static CURLcode
+request_credentials(WsManClient *cl, curl_request *req)
+{
+	CURL *curl = (CURL *)cl->transport;
+	CURLcode r = CURLE_OK;
 
-		r = curl_easy_perform(curl);
+	u_free(req->user);
+	u_free(req->pass);
+	req->user = wsmc_get_user(cl);
+	req->pass = wsmc_get_password(cl);
+	if (req->user && req->pass && cl->data.auth_set) {
+		r = curl_easy_setopt(curl, CURLOPT_HTTPAUTH, cl->data.auth_set);
 		if (r != CURLE_OK) {
 			cl->fault_string = u_strdup(curl_easy_strerror(r));
-			curl_err("curl_easy_perform failed");
-			goto DONE;
+			curl_err("curl_easy_setopt(CURLOPT_HTTPAUTH) failed");
+			return r;
 		}
-
-		r = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+		u_free(req->upwd);
+		req->upwd = u_strdup_printf(  "%s:%s", req->user ,  req->pass);
+		if (!req->upwd) {
+			r = CURLE_OUT_OF_MEMORY;
+			cl->fault_string = u_strdup("Could not malloc memory");
+			curl_err("Could not malloc memory");
+			return r;
+		}
+		r = curl_easy_setopt(curl, CURLOPT_USERPWD, req->upwd);
 		if (r != CURLE_OK) {
 			cl->fault_string = u_strdup(curl_easy_strerror(r));
-			curl_err("curl_easy_getinfo(CURLINFO_RESPONSE_CODE) failed");
-			goto DONE;
+			curl_err("curl_easy_setopt(curl, CURLOPT_USERPWD, ..) failed");
+			return r;
 		}
+	}
 
-		switch (http_code) 
-		{
-			case 200:
-			case 400:
-			case 500:
-				// The resource was successfully retrieved or WSMan server 
-				// returned a HTTP status code. You can use WinHttpReadData to 
-				// read the contents of the server's response.
-				iDone = 1;
-				break;
-			case 401:
-				// The server requires authentication.
-				break;
-			default:
-				// The status code does not indicate success.
-				r = WS_LASTERR_OTHER_ERROR;
-				iDone = 1;
-				break;
-		}
+	if (wsman_debug_level_debugged(DEBUG_LEVEL_MESSAGE)) {
+		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
+	}
+	return r;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x073D00
+#define curl_usec(curl, what, usec) do { \
+		curl_off_t t = 0; \
+		curl_easy_getinfo(curl, CURLINFO_##what##_TIME_T, &t); \
+		usec = t; \
+	} while (0)
+#else
+#define curl_usec(curl, what, usec) do { \
+		double t = 0; \
+		curl_easy_getinfo(curl, CURLINFO_##what##_TIME, &t); \
+		usec = t * 1000000; \
+	} while (0)
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+#define curl_bytes(curl, what, bytes) do { \
+		curl_off_t n = 0; \
+		curl_easy_getinfo(curl, CURLINFO_SIZE_##what##_T, &n); \
+		bytes = n; \
+	} while (0)
+#else
+#define curl_bytes(curl, what, bytes) do { \
+		double n = 0; \
+		curl_easy_getinfo(curl, CURLINFO_SIZE_##what, &n); \
+		bytes = n; \
+	} while (0)
+#endif
+
+/*
+ * Add the last transfer to the client's statistics, every attempt
+ * of a request counts
+ */
+static void
+request_stats(WsManClient *cl)
+{
+	CURL *curl = (CURL *)cl->transport;
+	unsigned long long dns, conn, tls, pre, start, total, sent;
+
+	curl_usec(curl, NAMELOOKUP, dns);
+	curl_usec(curl, CONNECT, conn);
+	curl_usec(curl, APPCONNECT, tls);
+	curl_usec(curl, PRETRANSFER, pre);
+	curl_usec(curl, STARTTRANSFER, start);
+	curl_usec(curl, TOTAL, total);
+	/* the timers run from the start, 0 for phases that did not happen */
+	cl->stats.dns_usec += dns;
+	if (conn > dns)
+		cl->stats.connect_usec += conn - dns;
+	if (tls > conn)
+		cl->stats.tls_usec += tls - conn;
+	if (start > pre)
+		cl->stats.first_byte_usec += start - pre;
+	if (total > start)
+		cl->stats.transfer_usec += total - start;
+	cl->stats.total_usec += total;
+	curl_bytes(curl, UPLOAD, sent);
+	cl->stats.request_bytes += sent;
+	cl->stats.response_bytes += cl->connection->response_size;
+}
+
+/*
+ * Look at the outcome of a transfer. Returns 1 if the request has to
+ * go out again with new credentials, 0 when it is done with *rp set.
+ */
+static int
+request_check(WsManClient *cl, curl_request *req, CURLcode *rp)
+{
+	CURL *curl = (CURL *)cl->transport;
+	WsManConnection *con = cl->connection;
+	CURLcode r = *rp;
+	long http_code;
+	long auth_avail = 0;
+
+	request_stats(cl);
+	if (r != CURLE_OK) {
+		cl->fault_string = u_strdup(curl_easy_strerror(r));
+		curl_err("curl_easy_perform failed");
+		return 0;
+	}
 
-		if(iDone == 1) {
+	r = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	if (r != CURLE_OK) {
+		cl->fault_string = u_strdup(curl_easy_strerror(r));
+		curl_err("curl_easy_getinfo(CURLINFO_RESPONSE_CODE) failed");
+		*rp = r;
+		return 0;
+	}
+
+	switch (http_code)
+	{
+		case 200:
+		case 400:
+		case 500:
+			// The resource was successfully retrieved or WSMan server
+			// returned a HTTP status code.
+			if (req->stream) {
+				con->response_doc = ws_xml_stream_finish(req->stream);
+				req->stream = NULL;
+				return 0;
+			}
+			u_buf_adopt(con->response, req->response);
+			return 0;
+		case 401:
+			// The server requires authentication.
 			break;
-		}
+		default:
+			// The status code does not indicate success.
+			*rp = WS_LASTERR_OTHER_ERROR;
+			u_buf_adopt(con->response, req->response);
+			return 0;
+	}
 
-		/* we are here because of authentication required */
-		r = curl_easy_getinfo(curl, CURLINFO_HTTPAUTH_AVAIL, &auth_avail);
-		if (r != CURLE_OK) {
-			cl->fault_string = u_strdup(curl_easy_strerror(r));
-			curl_err("curl_easy_getinfo(CURLINFO_HTTPAUTH_AVAIL) failed");
-			goto DONE;
-		}
+	/* we are here because of authentication required */
+	r = curl_easy_getinfo(curl, CURLINFO_HTTPAUTH_AVAIL, &auth_avail);
+	if (r != CURLE_OK) {
+		cl->fault_string = u_strdup(curl_easy_strerror(r));
+		curl_err("curl_easy_getinfo(CURLINFO_HTTPAUTH_AVAIL) failed");
+		*rp = r;
+		return 0;
+	}
 
-		cl->data.auth_set = reauthenticate(cl, cl->data.auth_set, auth_avail,
-                        &cl->data.user, &cl->data.pwd);
-                u_buf_clear(response);
-                if (cl->data.auth_set == 0) {
-                    /* FIXME: user wants to cancel authentication */
+	cl->data.auth_set = reauthenticate(cl, cl->data.auth_set, auth_avail,
+                &cl->data.user, &cl->data.pwd);
+        u_buf_clear(req->response);
+	con->response_size = 0;
+        if (cl->data.auth_set == 0) {
+            /* FIXME: user wants to cancel authentication */
 #if LIBCURL_VERSION_NUM >= 0x70D01
-                    r = CURLE_LOGIN_DENIED;
+            r = CURLE_LOGIN_DENIED;
 #else
-					/* Map the login failure error to CURLE_LOGIN_DENIED (67) so that we
-					 * get the same error code in case of login failure
-					 */
-					r = 67;
+		/* Map the login failure error to CURLE_LOGIN_DENIED (67) so that we
+		 * get the same error code in case of login failure
+		 */
+		r = 67;
 #endif
-                    cl->fault_string = u_strdup(curl_easy_strerror(r));
-                    curl_err("user/password wrong or empty.");
-		    break;
-                }
+            cl->fault_string = u_strdup(curl_easy_strerror(r));
+            curl_err("user/password wrong or empty.");
+	    *rp = r;
+	    return 0;
         }
-#if 0
-	unsigned char *mbbuf = NULL;
-	iconv_t cd;
-	if(strcmp(cl->content_encoding, "UTF-8")) {
-                cd = iconv_open("UTF-8", cl->content_encoding);
-                if(cd == -1) {
-			cl->last_error = WS_LASTERR_BAD_CONTENT_ENCODING;
-			goto DONE2;
-                }
-                mbbuf = u_zalloc(u_buf_len(response));
-                size_t outbuf_len = u_buf_len(response);
-                size_t inbuf_len = outbuf_len;
-                char *inbuf = u_buf_ptr(response);
-                char *outbuf = mbbuf;
-                size_t coverted = iconv(cd, &inbuf, &inbuf_len, &outbuf, &outbuf_len);
-		  iconv_close(cd);
-                if( coverted == -1) {
-			cl->last_error = WS_LASTERR_BAD_CONTENT_ENCODING;
-			goto DONE2;
-                }
-                u_buf_append(con->response, mbbuf, u_buf_len(response) - inbuf_len);
-        }
-	u_free(mbbuf);
-#endif
-	u_buf_append(con->response, u_buf_ptr(response), u_buf_len(response));
-DONE:
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-	cl->response_code = http_code;
-	cl->last_error = convert_to_last_error(r);
+	return 1;
+}
+
+static void
+request_finish(WsManClient *cl, curl_request *req, CURLcode r)
+{
+	long http_code;
+
+	if (!req->no_transport) {
+		curl_easy_getinfo((CURL *)cl->transport, CURLINFO_RESPONSE_CODE, &http_code);
+		cl->response_code = http_code;
+		cl->last_error = convert_to_last_error(r);
+		cl->stats.requests++;
+	}
 
 	debug("curl error code: %d.", r);
 	debug("cl->response_code: %d.", cl->response_code);
 	debug("cl->last_error code: %d.", cl->last_error);
 
-	curl_slist_free_all(headers);
-	u_buf_free(response);
-	u_free(soapact_header);
-	u_free(usag);
-	u_free(upwd);
-	u_free(_pass);
-	u_free(_user);
+	if (req->stream)
+		ws_xml_destroy_doc(ws_xml_stream_finish(req->stream));
+	curl_slist_free_all(req->headers);
+	u_buf_free(req->response);
+	free(req->usag);
+	u_free(req->upwd);
+	u_free(req->pass);
+	u_free(req->user);
 #ifdef _WIN32
-	ws_xml_free_memory(buf);
+	ws_xml_free_memory(req->buf);
 #else
-	u_free(buf);
+	u_free(req->buf);
 #endif
+}
 
-	return;
-#undef curl_err
+void
+wsmc_handler( WsManClient *cl,
+		WsXmlDocH rqstDoc,
+		void* user_data)
+{
+	curl_request req;
+	CURLcode r;
+
+	memset(&req, 0, sizeof(req));
+	r = request_setup(cl, rqstDoc, user_data, &req);
+	while (r == CURLE_OK) {
+		r = request_credentials(cl, &req);
+		if (r != CURLE_OK)
+			break;
+		r = curl_easy_perform((CURL *)cl->transport);
+		if (!request_check(cl, &req, &r))
+			break;
+	}
+	request_finish(cl, &req, r);
+}
+
+
+/*
+ * Asynchronous requests: every request is driven by the client's easy
+ * handle, all of them by one curl multi handle. A client has one
+ * request in flight at a time, so many hosts means many clients.
+ */
+struct _WsManAsync {
+	CURLM *multi;
+	list_t *requests;
+};
+
+WsManAsync *
+wsman_async_new(void)
+{
+	WsManAsync *async = u_zalloc(sizeof(*async));
+	pthread_mutex_lock(&curl_mutex);
+	curl_global_init(CURL_GLOBAL_SSL | CURL_GLOBAL_WIN32);
+	pthread_mutex_unlock(&curl_mutex);
+	async->multi = curl_multi_init();
+	if (async->multi == NULL) {
+		error("Could not init multi curl");
+		u_free(async);
+		return NULL;
+	}
+	async->requests = list_create(LISTCOUNT_T_MAX);
+	return async;
+}
+
+static void
+async_complete(WsManAsync *async, curl_request *req, CURLcode r)
+{
+	WsManClient *cl = req->cl;
+
+	curl_easy_setopt((CURL *)cl->transport, CURLOPT_PRIVATE, NULL);
+	request_finish(cl, req, r);
+	if (cl->last_error != WS_LASTERR_OK)
+		warning("Couldn't send request to client: %s\n", cl->fault_string);
+	list_delete(async->requests, req->node);
+	lnode_destroy(req->node);
+	wsmc_unlock(cl);
+	if (req->callback)
+		req->callback(cl, req->data);
+	u_free(req);
+}
+
+int
+wsman_async_send_request(WsManAsync *async, WsManClient *cl, WsXmlDocH request,
+		wsman_async_callback_t callback, void *data)
+{
+	curl_request *req;
+	CURLcode r;
 
+	if (wsmc_lock(cl) != 0 ) {
+		error("Client busy");
+		return 1;
+	}
+	wsmc_reinit_conn(cl);
+	req = u_zalloc(sizeof(*req));
+	req->callback = callback;
+	req->data = data;
+	r = request_setup(cl, request, NULL, req);
+	if (r == CURLE_OK)
+		r = request_credentials(cl, req);
+	if (r == CURLE_OK)
+		r = curl_easy_setopt((CURL *)cl->transport, CURLOPT_PRIVATE, req);
+	if (r == CURLE_OK &&
+			curl_multi_add_handle(async->multi, (CURL *)cl->transport) != CURLM_OK)
+		r = CURLE_FAILED_INIT;
+	if (r != CURLE_OK) {
+		request_finish(cl, req, r);
+		warning("Couldn't send request to client: %s\n", cl->fault_string);
+		u_free(req);
+		wsmc_unlock(cl);
+		return 1;
+	}
+	req->node = lnode_create(req);
+	list_append(async->requests, req->node);
+	return 0;
+}
+
+int
+wsman_async_run(WsManAsync *async, int timeout)
+{
+	CURLMsg *msg;
+	CURL *curl;
+	CURLcode r;
+	curl_request *req;
+	int running, left, numfds;
+
+	curl_multi_perform(async->multi, &running);
+	if (running && timeout > 0) {
+		curl_multi_wait(async->multi, NULL, 0, timeout, &numfds);
+		curl_multi_perform(async->multi, &running);
+	}
+	while ((msg = curl_multi_info_read(async->multi, &left)) != NULL) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		curl = msg->easy_handle;
+		r = msg->data.result;
+		req = NULL;
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&req);
+		curl_multi_remove_handle(async->multi, curl);
+		if (req == NULL)
+			continue;
+		if (request_check(req->cl, req, &r)) {
+			r = request_credentials(req->cl, req);
+			if (r == CURLE_OK &&
+					curl_multi_add_handle(async->multi, curl) == CURLM_OK)
+				continue;
+		}
+		async_complete(async, req, r);
+	}
+	return list_count(async->requests);
 }
 
+int
+wsman_async_pending(WsManAsync *async)
+{
+	return list_count(async->requests);
+}
+
+void
+wsman_async_destroy(WsManAsync *async)
+{
+	curl_request *req;
+
+	if (async == NULL)
+		return;
+	/* requests still in flight complete as aborted */
+	while (!list_isempty(async->requests)) {
+		req = (curl_request *)lnode_get(list_first(async->requests));
+		curl_multi_remove_handle(async->multi, (CURL *)req->cl->transport);
+		u_free(req->cl->fault_string);
+		req->cl->fault_string = u_strdup("request aborted");
+		async_complete(async, req, CURLE_ABORTED_BY_CALLBACK);
+	}
+	list_destroy(async->requests);
+	curl_multi_cleanup(async->multi);
+	u_free(async);
+	pthread_mutex_lock(&curl_mutex);
+	curl_global_cleanup();
+	pthread_mutex_unlock(&curl_mutex);
+}
+#undef curl_err
+
 
 int wsmc_transport_init(WsManClient *cl, void *arg)
 {
@@ -723,10 +1242,84 @@ void wsmc_transport_fini(WsManClient *cl)
 void
 wsman_transport_close_transport(WsManClient *cl)
 {
-	if (cl->transport != NULL) {
-		curl_easy_cleanup((CURL *)cl->transport);
-	}
+	CURL *curl = (CURL *)cl->transport;
+	curl_cache_entry *entry, *evict = NULL;
+	lnode_t *node, *found = NULL;
+	int idle = 0;
+
+	if (curl == NULL)
+		return;
 	cl->transport = NULL;
+	/* nothing may point into the client or its last request */
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+
+	pthread_mutex_lock(&curl_mutex);
+	for (node = curl_cache ? list_first(curl_cache) : NULL; node;
+			node = list_next(curl_cache, node)) {
+		entry = (curl_cache_entry *)lnode_get(node);
+		if (entry->curl == curl)
+			found = node;
+		else if (!entry->in_use)
+			idle++;
+	}
+	if (found) {
+		/* most recently used at the tail */
+		entry = (curl_cache_entry *)lnode_get(found);
+		entry->in_use = 0;
+		list_delete(curl_cache, found);
+		list_append(curl_cache, found);
+		if (idle >= CURL_CACHE_IDLE_MAX) {
+			for (node = list_first(curl_cache); node;
+					node = list_next(curl_cache, node)) {
+				evict = (curl_cache_entry *)lnode_get(node);
+				if (!evict->in_use)
+					break;
+			}
+			list_delete(curl_cache, node);
+			lnode_destroy(node);
+		}
+	}
+	pthread_mutex_unlock(&curl_mutex);
+	if (found == NULL)
+		curl_easy_cleanup(curl);
+	if (evict)
+		curl_cache_entry_free(evict);
+}
+
+void
+wsman_transport_flush_connections(void)
+{
+	curl_cache_entry *entry;
+	lnode_t *node, *next;
+
+	pthread_mutex_lock(&curl_mutex);
+	if (curl_cache == NULL) {
+		pthread_mutex_unlock(&curl_mutex);
+		return;
+	}
+	for (node = list_first(curl_cache); node; node = next) {
+		next = list_next(curl_cache, node);
+		entry = (curl_cache_entry *)lnode_get(node);
+		if (entry->in_use)
+			continue;
+		list_delete(curl_cache, node);
+		lnode_destroy(node);
+		curl_cache_entry_free(entry);
+	}
+	/* the share goes once no client uses it any more */
+	if (list_isempty(curl_cache)) {
+		list_destroy(curl_cache);
+		curl_cache = NULL;
+		if (curl_share) {
+			curl_share_cleanup(curl_share);
+			curl_share = NULL;
+			curl_global_cleanup();
+		}
+	}
+	pthread_mutex_unlock(&curl_mutex);
 }
 
 
@@ -151,13 +151,12 @@ generate_notunderstood_fault(op_t * op,
 
 static int check_for_duplicate_selectors(op_t * op)
 {
-	WsXmlNodeH header, node, selector;
+	WsXmlNodeH node, selector;
 	int retval = 0, index = 0;
 	hash_t *h;
 
-	header = wsman_get_soap_header_element( op->in_doc, NULL, NULL);
-	if ((node = ws_xml_get_child(header, 0, XML_NS_WS_MAN,
-			      WSM_SELECTOR_SET)) == NULL) {
+	if ((node = wsman_get_header(op->in_doc,
+				WSMAN_HEADER_SELECTOR_SET)) == NULL) {
 		// No selectors
 		return 0;
 	}
@@ -205,8 +204,7 @@ static int validate_control_headers(op_t * op)
 	char *mu = NULL;
 
 	header = wsman_get_soap_header_element( op->in_doc,  NULL, NULL);
-	maxsize = ws_xml_get_child(header, 0, XML_NS_WS_MAN,
-			     WSM_MAX_ENVELOPE_SIZE);
+	maxsize = wsman_get_header(op->in_doc, WSMAN_HEADER_MAX_ENVELOPE_SIZE);
         /* DSP0226, v1.2
          * R13.1-3: A service should not send a SOAP Envelope with more than 32,767 octets unless the
          * client has specified a wsman:MaxEnvelopeSize header that overrides this limit
@@ -230,8 +228,7 @@ static int validate_control_headers(op_t * op)
 		}
 		op->maxsize = size;
 	}
-	child = ws_xml_get_child(header, 0,
-				 XML_NS_WS_MAN, WSM_OPERATION_TIMEOUT);
+	child = wsman_get_header(op->in_doc, WSMAN_HEADER_OPERATION_TIMEOUT);
 	if (child != NULL) {
 		char *text = ws_xml_get_node_text(child);
 		char *nsUri = ws_xml_get_node_name_ns(header);
@@ -264,18 +261,28 @@ static WsXmlNodeH
 validate_mustunderstand_headers(op_t * op)
 {
 	WsXmlNodeH child = NULL, header = NULL;
+	WsmanHeaderIndex *index = wsman_get_header_index(op->in_doc);
 	int i;
 	char *nsUri;
 
-	header = wsman_get_soap_header_element(op->in_doc, NULL, NULL);
-	nsUri = ws_xml_get_node_name_ns(header);
-
-	for (i = 0;(child = ws_xml_get_child(header, i, NULL, NULL)) != NULL; i++) {
-		if (ws_xml_find_attr_bool(child, nsUri, SOAP_MUST_UNDERSTAND)) {
-			if (!is_mu_header(child)) {
+	if (index) {
+		for (i = 0; i < index->mustUnderstandCount; i++) {
+			if (!is_mu_header(index->mustUnderstand[i])) {
+				child = index->mustUnderstand[i];
 				break;
 			}
 		}
+	} else {
+		header = wsman_get_soap_header_element(op->in_doc, NULL, NULL);
+		nsUri = ws_xml_get_node_name_ns(header);
+
+		for (i = 0;(child = ws_xml_get_child(header, i, NULL, NULL)) != NULL; i++) {
+			if (ws_xml_find_attr_bool(child, nsUri, SOAP_MUST_UNDERSTAND)) {
+				if (!is_mu_header(child)) {
+					break;
+				}
+			}
+		}
 	}
 
 	if (child != NULL) {
@@ -311,7 +318,6 @@ check_unsupported_features(op_t * op)
 {
 	WsXmlNodeH enumurate;
 	WsXmlNodeH subscribe;
-	WsXmlNodeH header = wsman_get_soap_header_element( op->in_doc, NULL, NULL);
 	WsXmlNodeH body = ws_xml_get_soap_body(op->in_doc);
 	int retVal = 0;
 	WsXmlNodeH n, m, k;
@@ -319,7 +325,7 @@ check_unsupported_features(op_t * op)
 	WsXmlAttrH attr = NULL;
 
 
-	n = ws_xml_get_child(header, 0, XML_NS_ADDRESSING, WSA_FAULT_TO);
+	n = wsman_get_header(op->in_doc, WSMAN_HEADER_FAULT_TO);
 	if (n != NULL) {
 		debug("wsa:FaultTo is not supported");
 		retVal = 1;
@@ -327,7 +333,7 @@ check_unsupported_features(op_t * op)
 					WSMAN_DETAIL_ADDRESSING_MODE);
 		goto DONE;
 	}
-	n = ws_xml_get_child(header, 0, XML_NS_WS_MAN, WSM_LOCALE);
+	n = wsman_get_header(op->in_doc, WSMAN_HEADER_LOCALE);
 	if (n != NULL) {
 		debug("Locale header found");
 		mu = ws_xml_find_attr_value(n, XML_NS_SOAP_1_2,
@@ -341,8 +347,7 @@ check_unsupported_features(op_t * op)
 		}
 	}
 #if 0
-	n = ws_xml_get_child(header, 0, XML_NS_WS_MAN,
-			     WSM_FRAGMENT_TRANSFER);
+	n = wsman_get_header(op->in_doc, WSMAN_HEADER_FRAGMENT_TRANSFER);
 	if (n != NULL) {
 		debug("FragmentTransfer header found");
 		mu = ws_xml_find_attr_value(n, XML_NS_SOAP_1_2,
@@ -393,7 +398,7 @@ check_unsupported_features(op_t * op)
 			goto DONE;
 			}
 	}
-	k = ws_xml_get_child(header, 0, XML_NS_WS_MAN, WSM_RESOURCE_URI);
+	k = wsman_get_header(op->in_doc, WSMAN_HEADER_RESOURCE_URI);
 	if (k)
 		resource_uri = ws_xml_get_node_text(k);
 	if (resource_uri &&
@@ -435,12 +440,6 @@ check_unsupported_features(op_t * op)
 				goto DONE;
 			}
 		}
-		m = ws_xml_get_child(n, 0, XML_NS_WS_MAN, WSM_CONNECTIONRETRY);
-		if(m) {
-			retVal = 1;
-			generate_op_fault(op, WSMAN_UNSUPPORTED_FEATURE, WSMAN_DETAIL_DELIVERY_RETRIES);
-			goto DONE;
-		}
 	}
 DONE:
 	return retVal;
@@ -455,13 +454,12 @@ DONE:
  */
 static int wsman_is_duplicate_message_id(op_t * op)
 {
-	WsXmlNodeH header = wsman_get_soap_header_element(op->in_doc, NULL, NULL);
 	int retVal = 0;
 	SoapH soap;
 	WsXmlNodeH msgIdNode;
 	soap = op->dispatch->soap;
 
-	msgIdNode = ws_xml_get_child(header, 0, XML_NS_ADDRESSING, WSA_MESSAGE_ID);
+	msgIdNode = wsman_get_header(op->in_doc, WSMAN_HEADER_MESSAGE_ID);
 	if (msgIdNode != NULL) {
 		lnode_t *node;
 		char *msgId;
@@ -472,7 +470,7 @@ static int wsman_is_duplicate_message_id(op_t * op)
 			return 1;
 		}
 		debug("Checking Message ID: %s", msgId);
-		u_lock(soap);
+		u_mutex_lock(&soap->lockMsgIds);
 
 		if (soap->processedMsgIdList == NULL) {
 			soap->processedMsgIdList = list_create(LISTCOUNT_T_MAX);
@@ -509,7 +507,7 @@ static int wsman_is_duplicate_message_id(op_t * op)
 				}
 			}
 		}
-		u_unlock(soap);
+		u_mutex_unlock(&soap->lockMsgIds);
 	} else if (!wsman_is_identify_request(op->in_doc)) {
 		generate_op_fault(op, WSA_MESSAGE_INFORMATION_HEADER_REQUIRED, 0);
 		debug("No MessageId Header found");
@@ -578,8 +576,7 @@ outbound_addressing_filter(SoapOpH opHandle, void *data, void *opaqueData)
 	}
 	if (in_doc != NULL) {
 		WsXmlNodeH inMsgIdNode;
-		inMsgIdNode = wsman_get_soap_header_element(in_doc,XML_NS_ADDRESSING,
-							    WSA_MESSAGE_ID);
+		inMsgIdNode = wsman_get_header(in_doc, WSMAN_HEADER_MESSAGE_ID);
 		if (inMsgIdNode != NULL &&
 		    !ws_xml_get_child(outHeaders, 0, XML_NS_ADDRESSING, WSA_RELATES_TO)) {
 			ws_xml_add_child(outHeaders, XML_NS_ADDRESSING, WSA_RELATES_TO,
@@ -693,12 +690,27 @@ dispatcher_create_fault(SoapH soap, WsmanMessage * msg, WsXmlDocH in_doc)
 }
 
 
+/* A response that cannot be dumped whole is replaced by a fault */
+static int
+dump_response(op_t * op, WsmanMessage * msg)
+{
+	int r = ws_xml_dump_buf_enc(op->out_doc, msg->response, msg->charset);
+
+	ws_xml_destroy_doc(op->out_doc);
+	op->out_doc = NULL;
+	if (r) {
+		error("response could not be dumped");
+		u_buf_clear(msg->response);
+		wsman_set_fault(msg, WSMAN_INTERNAL_ERROR,
+				OWSMAN_NO_DETAILS, NULL);
+	}
+	return r;
+}
+
 static int
 process_inbound_operation(op_t * op, WsmanMessage * msg, void *opaqueData)
 {
 	int retVal = 1;
-	char *buf = NULL;
-	int len;
 
 	msg->http_code = WSMAN_STATUS_OK;
 	op->out_doc = NULL;
@@ -723,11 +735,7 @@ process_inbound_operation(op_t * op, WsmanMessage * msg, void *opaqueData)
 			error("not fault envelope");
 		}
 
-		ws_xml_dump_memory_enc(op->out_doc, &buf, &len, msg->charset);
-		u_buf_set(msg->response, buf, len);
-		ws_xml_destroy_doc(op->out_doc);
-		op->out_doc = NULL;
-		u_free(buf);
+		dump_response(op, msg);
 		return 1;
 	}
 
@@ -757,11 +765,8 @@ process_inbound_operation(op_t * op, WsmanMessage * msg, void *opaqueData)
 	else {
 		wsman_add_fragement_for_header(op->in_doc, op->out_doc);
 	}
-	ws_xml_dump_memory_enc(op->out_doc, &buf, &len, msg->charset);
-	u_buf_set(msg->response, buf, len);
-	ws_xml_destroy_doc(op->out_doc);
-	op->out_doc = NULL;
-	u_free(buf);
+	if (dump_response(op, msg))
+		return 1;
 	return 0;
 
       GENERATE_FAULT:
@@ -788,7 +793,8 @@ void
 dispatch_inbound_call(SoapH soap, WsmanMessage * msg, void *opaqueData)
 {
 	op_t *op = NULL;
-	WsXmlDocH in_doc = wsman_build_inbound_envelope( msg);
+	WsXmlStreamParser *rest = NULL;
+	WsXmlDocH in_doc = wsman_build_inbound_header( msg, &rest);
 	SoapDispatchH dispatch = NULL;
 	debug("Inbound call...");
 #if 0
@@ -810,6 +816,14 @@ dispatch_inbound_call(SoapH soap, WsmanMessage * msg, void *opaqueData)
 		debug("dispatch == NULL");
 		goto DONE;
 	}
+	/* routed, the Body is worth reading now */
+	in_doc = wsman_build_inbound_body(msg, in_doc, rest);
+	rest = NULL;
+	if (in_doc == NULL) {
+		destroy_dispatch_entry(dispatch);
+		debug("document is not well-formed");
+		goto DONE;
+	}
 	op = create_op_entry(soap, dispatch, msg);
 	if (op == NULL) {
 		wsman_set_fault(msg, WSA_DESTINATION_UNREACHABLE,
@@ -821,6 +835,8 @@ dispatch_inbound_call(SoapH soap, WsmanMessage * msg, void *opaqueData)
 	op->in_doc = in_doc;
 	process_inbound_operation(op, msg, opaqueData);
 DONE:
+	if (rest)
+		ws_xml_read_envelope_abort(rest);
 	dispatcher_create_fault(soap, msg, in_doc);
 	destroy_op_entry(op);
 	ws_xml_destroy_doc(in_doc);
@@ -829,6 +845,7 @@ DONE:
 }
 
 
+/* The namespace is owned by the interface, nothing to free */
 static char *wsman_dispatcher_match_ns(WsDispatchInterfaceInfo * r,
 		char *uri)
 {
@@ -846,7 +863,7 @@ static char *wsman_dispatcher_match_ns(WsDispatchInterfaceInfo * r,
 		    (WsSupportedNamespaces *) node->list_data;
 		debug("namespace: %s", sns->ns);
 		if (sns->ns != NULL && strstr(uri, sns->ns)) {
-			ns = u_strdup(sns->ns);
+			ns = sns->ns;
 			break;
 		}
 		node = list_next(r->namespaces, node);
@@ -887,7 +904,6 @@ wsman_get_release_endpoint(WsContextH cntx, WsXmlDocH doc)
 		node = list_next((list_t *) dispInfo->interfaces, node);
 	}
 	if (r == NULL) {
-		u_free(ns);
 		return NULL;
 	}
 	/*
@@ -907,7 +923,6 @@ wsman_get_release_endpoint(WsContextH cntx, WsXmlDocH doc)
 			break;
 		}
 	}
-	u_free(ns);
 
 	if (ep == NULL) {
 		debug("no ep");
@@ -929,6 +944,7 @@ SoapDispatchH wsman_dispatcher(WsContextH cntx, void *data, WsXmlDocH doc)
 
 #ifdef ENABLE_EVENTING_SUPPORT
 	WsXmlNodeH nodedoc = NULL;
+	WsSubscribeInfo *subsInfo = NULL;
 #endif
 	int i;
 	char *ns = NULL;
@@ -949,18 +965,11 @@ SoapDispatchH wsman_dispatcher(WsContextH cntx, void *data, WsXmlDocH doc)
 			XML_NS_EVENTING, WSEVENT_IDENTIFIER);
 		char *uuid = ws_xml_get_node_text(temp);
 		debug("Request uuid: %s", uuid ? uuid : "NULL");
-		if(uuid) {
-			lnode_t *t = list_first(cntx->subscriptionMemList);
-			while(t != NULL) {
-				WsSubscribeInfo *subsInfo = (WsSubscribeInfo *)t->list_data;
-				if(!strcmp(uuid+5, subsInfo->subsId)) {
-					uri = subsInfo->uri;
-					break;
-				}
-				else
-					t = list_next(cntx->subscriptionMemList, t);
-			}
-			if(t == NULL) {
+		if(uuid && strlen(uuid) > 5) {
+			subsInfo = wse_get_subscription(cntx->soap, uuid+5);
+			if(subsInfo)
+				uri = subsInfo->uri;
+			else {
 				unsigned char *buf = NULL;
 				int len;
 				if(cntx->soap->subscriptionOpSet->get_subscription(cntx->soap->uri_subsRepository,
@@ -1061,10 +1070,12 @@ SoapDispatchH wsman_dispatcher(WsContextH cntx, void *data, WsXmlDocH doc)
 	}
 
 cleanup:
+#ifdef ENABLE_EVENTING_SUPPORT
+	if(subsInfo)
+		wse_put_subscription(cntx->soap, subsInfo);
+#endif
 	if(notdoc)
 		ws_xml_destroy_doc(notdoc);
-	if (ns)
-		u_free(ns);
 	return disp;
 }
 
@@ -1141,10 +1152,12 @@ void wsman_dispatch_start(SoapDispatchH disp)
 {
 	list_t *displist = NULL;
 	if (disp) {
+		u_mutex_lock(&disp->soap->lockDispatch);
 		displist = disp->soap->dispatchList;
 		if (displist != NULL || ( displist = list_create(LISTCOUNT_T_MAX) )) {
 			list_append(displist, &(disp)->node);
 		}
+		u_mutex_unlock(&disp->soap->lockDispatch);
 	}
 }
 
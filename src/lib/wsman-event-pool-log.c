@@ -0,0 +1,758 @@
+/*******************************************************************************
+ * Copyright (C) 2004-2007 Intel Corp. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of Intel Corp. nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Intel Corp. OR THE CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************/
+
+/*
+ * Event pool backed by an append-only log of mmap'ed segment files.
+ *
+ * Every queued notification is appended as an EVENT record.  Delivery
+ * progress is recorded per subscription as a COMMIT record carrying the
+ * sequence number of the last delivered event, a dropped subscription as
+ * a CLEAR record.  On startup the segments are replayed to rebuild the
+ * per-subscription queues, so undelivered events survive a restart and
+ * events handed out but not committed are delivered again.
+ *
+ * Segments whose events have all been consumed are unlinked from the
+ * oldest end.  If too many sealed segments pile up behind a few long
+ * lived events, those events are copied forward into the active segment
+ * so the oldest one can go, provided most of it has been consumed.
+ */
+#ifdef HAVE_CONFIG_H
+#include "wsman_config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#include "u/libu.h"
+#include "wsman-xml-api.h"
+#include "wsman-xml.h"
+#include "wsman-event-pool.h"
+
+#define LOG_EVENT_POOL_MAGIC	0x4c45574fU /* "OWEL" */
+
+#define LOG_RECORD_EVENT	1
+#define LOG_RECORD_COMMIT	2
+#define LOG_RECORD_CLEAR	3
+
+#define LOG_SEGMENT_PREFIX	"events."
+#define LOG_SEGMENT_SUFFIX	".log"
+
+#define LOG_DEFAULT_SEGMENT_SIZE	(4 * 1024 * 1024)
+#define LOG_DEFAULT_SYNC_BATCH		32
+#define LOG_DEFAULT_MAX_SEGMENTS	8
+
+#define LOG_ALIGN(n)	(((n) + 7) & ~((size_t)7))
+
+struct log_record {
+	uint32_t magic;
+	uint32_t type;
+	uint32_t length; // whole record including this header, 8 byte aligned
+	uint32_t checksum; // over the payload
+	uint64_t seq;
+	char subscription_id[EUIDLEN];
+	uint32_t action_len;
+	uint32_t header_len;
+	uint32_t content_len;
+	uint32_t reserved;
+};
+
+struct log_segment {
+	unsigned long id;
+	int fd;
+	char *base;
+	size_t size;
+	size_t tail; // first free byte
+	size_t synced; // everything below is on disk
+	unsigned long live; // pending events stored in this segment
+	size_t live_bytes; // and the space they take
+};
+
+struct log_event_ref {
+	struct log_segment *seg;
+	size_t offset;
+	uint64_t seq;
+};
+
+struct log_subscription {
+	char id[EUIDLEN];
+	list_t *events; // log_event_ref, ordered by seq
+	lnode_t *cursor; // next event to hand out, NULL if all are in flight
+	unsigned long pending; // events from cursor on
+	uint64_t committed_seq;
+};
+
+int LogEventPoolInit (void *opaqueData);
+int LogEventPoolFinalize (void *opaqueData);
+int LogEventPoolCount(char *uuid);
+int LogEventPoolAddEvent (char *uuid, WsNotificationInfoH notification);
+int LogEventPoolAddPullEvent (char *uuid, WsNotificationInfoH notification);
+int LogEventPoolGetAndDeleteEvent (char *uuid, WsNotificationInfoH *notification);
+int LogEventPoolClearEvent (char *uuid, clearproc proc);
+int LogEventPoolCommitEvent (char *uuid);
+
+static struct __EventPoolOpSet log_event_pool_op_set = {LogEventPoolInit, LogEventPoolFinalize,
+	LogEventPoolCount, LogEventPoolAddEvent, LogEventPoolAddPullEvent,
+	LogEventPoolGetAndDeleteEvent, LogEventPoolClearEvent, LogEventPoolCommitEvent};
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *log_path = NULL;
+static list_t *log_segments = NULL; // oldest first, last one is active
+static hash_t *log_subscriptions = NULL;
+static uint64_t log_seq = 0;
+static unsigned long log_segment_size = LOG_DEFAULT_SEGMENT_SIZE;
+static int log_sync_batch = LOG_DEFAULT_SYNC_BATCH;
+static int log_max_segments = LOG_DEFAULT_MAX_SEGMENTS;
+static int log_max_pull_events = 16;
+static int log_unsynced = 0;
+static time_t log_last_sync = 0;
+
+EventPoolOpSetH wsman_get_log_eventpool_opset()
+{
+	return &log_event_pool_op_set;
+}
+
+static uint32_t log_checksum(const char *buf, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)buf[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static char *log_segment_name(unsigned long id)
+{
+	return u_strdup_printf("%s/" LOG_SEGMENT_PREFIX "%08lu" LOG_SEGMENT_SUFFIX,
+			log_path, id);
+}
+
+static void log_segment_sync(struct log_segment *seg)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	size_t start;
+	if (seg->synced >= seg->tail)
+		return;
+	start = seg->synced - (seg->synced % pagesize);
+	if (msync(seg->base + start, seg->tail - start, MS_SYNC))
+		error("msync of event segment %lu failed: %s", seg->id, strerror(errno));
+	seg->synced = seg->tail;
+}
+
+static void log_sync(int force)
+{
+	lnode_t *node;
+	time_t now = time(NULL);
+	if (!force && log_unsynced < log_sync_batch && now == log_last_sync)
+		return;
+	for (node = list_first(log_segments); node; node = list_next(log_segments, node))
+		log_segment_sync((struct log_segment *)node->list_data);
+	log_unsynced = 0;
+	log_last_sync = now;
+}
+
+static struct log_segment *log_segment_map(unsigned long id, size_t size, int create)
+{
+	struct log_segment *seg;
+	struct stat st;
+	char *name = log_segment_name(id);
+	int fd = open(name, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0600);
+	if (fd < 0) {
+		error("Can't open %s: %s", name, strerror(errno));
+		u_free(name);
+		return NULL;
+	}
+	if (create) {
+		if (ftruncate(fd, size)) {
+			error("Can't size %s: %s", name, strerror(errno));
+			goto ERR;
+		}
+	} else {
+		if (fstat(fd, &st) || st.st_size == 0)
+			goto ERR;
+		size = st.st_size;
+	}
+	seg = u_zalloc(sizeof(*seg));
+	seg->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (seg->base == MAP_FAILED) {
+		error("Can't map %s: %s", name, strerror(errno));
+		u_free(seg);
+		goto ERR;
+	}
+	seg->id = id;
+	seg->fd = fd;
+	seg->size = size;
+	u_free(name);
+	return seg;
+ERR:
+	close(fd);
+	if (create)
+		unlink(name);
+	u_free(name);
+	return NULL;
+}
+
+static void log_segment_destroy(struct log_segment *seg, int remove)
+{
+	munmap(seg->base, seg->size);
+	close(seg->fd);
+	if (remove) {
+		char *name = log_segment_name(seg->id);
+		debug("event segment %s compacted", name);
+		if (unlink(name))
+			error("Can't remove %s: %s", name, strerror(errno));
+		u_free(name);
+	}
+	u_free(seg);
+}
+
+static struct log_segment *log_active_segment(void)
+{
+	lnode_t *node = list_last(log_segments);
+	return node ? (struct log_segment *)node->list_data : NULL;
+}
+
+/* make room for len bytes, opening a new segment if the active one is full */
+static struct log_segment *log_reserve(size_t len)
+{
+	struct log_segment *seg = log_active_segment();
+	size_t size = log_segment_size;
+	if (seg && seg->tail + len <= seg->size)
+		return seg;
+	if (seg)
+		log_segment_sync(seg);
+	if (size < len)
+		size = LOG_ALIGN(len);
+	seg = log_segment_map(seg ? seg->id + 1 : 1, size, 1);
+	if (seg)
+		list_append(log_segments, lnode_create(seg));
+	return seg;
+}
+
+/*
+ * Append one record. Stores to the mapping reach the file in no set
+ * order, so a crash may leave the header without all of the payload;
+ * replay rejects such a torn record by the payload checksum.
+ */
+static struct log_segment *log_append(uint32_t type, const char *uuid, uint64_t seq,
+		const char *action, size_t action_len,
+		const char *header, size_t header_len,
+		const char *content, size_t content_len,
+		size_t *offset)
+{
+	struct log_record rec;
+	size_t payload = action_len + header_len + content_len;
+	size_t len = LOG_ALIGN(sizeof(rec) + payload);
+	struct log_segment *seg = log_reserve(len);
+	char *p;
+	if (seg == NULL)
+		return NULL;
+	p = seg->base + seg->tail + sizeof(rec);
+	if (action_len)
+		memcpy(p, action, action_len);
+	if (header_len)
+		memcpy(p + action_len, header, header_len);
+	if (content_len)
+		memcpy(p + action_len + header_len, content, content_len);
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = LOG_EVENT_POOL_MAGIC;
+	rec.type = type;
+	rec.length = len;
+	rec.checksum = log_checksum(p, payload);
+	rec.seq = seq;
+	strncpy(rec.subscription_id, uuid, EUIDLEN - 1);
+	rec.action_len = action_len;
+	rec.header_len = header_len;
+	rec.content_len = content_len;
+	memcpy(seg->base + seg->tail, &rec, sizeof(rec));
+	if (offset)
+		*offset = seg->tail;
+	seg->tail += len;
+	log_unsynced++;
+	log_sync(0);
+	return seg;
+}
+
+static struct log_subscription *log_find_subscription(const char *uuid, int create)
+{
+	struct log_subscription *entry;
+	hnode_t *hn = hash_lookup(log_subscriptions, uuid);
+	if (hn)
+		return (struct log_subscription *)hnode_get(hn);
+	if (!create)
+		return NULL;
+	entry = u_zalloc(sizeof(*entry));
+	strncpy(entry->id, uuid, EUIDLEN - 1);
+	entry->events = list_create(LISTCOUNT_T_MAX);
+	if (!hash_alloc_insert(log_subscriptions, entry->id, entry)) {
+		list_destroy(entry->events);
+		u_free(entry);
+		return NULL;
+	}
+	return entry;
+}
+
+static void log_drop_subscription(struct log_subscription *entry)
+{
+	hnode_t *hn = hash_lookup(log_subscriptions, entry->id);
+	if (hn)
+		hash_delete_free(log_subscriptions, hn);
+	list_destroy(entry->events);
+	u_free(entry);
+}
+
+/* queue a ref, keeping seq order; replay may see copied-forward records late */
+static void log_queue_event(struct log_subscription *entry, struct log_segment *seg,
+		size_t offset, uint64_t seq)
+{
+	struct log_event_ref *ref;
+	lnode_t *added;
+	lnode_t *node = list_last(entry->events);
+	while (node && ((struct log_event_ref *)node->list_data)->seq > seq)
+		node = list_prev(entry->events, node);
+	if (node && ((struct log_event_ref *)node->list_data)->seq == seq) {
+		/* original and copy both survived a crash during compaction */
+		return;
+	}
+	ref = u_malloc(sizeof(*ref));
+	ref->seg = seg;
+	ref->offset = offset;
+	ref->seq = seq;
+	added = lnode_create(ref);
+	if (node)
+		list_ins_after(entry->events, added, node);
+	else
+		list_prepend(entry->events, added);
+	/* never behind the cursor: replay hands out nothing */
+	if (entry->cursor == NULL || ((struct log_event_ref *)entry->cursor->list_data)->seq > seq)
+		entry->cursor = added;
+	entry->pending++;
+	seg->live++;
+	seg->live_bytes += ((struct log_record *)(seg->base + offset))->length;
+}
+
+/* forget all queued events up to and including seq */
+static void log_consume(struct log_subscription *entry, uint64_t seq)
+{
+	lnode_t *node;
+	while ((node = list_first(entry->events))) {
+		struct log_event_ref *ref = (struct log_event_ref *)node->list_data;
+		if (ref->seq > seq)
+			break;
+		if (entry->cursor == node) {
+			entry->cursor = list_next(entry->events, node);
+			entry->pending--;
+		}
+		list_delete(entry->events, node);
+		lnode_destroy(node);
+		ref->seg->live--;
+		ref->seg->live_bytes -= ((struct log_record *)(ref->seg->base + ref->offset))->length;
+		u_free(ref);
+	}
+	if (seq > entry->committed_seq)
+		entry->committed_seq = seq;
+}
+
+static void log_copy_forward(struct log_segment *old)
+{
+	hscan_t hs;
+	hnode_t *hn;
+	hash_scan_begin(&hs, log_subscriptions);
+	while ((hn = hash_scan_next(&hs))) {
+		struct log_subscription *entry = (struct log_subscription *)hnode_get(hn);
+		lnode_t *node;
+		for (node = list_first(entry->events); node; node = list_next(entry->events, node)) {
+			struct log_event_ref *ref = (struct log_event_ref *)node->list_data;
+			struct log_record *rec;
+			struct log_segment *seg;
+			if (ref->seg != old)
+				continue;
+			rec = (struct log_record *)(old->base + ref->offset);
+			seg = log_reserve(rec->length);
+			if (seg == NULL)
+				return;
+			memcpy(seg->base + seg->tail, rec, rec->length);
+			ref->offset = seg->tail;
+			ref->seg = seg;
+			seg->tail += rec->length;
+			seg->live++;
+			seg->live_bytes += rec->length;
+			old->live--;
+			old->live_bytes -= rec->length;
+		}
+	}
+	log_sync(1);
+}
+
+/*
+ * Copying forward only pays off for mostly consumed segments, otherwise a
+ * backlog larger than max_segments would be shuffled around forever.
+ */
+static void log_compact(void)
+{
+	while (list_count(log_segments) > 1) {
+		lnode_t *node = list_first(log_segments);
+		struct log_segment *seg = (struct log_segment *)node->list_data;
+		if (seg->live) {
+			if (list_count(log_segments) <= (listcount_t)log_max_segments ||
+					seg->live_bytes > seg->tail / 2)
+				break;
+			log_copy_forward(seg);
+			if (seg->live)
+				break;
+		}
+		list_delete(log_segments, node);
+		lnode_destroy(node);
+		log_segment_destroy(seg, 1);
+	}
+}
+
+static int log_replay_segment(struct log_segment *seg)
+{
+	size_t offset = 0;
+	while (offset + sizeof(struct log_record) <= seg->size) {
+		struct log_record *rec = (struct log_record *)(seg->base + offset);
+		struct log_subscription *entry;
+		size_t payload;
+		char uuid[EUIDLEN];
+		if (rec->magic != LOG_EVENT_POOL_MAGIC)
+			break;
+		payload = (size_t)rec->action_len + rec->header_len + rec->content_len;
+		if (rec->length < sizeof(*rec) + payload ||
+				offset + rec->length > seg->size ||
+				rec->checksum != log_checksum((char *)(rec + 1), payload)) {
+			error("event segment %lu: damaged record at %lu", seg->id,
+					(unsigned long)offset);
+			break;
+		}
+		memcpy(uuid, rec->subscription_id, EUIDLEN);
+		uuid[EUIDLEN - 1] = '\0';
+		if (rec->seq > log_seq)
+			log_seq = rec->seq;
+		switch (rec->type) {
+		case LOG_RECORD_EVENT:
+			entry = log_find_subscription(uuid, 1);
+			if (entry && rec->seq > entry->committed_seq)
+				log_queue_event(entry, seg, offset, rec->seq);
+			break;
+		case LOG_RECORD_COMMIT:
+		case LOG_RECORD_CLEAR:
+			entry = log_find_subscription(uuid, 1);
+			if (entry)
+				log_consume(entry, rec->seq);
+			break;
+		}
+		offset += rec->length;
+	}
+	seg->tail = offset;
+	seg->synced = offset;
+	return 0;
+}
+
+static int log_segment_filter(const struct dirent *d)
+{
+	size_t len = strlen(d->d_name);
+	return strncmp(d->d_name, LOG_SEGMENT_PREFIX, strlen(LOG_SEGMENT_PREFIX)) == 0 &&
+		len > strlen(LOG_SEGMENT_SUFFIX) &&
+		strcmp(d->d_name + len - strlen(LOG_SEGMENT_SUFFIX), LOG_SEGMENT_SUFFIX) == 0;
+}
+
+static int log_replay(void)
+{
+	struct dirent **namelist;
+	int n, i;
+	hscan_t hs;
+	hnode_t *hn;
+
+	n = scandir(log_path, &namelist, log_segment_filter, alphasort);
+	if (n < 0) {
+		error("Can't read event pool %s: %s", log_path, strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		unsigned long id = strtoul(namelist[i]->d_name + strlen(LOG_SEGMENT_PREFIX), NULL, 10);
+		struct log_segment *seg = log_segment_map(id, 0, 0);
+		if (seg) {
+			list_append(log_segments, lnode_create(seg));
+			log_replay_segment(seg);
+		}
+		u_free(namelist[i]);
+	}
+	u_free(namelist);
+
+	/* subscriptions without anything queued need no entry */
+	hash_scan_begin(&hs, log_subscriptions);
+	while ((hn = hash_scan_next(&hs))) {
+		struct log_subscription *entry = (struct log_subscription *)hnode_get(hn);
+		if (list_isempty(entry->events)) {
+			hash_scan_delfree(log_subscriptions, hn);
+			list_destroy(entry->events);
+			u_free(entry);
+		} else {
+			debug("event pool: %lu events pending for uuid:%s",
+				(unsigned long)list_count(entry->events), entry->id);
+		}
+	}
+	log_compact();
+	return 0;
+}
+
+int LogEventPoolInit (void *opaqueData) {
+	LogEventPoolConfig *config = (LogEventPoolConfig *)opaqueData;
+	int r;
+	if (config == NULL || config->path == NULL)
+		return -1;
+	if (mkdir(config->path, 0700) && errno != EEXIST) {
+		error("Can't create event pool %s: %s", config->path, strerror(errno));
+		return -1;
+	}
+	pthread_mutex_lock(&log_lock);
+	log_path = u_strdup(config->path);
+	if (config->segment_size)
+		log_segment_size = config->segment_size;
+	if (config->sync_batch > 0)
+		log_sync_batch = config->sync_batch;
+	if (config->max_segments > 0)
+		log_max_segments = config->max_segments;
+	if (config->max_pull_events > 0)
+		log_max_pull_events = config->max_pull_events;
+	log_segments = list_create(LISTCOUNT_T_MAX);
+	log_subscriptions = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+	r = log_replay();
+	if (r == 0 && log_reserve(0) == NULL)
+		r = -1;
+	pthread_mutex_unlock(&log_lock);
+	if (r == 0)
+		debug("event pool %s: %lu segments, last seq %llu", log_path,
+			(unsigned long)list_count(log_segments), (unsigned long long)log_seq);
+	else
+		LogEventPoolFinalize(NULL);
+	return r;
+}
+
+int LogEventPoolFinalize (void *opaqueData) {
+	lnode_t *node;
+	hscan_t hs;
+	hnode_t *hn;
+	pthread_mutex_lock(&log_lock);
+	if (log_segments) {
+		log_sync(1);
+		while (!list_isempty(log_segments)) {
+			node = list_del_first(log_segments);
+			log_segment_destroy((struct log_segment *)node->list_data, 0);
+			lnode_destroy(node);
+		}
+		list_destroy(log_segments);
+		log_segments = NULL;
+	}
+	if (log_subscriptions) {
+		hash_scan_begin(&hs, log_subscriptions);
+		while ((hn = hash_scan_next(&hs))) {
+			struct log_subscription *entry = (struct log_subscription *)hnode_get(hn);
+			hash_scan_delfree(log_subscriptions, hn);
+			while (!list_isempty(entry->events)) {
+				node = list_del_first(entry->events);
+				u_free(node->list_data);
+				lnode_destroy(node);
+			}
+			list_destroy(entry->events);
+			u_free(entry);
+		}
+		hash_destroy(log_subscriptions);
+		log_subscriptions = NULL;
+	}
+	u_free(log_path);
+	log_path = NULL;
+	pthread_mutex_unlock(&log_lock);
+	return 0;
+}
+
+int LogEventPoolCount(char *uuid) {
+	struct log_subscription *entry;
+	int count = 0;
+	pthread_mutex_lock(&log_lock);
+	entry = log_find_subscription(uuid, 0);
+	if (entry)
+		count = entry->pending;
+	pthread_mutex_unlock(&log_lock);
+	return count;
+}
+
+static int log_add_event(char *uuid, WsNotificationInfoH notification, int limit) {
+	struct log_subscription *entry;
+	struct log_segment *seg;
+	char *header = NULL, *content = NULL;
+	int header_len = 0, content_len = 0;
+	size_t action_len = 0, offset;
+	int retVal = -1;
+
+	if (notification == NULL)
+		return 0;
+	if (notification->headerOpaqueData)
+		ws_xml_dump_memory_enc(notification->headerOpaqueData, &header, &header_len, "UTF-8");
+	if (notification->EventContent)
+		ws_xml_dump_memory_enc(notification->EventContent, &content, &content_len, "UTF-8");
+	if (notification->EventAction)
+		action_len = strlen(notification->EventAction);
+
+	pthread_mutex_lock(&log_lock);
+	entry = log_find_subscription(uuid, 1);
+	if (entry == NULL)
+		goto DONE;
+	if (limit && entry->pending > (unsigned long)log_max_pull_events)
+		goto DONE;
+	seg = log_append(LOG_RECORD_EVENT, uuid, log_seq + 1,
+			notification->EventAction, action_len,
+			header, header_len, content, content_len, &offset);
+	if (seg == NULL)
+		goto DONE;
+	log_seq++;
+	log_queue_event(entry, seg, offset, log_seq);
+	retVal = 0;
+DONE:
+	pthread_mutex_unlock(&log_lock);
+	if (header)
+		ws_xml_free_memory(header);
+	if (content)
+		ws_xml_free_memory(content);
+	if (retVal == 0) {
+		/* the log owns a copy now */
+		ws_xml_destroy_doc(notification->EventContent);
+		ws_xml_destroy_doc(notification->headerOpaqueData);
+		u_free(notification->EventAction);
+		u_free(notification);
+	}
+	return retVal;
+}
+
+int LogEventPoolAddEvent (char *uuid, WsNotificationInfoH notification) {
+	return log_add_event(uuid, notification, 0);
+}
+
+int LogEventPoolAddPullEvent (char *uuid, WsNotificationInfoH notification) {
+	return log_add_event(uuid, notification, 1);
+}
+
+int LogEventPoolGetAndDeleteEvent (char *uuid, WsNotificationInfoH *notification) {
+	struct log_subscription *entry;
+	struct log_event_ref *ref;
+	struct log_record *rec;
+	WsNotificationInfoH info;
+	char *p;
+
+	*notification = NULL;
+	pthread_mutex_lock(&log_lock);
+	entry = log_find_subscription(uuid, 0);
+	if (entry == NULL || entry->cursor == NULL) {
+		pthread_mutex_unlock(&log_lock);
+		return -1;
+	}
+	ref = (struct log_event_ref *)entry->cursor->list_data;
+	rec = (struct log_record *)(ref->seg->base + ref->offset);
+	p = (char *)(rec + 1);
+	info = u_zalloc(sizeof(*info));
+	if (rec->action_len)
+		info->EventAction = u_strndup(p, rec->action_len);
+	if (rec->header_len)
+		info->headerOpaqueData = ws_xml_read_memory(p + rec->action_len,
+				rec->header_len, "UTF-8", 0);
+	if (rec->content_len)
+		info->EventContent = ws_xml_read_memory(p + rec->action_len + rec->header_len,
+				rec->content_len, "UTF-8", 0);
+	/* stays in the log until committed */
+	entry->cursor = list_next(entry->events, entry->cursor);
+	entry->pending--;
+	pthread_mutex_unlock(&log_lock);
+	*notification = info;
+	return 0;
+}
+
+int LogEventPoolCommitEvent (char *uuid) {
+	struct log_subscription *entry;
+	lnode_t *last;
+	uint64_t seq;
+	int retVal = 0;
+
+	pthread_mutex_lock(&log_lock);
+	entry = log_find_subscription(uuid, 0);
+	if (entry == NULL)
+		goto DONE;
+	last = entry->cursor ? list_prev(entry->events, entry->cursor) :
+		list_last(entry->events);
+	if (last == NULL)
+		goto DONE;
+	seq = ((struct log_event_ref *)last->list_data)->seq;
+	if (log_append(LOG_RECORD_COMMIT, uuid, seq, NULL, 0, NULL, 0, NULL, 0, NULL) == NULL) {
+		retVal = -1;
+		goto DONE;
+	}
+	log_consume(entry, seq);
+	if (list_isempty(entry->events))
+		log_drop_subscription(entry);
+	log_compact();
+DONE:
+	pthread_mutex_unlock(&log_lock);
+	return retVal;
+}
+
+int LogEventPoolClearEvent (char *uuid, clearproc proc) {
+	struct log_subscription *entry;
+	int retVal = 0;
+
+	pthread_mutex_lock(&log_lock);
+	entry = log_find_subscription(uuid, 0);
+	if (entry == NULL) {
+		retVal = -1;
+		goto DONE;
+	}
+	log_append(LOG_RECORD_CLEAR, uuid, log_seq, NULL, 0, NULL, 0, NULL, 0, NULL);
+	log_consume(entry, log_seq);
+	log_drop_subscription(entry);
+	log_compact();
+DONE:
+	pthread_mutex_unlock(&log_lock);
+	return retVal;
+}
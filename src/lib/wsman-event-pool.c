@@ -45,13 +45,14 @@ int MemEventPoolAddEvent (char *uuid, WsNotificationInfoH notification);
 int MemEventPoolAddPullEvent (char *uuid, WsNotificationInfoH notification) ;
 int MemEventPoolGetAndDeleteEvent (char *uuid, WsNotificationInfoH *notification);
 int MemEventPoolClearEvent (char *uuid, clearproc proc);
+int MemEventPoolCommitEvent (char *uuid);
 
 list_t *global_event_list = NULL;
 int max_pull_event_number = 16;
 
 struct __EventPoolOpSet event_pool_op_set ={MemEventPoolInit, MemEventPoolFinalize, 
 	MemEventPoolCount, MemEventPoolAddEvent, MemEventPoolAddPullEvent,
-	MemEventPoolGetAndDeleteEvent, MemEventPoolClearEvent};
+	MemEventPoolGetAndDeleteEvent, MemEventPoolClearEvent, MemEventPoolCommitEvent};
 
 EventPoolOpSetH wsman_get_eventpool_opset()
 {
@@ -186,4 +187,7 @@ int MemEventPoolClearEvent (char *uuid, clearproc proc) {
 	return 0;
 }
 
-
+int MemEventPoolCommitEvent (char *uuid) {
+	/* nothing survives a restart, so there is nothing to make durable */
+	return 0;
+}
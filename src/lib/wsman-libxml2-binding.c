@@ -44,7 +44,11 @@
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
+#include <libxml/parserInternals.h>
+#include <libxml/SAX2.h>
 #include <libxml/xmlstring.h>
+#include <libxml/dict.h>
+#include <libxml/xmlsave.h>
 
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
@@ -57,6 +61,203 @@
 #include "wsman-xml-binding.h"
 
 
+/*
+ * Namespace URIs and local names interned once in a dictionary that is
+ * the parent of every document dictionary, so element names equal to one
+ * of them are this very pointer. Both the dictionary and the table
+ * finding the interned copies are read-only once built.
+ */
+static const char *well_known_names[] = {
+	XML_NS_SOAP_1_1, XML_NS_SOAP_1_2, XML_NS_XML_NAMESPACES,
+	XML_NS_ADDRESSING, XML_NS_DISCOVERY, XML_NS_EVENTING,
+	XML_NS_ENUMERATION, XML_NS_TRANSFER, XML_NS_XML_SCHEMA,
+	XML_NS_SCHEMA_INSTANCE, XML_NS_POLICY, XML_NS_TRUST, XML_NS_SE,
+	XML_NS_OPENWSMAN, XML_NS_CIM_SCHEMA, XML_NS_CIM_CLASS,
+	XML_NS_CIM_BINDING, XML_NS_CIM_INTRINSIC, XML_NS_WS_MAN,
+	XML_NS_WSMAN_FAULT_DETAIL, XML_NS_WS_MAN_CAT, XML_NS_WSMAN_ID,
+
+	SOAP_ENVELOPE, SOAP_HEADER, SOAP_BODY, SOAP_FAULT, SOAP_CODE,
+	SOAP_VALUE, SOAP_SUBCODE, SOAP_REASON, SOAP_TEXT, SOAP_DETAIL,
+	SOAP_FAULT_DETAIL, SOAP_UPGRADE, SOAP_SUPPORTED_ENVELOPE,
+
+	WSA_MESSAGE_ID, WSA_ADDRESS, WSA_EPR, WSA_ACTION, WSA_RELATES_TO,
+	WSA_TO, WSA_REPLY_TO, WSA_FROM, WSA_FAULT_TO,
+	WSA_REFERENCE_PROPERTIES, WSA_REFERENCE_PARAMETERS,
+
+	WSM_SYSTEM, WSM_LOCALE, WSM_RESOURCE_URI, WSM_SELECTOR_SET,
+	WSM_SELECTOR, WSM_NAME, WSM_REQUEST_TOTAL, WSM_TOTAL_ESTIMATE,
+	WSM_OPTIMIZE_ENUM, WSM_MAX_ELEMENTS, WSM_ENUM_MODE, WSM_ITEM,
+	WSM_FRAGMENT_TRANSFER, WSM_XML_FRAGMENT, WSM_OPTION_SET,
+	WSM_OPTION, WSM_EVENTS, WSM_EVENT, WSM_ACKREQUESTED,
+	WSM_MAX_ENVELOPE_SIZE, WSM_OPERATION_TIMEOUT, WSM_FAULT_SUBCODE,
+	WSM_FILTER, WSM_DIALECT, WSM_CONTENTCODING,
+
+	WSMID_IDENTIFY, WSMID_IDENTIFY_RESPONSE, WSMID_PROTOCOL_VERSION,
+	WSMID_PRODUCT_VENDOR, WSMID_PRODUCT_VERSION,
+
+	TRANSFER_GET, TRANSFER_GET_RESP, TRANSFER_PUT, TRANSFER_PUT_RESP,
+	TRANSFER_CREATE, TRANSFER_DELETE, TRANSFER_DELETE_RESP,
+	WXF_RESOURCE_CREATED,
+
+	WSENUM_ENUMERATE, WSENUM_ENUMERATE_RESP, WSENUM_RELEASE,
+	WSENUM_RELEASE_RESP, WSENUM_PULL, WSENUM_PULL_RESP, WSENUM_RENEW,
+	WSENUM_RENEW_RESP, WSENUM_GET_STATUS, WSENUM_GET_STATUS_RESP,
+	WSENUM_END_TO, WSENUM_EXPIRES, WSENUM_ENUMERATION_CONTEXT,
+	WSENUM_MAX_TIME, WSENUM_MAX_CHARACTERS, WSENUM_ITEMS,
+	WSENUM_END_OF_SEQUENCE, WSENUM_ENUMERATION_END,
+
+	WSEVENT_SUBSCRIBE, WSEVENT_SUBSCRIBE_RESP, WSEVENT_UNSUBSCRIBE,
+	WSEVENT_UNSUBSCRIBE_RESP, WSEVENT_DELIVERY, WSEVENT_NOTIFY_TO,
+	WSEVENT_DELIVERY_MODE, WSEVENT_SUBSCRIPTION_MANAGER,
+	WSEVENT_IDENTIFIER,
+
+	WSMB_ASSOCIATED_INSTANCES, WSMB_ASSOCIATION_INSTANCES, WSMB_OBJECT,
+	WSMB_ASSOCIATION_CLASS_NAME, WSMB_RESULT_CLASS_NAME, WSMB_ROLE,
+	WSMB_RESULT_ROLE, WSMB_INCLUDE_RESULT_PROPERTY,
+	NULL
+};
+
+#define NAMES_TABLE_SIZE	512
+
+static xmlDictPtr names_dict = NULL;
+static const xmlChar *names_table[NAMES_TABLE_SIZE];
+static pthread_once_t names_once = PTHREAD_ONCE_INIT;
+
+/* Cached in xmlNs::_private for a namespace that is not well-known */
+static const char unknown_ns = 0;
+
+/*
+ * The well-known namespaces share long prefixes, hash the length and the
+ * last characters instead of the whole string.
+ */
+static unsigned int names_hash(const char *str, size_t len)
+{
+	unsigned int h = (unsigned int) len;
+
+	if (len > 0)
+		h = h * 31 + (unsigned char) str[len - 1];
+	if (len > 1)
+		h = h * 31 + (unsigned char) str[len - 2];
+	if (len > 2)
+		h = h * 31 + (unsigned char) str[len / 2];
+	return h * 2654435761U;
+}
+
+static void build_names_dict(void)
+{
+	xmlDictPtr dict = xmlDictCreate();
+	int i;
+
+	for (i = 0; dict && well_known_names[i]; i++) {
+		const char *name = well_known_names[i];
+		size_t len = strlen(name);
+		unsigned int h = names_hash(name, len);
+		const xmlChar *interned =
+			xmlDictLookup(dict, BAD_CAST name, (int) len);
+
+		while (names_table[h % NAMES_TABLE_SIZE] &&
+		       names_table[h % NAMES_TABLE_SIZE] != interned)
+			h++;
+		names_table[h % NAMES_TABLE_SIZE] = interned;
+	}
+	names_dict = dict;
+}
+
+static xmlDictPtr get_names_dict(void)
+{
+	pthread_once(&names_once, build_names_dict);
+	return names_dict;
+}
+
+static xmlDictPtr new_doc_dict(void)
+{
+	xmlDictPtr names = get_names_dict();
+
+	return names ? xmlDictCreateSub(names) : xmlDictCreate();
+}
+
+static void use_doc_dict(xmlParserCtxtPtr ctxt)
+{
+	xmlDictPtr dict = new_doc_dict();
+
+	if (dict) {
+		xmlDictFree(ctxt->dict);
+		ctxt->dict = dict;
+	}
+}
+
+/*
+ * Parser contexts are kept for the next document instead of allocating
+ * their tables again for every one. A context only ever holds the
+ * dictionary of the document it parses, each document still gets its own.
+ * Pull and push parsers are pooled apart.
+ */
+#define PARSER_POOL_SIZE	8
+
+struct parser_pool {
+	xmlParserCtxtPtr ctxts[PARSER_POOL_SIZE];
+	int count;
+	pthread_mutex_t lock;
+	xmlParserCtxtPtr (*create)(void);
+};
+
+static xmlParserCtxtPtr new_envelope_parser(void);
+
+static struct parser_pool read_parsers = {
+	{ NULL }, 0, PTHREAD_MUTEX_INITIALIZER, xmlNewParserCtxt
+};
+static struct parser_pool envelope_parsers = {
+	{ NULL }, 0, PTHREAD_MUTEX_INITIALIZER, new_envelope_parser
+};
+
+static xmlParserCtxtPtr get_parser(struct parser_pool *pool)
+{
+	xmlParserCtxtPtr ctxt = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->count > 0)
+		ctxt = pool->ctxts[--pool->count];
+	pthread_mutex_unlock(&pool->lock);
+
+	if (ctxt == NULL && (ctxt = pool->create()) == NULL)
+		return NULL;
+	use_doc_dict(ctxt);
+	if (ctxt->dict == NULL) {
+		xmlFreeParserCtxt(ctxt);
+		return NULL;
+	}
+	return ctxt;
+}
+
+static void put_parser(struct parser_pool *pool, xmlParserCtxtPtr ctxt)
+{
+	/*
+	 * Reset while the dictionary of the last document is still there,
+	 * the strings it drops may come from it.
+	 */
+	xmlCtxtReset(ctxt);
+	xmlDictFree(ctxt->dict);
+	ctxt->dict = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->count < PARSER_POOL_SIZE) {
+		pool->ctxts[pool->count++] = ctxt;
+		ctxt = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (ctxt)
+		xmlFreeParserCtxt(ctxt);
+}
+
+static void free_parsers(struct parser_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->count > 0)
+		xmlFreeParserCtxt(pool->ctxts[--pool->count]);
+	pthread_mutex_unlock(&pool->lock);
+}
+
 static void destroy_attr_private_data(void *data)
 {
 	if (data)
@@ -97,6 +298,18 @@ static void destroy_tree_private_data(xmlNode * node)
 	}
 }
 
+/* Structural changes drop the header index built for inbound envelopes */
+static void tree_changed(xmlNodePtr node)
+{
+	WsXmlDocH doc = (node && node->doc) ?
+		(WsXmlDocH) node->doc->_private : NULL;
+
+	if (doc && doc->headers) {
+		u_free(doc->headers);
+		doc->headers = NULL;
+	}
+}
+
 static void
 myXmlErrorReporting (void *ctx, const char* msg, ...)
 {
@@ -117,6 +330,8 @@ void xml_parser_initialize()
 
 void xml_parser_destroy()
 {
+	free_parsers(&read_parsers);
+	free_parsers(&envelope_parsers);
 }
 
 int xml_parser_utf8_strlen(char *buf)
@@ -151,6 +366,7 @@ int xml_parser_create_doc_by_import(WsXmlDocH wsDoc, WsXmlNodeH node)
 			xmlFreeDoc(doc);
 		return 0;
 	} else {
+		doc->dict = new_doc_dict();
 		doc->_private = wsDoc;
 		wsDoc->parserDoc = doc;
 		rootNode = xmlDocCopyNode((xmlNodePtr) node, doc, 1);
@@ -165,8 +381,11 @@ int xml_parser_create_doc(WsXmlDocH wsDoc, const char *rootName)
 	xmlDocPtr doc;
 	xmlNodePtr rootNode;
 
-	if ((doc = xmlNewDoc(BAD_CAST "1.0")) == NULL ||
-			(rootNode = xmlNewNode(NULL, BAD_CAST rootName)) == NULL) {
+	if ((doc = xmlNewDoc(BAD_CAST "1.0")) != NULL)
+		doc->dict = new_doc_dict();
+	if (doc == NULL ||
+			(rootNode = xmlNewDocNode(doc, NULL, BAD_CAST rootName,
+						  NULL)) == NULL) {
 		if (doc)
 			xmlFreeDoc(doc);
 	} else {
@@ -184,6 +403,8 @@ int xml_parser_create_doc(WsXmlDocH wsDoc, const char *rootName)
 void xml_parser_destroy_doc(WsXmlDocH wsDoc)
 {
 	xmlDocPtr xmlDoc = (xmlDocPtr) wsDoc->parserDoc;
+	u_free(wsDoc->headers);
+	wsDoc->headers = NULL;
 	if (xmlDoc != NULL) {
 		destroy_tree_private_data(xmlDocGetRootElement(xmlDoc));
 		xmlFreeDoc(xmlDoc);
@@ -210,11 +431,15 @@ WsXmlDocH
 xml_parser_file_to_doc( const char *filename,
 		const char *encoding, unsigned long options)
 {
+	xmlParserCtxtPtr ctxt;
 	xmlDocPtr xmlDoc;
 	WsXmlDocH Doc = NULL;
 
-	xmlDoc = xmlReadFile(filename, encoding,
+	if ((ctxt = get_parser(&read_parsers)) == NULL)
+		return NULL;
+	xmlDoc = xmlCtxtReadFile(ctxt, filename, encoding,
 			XML_PARSE_NONET | XML_PARSE_NSCLEAN);
+	put_parser(&read_parsers, ctxt);
 	if (xmlDoc == NULL) {
 		return NULL;
 	}
@@ -235,12 +460,16 @@ xml_parser_memory_to_doc( const char *buf, size_t size,
 		const char *encoding, unsigned long options)
 {
 	WsXmlDocH Doc = NULL;
+	xmlParserCtxtPtr ctxt;
 	xmlDocPtr xmlDoc;
 	if (!buf || !size ) {
 		return NULL;
 	}
-	xmlDoc = xmlReadMemory(buf, (int) size, NULL, encoding,
+	if ((ctxt = get_parser(&read_parsers)) == NULL)
+		return NULL;
+	xmlDoc = xmlCtxtReadMemory(ctxt, buf, (int) size, NULL, encoding,
 			XML_PARSE_NONET | XML_PARSE_NSCLEAN);
+	put_parser(&read_parsers, ctxt);
 	if (xmlDoc == NULL) {
 		return NULL;
 	}
@@ -257,6 +486,324 @@ xml_parser_memory_to_doc( const char *buf, size_t size,
 }
 
 
+/*
+ * Push parser fed as the response comes in. Every child of an
+ * enumeration Items element goes to the callback once it is complete
+ * and is dropped afterwards, so the document never holds more than one
+ * item.
+ */
+struct _WsXmlStreamParser {
+	xmlParserCtxtPtr ctxt;
+	WsXmlEnumCallback callback;
+	void *data;
+	int stopped;
+	/* envelope read in two steps */
+	const char *buf;
+	size_t size;
+	size_t done;
+	int inBody;
+};
+
+static int
+is_items_node(xmlNodePtr node)
+{
+	if (node == NULL || node->type != XML_ELEMENT_NODE || node->ns == NULL ||
+			!xmlStrEqual(node->name, BAD_CAST WSENUM_ITEMS))
+		return 0;
+	return xmlStrEqual(node->ns->href, BAD_CAST XML_NS_ENUMERATION) ||
+		xmlStrEqual(node->ns->href, BAD_CAST XML_NS_WS_MAN);
+}
+
+static void
+stream_end_element(void *ctx, const xmlChar *localname,
+		const xmlChar *prefix, const xmlChar *URI)
+{
+	xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+	WsXmlStreamParser *parser = (WsXmlStreamParser *) ctxt->_private;
+	xmlNodePtr node = ctxt->node;
+	xmlNodePtr items = node ? node->parent : NULL;
+	xmlNodePtr child;
+
+	xmlSAX2EndElementNs(ctx, localname, prefix, URI);
+	if (parser->stopped || !is_items_node(items))
+		return;
+	if (parser->callback((WsXmlNodeH) node, parser->data)) {
+		parser->stopped = 1;
+		xmlStopParser(ctxt);
+	}
+	destroy_tree_private_data(items->children);
+	while ((child = items->children) != NULL) {
+		xmlUnlinkNode(child);
+		xmlFreeNode(child);
+	}
+}
+
+WsXmlStreamParser *xml_parser_stream_new(const char *encoding,
+		WsXmlEnumCallback callback, void *data)
+{
+	WsXmlStreamParser *parser;
+	xmlSAXHandler sax;
+
+	memset(&sax, 0, sizeof(sax));
+	xmlSAXVersion(&sax, 2);
+	sax.endElementNs = stream_end_element;
+	parser = u_zalloc(sizeof(*parser));
+	parser->ctxt = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, NULL);
+	if (parser->ctxt == NULL) {
+		u_free(parser);
+		return NULL;
+	}
+	use_doc_dict(parser->ctxt);
+	xmlCtxtUseOptions(parser->ctxt, XML_PARSE_NONET | XML_PARSE_NSCLEAN);
+	if (encoding)
+		xmlCtxtResetPush(parser->ctxt, NULL, 0, NULL, encoding);
+	parser->ctxt->_private = parser;
+	parser->callback = callback;
+	parser->data = data;
+	return parser;
+}
+
+int xml_parser_stream_push(WsXmlStreamParser *parser,
+		const char *buf, size_t size)
+{
+	if (parser->stopped)
+		return 1;
+	xmlParseChunk(parser->ctxt, buf, (int) size, 0);
+	return parser->stopped;
+}
+
+WsXmlDocH xml_parser_stream_finish(WsXmlStreamParser *parser)
+{
+	xmlParserCtxtPtr ctxt = parser->ctxt;
+	WsXmlDocH Doc = NULL;
+	xmlDocPtr xmlDoc;
+
+	if (!parser->stopped)
+		xmlParseChunk(ctxt, NULL, 0, 1);
+	xmlDoc = ctxt->myDoc;
+	ctxt->myDoc = NULL;
+	if (xmlDoc && (parser->stopped || !ctxt->wellFormed)) {
+		destroy_tree_private_data(xmlDocGetRootElement(xmlDoc));
+		xmlFreeDoc(xmlDoc);
+	} else if (xmlDoc) {
+		Doc = (WsXmlDocH) u_zalloc(sizeof(*Doc));
+		xmlDoc->_private = Doc;
+		Doc->parserDoc = xmlDoc;
+	}
+	xmlFreeParserCtxt(ctxt);
+	u_free(parser);
+	return Doc;
+}
+
+
+/*
+ * Request envelopes are read in two steps: up to the first element in
+ * the Body, which is enough to check and route them, and the rest only
+ * once they are accepted.
+ */
+#define ENVELOPE_CHUNK_SIZE	4096
+
+static void
+envelope_start_element(void *ctx, const xmlChar *localname,
+		const xmlChar *prefix, const xmlChar *URI,
+		int nb_namespaces, const xmlChar **namespaces,
+		int nb_attributes, int nb_defaulted,
+		const xmlChar **attributes)
+{
+	xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+	WsXmlStreamParser *parser = (WsXmlStreamParser *) ctxt->_private;
+	xmlNodePtr body;
+
+	xmlSAX2StartElementNs(ctx, localname, prefix, URI, nb_namespaces,
+			namespaces, nb_attributes, nb_defaulted, attributes);
+	body = ctxt->node ? ctxt->node->parent : NULL;
+	if (body && body->parent && body->parent->parent &&
+	    body->parent->parent->type == XML_DOCUMENT_NODE &&
+	    xmlStrEqual(body->name, BAD_CAST SOAP_BODY))
+		parser->inBody = 1;
+}
+
+static xmlParserCtxtPtr new_envelope_parser(void)
+{
+	xmlSAXHandler sax;
+
+	memset(&sax, 0, sizeof(sax));
+	xmlSAXVersion(&sax, 2);
+	sax.startElementNs = envelope_start_element;
+	return xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, NULL);
+}
+
+static void envelope_parser_free(WsXmlStreamParser *parser)
+{
+	/* the document is owned by its WsXmlDoc by now */
+	parser->ctxt->myDoc = NULL;
+	parser->ctxt->_private = NULL;
+	put_parser(&envelope_parsers, parser->ctxt);
+	u_free(parser);
+}
+
+WsXmlDocH xml_parser_envelope_head(const char *buf, size_t size,
+		const char *encoding, WsXmlStreamParser **rest)
+{
+	WsXmlStreamParser *parser;
+	xmlParserCtxtPtr ctxt;
+	xmlDocPtr xmlDoc;
+	WsXmlDocH Doc;
+
+	*rest = NULL;
+	if (!buf || !size)
+		return NULL;
+	if ((ctxt = get_parser(&envelope_parsers)) == NULL)
+		return NULL;
+	if ((parser = u_zalloc(sizeof(*parser))) == NULL) {
+		put_parser(&envelope_parsers, ctxt);
+		return NULL;
+	}
+	xmlCtxtResetPush(ctxt, NULL, 0, NULL, encoding);
+	xmlCtxtUseOptions(ctxt, XML_PARSE_NONET | XML_PARSE_NSCLEAN);
+	ctxt->_private = parser;
+	parser->ctxt = ctxt;
+	parser->buf = buf;
+	parser->size = size;
+
+	while (!parser->inBody && parser->done < size && ctxt->wellFormed) {
+		size_t chunk = size - parser->done;
+
+		if (chunk > ENVELOPE_CHUNK_SIZE)
+			chunk = ENVELOPE_CHUNK_SIZE;
+		parser->done += chunk;
+		xmlParseChunk(ctxt, buf + parser->done - chunk, (int) chunk,
+				parser->done == size);
+	}
+	xmlDoc = ctxt->myDoc;
+	if (xmlDoc == NULL || !ctxt->wellFormed ||
+	    (Doc = (WsXmlDocH) u_zalloc(sizeof(*Doc))) == NULL) {
+		if (xmlDoc) {
+			destroy_tree_private_data(xmlDocGetRootElement(xmlDoc));
+			xmlFreeDoc(xmlDoc);
+		}
+		envelope_parser_free(parser);
+		return NULL;
+	}
+	xmlDoc->_private = Doc;
+	Doc->parserDoc = xmlDoc;
+	*rest = parser;
+	return Doc;
+}
+
+int xml_parser_envelope_rest(WsXmlStreamParser *parser)
+{
+	xmlParserCtxtPtr ctxt = parser->ctxt;
+	int wellFormed;
+
+	if (parser->done < parser->size)
+		xmlParseChunk(ctxt, parser->buf + parser->done,
+				(int) (parser->size - parser->done), 1);
+	wellFormed = ctxt->wellFormed;
+	envelope_parser_free(parser);
+	return wellFormed;
+}
+
+void xml_parser_envelope_abort(WsXmlStreamParser *parser)
+{
+	envelope_parser_free(parser);
+}
+
+
+/*
+ * A look at the outline of a document without building it: only the
+ * start tags reach the callback. Entities are not substituted, external
+ * ones would be read otherwise; attribute values are decoded as the tree
+ * builder does.
+ */
+struct xml_scan {
+	WsXmlScanCallback callback;
+	void *data;
+	int depth;
+	int stopped;
+};
+
+static void
+scan_start_element(void *ctx, const xmlChar *localname,
+		const xmlChar *prefix, const xmlChar *URI,
+		int nb_namespaces, const xmlChar **namespaces,
+		int nb_attributes, int nb_defaulted,
+		const xmlChar **attributes)
+{
+	xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+	struct xml_scan *scan = (struct xml_scan *) ctxt->_private;
+	const char **attrs;
+	int i;
+
+	attrs = u_zalloc((2 * nb_attributes + 1) * sizeof(*attrs));
+	for (i = 0; i < nb_attributes; i++) {
+		const xmlChar *value = attributes[5 * i + 3];
+		int len = (int) (attributes[5 * i + 4] - value);
+
+		attrs[2 * i] = (const char *) attributes[5 * i];
+		if (memchr(value, '&', len))
+			attrs[2 * i + 1] = (char *) xmlStringLenDecodeEntities(ctxt,
+					value, len, XML_SUBSTITUTE_REF, 0, 0, 0);
+		else
+			attrs[2 * i + 1] = (char *) xmlStrndup(value, len);
+	}
+	if (scan->callback(scan->depth, (const char *) localname, attrs,
+				scan->data)) {
+		scan->stopped = 1;
+		xmlStopParser(ctxt);
+	}
+	for (i = 0; i < nb_attributes; i++)
+		xmlFree((char *) attrs[2 * i + 1]);
+	u_free(attrs);
+	scan->depth++;
+}
+
+static void
+scan_end_element(void *ctx, const xmlChar *localname,
+		const xmlChar *prefix, const xmlChar *URI)
+{
+	xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+	struct xml_scan *scan = (struct xml_scan *) ctxt->_private;
+
+	scan->depth--;
+}
+
+int xml_parser_scan_memory(const char *buf, size_t size,
+		const char *encoding, WsXmlScanCallback callback, void *data)
+{
+	xmlParserCtxtPtr ctxt;
+	xmlSAXHandler sax;
+	struct xml_scan scan;
+	int wellFormed;
+
+	if (!buf || !size)
+		return 0;
+	memset(&sax, 0, sizeof(sax));
+	sax.initialized = XML_SAX2_MAGIC;
+	sax.startElementNs = scan_start_element;
+	sax.endElementNs = scan_end_element;
+	ctxt = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, NULL);
+	if (ctxt == NULL)
+		return 0;
+	xmlCtxtUseOptions(ctxt, XML_PARSE_NONET);
+	if (encoding)
+		xmlCtxtResetPush(ctxt, NULL, 0, NULL, encoding);
+	memset(&scan, 0, sizeof(scan));
+	scan.callback = callback;
+	scan.data = data;
+	ctxt->_private = &scan;
+	xmlParseChunk(ctxt, buf, (int) size, 1);
+	wellFormed = ctxt->wellFormed && !scan.stopped;
+	/* a DTD still gets a document of its own */
+	if (ctxt->myDoc) {
+		xmlFreeDoc(ctxt->myDoc);
+		ctxt->myDoc = NULL;
+	}
+	xmlFreeParserCtxt(ctxt);
+	return wellFormed;
+}
+
+
 char *xml_parser_node_query(WsXmlNodeH node, int what)
 {
 	char *ptr = NULL;
@@ -314,12 +861,16 @@ int xml_parser_node_set(WsXmlNodeH node, int what, const char *str)
 				xmlFree(wsNode->valText);
 				wsNode->valText = NULL;
 			}
+			/* the content replaces any children */
+			if (xmlNode->children)
+				tree_changed(xmlNode);
 			xmlNodeSetContent(xmlNode, BAD_CAST str);
 			retVal = 0;
 		}
 		break;
 
 	case XML_LOCAL_NAME:
+		tree_changed(xmlNode);
 		xmlNodeSetName(xmlNode, BAD_CAST str);
 		retVal = 0;
 		break;
@@ -327,6 +878,7 @@ int xml_parser_node_set(WsXmlNodeH node, int what, const char *str)
 	case XML_NS_URI:
 		if ((xmlNs = (xmlNsPtr) xml_parser_ns_find(node, str, NULL, 1,
 						1)) != NULL) {
+			tree_changed(xmlNode);
 			xmlNode->ns = xmlNs;
 			retVal = 0;
 		} else
@@ -622,7 +1174,8 @@ make_new_xml_node(xmlNodePtr base,
 			(ns =
 			 (xmlNsPtr) xml_parser_ns_find((WsXmlNodeH) base, uri, NULL, 1,
 				 1)) != NULL) {
-		if ((newNode = xmlNewNode(ns, BAD_CAST name)) != NULL) {
+		if ((newNode = xmlNewDocNode(base ? base->doc : NULL, ns,
+						BAD_CAST name, NULL)) != NULL) {
 			if (value != NULL){		
 				if (xmlescape == 1)
 					xmlNodeAddContent(newNode, BAD_CAST value);
@@ -653,6 +1206,7 @@ xml_parser_node_add(WsXmlNodeH base,
 				? xmlBase : xmlBase->parent, nsUri,
 				localName, value, xmlescape);
 	if (newNode) {
+		tree_changed(xmlBase);
 		switch (where) {
 		case XML_ELEMENT_NEXT:
 			xmlAddNextSibling((xmlNodePtr) base, newNode);
@@ -672,6 +1226,7 @@ xml_parser_node_add(WsXmlNodeH base,
 
 int xml_parser_node_remove(WsXmlNodeH node)
 {
+	tree_changed((xmlNodePtr) node);
 	destroy_node_private_data(((xmlNodePtr) node)->_private);
 	xmlUnlinkNode((xmlNodePtr) node);
 	xmlFreeNode((xmlNodePtr) node);
@@ -689,6 +1244,7 @@ xml_parser_attr_add(WsXmlNodeH node,
 	xmlAttrPtr xmlAttr =
 		(xmlAttrPtr) ws_xml_find_node_attr(node, uri, name);
 
+	tree_changed(xmlNode);
 	if (xmlAttr != NULL)
 		ws_xml_remove_node_attr((WsXmlAttrH) xmlAttr);
 
@@ -722,6 +1278,7 @@ int xml_parser_attr_remove(WsXmlAttrH attr)
 	xmlAttrPtr xmlAttrPrev =
 		(xmlNode->properties == xmlAttr) ? NULL : xmlNode->properties;
 
+	tree_changed(xmlNode);
 	while (xmlAttrPrev != NULL && xmlAttrPrev->next != xmlAttr) {
 		xmlAttrPrev = xmlAttrPrev->next;
 	}
@@ -845,6 +1402,61 @@ void xml_parser_doc_dump_memory_enc(WsXmlDocH doc, char **buf, int *ptrSize, con
 	return;
 }
 
+static int dump_to_buf(void *context, const char *buffer, int len)
+{
+	if (len > 0 && u_buf_append((u_buf_t *) context, (void *) buffer, len))
+		return -1;
+	return len;
+}
+
+static int dump_to_count(void *context, const char *buffer, int len)
+{
+	*(size_t *) context += len;
+	return len;
+}
+
+/* Same output as xml_parser_doc_to_memory(), handed to write */
+static int dump_doc_io(WsXmlDocH doc, const char *encoding,
+		xmlOutputWriteCallback write, void *context)
+{
+	xmlSaveCtxtPtr save = xmlSaveToIO(write, NULL, context,
+			encoding ? encoding : "UTF-8", 0);
+
+	if (save == NULL)
+		return -1;
+	xmlSaveDoc(save, (xmlDocPtr) doc->parserDoc);
+	return xmlSaveClose(save) < 0 ? -1 : 0;
+}
+
+int xml_parser_doc_dump_buf_enc(WsXmlDocH doc, u_buf_t *buf, const char *encoding)
+{
+	u_buf_clear(buf);
+	return dump_doc_io(doc, encoding, dump_to_buf, buf);
+}
+
+int xml_parser_doc_dump_size(WsXmlDocH doc, const char *encoding, size_t *size)
+{
+	*size = 0;
+	return dump_doc_io(doc, encoding, dump_to_count, size);
+}
+
+/*
+ * Markup written elsewhere goes in as a text node that is dumped as is.
+ * The node takes markup, which must come from malloc().
+ */
+WsXmlNodeH xml_parser_node_add_markup(WsXmlNodeH base, char *markup)
+{
+	xmlNodePtr parent = (xmlNodePtr) base;
+	xmlNodePtr node = xmlNewDocTextLen(parent->doc, NULL, 0);
+
+	if (node == NULL)
+		return NULL;
+	node->name = xmlStringTextNoenc;
+	node->content = BAD_CAST markup;
+	tree_changed(parent);
+	return (WsXmlNodeH) xmlAddChild(parent, node);
+}
+
 static void
 register_namespaces(xmlXPathContextPtr ctxt, WsXmlDocH doc,
 		WsXmlNodeH node)
@@ -955,6 +1567,7 @@ char *xml_parser_get_xpath_value(WsXmlDocH doc, const char *expression)
 
 void xml_parser_unlink_node(WsXmlNodeH node)
 {
+	tree_changed((xmlNodePtr) node);
 	xmlUnlinkNode((xmlNodePtr) node);
 	xmlFreeNode((xmlNodePtr) node);
 	return;
@@ -968,6 +1581,7 @@ void xml_parser_node_set_lang(WsXmlNodeH node,  const char *lang)
 
 void xml_parser_set_ns(WsXmlNodeH r, WsXmlNsH ns, const char *prefix)
 {
+	tree_changed((xmlNodePtr) r);
 	xmlSetNs((xmlNodePtr) r, (xmlNsPtr) ns);
 }
 
@@ -976,7 +1590,71 @@ void xml_parser_copy_node(WsXmlNodeH src, WsXmlNodeH dst)
 	if (src && dst) {
 		xmlNodePtr x = xmlDocCopyNode((xmlNodePtr) src,
 				   ((xmlDocPtr) src)->doc, 1);
-		if (x)
+		if (x) {
+			tree_changed((xmlNodePtr) dst);
 			xmlAddChild((xmlNodePtr) dst, x);
+		}
 	}
 }
+
+const char *xml_parser_intern(const char *str)
+{
+	size_t len;
+	unsigned int h;
+	const xmlChar *interned;
+
+	if (str == NULL || get_names_dict() == NULL)
+		return NULL;
+	len = strlen(str);
+	h = names_hash(str, len);
+	while ((interned = names_table[h % NAMES_TABLE_SIZE]) != NULL) {
+		if (!strcmp((char *) interned, str))
+			return (const char *) interned;
+		h++;
+	}
+	return NULL;
+}
+
+static int node_is_qname(xmlNodePtr node, const WsXmlQName *qname)
+{
+	if (qname->ns) {
+		xmlNsPtr ns = node->ns;
+
+		if (ns == NULL || ns->href == NULL)
+			return 0;
+		if (qname->internedNs) {
+			if (ns->_private == NULL) {
+				const char *href = xml_parser_intern((char *) ns->href);
+				ns->_private = (void *) (href ? href : &unknown_ns);
+			}
+			if (ns->_private != qname->internedNs)
+				return 0;
+		} else if ((char *) ns->href != qname->ns &&
+			   strcmp((char *) ns->href, qname->ns)) {
+			return 0;
+		}
+	}
+	if (qname->name && (char *) node->name != qname->internedName &&
+	    (node->name[0] != qname->name[0] ||
+	     strcmp((char *) node->name, qname->name)))
+		return 0;
+	return 1;
+}
+
+int xml_parser_node_is_qname(WsXmlNodeH node, const WsXmlQName *qname)
+{
+	return node_is_qname((xmlNodePtr) node, qname);
+}
+
+WsXmlNodeH xml_parser_get_child_qname(WsXmlNodeH parent, int index,
+		const WsXmlQName *qname)
+{
+	xmlNodePtr node;
+
+	for (node = ((xmlNodePtr) parent)->children; node; node = node->next) {
+		if (node->type == XML_ELEMENT_NODE && node_is_qname(node, qname) &&
+		    index-- == 0)
+			return (WsXmlNodeH) node;
+	}
+	return NULL;
+}
@@ -166,8 +166,35 @@ void wsman_event_init(void *arg)
 {
 	SoapH soap = (SoapH)arg;
 	WsContextH cntx = soap->cntx;
-	SubsRepositoryOpSetH ops = wsman_init_subscription_repository(cntx, (char *)wsman_server_get_subscription_repos());
-	list_t *subs_list = list_create(-1);
+	WsManListenerH *listener = (WsManListenerH *)soap->listener;
+	dictionary *ini = listener ? listener->config : NULL;
+	SubsRepositoryOpSetH ops;
+	list_t *subs_list;
+
+	if (ini) {
+		LogEventPoolConfig config;
+		config.path = iniparser_getstr(ini, "server:event_pool");
+		config.segment_size = iniparser_getint(ini, "server:event_pool_segment_size", 0);
+		config.sync_batch = iniparser_getint(ini, "server:event_pool_sync_batch", 0);
+		config.max_segments = iniparser_getint(ini, "server:event_pool_max_segments", 0);
+		config.max_pull_events = 0;
+		soap->deliveryRetryCount = iniparser_getint(ini, "server:event_delivery_retries",
+			WSE_DELIVERY_RETRY_COUNT);
+		soap->deliveryRetryInterval = 1000 * iniparser_getint(ini, "server:event_delivery_retry_interval",
+			WSE_DELIVERY_RETRY_INTERVAL / 1000);
+		soap->deliveryRetryMaxInterval = 1000 * iniparser_getint(ini, "server:event_delivery_retry_max_interval",
+			WSE_DELIVERY_RETRY_MAX_INTERVAL / 1000);
+		if (config.path)
+			wsman_init_log_event_pool(cntx, &config);
+		cim_indication_ingest_init(iniparser_getint(ini, "server:cim_indication_queue_size",
+			CIMXML_INGEST_QUEUE_SIZE));
+	}
+	/* queued events of subscriptions expired meanwhile are dropped below */
+	if (soap->eventpoolOpSet == NULL)
+		wsman_init_event_pool(cntx, NULL);
+
+	ops = wsman_init_subscription_repository(cntx, (char *)wsman_server_get_subscription_repos());
+	subs_list = list_create(-1);
 	debug("subscription_repository_uri = %s", soap->uri_subsRepository);
 	if(ops->load_subscription(soap->uri_subsRepository, subs_list) == 0) {
 		lnode_t *node = list_first(subs_list);
@@ -187,7 +214,12 @@ void wsman_event_init(void *arg)
 		}
 	}
 	list_destroy(subs_list);
-	wsman_init_event_pool(cntx, NULL);
+}
+
+void wsman_event_shutdown(void *arg)
+{
+	/* indications already acknowledged go to the event pool first */
+	cim_indication_ingest_shutdown();
 }
 
 void wsman_receive_cim_indication(void *arg, char *uuid, void *msg)
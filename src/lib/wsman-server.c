@@ -159,6 +159,20 @@ wsman_init_event_pool(WsContextH cntx, void*data)
 	return soap->eventpoolOpSet;
 }
 
+EventPoolOpSetH
+wsman_init_log_event_pool(WsContextH cntx, LogEventPoolConfig *config)
+{
+	SoapH soap = ws_context_get_runtime(cntx);
+	if(soap) {
+		soap->eventpoolOpSet = wsman_get_log_eventpool_opset();
+		if(soap->eventpoolOpSet->init(config)) {
+			error("event pool %s not usable, events are kept in memory only", config->path);
+			return wsman_init_event_pool(cntx, NULL);
+		}
+	}
+	return soap->eventpoolOpSet;
+}
+
 int wsman_clean_subsrepository(SoapH soap, SubsRepositoryEntryH entry)
 {
 	int retVal = 0;
@@ -173,6 +187,8 @@ int wsman_clean_subsrepository(SoapH soap, SubsRepositoryEntryH entry)
 			if(node == NULL) { //No specified expiration, delete it
 				debug("subscription %s deleted from the repository", entry->uuid);
 				soap->subscriptionOpSet->delete_subscription(soap->uri_subsRepository, entry->uuid+5);
+				if(soap->eventpoolOpSet)
+					soap->eventpoolOpSet->clear(entry->uuid+5, NULL);
 				retVal = 1;
 			}
 			else {
@@ -181,6 +197,8 @@ int wsman_clean_subsrepository(SoapH soap, SubsRepositoryEntryH entry)
 					if(time_expired(expire)) {
 						debug("subscription %s deleted from the repository", entry->uuid);
 						soap->subscriptionOpSet->delete_subscription(soap->uri_subsRepository, entry->uuid+5);
+						if(soap->eventpoolOpSet)
+							soap->eventpoolOpSet->clear(entry->uuid+5, NULL);
 						retVal = 1;
 					}
 				}
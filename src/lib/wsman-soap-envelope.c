@@ -48,6 +48,7 @@
 #include "wsman-client-api.h"
 #include "wsman-soap.h"
 #include "wsman-xml.h"
+#include "wsman-xml-binding.h"
 #include "wsman-xml-serializer.h"
 
 #include "wsman-faults.h"
@@ -103,25 +104,23 @@ wsman_create_response_envelope(WsXmlDocH rqstDoc, const char *action)
 {
 
 	WsXmlDocH doc = ws_xml_create_envelope();
-	WsXmlNodeH dstHeader, srcHeader, srcNode;
+	WsXmlNodeH dstHeader, srcNode;
 	if (wsman_is_identify_request(rqstDoc))
 		return doc;
 	if (!doc)
 		return NULL;
 
 	dstHeader = ws_xml_get_soap_header(doc);
-	srcHeader = ws_xml_get_soap_header(rqstDoc);
 
-	srcNode = ws_xml_get_child(srcHeader, 0, XML_NS_ADDRESSING,
-			     WSA_REPLY_TO);
+	srcNode = wsman_get_header(rqstDoc, WSMAN_HEADER_REPLY_TO);
 	wsman_epr_from_request_to_response(dstHeader, srcNode);
 
 	if (action != NULL) {
 		ws_xml_add_child(dstHeader, XML_NS_ADDRESSING, WSA_ACTION,
 				 action);
 	} else {
-		if ((srcNode = ws_xml_get_child(srcHeader, 0, XML_NS_ADDRESSING,
-				      WSA_ACTION)) != NULL) {
+		if ((srcNode = wsman_get_header(rqstDoc,
+					WSMAN_HEADER_ACTION)) != NULL) {
 			if ((action = ws_xml_get_node_text(srcNode)) != NULL) {
 				size_t len = strlen(action) + sizeof(WSFW_RESPONSE_STR) + 2;
 				char *tmp = (char *) u_malloc(sizeof(char) * len);
@@ -135,8 +134,8 @@ wsman_create_response_envelope(WsXmlDocH rqstDoc, const char *action)
 		}
 	}
 
-	if ((srcNode = ws_xml_get_child(srcHeader, 0, XML_NS_ADDRESSING,
-					WSA_MESSAGE_ID)) != NULL) {
+	if ((srcNode = wsman_get_header(rqstDoc,
+					WSMAN_HEADER_MESSAGE_ID)) != NULL) {
 		ws_xml_add_child(dstHeader, XML_NS_ADDRESSING, WSA_RELATES_TO,
 				 ws_xml_get_node_text(srcNode));
 	}
@@ -151,8 +150,9 @@ wsman_create_response_envelope(WsXmlDocH rqstDoc, const char *action)
 int wsman_check_identify(WsmanMessage * msg)
 {
 	int ret = 0;
-	WsXmlDocH doc = ws_xml_read_memory( u_buf_ptr(msg->request),
-					   u_buf_len(msg->request), msg->charset,  0);
+	WsXmlStreamParser *rest;
+	WsXmlDocH doc = ws_xml_read_envelope_head( u_buf_ptr(msg->request),
+					   u_buf_len(msg->request), msg->charset, &rest);
 
 	if (doc == NULL) {
 		return 0;
@@ -160,24 +160,29 @@ int wsman_check_identify(WsmanMessage * msg)
 	if (wsman_is_identify_request(doc)) {
 		ret = 1;
 	}
+	ws_xml_read_envelope_abort(rest);
 	ws_xml_destroy_doc(doc);
 	return ret;
 }
 
 /**
- * Buid Inbound Envelope
- * @param buf Message buffer
- * @return XML document with Envelope
+ * Build the header of an inbound envelope, enough to check and route it
+ * @param msg Message data
+ * @param rest Set to the parser of the Body, for wsman_build_inbound_body()
+ * or ws_xml_read_envelope_abort()
+ * @return XML document read up to the first element of the Body
  */
-WsXmlDocH wsman_build_inbound_envelope(WsmanMessage * msg)
+WsXmlDocH wsman_build_inbound_header(WsmanMessage * msg,
+		WsXmlStreamParser **rest)
 {
-	WsXmlDocH doc = ws_xml_read_memory( u_buf_ptr(msg->request),
-					   u_buf_len(msg->request), msg->charset,  0);
+	WsXmlDocH doc = ws_xml_read_envelope_head( u_buf_ptr(msg->request),
+					   u_buf_len(msg->request), msg->charset, rest);
 
 	if (doc == NULL) {
 		wsman_set_fault(msg, WSA_INVALID_MESSAGE_INFORMATION_HEADER, 0, NULL);
 		return NULL;
 	}
+	wsman_index_headers(doc);
 	if (wsman_is_identify_request(doc)) {
 		wsman_set_message_flags(msg, FLAG_IDENTIFY_REQUEST);
 	}
@@ -185,6 +190,130 @@ WsXmlDocH wsman_build_inbound_envelope(WsmanMessage * msg)
 	return doc;
 }
 
+/**
+ * Build the Body of an inbound envelope
+ * @param msg Message data
+ * @param doc XML document from wsman_build_inbound_header()
+ * @param rest Parser from wsman_build_inbound_header(), freed
+ * @return The complete document, NULL if it is not well-formed
+ * (doc is destroyed then)
+ */
+WsXmlDocH wsman_build_inbound_body(WsmanMessage * msg, WsXmlDocH doc,
+		WsXmlStreamParser *rest)
+{
+	if (!ws_xml_read_envelope_rest(rest)) {
+		ws_xml_destroy_doc(doc);
+		wsman_set_fault(msg, WSA_INVALID_MESSAGE_INFORMATION_HEADER, 0, NULL);
+		return NULL;
+	}
+	return doc;
+}
+
+/**
+ * Buid Inbound Envelope
+ * @param buf Message buffer
+ * @return XML document with Envelope
+ */
+WsXmlDocH wsman_build_inbound_envelope(WsmanMessage * msg)
+{
+	WsXmlStreamParser *rest;
+	WsXmlDocH doc = wsman_build_inbound_header(msg, &rest);
+
+	if (doc != NULL)
+		doc = wsman_build_inbound_body(msg, doc, rest);
+	return doc;
+}
+
+static const struct {
+	const char *ns;
+	const char *name;
+} header_names[WSMAN_HEADER_COUNT] = {
+	{ XML_NS_ADDRESSING, WSA_ACTION },
+	{ XML_NS_ADDRESSING, WSA_TO },
+	{ XML_NS_ADDRESSING, WSA_MESSAGE_ID },
+	{ XML_NS_ADDRESSING, WSA_REPLY_TO },
+	{ XML_NS_ADDRESSING, WSA_FAULT_TO },
+	{ XML_NS_WS_MAN, WSM_RESOURCE_URI },
+	{ XML_NS_WS_MAN, WSM_SELECTOR_SET },
+	{ XML_NS_WS_MAN, WSM_OPTION_SET },
+	{ XML_NS_WS_MAN, WSM_MAX_ENVELOPE_SIZE },
+	{ XML_NS_WS_MAN, WSM_OPERATION_TIMEOUT },
+	{ XML_NS_WS_MAN, WSM_LOCALE },
+	{ XML_NS_WS_MAN, WSM_FRAGMENT_TRANSFER },
+	{ XML_NS_WS_MAN, WSM_REQUEST_TOTAL }
+};
+
+/**
+ * Index the SOAP header of a document
+ * @param doc XML document
+ * @return Header index, kept with the document until the tree changes
+ */
+WsmanHeaderIndex *wsman_index_headers(WsXmlDocH doc)
+{
+	WsmanHeaderIndex *index;
+	WsXmlNodeH header, child;
+	char *soapNsUri = NULL;
+	int i, count = 0;
+
+	u_free(doc->headers);
+	doc->headers = NULL;
+	header = ws_xml_get_soap_header(doc);
+	if (header) {
+		count = ws_xml_get_child_count(header);
+		soapNsUri = ws_xml_get_node_name_ns(header);
+	}
+	index = u_zalloc(sizeof(*index) + count * sizeof(WsXmlNodeH));
+	if (index == NULL)
+		return NULL;
+	index->header = header;
+	index->identify = ws_xml_get_child(ws_xml_get_soap_body(doc), 0,
+					   XML_NS_WSMAN_ID, WSMID_IDENTIFY);
+	child = header ? xml_parser_get_first_child(header) : NULL;
+	for (; child != NULL; child = xml_parser_get_next_child(child)) {
+		char *ns = ws_xml_get_node_name_ns(child);
+		char *name = ws_xml_get_node_local_name(child);
+
+		for (i = 0; ns && i < WSMAN_HEADER_COUNT; i++) {
+			if (index->elements[i] == NULL &&
+			    !strcmp(name, header_names[i].name) &&
+			    !strcmp(ns, header_names[i].ns)) {
+				index->elements[i] = child;
+				break;
+			}
+		}
+		if (ws_xml_find_attr_bool(child, soapNsUri, SOAP_MUST_UNDERSTAND))
+			index->mustUnderstand[index->mustUnderstandCount++] = child;
+	}
+	doc->headers = index;
+	return index;
+}
+
+/**
+ * Get the header index of a document
+ * @param doc XML document
+ * @return Header index, NULL if the document has none
+ */
+WsmanHeaderIndex *wsman_get_header_index(WsXmlDocH doc)
+{
+	return doc ? doc->headers : NULL;
+}
+
+/**
+ * Get a SOAP header element
+ * @param doc XML document
+ * @param which One of WSMAN_HEADER_*
+ * @return First header element of that name
+ */
+WsXmlNodeH wsman_get_header(WsXmlDocH doc, int which)
+{
+	if (doc == NULL)
+		return NULL;
+	if (doc->headers)
+		return doc->headers->elements[which];
+	return ws_xml_get_child(ws_xml_get_soap_header(doc), 0,
+				header_names[which].ns, header_names[which].name);
+}
+
 /**
  * Get SOAP header value
  * @param fw SOAP Framework handle
@@ -215,7 +344,12 @@ char *wsman_get_soap_header_value( WsXmlDocH doc, const char *nsUri, const char
 WsXmlNodeH
 wsman_get_soap_header_element(WsXmlDocH doc, const char *nsUri, const char *name)
 {
-	WsXmlNodeH node = ws_xml_get_soap_header(doc);
+	WsXmlNodeH node;
+
+	if (doc && doc->headers)
+		node = doc->headers->header;
+	else
+		node = ws_xml_get_soap_header(doc);
 	if (node && name) {
 		node = ws_xml_find_in_tree(node, nsUri, name, 1);
 	}
@@ -342,18 +476,12 @@ int wsman_is_valid_envelope(WsmanMessage * msg, WsXmlDocH doc)
 	} else {
 		if (!wsman_is_identify_request(doc) && !wsman_is_event_related_request(doc)) {
 			WsXmlNodeH resource_uri =
-			    ws_xml_get_child(header, 0,
-					     XML_NS_WS_MAN,
-					     WSM_RESOURCE_URI);
-			WsXmlNodeH action = ws_xml_get_child(header, 0,
-							     XML_NS_ADDRESSING,
-							     WSA_ACTION);
-			WsXmlNodeH reply = ws_xml_get_child(header, 0,
-							    XML_NS_ADDRESSING,
-							    WSA_REPLY_TO);
-			WsXmlNodeH to = ws_xml_get_child(header, 0,
-							 XML_NS_ADDRESSING,
-							 WSA_TO);
+			    wsman_get_header(doc, WSMAN_HEADER_RESOURCE_URI);
+			WsXmlNodeH action =
+			    wsman_get_header(doc, WSMAN_HEADER_ACTION);
+			WsXmlNodeH reply =
+			    wsman_get_header(doc, WSMAN_HEADER_REPLY_TO);
+			WsXmlNodeH to = wsman_get_header(doc, WSMAN_HEADER_TO);
 			if (!resource_uri) {
 				wsman_set_fault(msg,
 						WSA_DESTINATION_UNREACHABLE,
@@ -763,17 +891,16 @@ wsman_get_option_set(WsContextH cntx, WsXmlDocH doc,
 	char *optval = NULL;
 	int index = 0;
 	WsXmlNodeH node, option;
+	WsXmlQName qname;
 	if (doc == NULL) {
 		doc = cntx->indoc;
 		if (!doc)
 			return NULL;
 	}
 
-	node = ws_xml_get_soap_header(doc);
-	if (node && (node = ws_xml_get_child(node, 0,
-					XML_NS_WS_MAN, WSM_OPTION_SET))) {
-		while ((option = ws_xml_get_child(node, index++, XML_NS_WS_MAN,
-						WSM_OPTION))) {
+	if ((node = wsman_get_header(doc, WSMAN_HEADER_OPTION_SET))) {
+		ws_xml_qname_init(&qname, XML_NS_WS_MAN, WSM_OPTION);
+		while ((option = ws_xml_get_child_qname(node, index++, &qname))) {
 			char *attrVal = ws_xml_find_attr_value(option, NULL,
 					WSM_NAME);
 			if (attrVal && strcmp(attrVal, op ) == 0 ) {
@@ -827,12 +954,11 @@ unsigned long wsman_get_max_envelope_size(WsContextH cntx, WsXmlDocH doc)
 	char *mu = NULL;
 	if (doc == NULL)
 		doc = cntx->indoc;
-	header = ws_xml_get_soap_header(doc);
-	maxsize = ws_xml_get_child(header, 0, XML_NS_WS_MAN,
-			     WSM_MAX_ENVELOPE_SIZE);
+	maxsize = wsman_get_header(doc, WSMAN_HEADER_MAX_ENVELOPE_SIZE);
 	mu = ws_xml_find_attr_value(maxsize, XML_NS_SOAP_1_2,
 				    SOAP_MUST_UNDERSTAND);
 	if (mu != NULL && strcmp(mu, "true") == 0) {
+		header = ws_xml_get_soap_header(doc);
 		size = ws_deserialize_uint32(NULL, header,
 					     0, XML_NS_WS_MAN,
 					     WSM_MAX_ENVELOPE_SIZE);
@@ -842,13 +968,11 @@ unsigned long wsman_get_max_envelope_size(WsContextH cntx, WsXmlDocH doc)
 
 char * wsman_get_fragment_string(WsContextH cntx, WsXmlDocH doc)
 {
-	WsXmlNodeH header, n;
+	WsXmlNodeH n;
 	char *mu = NULL;
 	if(doc == NULL)
 		doc = cntx->indoc;
-	header = ws_xml_get_soap_header(doc);
-	n = ws_xml_get_child(header, 0, XML_NS_WS_MAN,
-			     WSM_FRAGMENT_TRANSFER);
+	n = wsman_get_header(doc, WSMAN_HEADER_FRAGMENT_TRANSFER);
 	if (n != NULL) {
 		mu = ws_xml_find_attr_value(n, XML_NS_SOAP_1_2,
 					    SOAP_MUST_UNDERSTAND);
@@ -927,7 +1051,7 @@ char *
 wsman_get_resource_uri(WsContextH cntx, WsXmlDocH doc)
 {
 	char *val = NULL;
-	WsXmlNodeH header, node;
+	WsXmlNodeH node;
 
 	if (doc == NULL) {
 		doc = cntx->indoc;
@@ -935,9 +1059,7 @@ wsman_get_resource_uri(WsContextH cntx, WsXmlDocH doc)
 			return NULL;
 	}
 
-	header = ws_xml_get_soap_header(doc);
-	node = ws_xml_get_child(header, 0, XML_NS_WS_MAN,
-				WSM_RESOURCE_URI);
+	node = wsman_get_header(doc, WSMAN_HEADER_RESOURCE_URI);
 	val = (!node) ? NULL : ws_xml_get_node_text(node);
 	return val;
 }
@@ -1080,7 +1202,6 @@ wsman_get_selectors_from_epr(WsContextH cntx, WsXmlNodeH epr_node)
 						   WSM_NAME);
 
 		if (attrVal && !hash_lookup(h, attrVal)) {
-			sentry = u_malloc(sizeof(*sentry));
 			epr = ws_xml_get_child(selector, 0, XML_NS_ADDRESSING,
 					WSA_EPR);
 			if (epr) {
@@ -1181,9 +1302,9 @@ wsman_get_selector(WsContextH cntx,
 	if (doc == NULL)
 		doc = cntx->indoc;
 	if (doc) {
-		WsXmlNodeH header = ws_xml_get_soap_header(doc);
-		WsXmlNodeH node = ws_xml_get_child(header, index, XML_NS_WS_MAN,
-				     WSM_SELECTOR_SET);
+		WsXmlNodeH node = index ? ws_xml_get_child(ws_xml_get_soap_header(doc),
+				index, XML_NS_WS_MAN, WSM_SELECTOR_SET) :
+			wsman_get_header(doc, WSMAN_HEADER_SELECTOR_SET);
 
 		if (node) {
 			WsXmlNodeH selector;
@@ -1215,9 +1336,7 @@ char *wsman_get_action(WsContextH cntx, WsXmlDocH doc)
 		doc = cntx->indoc;
 	}
 	if (doc) {
-		WsXmlNodeH header = ws_xml_get_soap_header(doc);
-		WsXmlNodeH node = ws_xml_get_child(header, 0, XML_NS_ADDRESSING,
-				     WSA_ACTION);
+		WsXmlNodeH node = wsman_get_header(doc, WSMAN_HEADER_ACTION);
 		val = (!node) ? NULL : ws_xml_get_node_text(node);
 	}
 	return val;
@@ -1280,9 +1399,7 @@ void
 wsman_set_estimated_total(WsXmlDocH in_doc,
 			  WsXmlDocH out_doc, WsEnumerateInfo * enumInfo)
 {
-	WsXmlNodeH header = ws_xml_get_soap_header(in_doc);
-	if (ws_xml_get_child(header, 0,
-			     XML_NS_WS_MAN, WSM_REQUEST_TOTAL) != NULL) {
+	if (wsman_get_header(in_doc, WSMAN_HEADER_REQUEST_TOTAL) != NULL) {
 		if (out_doc) {
 			WsXmlNodeH response_header =
 			    ws_xml_get_soap_header(out_doc);
@@ -1311,10 +1428,9 @@ void wsman_add_namespace_as_selector(WsXmlDocH doc, const char *_namespace)
 
 void wsman_add_fragement_for_header(WsXmlDocH indoc, WsXmlDocH outdoc)
 {
-	WsXmlNodeH inheader, outheader;
+	WsXmlNodeH outheader;
 	WsXmlNodeH fragmentnode;
-	inheader = ws_xml_get_soap_header(indoc);
-	fragmentnode = ws_xml_get_child(inheader, 0, XML_NS_WS_MAN, WSM_FRAGMENT_TRANSFER);
+	fragmentnode = wsman_get_header(indoc, WSMAN_HEADER_FRAGMENT_TRANSFER);
 	if(fragmentnode == NULL)
 		return;
 	outheader = ws_xml_get_soap_header(outdoc);
@@ -1324,7 +1440,11 @@ void wsman_add_fragement_for_header(WsXmlDocH indoc, WsXmlDocH outdoc)
 
 int wsman_is_identify_request(WsXmlDocH doc)
 {
-	WsXmlNodeH node = ws_xml_get_soap_body(doc);
+	WsXmlNodeH node;
+
+	if (doc && doc->headers)
+		return doc->headers->identify != NULL;
+	node = ws_xml_get_soap_body(doc);
 	node = ws_xml_get_child(node, 0, XML_NS_WSMAN_ID, WSMID_IDENTIFY);
 	if (node)
 		return 1;
@@ -1334,9 +1454,8 @@ int wsman_is_identify_request(WsXmlDocH doc)
 
 int wsman_is_event_related_request(WsXmlDocH doc)
 {
-	WsXmlNodeH node = ws_xml_get_soap_header(doc);
+	WsXmlNodeH node = wsman_get_header(doc, WSMAN_HEADER_ACTION);
 	char *action = NULL;
-	node = ws_xml_get_child(node, 0, XML_NS_ADDRESSING, WSA_ACTION);
 	action = ws_xml_get_node_text(node);
 	if (!action)
 		return 0;
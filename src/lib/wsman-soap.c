@@ -47,6 +47,7 @@
 #include "wsman-dispatcher.h"
 #include "wsman-xml-serializer.h"
 #include "wsman-xml-serialize.h"
+#include "wsman-xml-writer.h"
 #include "wsman-soap-envelope.h"
 #include "wsman-faults.h"
 #include "wsman-soap-message.h"
@@ -59,6 +60,18 @@
 	((enumInfo->expires > 0) &&        \
 	(enumInfo->expires > mytime))
 
+/* request contexts: arena chunk size and entry hash chains */
+#define WS_CONTEXT_ARENA_SIZE	4096
+#define WS_CONTEXT_CHAINS	16
+
+/*
+ * Entries of a request context are seen by its own request only, those
+ * of the runtime context by all requests, under soap->lockEntries
+ */
+#define WS_CONTEXT_SHARED(cntx)	((cntx)->arena == NULL && (cntx)->soap != NULL)
+
+static void remove_context_entry(WsContextH cntx, const char *name);
+
 
 
 /**
@@ -116,17 +129,25 @@ set_context_val(WsContextH cntx,
 		void *ptr = val;
 
 		if (!no_dup) {
-			if (val && (ptr = u_malloc(size))) {
+			if (val && (ptr = cntx->arena ?
+					u_arena_alloc(cntx->arena, size) : u_malloc(size))) {
 				memcpy(ptr, val, size);
 			}
 		}
 		if (ptr || val == NULL) {
-			u_lock(cntx->soap);
-			ws_remove_context_val(cntx, name);
-			if (create_context_entry(cntx->entries, name, ptr)) {
+			int shared = WS_CONTEXT_SHARED(cntx);
+			if (shared)
+				u_rwlock_wrlock(&cntx->soap->lockEntries);
+			remove_context_entry(cntx, name);
+			if (cntx->arena) {
+				char *key = u_arena_strdup(cntx->arena, name);
+				if (key && hash_alloc_insert(cntx->entries, key, ptr))
+					retVal = 0;
+			} else if (create_context_entry(cntx->entries, name, ptr)) {
 				retVal = 0;
 			}
-			u_unlock(cntx->soap);
+			if (shared)
+				u_rwlock_unlock(&cntx->soap->lockEntries);
 		}
 	} else {
 		error("error setting context value.");
@@ -142,20 +163,32 @@ free_hentry_func(hnode_t * n, void *arg)
 	u_free(n);
 }
 
+static hnode_t *
+arena_hnode_alloc(void *arena)
+{
+	return u_arena_alloc(arena, sizeof(hnode_t));
+}
+
+static void
+arena_hnode_free(hnode_t * n, void *arena)
+{
+	/* released with the arena */
+}
+
 
 static void
 remove_locked_enuminfo(WsContextH cntx,
                        WsEnumerateInfo * enumInfo)
 {
-	u_lock(cntx->soap);
+	u_mutex_lock(&cntx->soap->lockEnum);
 	if (!(enumInfo->flags & WSMAN_ENUMINFO_INWORK_FLAG)) {
 		error("locked enuminfo unlocked");
-		u_unlock(cntx->soap);
+		u_mutex_unlock(&cntx->soap->lockEnum);
 		return;
 	}
 	hash_delete_free(cntx->enuminfos,
 	             hash_lookup(cntx->enuminfos, enumInfo->enumId));
-	u_unlock(cntx->soap);
+	u_mutex_unlock(&cntx->soap->lockEnum);
 }
 
 #ifdef ENABLE_EVENTING_SUPPORT
@@ -183,13 +216,30 @@ static void delete_notification_info(WsNotificationInfoH notificationInfo) {
 #endif
 
 
+/* subscription identifiers are matched case-insensitively */
+static int
+subs_id_compare(const void *key1, const void *key2)
+{
+	return strcasecmp((const char *)key1, (const char *)key2);
+}
+
+static hash_val_t
+subs_id_hash(const void *key)
+{
+	const unsigned char *p = key;
+	hash_val_t h = 2166136261U;
+	while (*p) {
+		h ^= tolower(*p++);
+		h *= 16777619U;
+	}
+	return h;
+}
+
 static WsSubscribeInfo*
 search_pull_subs_info(SoapH soap, WsXmlDocH indoc)
 {
-	WsSubscribeInfo *subsInfo = NULL;
+#ifdef ENABLE_EVENTING_SUPPORT
 	char *uuid = NULL;
-	lnode_t *lnode;
-	WsContextH soapCntx = ws_get_soap_context(soap);
 	WsXmlNodeH node = ws_xml_get_soap_body(indoc);
 
 	node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_PULL);
@@ -197,17 +247,11 @@ search_pull_subs_info(SoapH soap, WsXmlDocH indoc)
 		node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_ENUMERATION_CONTEXT);
 		uuid = ws_xml_get_node_text(node);
 	}
-	if(uuid == NULL) return subsInfo;
-	pthread_mutex_lock(&soap->lockSubs);
-	lnode = list_first(soapCntx->subscriptionMemList);
-	while(lnode) {
-		subsInfo = (WsSubscribeInfo *)lnode->list_data;
-		if(!strcmp(subsInfo->subsId, uuid+5)) break;
-		lnode = list_next(soapCntx->subscriptionMemList, lnode);
-	}
-	pthread_mutex_unlock(&soap->lockSubs);
-	if(lnode == NULL) return NULL;
-	return subsInfo;
+	if(uuid == NULL || strlen(uuid) < 5) return NULL;
+	return wse_get_subscription(soap, uuid+5);
+#else
+	return NULL;
+#endif
 }
 
 
@@ -344,13 +388,13 @@ insert_enum_info(WsContextH cntx,
 	struct timeval tv;
 	int retVal = 1;
 
-	u_lock(cntx->soap);
+	u_mutex_lock(&cntx->soap->lockEnum);
 	gettimeofday(&tv, NULL);
 	enumInfo->timeStamp = tv.tv_sec;
 	if (create_context_entry(cntx->enuminfos, enumInfo->enumId, enumInfo)) {
 		retVal = 0;
 	}
-	u_unlock(cntx->soap);
+	u_mutex_unlock(&cntx->soap->lockEnum);
 	return retVal;
 }
 
@@ -382,7 +426,7 @@ get_locked_enuminfo(WsContextH cntx,
 		status->fault_code = WSEN_INVALID_ENUMERATION_CONTEXT;
 		return NULL;
 	}
-	u_lock(cntx->soap);
+	u_mutex_lock(&cntx->soap->lockEnum);
 	hn = hash_lookup(cntx->enuminfos, enumId);
 	if (hn) {
 		eInfo = (WsEnumerateInfo *)hnode_get(hn);
@@ -404,7 +448,7 @@ get_locked_enuminfo(WsContextH cntx,
 	if (status->fault_code != WSMAN_RC_OK) {
 		eInfo = NULL;
 	}
-	u_unlock(cntx->soap);
+	u_mutex_unlock(&cntx->soap->lockEnum);
 	return eInfo;
 }
 
@@ -413,22 +457,22 @@ unlock_enuminfo(WsContextH cntx, WsEnumerateInfo *enumInfo)
 {
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	u_lock(cntx->soap);
+	u_mutex_lock(&cntx->soap->lockEnum);
 	if (!(enumInfo->flags & WSMAN_ENUMINFO_INWORK_FLAG)) {
 		error("locked enuminfo unlocked");
-		u_unlock(cntx->soap);
+		u_mutex_unlock(&cntx->soap->lockEnum);
 		return;
 	}
 	enumInfo->flags &= ~WSMAN_ENUMINFO_INWORK_FLAG;
 	enumInfo->timeStamp = tv.tv_sec;
-	u_unlock(cntx->soap);
+	u_mutex_unlock(&cntx->soap->lockEnum);
 }
 
 static void
 ws_clear_context_entries(WsContextH hCntx)
 {
 	hash_t *h;
-	if (!hCntx) {
+	if (!hCntx || hCntx->arena) {
 		return;
 	}
 	h = hCntx->entries;
@@ -439,7 +483,7 @@ static void
 ws_clear_context_enuminfos(WsContextH hCntx)
 {
 	hash_t *h;
-	if (!hCntx) {
+	if (!hCntx || !hCntx->enuminfos) {
 		return;
 	}
 	h = hCntx->enuminfos;
@@ -476,6 +520,7 @@ ws_initialize_context(WsContextH cntx, SoapH soap)
 
 	cntx->enuminfos = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
 	cntx->subscriptionMemList = list_create(LISTCOUNT_T_MAX);
+	cntx->subscriptionHash = hash_create(HASHCOUNT_T_MAX, subs_id_compare, subs_id_hash);
 	hash_set_allocator(cntx->enuminfos, NULL, free_hentry_func, NULL);
 	cntx->owner = 1;
 	cntx->soap = soap;
@@ -492,6 +537,64 @@ ws_create_context(SoapH soap)
 	return cntx;
 }
 
+/*
+ * Context living for a single request. The context itself, its entries
+ * and its serializer allocations come from one arena, released in one go
+ * by ws_destroy_context(). Enumerations and subscriptions are kept in
+ * the runtime context only, so request contexts have no room for them.
+ */
+static WsContextH
+ws_create_request_context(SoapH soap)
+{
+	hnode_t **table;
+	WsContextH cntx;
+	u_arena_t *arena = u_arena_create(WS_CONTEXT_ARENA_SIZE);
+
+	if (arena == NULL)
+		return NULL;
+	cntx = u_arena_zalloc(arena, sizeof (*cntx));
+	cntx->arena = arena;
+	cntx->entries = u_arena_alloc(arena, sizeof (hash_t));
+	table = u_arena_alloc(arena, WS_CONTEXT_CHAINS * sizeof (hnode_t *));
+	cntx->serializercntx = ws_serializer_init_arena(arena);
+	if (cntx->entries == NULL || table == NULL || cntx->serializercntx == NULL) {
+		u_arena_destroy(arena);
+		return NULL;
+	}
+	hash_init(cntx->entries, HASHCOUNT_T_MAX, NULL, NULL, table,
+			WS_CONTEXT_CHAINS);
+	hash_set_allocator(cntx->entries, arena_hnode_alloc, arena_hnode_free, arena);
+	cntx->owner = 1;
+	cntx->soap = soap;
+	return cntx;
+}
+
+/**
+ * Allocate memory that lives as long as the request context
+ * @param cntx Context handle
+ * @param size Number of bytes
+ * @return The memory, never to be freed by the caller, or NULL if
+ * cntx is not a request context
+ */
+void *
+ws_context_alloc(WsContextH cntx, size_t size)
+{
+	if (cntx == NULL || cntx->arena == NULL)
+		return NULL;
+	return u_arena_alloc(cntx->arena, size);
+}
+
+/**
+ * Copy a string into the request context, see ws_context_alloc()
+ */
+char *
+ws_context_strdup(WsContextH cntx, const char *str)
+{
+	if (cntx == NULL || cntx->arena == NULL)
+		return NULL;
+	return u_arena_strdup(cntx->arena, str);
+}
+
 SoapH
 ws_soap_initialize()
 {
@@ -508,8 +611,14 @@ ws_soap_initialize()
 	soap->dispatchList = NULL;
 	soap->processedMsgIdList = NULL;
 
-	u_init_lock(soap);
-	u_init_lock(&soap->lockSubs);
+	u_mutex_init(&soap->lockDispatch, "dispatch");
+	u_mutex_init(&soap->lockMsgIds, "message ids");
+	u_mutex_init(&soap->lockEnum, "enumerations");
+	u_rwlock_init(&soap->lockEntries, "context");
+	u_mutex_init(&soap->lockSubs, "subscriptions");
+	soap->deliveryRetryCount = WSE_DELIVERY_RETRY_COUNT;
+	soap->deliveryRetryInterval = WSE_DELIVERY_RETRY_INTERVAL;
+	soap->deliveryRetryMaxInterval = WSE_DELIVERY_RETRY_MAX_INTERVAL;
 	ws_xml_parser_initialize();
 
 	soap_add_filter(soap, outbound_addressing_filter, NULL, 0);
@@ -815,8 +924,7 @@ ws_transfer_put_stub(SoapOpH op,
 	if (doc) {
 		soap_set_op_doc(op, doc, 0);
 	}
-	ws_serializer_free_all(cntx->serializercntx);
-	ws_serializer_cleanup(cntx->serializercntx);
+	ws_destroy_context(cntx);
 	return retVal;
 }
 
@@ -922,10 +1030,10 @@ unsigned long wsman_get_maxsize_from_op(SoapOpH op)
 static
 unsigned long get_total_enum_context(WsContextH cntx){
         hscan_t hs;
-        u_lock(cntx->soap);
+        u_mutex_lock(&cntx->soap->lockEnum);
         hash_scan_begin(&hs, cntx->enuminfos);
         unsigned long total = hash_count(hs.hash_table);
-        u_unlock(cntx->soap);
+        u_mutex_unlock(&cntx->soap->lockEnum);
         return total;
 }
 
@@ -1120,6 +1228,7 @@ wsenum_pull_stub(SoapOpH op, void *appData,
 	WsmanStatus     status;
 	SoapH           soap = soap_get_op_soap(op);
 	WsContextH      soapCntx = ws_get_soap_context(soap);
+	WsContextH      epcntx = NULL;
 
 	WsDispatchEndPointInfo *ep = (WsDispatchEndPointInfo *) appData;
 	XmlSerializerInfo *typeInfo = ep->serializationInfo;
@@ -1141,7 +1250,8 @@ wsenum_pull_stub(SoapOpH op, void *appData,
 		goto DONE;
 	}
 	locked = 1;
-	if ((retVal = endPoint(ws_create_ep_context(soap, _doc),
+	epcntx = ws_create_ep_context(soap, _doc);
+	if ((retVal = endPoint(epcntx,
 						enumInfo, &status, opaqueData))) {
 		doc = wsman_generate_fault(_doc, status.fault_code, status.fault_detail_code, NULL);
 		goto DONE;
@@ -1162,21 +1272,21 @@ wsenum_pull_stub(SoapOpH op, void *appData,
 	}
 	if (enumInfo->pullResultPtr) {
 		if (enumId) {
-			ws_serialize_str(soapCntx->serializercntx, node, enumId,
+			ws_serialize_str(epcntx->serializercntx, node, enumId,
 			    XML_NS_ENUMERATION, WSENUM_ENUMERATION_CONTEXT, 0);
 		}
 		WsXmlNodeH itemsNode = ws_xml_add_child(node,
 				    XML_NS_ENUMERATION, WSENUM_ITEMS, NULL);
-		ws_serialize(soapCntx->serializercntx, itemsNode, enumInfo->pullResultPtr,
+		ws_serialize(epcntx->serializercntx, itemsNode, enumInfo->pullResultPtr,
 			 typeInfo, ep->respName, (char *) ep->data, NULL, 1);
-		ws_serializer_free_mem(soapCntx->serializercntx,
+		ws_serializer_free_mem(epcntx->serializercntx,
 			enumInfo->pullResultPtr, typeInfo);
 	} else {
 		/*
 		ws_serialize_str(soapCntx, node, NULL,
 			    XML_NS_ENUMERATION, WSENUM_ENUMERATION_CONTEXT, 0);
 			    */
-		ws_serialize_str(soapCntx->serializercntx,
+		ws_serialize_str(epcntx->serializercntx,
 		    node, NULL, XML_NS_ENUMERATION, WSENUM_END_OF_SEQUENCE, 0);
 		remove_locked_enuminfo(soapCntx, enumInfo);
 		locked = 0;
@@ -1190,6 +1300,7 @@ DONE:
 	if (doc) {
 		soap_set_op_doc(op, doc, 0);
 	}
+	ws_destroy_context(epcntx);
 	return retVal;
 }
 
@@ -1203,6 +1314,7 @@ wsenum_pull_direct_stub(SoapOpH op,
 	WsXmlDocH       doc = NULL;
 	SoapH           soap = soap_get_op_soap(op);
 	WsContextH      soapCntx = ws_get_soap_context(soap);
+	WsContextH      epcntx = NULL;
 	WsDispatchEndPointInfo *ep = (WsDispatchEndPointInfo *) appData;
 #ifdef ENABLE_EVENTING_SUPPORT
 	WsNotificationInfoH notificationInfo = NULL;
@@ -1229,7 +1341,8 @@ wsenum_pull_direct_stub(SoapOpH op,
 	if (enumInfo) { //pull things from "enumerate" results
 		locked = 1;
 
-		if ((retVal = endPoint(ws_create_ep_context(soap, _doc),
+		epcntx = ws_create_ep_context(soap, _doc);
+		if ((retVal = endPoint(epcntx,
 						enumInfo, &status, opaqueData))) {
 			doc = wsman_generate_fault( _doc, status.fault_code, status.fault_detail_code, NULL);
 //			ws_remove_context_val(soapCntx, cntxName);
@@ -1296,16 +1409,33 @@ wsenum_pull_direct_stub(SoapOpH op,
 			if(max_elements > 1 && count > 1) {
 				docnode = ws_xml_add_child(docnode, XML_NS_ENUMERATION, WSENUM_ITEMS, NULL);
 			}
-			while(max_elements > 0) {
+			/* the events are written out as text rather than copied as trees */
+			WsXmlWriter *writer = ws_xml_writer_new(docnode);
+			int written = writer ? 0 : -1;
+			while(max_elements > 0 && written == 0) {
 				if(soap->eventpoolOpSet->remove(subsInfo->subsId, &notificationInfo))
 					break;
 				ws_xml_add_child(docheader, XML_NS_ADDRESSING, WSA_ACTION, notificationInfo->EventAction);
 				notidoc = notificationInfo->EventContent;
 				WsXmlNodeH tempnode = ws_xml_get_doc_root(notidoc);
-				ws_xml_duplicate_tree(docnode, tempnode);
+				if (tempnode)
+					written = ws_xml_writer_add_node(writer, tempnode);
 				delete_notification_info(notificationInfo);
 				max_elements--;
 			}
+			if (written == 0)
+				written = ws_xml_writer_flush(writer);
+			ws_xml_writer_destroy(writer);
+			if (written) {
+				/* left uncommitted, a log backed pool delivers them again */
+				error("could not write the events of %s", subsInfo->subsId);
+				ws_xml_destroy_doc(doc);
+				doc = wsman_generate_fault(_doc, WSMAN_INTERNAL_ERROR,
+						OWSMAN_NO_DETAILS, NULL);
+			}
+			/* nobody acknowledges a pull response, so consider it delivered */
+			else if(soap->eventpoolOpSet->commit)
+				soap->eventpoolOpSet->commit(subsInfo->subsId);
 		}
 		else {
 			status.fault_code = WSMAN_TIMED_OUT;
@@ -1318,11 +1448,16 @@ cleanup:
 	if (locked) {
 		unlock_enuminfo(soapCntx, enumInfo);
 	}
+#ifdef ENABLE_EVENTING_SUPPORT
+	if (subsInfo)
+		wse_put_subscription(soap, subsInfo);
+#endif
 	if (doc) {
 		soap_set_op_doc(op, doc, 0);
 	} else {
 		error("doc is null");
 	}
+	ws_destroy_context(epcntx);
 
 	return retVal;
 }
@@ -1343,9 +1478,9 @@ wsman_get_expired_enuminfos(WsContextH cntx)
 	}
 	gettimeofday(&tv, NULL);
 	mytime = tv.tv_sec;
-	u_lock(cntx->soap);
+	u_mutex_lock(&cntx->soap->lockEnum);
 	if (hash_isempty(cntx->enuminfos)) {
-		u_unlock(cntx->soap);
+		u_mutex_unlock(&cntx->soap->lockEnum);
 		return NULL;
 	}
 	hash_scan_begin(&hs, cntx->enuminfos);
@@ -1364,7 +1499,7 @@ wsman_get_expired_enuminfos(WsContextH cntx)
 			list = list_create(LISTCOUNT_T_MAX);
 		}
 		if (list == NULL) {
-			u_unlock(cntx->soap);
+			u_mutex_unlock(&cntx->soap->lockEnum);
 			error("could not create list");
 			return NULL;
 		}
@@ -1372,7 +1507,7 @@ wsman_get_expired_enuminfos(WsContextH cntx)
 		list_append(list, lnode_create(enumInfo));
 		debug("Enum expired list appended: %s", enumInfo->enumId);
 	}
-	u_unlock(cntx->soap);
+	u_mutex_unlock(&cntx->soap->lockEnum);
 	return list;
 }
 
@@ -1432,9 +1567,66 @@ ws_create_event_context(SoapH soap, WsSubscribeInfo *subsInfo, WsXmlDocH doc)
 	eventcntx->soap = soap;
 	eventcntx->subsInfo = subsInfo;
 	eventcntx->outdoc = doc;
+	eventcntx->message = NULL;
 	return eventcntx;
 }
 
+/*
+ * The notification envelope of a subscription serialized once, with
+ * slots for the MessageID and the action in the header. The header
+ * opaque data goes in front of the first of them, where the tree route
+ * adds it too. The body is built as a tree for every notification and
+ * put in place of the template's.
+ */
+enum {
+	WSE_SLOT_MESSAGE_ID,
+	WSE_SLOT_ACTION,
+	WSE_SLOT_BODY,
+	WSE_SLOTS
+};
+
+struct __WsNotificationTemplate {
+	WsXmlTemplate *xml;
+	size_t header_at; // start tag of the first header slot
+	size_t body_at, body_end; // the body element
+	char *soapNs; // namespace of the body element
+	int events; // Events delivery mode, the action slot is fixed
+};
+
+void
+wse_destroy_notification_template(WsNotificationTemplateH t)
+{
+	if (t == NULL)
+		return;
+	ws_xml_template_destroy(t->xml);
+	u_free(t->soapNs);
+	u_free(t);
+}
+
+static void
+destroy_notification_message(WsNotificationMessageH msg)
+{
+	if (msg == NULL)
+		return;
+	u_buf_free(msg->buf);
+	u_free(msg);
+}
+
+static void
+destroy_notification_events(list_t *events)
+{
+	lnode_t *node;
+
+	if (events == NULL)
+		return;
+	while (!list_isempty(events)) {
+		node = list_del_first(events);
+		delete_notification_info((WsNotificationInfoH)lnode_get(node));
+		lnode_destroy(node);
+	}
+	list_destroy(events);
+}
+
 static void
 destroy_subsinfo(WsSubscribeInfo * subsInfo)
 {
@@ -1456,12 +1648,262 @@ destroy_subsinfo(WsSubscribeInfo * subsInfo)
 	ws_xml_destroy_doc(subsInfo->bookmarkDoc);
 	ws_xml_destroy_doc(subsInfo->templateDoc);
 	ws_xml_destroy_doc(subsInfo->heartbeatDoc);
+	wse_destroy_notification_template(subsInfo->notificationTemplate);
+	destroy_notification_message(subsInfo->retryMessage);
+	destroy_notification_events(subsInfo->retryEvents);
 	u_free(subsInfo);
 }
 
+/* caller holds soap->lockSubs */
+static void
+wse_add_subscription(WsContextH soapCntx, WsSubscribeInfo *subsInfo)
+{
+	list_append(soapCntx->subscriptionMemList, lnode_create(subsInfo));
+	if (hash_lookup(soapCntx->subscriptionHash, subsInfo->subsId) == NULL)
+		hash_alloc_insert(soapCntx->subscriptionHash, subsInfo->subsId, subsInfo);
+	subsInfo->refcount = 1;
+}
+
+/* caller holds soap->lockSubs, subsInfo goes once the last lookup is done */
+static void
+wse_remove_subscription(WsContextH soapCntx, WsSubscribeInfo *subsInfo)
+{
+	hnode_t *hn = hash_lookup(soapCntx->subscriptionHash, subsInfo->subsId);
+	if (hn && hnode_get(hn) == subsInfo)
+		hash_delete_free(soapCntx->subscriptionHash, hn);
+	if (--subsInfo->refcount == 0)
+		destroy_subsinfo(subsInfo);
+}
+
+/**
+ * Look up a subscription by its identifier (without the "uuid:" prefix).
+ * The subscription stays valid until released with wse_put_subscription(),
+ * even if the notification manager drops it meanwhile.
+ * @param soap SOAP handler
+ * @param uuid Subscription identifier
+ * @return Subscription or NULL
+ */
+WsSubscribeInfo *
+wse_get_subscription(SoapH soap, const char *uuid)
+{
+	WsContextH soapCntx = ws_get_soap_context(soap);
+	WsSubscribeInfo *subsInfo = NULL;
+	hnode_t *hn;
+
+	u_mutex_lock(&soap->lockSubs);
+	hn = hash_lookup(soapCntx->subscriptionHash, (void *)uuid);
+	if (hn) {
+		subsInfo = (WsSubscribeInfo *)hnode_get(hn);
+		subsInfo->refcount++;
+	}
+	u_mutex_unlock(&soap->lockSubs);
+	return subsInfo;
+}
+
+void
+wse_put_subscription(SoapH soap, WsSubscribeInfo *subsInfo)
+{
+	u_mutex_lock(&soap->lockSubs);
+	if (--subsInfo->refcount == 0)
+		destroy_subsinfo(subsInfo);
+	u_mutex_unlock(&soap->lockSubs);
+}
+
+
+/* start of the tag enclosing pos */
+static size_t
+template_tag_start(const char *buf, size_t pos)
+{
+	while (pos > 0 && buf[pos] != '<')
+		pos--;
+	return pos;
+}
+
+static WsNotificationTemplateH
+create_rendered_template(WsSubscribeInfo *subsInfo)
+{
+	WsNotificationTemplateH t = NULL;
+	WsXmlTemplate *xml;
+	WsXmlDocH doc;
+	WsXmlNodeH header, body;
+	const WsXmlTemplateSlot *content;
+	char msgidMarker[128], actionMarker[128], bodyMarker[128];
+	const char *end;
+	int events = (subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_EVENTS);
+
+	/* other encodings take the DOM route */
+	if (subsInfo->contentEncoding && strcasecmp(subsInfo->contentEncoding, "UTF-8"))
+		return NULL;
+	if ((xml = ws_xml_template_new()) == NULL)
+		return NULL;
+	ws_xml_template_marker(xml, WSE_SLOT_MESSAGE_ID, msgidMarker, sizeof(msgidMarker));
+	ws_xml_template_marker(xml, WSE_SLOT_ACTION, actionMarker, sizeof(actionMarker));
+	ws_xml_template_marker(xml, WSE_SLOT_BODY, bodyMarker, sizeof(bodyMarker));
+	doc = ws_xml_duplicate_doc(subsInfo->templateDoc);
+	header = ws_xml_get_soap_header(doc);
+	body = ws_xml_get_soap_body(doc);
+	/* in the order wse_build_notification() adds them */
+	if (events) {
+		ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_ACTION, actionMarker);
+		ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_MESSAGE_ID, msgidMarker);
+	} else {
+		ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_MESSAGE_ID, msgidMarker);
+		ws_xml_add_child(header, XML_NS_WS_MAN, WSM_ACTION, actionMarker);
+	}
+	ws_xml_set_node_text(body, bodyMarker);
+	if (ws_xml_template_compile(xml, doc, WSE_SLOTS) == 0) {
+		content = ws_xml_template_slot(xml, WSE_SLOT_BODY);
+		end = strchr(xml->buf + content->end, '>');
+		/* the body comes after the header slots */
+		if (content == &xml->slots[WSE_SLOTS - 1] && end != NULL &&
+				xml->buf[content->at - 1] == '>') {
+			t = u_zalloc(sizeof(*t));
+			t->xml = xml;
+			t->header_at = template_tag_start(xml->buf, xml->slots[0].at);
+			t->body_at = template_tag_start(xml->buf, content->at - 1);
+			t->body_end = end + 1 - xml->buf;
+			t->soapNs = u_strdup(ws_xml_get_node_name_ns(body));
+			t->events = events;
+		}
+	}
+	ws_xml_destroy_doc(doc);
+	if (t == NULL) {
+		ws_xml_template_destroy(xml);
+		debug("no serialized notification template for %s", subsInfo->subsId);
+	}
+	return t;
+}
+
+/* first element of a serialized document, past the prolog */
+static char *
+skip_xml_prolog(char *p)
+{
+	while ((p = strchr(p, '<')) != NULL && (p[1] == '?' || p[1] == '!'))
+		p++;
+	return p;
+}
+
+/* the root element of doc, serialized */
+static int
+render_doc_root(u_buf_t *buf, WsXmlDocH doc)
+{
+	char *xml = NULL, *root;
+	int len = 0;
+	size_t n;
+
+	ws_xml_dump_memory_enc(doc, &xml, &len, "UTF-8");
+	if (xml == NULL)
+		return 1;
+	root = skip_xml_prolog(xml);
+	if (root) {
+		n = len - (root - xml);
+		while (n > 0 && (root[n - 1] == '\n' || root[n - 1] == ' '))
+			n--;
+		u_buf_append(buf, root, n);
+	}
+	ws_xml_free_memory(xml);
+	return root == NULL;
+}
 
+/* the events under the body, the first one only unless in Events mode */
 static void
-create_notification_template(WsXmlDocH indoc, WsSubscribeInfo *subsInfo)
+add_notification_body(WsXmlNodeH body, int eventsMode, list_t *events)
+{
+	WsNotificationInfoH info;
+	WsXmlNodeH eventnode, temp;
+	lnode_t *node;
+
+	if (!eventsMode) {
+		info = (WsNotificationInfoH)lnode_get(list_first(events));
+		ws_xml_duplicate_children(body, ws_xml_get_doc_root(info->EventContent));
+		return;
+	}
+	eventnode = ws_xml_add_child(body, XML_NS_WS_MAN, WSM_EVENTS, NULL);
+	for (node = list_first(events); node; node = list_next(events, node)) {
+		info = (WsNotificationInfoH)lnode_get(node);
+		temp = ws_xml_add_child(eventnode, XML_NS_WS_MAN, WSM_EVENT, NULL);
+		if (temp == NULL)
+			continue;
+		ws_xml_add_node_attr(temp, XML_NS_WS_MAN, WSM_ACTION,
+				info->EventAction ? info->EventAction : WSMAN_ACTION_EVENT);
+		ws_xml_duplicate_children(temp, ws_xml_get_doc_root(info->EventContent));
+	}
+}
+
+/*
+ * Fill the serialized template: the header slots as text, the body as a
+ * tree of its own, so the event content keeps its namespaces.
+ */
+static WsNotificationMessageH
+wse_render_notification(WsNotificationTemplateH t, list_t *events)
+{
+	WsXmlTemplate *xml = t->xml;
+	WsNotificationMessageH msg = u_zalloc(sizeof(*msg));
+	WsNotificationInfoH info = (WsNotificationInfoH)lnode_get(list_first(events));
+	const WsXmlTemplateSlot *slot;
+	const char *action = WSEVENT_DELIVERY_MODE_EVENTS;
+	WsXmlDocH body;
+	size_t from;
+	int failed = 0;
+
+	if (!t->events)
+		action = info->EventAction ? info->EventAction : WSMAN_ACTION_EVENT;
+	generate_uuid(msg->messageId, sizeof(msg->messageId), 0);
+	u_buf_create_sized(&msg->buf, xml->len + 1024);
+	u_buf_append(msg->buf, xml->buf, t->header_at);
+	if (info->headerOpaqueData)
+		failed = render_doc_root(msg->buf, info->headerOpaqueData);
+	from = t->header_at;
+	for (slot = xml->slots; slot->id != WSE_SLOT_BODY; slot++) {
+		u_buf_append(msg->buf, xml->buf + from, slot->at - from);
+		if (slot->id == WSE_SLOT_MESSAGE_ID)
+			u_buf_append(msg->buf, msg->messageId, strlen(msg->messageId));
+		else
+			ws_xml_buf_append_escaped(msg->buf, action);
+		from = slot->end;
+	}
+	u_buf_append(msg->buf, xml->buf + from, t->body_at - from);
+	body = ws_xml_create_doc(t->soapNs, SOAP_BODY);
+	if (body) {
+		add_notification_body(ws_xml_get_doc_root(body), t->events, events);
+		if (failed == 0)
+			failed = render_doc_root(msg->buf, body);
+		ws_xml_destroy_doc(body);
+	} else {
+		failed = 1;
+	}
+	u_buf_append(msg->buf, xml->buf + t->body_end, xml->len - t->body_end);
+	if (failed) {
+		destroy_notification_message(msg);
+		return NULL;
+	}
+	return msg;
+}
+
+static WsNotificationMessageH
+create_notification_message(WsXmlDocH doc, const char *encoding)
+{
+	WsNotificationMessageH msg;
+	WsXmlNodeH node;
+	char *buf = NULL;
+	int len = 0;
+
+	ws_xml_dump_memory_enc(doc, &buf, &len, encoding ? encoding : "UTF-8");
+	if (buf == NULL)
+		return NULL;
+	msg = u_zalloc(sizeof(*msg));
+	u_buf_create(&msg->buf);
+	u_buf_append(msg->buf, buf, len);
+	ws_xml_free_memory(buf);
+	node = ws_xml_get_child(ws_xml_get_soap_header(doc), 0,
+			XML_NS_ADDRESSING, WSA_MESSAGE_ID);
+	if (node && ws_xml_get_node_text(node))
+		strncpy(msg->messageId, ws_xml_get_node_text(node), sizeof(msg->messageId) - 1);
+	return msg;
+}
+
+void
+wse_create_notification_template(WsXmlDocH indoc, WsSubscribeInfo *subsInfo)
 {
 	WsXmlDocH notificationDoc = ws_xml_create_envelope();
 	WsXmlNodeH temp = NULL;
@@ -1489,6 +1931,7 @@ create_notification_template(WsXmlDocH indoc, WsSubscribeInfo *subsInfo)
 	temp = ws_xml_add_child(temp, XML_NS_ADDRESSING, WSA_ACTION, WSMAN_ACTION_HEARTBEAT);
 	ws_xml_add_node_attr(temp, XML_NS_XML_SCHEMA, SOAP_MUST_UNDERSTAND, "true");
 	ws_xml_destroy_doc(notificationDoc);
+	subsInfo->notificationTemplate = create_rendered_template(subsInfo);
 }
 
 
@@ -1505,6 +1948,7 @@ create_subs_info(SoapOpH op,
 	WsSubscribeInfo *subsInfo;
 	WsXmlAttrH attr = NULL;
 	op_t *_op = (op_t *) op;
+	SoapH soap = soap_get_op_soap(op);
 	WsmanMessage   *msg = (WsmanMessage *) _op->data;
 	WsmanFaultCodeType fault_code = WSMAN_RC_OK;
 	WsmanFaultDetailType fault_detail_code = WSMAN_DETAIL_OK;
@@ -1613,6 +2057,21 @@ create_subs_info(SoapOpH op,
 			subsInfo->heartbeatCountdown = subsInfo->heartbeatInterval;
 		}
 	}
+	subsInfo->connectionRetryCount = soap->deliveryRetryCount;
+	subsInfo->connectionRetryinterval = soap->deliveryRetryInterval;
+	temp = ws_xml_get_child(node, 0, XML_NS_WS_MAN, WSM_CONNECTIONRETRY);
+	if(temp) {
+		str = ws_xml_get_node_text(temp);
+		attr = ws_xml_find_node_attr(temp, NULL, WSM_TOTAL);
+		if(str == NULL || attr == NULL || ws_deserialize_duration(str, &timeout)) {
+			fault_code = WSE_INVALID_MESSAGE;
+			goto DONE;
+		}
+		subsInfo->connectionRetryCount = atoi(ws_xml_get_attr_value(attr));
+		subsInfo->connectionRetryinterval = timeout * 1000;
+		debug("connection retry: %u times, interval = %lu", subsInfo->connectionRetryCount,
+			subsInfo->connectionRetryinterval);
+	}
 	if(subsInfo->deliveryMode != WS_EVENT_DELIVERY_MODE_PULL) {
 		temp = ws_xml_get_child(node, 0, XML_NS_EVENTING, WSEVENT_NOTIFY_TO);
 		if(temp == NULL) {
@@ -1693,7 +2152,7 @@ create_subs_info(SoapOpH op,
 	else
 		generate_uuid(subsInfo->subsId, EUIDLEN, 1);
 	if(subsInfo->deliveryMode != WS_EVENT_DELIVERY_MODE_PULL)
-		create_notification_template(indoc, subsInfo);
+		wse_create_notification_template(indoc, subsInfo);
 DONE:
 	if (fault_code != WSMAN_RC_OK) {
 		outdoc = wsman_generate_fault(indoc, fault_code, fault_detail_code, NULL);
@@ -1766,10 +2225,9 @@ wse_subscribe_stub(SoapOpH op, void *appData, void *opaqueData)
 			u_free(buf);
 		}
 	}
-	lnode_t * sinfo = lnode_create(subsInfo);
-	pthread_mutex_lock(&soap->lockSubs);
-	list_append(soapCntx->subscriptionMemList, sinfo);
-	pthread_mutex_unlock(&soap->lockSubs);
+	u_mutex_lock(&soap->lockSubs);
+	wse_add_subscription(soapCntx, subsInfo);
+	u_mutex_unlock(&soap->lockSubs);
 	debug("subscription uuid:%s kept in the memory", subsInfo->subsId);
 	header = ws_xml_get_soap_header(doc);
 	inNode = ws_xml_get_soap_header(_doc);
@@ -1850,26 +2308,15 @@ wse_unsubscribe_stub(SoapOpH op, void *appData, void *opaqueData)
 		goto DONE;
 	}
 	char *uuid = ws_xml_get_node_text(inNode);
-	lnode_t *t = NULL;
-	pthread_mutex_lock(&soap->lockSubs);
-	if(!list_isempty(soapCntx->subscriptionMemList)) {
-		t = list_first(soapCntx->subscriptionMemList);
-		subsInfo = (WsSubscribeInfo *)t->list_data;
-		while(t && strcasecmp(subsInfo->subsId, uuid+5)) {
-			t = list_next(soapCntx->subscriptionMemList, t);
-			if(t)
-				subsInfo = (WsSubscribeInfo *)t->list_data;
-		}
-	}
-	if(t == NULL) {
+	if(uuid && strlen(uuid) > 5)
+		subsInfo = wse_get_subscription(soap, uuid+5);
+	if(subsInfo == NULL) {
 		status.fault_code = WSMAN_INVALID_PARAMETER;
 		status.fault_detail_code = WSMAN_DETAIL_INVALID_VALUE;
 		doc = wsman_generate_fault( _doc,
 		 	status.fault_code, status.fault_detail_code, NULL);
-		pthread_mutex_unlock(&soap->lockSubs);
 		goto DONE;
 	}
-	pthread_mutex_unlock(&soap->lockSubs);
 	if (endPoint && (retVal = endPoint(epcntx, subsInfo, &status, opaqueData))) {
                debug("UnSubscribe fault");
 		doc = wsman_generate_fault( _doc, status.fault_code, status.fault_detail_code, status.fault_msg);
@@ -1883,6 +2330,8 @@ wse_unsubscribe_stub(SoapOpH op, void *appData, void *opaqueData)
 	if (!doc)
 		goto DONE;
 DONE:
+	if (subsInfo)
+		wse_put_subscription(soap, subsInfo);
 	if (doc) {
 		soap_set_op_doc(op, doc, 0);
 	}
@@ -1904,13 +2353,12 @@ wse_renew_stub(SoapOpH op, void *appData, void *opaqueData)
 {
 	WsXmlDocH       doc = NULL;
 	int             retVal = 0;
-	WsSubscribeInfo *subsInfo;
+	WsSubscribeInfo *subsInfo = NULL;
 	WsmanStatus     status;
 	WsXmlNodeH      inNode;
 	WsXmlNodeH      body;
 	WsXmlNodeH      header;
 	SoapH           soap = soap_get_op_soap(op);
-	WsContextH soapCntx = ws_get_soap_context(soap);
 	char * expirestr = NULL;
 
 	WsDispatchEndPointInfo *ep = (WsDispatchEndPointInfo *) appData;
@@ -1931,24 +2379,13 @@ wse_renew_stub(SoapOpH op, void *appData, void *opaqueData)
 		doc = wsman_generate_fault( _doc, status.fault_code, status.fault_detail_code, NULL);
 		goto DONE;
 	}
-	pthread_mutex_lock(&soap->lockSubs);
-	lnode_t *t = NULL;
-	if(!list_isempty(soapCntx->subscriptionMemList)) {
-		t = list_first(soapCntx->subscriptionMemList);
-		subsInfo = (WsSubscribeInfo *)t->list_data;
-		while(t && strcasecmp(subsInfo->subsId, uuid+5)) {
-			t = list_next(soapCntx->subscriptionMemList, t);
-			if(t)
-				subsInfo = (WsSubscribeInfo *)t->list_data;
-		}
-	}
-	if(t == NULL) {
+	if(strlen(uuid) > 5)
+		subsInfo = wse_get_subscription(soap, uuid+5);
+	if(subsInfo == NULL) {
 		status.fault_code = WSE_UNABLE_TO_RENEW;
 		doc = wsman_generate_fault( _doc, status.fault_code, status.fault_detail_code, NULL);
-		pthread_mutex_unlock(&soap->lockSubs);
 		goto DONE;
 	}
-	pthread_mutex_unlock(&soap->lockSubs);
 	inNode = ws_xml_get_child(body, 0, XML_NS_EVENTING, WSEVENT_RENEW);
 	inNode = ws_xml_get_child(inNode, 0, XML_NS_EVENTING ,WSEVENT_EXPIRES);
 	pthread_mutex_lock(&subsInfo->notificationlock);
@@ -1957,7 +2394,6 @@ wse_renew_stub(SoapOpH op, void *appData, void *opaqueData)
 	pthread_mutex_unlock(&subsInfo->notificationlock);
 	if (status.fault_code != WSMAN_RC_OK) {
 		status.fault_detail_code = WSMAN_DETAIL_EXPIRATION_TIME;
-		pthread_mutex_unlock(&subsInfo->notificationlock);
 		goto DONE;
 	}
 	char str[30];
@@ -1971,7 +2407,6 @@ wse_renew_stub(SoapOpH op, void *appData, void *opaqueData)
 	if (endPoint && (retVal = endPoint(epcntx, subsInfo, &status, opaqueData))) {
                 debug("renew fault in plug-in");
 		doc = wsman_generate_fault( _doc, status.fault_code, status.fault_detail_code, status.fault_msg);
-		pthread_mutex_unlock(&subsInfo->notificationlock);
 		goto DONE;
 	}
 	doc = wsman_create_response_envelope( _doc, NULL);
@@ -1981,6 +2416,8 @@ wse_renew_stub(SoapOpH op, void *appData, void *opaqueData)
 	body = ws_xml_add_child(body, XML_NS_EVENTING, WSEVENT_RENEW_RESP, NULL);
 	ws_xml_add_child(body, XML_NS_EVENTING, WSEVENT_EXPIRES, expirestr);
 DONE:
+	if (subsInfo)
+		wse_put_subscription(soap, subsInfo);
 	if (doc) {
 		soap_set_op_doc(op, doc, 0);
 	}
@@ -2010,7 +2447,7 @@ wsman_heartbeat_generator(WsContextH cntx, void *opaqueData)
 		debug("pthread_attr_setdetachstate = %d", r);
 		return;
 	}
-	pthread_mutex_lock(&soap->lockSubs);
+	u_mutex_lock(&soap->lockSubs);
 	lnode_t *node = list_first(soapCntx->subscriptionMemList);
 	while(node) {
 		subsInfo = (WsSubscribeInfo *)node->list_data;
@@ -2050,10 +2487,10 @@ LOOP:
 		pthread_mutex_unlock(&subsInfo->notificationlock);
 		node = list_next(soapCntx->subscriptionMemList, node);
 	}
-	pthread_mutex_unlock(&soap->lockSubs);
+	u_mutex_unlock(&soap->lockSubs);
 }
 
-static int wse_send_notification(WsEventThreadContextH cntx, WsXmlDocH outdoc, WsSubscribeInfo *subsInfo, unsigned char acked)
+static int wse_send_notification(WsEventThreadContextH cntx, WsNotificationMessageH message, WsSubscribeInfo *subsInfo, unsigned char acked)
 {
 	int retVal = 0;
 	WsManClient *notificationSender = wsmc_create_from_uri(subsInfo->epr_notifyto);
@@ -2101,22 +2538,22 @@ static int wse_send_notification(WsEventThreadContextH cntx, WsXmlDocH outdoc, W
 	else { //WSMAN_SECURITY_PROFILE_HTTP_SPNEGO_KERBEROS_TYPE
 	}
 	wsmc_transport_init(notificationSender, NULL);
-	if (wsman_send_request(notificationSender, outdoc)) {
+	if (wsman_send_request_buf(notificationSender, message->buf) ||
+		wsmc_get_response_code(notificationSender) >= 500) {
                 warning("wse_send_notification: wsman_send_request fails for endpoint %s", subsInfo->epr_notifyto);
-                /* FIXME: retVal */
+		wsmc_release(notificationSender);
+		return WSE_NOTIFICATION_DELIVERY_FAILED;
         }
 	if(acked) {
 		retVal = WSE_NOTIFICATION_NOACK;
 		WsXmlDocH ackdoc = wsmc_build_envelope_from_response(notificationSender);
 		if(ackdoc) {
 			WsXmlNodeH node = ws_xml_get_soap_header(ackdoc);
-			WsXmlNodeH srcnode = ws_xml_get_soap_header(outdoc);
 			WsXmlNodeH temp = NULL;
-			srcnode = ws_xml_get_child(srcnode, 0, XML_NS_ADDRESSING, WSA_MESSAGE_ID);
 			if(node) {
 				temp = ws_xml_get_child(node, 0, XML_NS_ADDRESSING, WSA_RELATES_TO);
 				if(temp) {
-					if(!strcasecmp(ws_xml_get_node_text(srcnode),
+					if(!strcasecmp(message->messageId,
 						ws_xml_get_node_text(temp))) {
 						node = ws_xml_get_child(node, 0, XML_NS_ADDRESSING, WSA_ACTION);
 						if(!strcasecmp(ws_xml_get_node_text(node), WSMAN_ACTION_ACK))
@@ -2133,9 +2570,34 @@ static int wse_send_notification(WsEventThreadContextH cntx, WsXmlDocH outdoc, W
 }
 
 
+/*
+ * Set when a notification whose delivery or building failed is tried
+ * again; the caller keeps it in retryMessage or retryEvents.
+ * The wait doubles with every failure, bounded by the server setting.
+ * Its events stay uncommitted in the event pool meanwhile.
+ */
+static void wse_schedule_retry(SoapH soap, WsSubscribeInfo *subsInfo)
+{
+	unsigned long wait = subsInfo->connectionRetryinterval;
+	unsigned int i;
+	struct timeval tv;
+
+	for (i = 0; i < subsInfo->deliveryFailures && wait < soap->deliveryRetryMaxInterval; i++)
+		wait *= 2;
+	if (wait > soap->deliveryRetryMaxInterval)
+		wait = soap->deliveryRetryMaxInterval;
+	subsInfo->deliveryFailures++;
+	gettimeofday(&tv, NULL);
+	subsInfo->retryTime = tv.tv_sec + (wait + 999) / 1000;
+	debug("notification for %s failed %u times, retry in %lu msecs",
+		subsInfo->subsId, subsInfo->deliveryFailures, wait);
+}
+
 static void * wse_event_sender(void * thrdcntx, unsigned char flag)
 {
 	char uuidBuf[50];
+	int retVal = 0;
+	int send;
 	WsXmlNodeH header;
 	if(thrdcntx == NULL) return NULL;
 	WsEventThreadContextH threadcntx = (WsEventThreadContextH)thrdcntx;
@@ -2144,30 +2606,59 @@ static void * wse_event_sender(void * thrdcntx, unsigned char flag)
 		debug("wse_notification_sender for %s started", subsInfo->subsId);
 	else
 		debug("wse_heartbeat_sender for %s started", subsInfo->subsId);
-	WsXmlDocH notificationDoc = NULL;
+	WsNotificationMessageH message = NULL;
+	WsXmlDocH notificationDoc;
 	pthread_mutex_lock(&subsInfo->notificationlock);
 	if(flag == 1)
 		subsInfo->eventSentLastTime = 1;
-	if(!(subsInfo->flags & WSMAN_SUBSCRIBEINFO_UNSUBSCRIBE) &&
-		!time_expired(subsInfo->expires)) {
-		if(flag) {
-			notificationDoc = threadcntx->outdoc;
-		}
-		else {
+	send = !(subsInfo->flags & WSMAN_SUBSCRIBEINFO_UNSUBSCRIBE) &&
+		!time_expired(subsInfo->expires);
+	if(flag)
+		message = threadcntx->message;
+	pthread_mutex_unlock(&subsInfo->notificationlock);
+
+	/*
+	 * The pending flag keeps the subscription alive and other
+	 * notifications back, so the lock is not held while sending.
+	 */
+	if(send) {
+		if(flag == 0) {
 	 		notificationDoc = ws_xml_duplicate_doc(subsInfo->heartbeatDoc);
 			header = ws_xml_get_soap_header(notificationDoc);
 			generate_uuid(uuidBuf, sizeof(uuidBuf), 0);
 			ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_MESSAGE_ID,uuidBuf);
-		}
-		if (subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_EVENTS  ||
-			subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_PUSHWITHACK){
-			if(wse_send_notification(threadcntx, notificationDoc, subsInfo, 1) == WSE_NOTIFICATION_NOACK)
-				subsInfo->flags |= WSMAN_SUBSCRIPTION_CANCELLED;
-		}
+			message = create_notification_message(notificationDoc, subsInfo->contentEncoding);
+			ws_xml_destroy_doc(notificationDoc);
+		}
+		if (message == NULL)
+			retVal = WSE_NOTIFICATION_DELIVERY_FAILED;
+		else if (subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_EVENTS  ||
+			subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_PUSHWITHACK)
+			retVal = wse_send_notification(threadcntx, message, subsInfo, 1);
 		else
-			wse_send_notification(threadcntx, notificationDoc, subsInfo, 0);
+			retVal = wse_send_notification(threadcntx, message, subsInfo, 0);
 	}
-	ws_xml_destroy_doc(notificationDoc);
+
+	pthread_mutex_lock(&subsInfo->notificationlock);
+	if(send) {
+		if(retVal == WSE_NOTIFICATION_NOACK)
+			subsInfo->flags |= WSMAN_SUBSCRIPTION_CANCELLED;
+		if(flag == 1 && retVal == WSE_NOTIFICATION_DELIVERY_FAILED &&
+			subsInfo->deliveryFailures < subsInfo->connectionRetryCount) {
+			wse_schedule_retry(threadcntx->soap, subsInfo);
+			subsInfo->retryMessage = message;
+			message = NULL;
+		}
+		else if(flag == 1) {
+			if(retVal == WSE_NOTIFICATION_DELIVERY_FAILED)
+				warning("notification for %s dropped after %u retries",
+					subsInfo->subsId, subsInfo->deliveryFailures);
+			subsInfo->deliveryFailures = 0;
+			if(threadcntx->soap->eventpoolOpSet->commit)
+				threadcntx->soap->eventpoolOpSet->commit(subsInfo->subsId);
+		}
+	}
+	destroy_notification_message(message);
 	subsInfo->flags &= ~WSMAN_SUBSCRIPTION_NOTIFICAITON_PENDING;
 	debug("[ wse_notification_sender thread for %s quit! ]",subsInfo->subsId);
 	pthread_mutex_unlock(&subsInfo->notificationlock);
@@ -2185,16 +2676,55 @@ void *wse_notification_sender(void *thrdcntx)
 	return wse_event_sender(thrdcntx, 1);
 }
 
+/* NULL if the notification could not be built, the events are left alone */
+WsNotificationMessageH
+wse_build_notification(WsSubscribeInfo *subsInfo, list_t *events)
+{
+	WsNotificationMessageH message = NULL;
+	WsNotificationInfoH notificationInfo;
+	WsXmlDocH notificationDoc;
+	WsXmlNodeH header, temp;
+	char uuidBuf[50];
+
+	if(subsInfo->notificationTemplate)
+		message = wse_render_notification(subsInfo->notificationTemplate, events);
+	if(message)
+		return message;
+	notificationDoc = ws_xml_duplicate_doc(subsInfo->templateDoc);
+	if(notificationDoc == NULL)
+		return NULL;
+	header = ws_xml_get_soap_header(notificationDoc);
+	notificationInfo = (WsNotificationInfoH)lnode_get(list_first(events));
+	if(notificationInfo->headerOpaqueData) {
+		temp = ws_xml_get_doc_root(notificationInfo->headerOpaqueData);
+		ws_xml_duplicate_tree(header, temp);
+	}
+	if(subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_EVENTS) {
+		ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_ACTION, WSEVENT_DELIVERY_MODE_EVENTS);
+		generate_uuid(uuidBuf, sizeof(uuidBuf), 0);
+		ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_MESSAGE_ID,uuidBuf);
+	}
+	else{
+		generate_uuid(uuidBuf, sizeof(uuidBuf), 0);
+		ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_MESSAGE_ID,uuidBuf);
+		if(notificationInfo->EventAction)
+			ws_xml_add_child(header, XML_NS_WS_MAN, WSM_ACTION, notificationInfo->EventAction);
+		else
+			ws_xml_add_child(header, XML_NS_WS_MAN, WSM_ACTION, WSMAN_ACTION_EVENT);
+	}
+	add_notification_body(ws_xml_get_soap_body(notificationDoc),
+			subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_EVENTS, events);
+	message = create_notification_message(notificationDoc, subsInfo->contentEncoding);
+	ws_xml_destroy_doc(notificationDoc);
+	return message;
+}
+
 void wse_notification_manager(void * cntx)
 {
 	int retVal;
 	WsSubscribeInfo * subsInfo = NULL;
-	WsXmlDocH notificationDoc =NULL;
-	WsXmlNodeH header = NULL;
-	WsXmlNodeH body = NULL;
-	WsXmlNodeH node = NULL;
-	WsXmlNodeH eventnode = NULL;
-	WsXmlNodeH temp = NULL;
+	WsNotificationMessageH message = NULL;
+	list_t *events = NULL;
 	lnode_t *subsnode = NULL;
 	WsEventThreadContextH threadcntx = NULL;
 	WsContextH contex = (WsContextH)cntx;
@@ -2202,7 +2732,6 @@ void wse_notification_manager(void * cntx)
 	WsContextH soapCntx = ws_get_soap_context(soap);
 	pthread_t eventsender;
 	pthread_attr_t pattrs;
-	char uuidBuf[50];
 	int r;
 	if ((r = pthread_attr_init(&pattrs)) != 0) {
 		debug("pthread_attr_init failed = %d", r);
@@ -2213,7 +2742,7 @@ void wse_notification_manager(void * cntx)
 		debug("pthread_attr_setdetachstate = %d", r);
 		return;
 	}
-	pthread_mutex_lock(&soap->lockSubs);
+	u_mutex_lock(&soap->lockSubs);
 	subsnode = list_first(soapCntx->subscriptionMemList);
 	while(subsnode) {
 		subsInfo = (WsSubscribeInfo *)subsnode->list_data;
@@ -2234,7 +2763,8 @@ void wse_notification_manager(void * cntx)
 				debug("Cancelled! uuid:%s deleted", subsInfo->subsId);
 			else
 				debug("Expired! uuid:%s deleted", subsInfo->subsId);
-			destroy_subsinfo(subsInfo);
+			pthread_mutex_unlock(&subsInfo->notificationlock);
+			wse_remove_subscription(soapCntx, subsInfo);
 			lnode_destroy(subsnode);
 			u_free(threadcntx);
 			subsnode = nodetemp;
@@ -2248,59 +2778,65 @@ void wse_notification_manager(void * cntx)
 		}
 		if(subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_PULL)
 			goto LOOP;
-		WsNotificationInfoH notificationInfo = NULL;
-		if(soap->eventpoolOpSet->remove(subsInfo->subsId, &notificationInfo) ) // to get the event and delete it from the event source
+		/* one notification in flight per subscription, the rest waits in the pool */
+		if(subsInfo->flags & WSMAN_SUBSCRIPTION_NOTIFICAITON_PENDING)
 			goto LOOP;
-		if(subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_PULL) goto LOOP;
-		notificationDoc = ws_xml_duplicate_doc(subsInfo->templateDoc);
-		header = ws_xml_get_soap_header(notificationDoc);
-		body = ws_xml_get_soap_body(notificationDoc);
-		if(notificationInfo->headerOpaqueData) {
-			temp = ws_xml_get_doc_root(notificationInfo->headerOpaqueData);
-			ws_xml_duplicate_tree(header, temp);
+		if(subsInfo->retryMessage || subsInfo->retryEvents) {
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			if((unsigned long)tv.tv_sec < subsInfo->retryTime)
+				goto LOOP;
+			if(subsInfo->retryMessage) {
+				message = subsInfo->retryMessage;
+				subsInfo->retryMessage = NULL;
+				goto SEND;
+			}
+			events = subsInfo->retryEvents;
+			subsInfo->retryEvents = NULL;
 		}
-		if(subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_EVENTS) {
-			ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_ACTION, WSEVENT_DELIVERY_MODE_EVENTS);
-			generate_uuid(uuidBuf, sizeof(uuidBuf), 0);
-			ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_MESSAGE_ID,uuidBuf);
-			eventnode = ws_xml_add_child(body, XML_NS_WS_MAN, WSM_EVENTS, NULL);
-			while(notificationInfo) {
-				temp = ws_xml_add_child(eventnode, XML_NS_WS_MAN, WSM_EVENT, NULL);
-				if(notificationInfo->EventAction)  {
-					ws_xml_add_node_attr(temp, XML_NS_WS_MAN, WSM_ACTION, notificationInfo->EventAction);
-				}
-				else {
-					ws_xml_add_node_attr(temp, XML_NS_WS_MAN, WSM_ACTION, WSMAN_ACTION_EVENT);
-				}
-				if(temp) {
-					node = ws_xml_get_doc_root(notificationInfo->EventContent);
-					ws_xml_duplicate_children(temp, node);
-				}
-				delete_notification_info(notificationInfo);
-				soap->eventpoolOpSet->remove(subsInfo->subsId, &notificationInfo);
+		else {
+			WsNotificationInfoH notificationInfo = NULL;
+			if(soap->eventpoolOpSet->remove(subsInfo->subsId, &notificationInfo) ) // to get the event and delete it from the event source
+				goto LOOP;
+			events = list_create(LISTCOUNT_T_MAX);
+			list_append(events, lnode_create(notificationInfo));
+			if(subsInfo->deliveryMode == WS_EVENT_DELIVERY_MODE_EVENTS) {
+				while(soap->eventpoolOpSet->remove(subsInfo->subsId, &notificationInfo) == 0)
+					list_append(events, lnode_create(notificationInfo));
 			}
 		}
-		else{
-			generate_uuid(uuidBuf, sizeof(uuidBuf), 0);
-			ws_xml_add_child(header, XML_NS_ADDRESSING, WSA_MESSAGE_ID,uuidBuf);
-			if(notificationInfo->EventAction)
-				ws_xml_add_child(header, XML_NS_WS_MAN, WSM_ACTION, notificationInfo->EventAction);
-			else
-				ws_xml_add_child(header, XML_NS_WS_MAN, WSM_ACTION, WSMAN_ACTION_EVENT);
-			node = ws_xml_get_doc_root(notificationInfo->EventContent);
-			ws_xml_duplicate_children(body, node);
-			delete_notification_info(notificationInfo);
+		message = wse_build_notification(subsInfo, events);
+		if(message == NULL) {
+			if(subsInfo->deliveryFailures < subsInfo->connectionRetryCount) {
+				/* kept in order for the next attempt, still uncommitted in the pool */
+				wse_schedule_retry(soap, subsInfo);
+				subsInfo->retryEvents = events;
+				goto LOOP;
+			}
+			warning("notification for %s dropped, it could not be built after %u retries",
+				subsInfo->subsId, subsInfo->deliveryFailures);
+			subsInfo->deliveryFailures = 0;
+			if(soap->eventpoolOpSet->commit)
+				soap->eventpoolOpSet->commit(subsInfo->subsId);
+			destroy_notification_events(events);
+			goto LOOP;
 		}
-		if(subsInfo->deliveryMode != WS_EVENT_DELIVERY_MODE_PULL) {
-			if((subsInfo->flags & WSMAN_SUBSCRIPTION_NOTIFICAITON_PENDING) == 0) {
-				WsEventThreadContextH threadcntx2 = ws_create_event_context(soap, subsInfo, notificationDoc);
-				if(pthread_create(&eventsender, &pattrs, wse_notification_sender, threadcntx2) == 0) {
-					subsInfo->flags |= WSMAN_SUBSCRIPTION_NOTIFICAITON_PENDING;
-				}
-				else {
-					debug("thread created for %s failed![ %s ]", subsInfo->subsId, strerror(errno));
-				}
+		destroy_notification_events(events);
+SEND:
+		{
+			WsEventThreadContextH threadcntx2 = ws_create_event_context(soap, subsInfo, NULL);
+			threadcntx2->message = message;
+			if(pthread_create(&eventsender, &pattrs, wse_notification_sender, threadcntx2) == 0) {
+				subsInfo->flags |= WSMAN_SUBSCRIPTION_NOTIFICAITON_PENDING;
+			}
+			else {
+				debug("thread created for %s failed![ %s ]", subsInfo->subsId, strerror(errno));
+				/* keep the events for the next round */
+				u_free(threadcntx2);
+				subsInfo->retryMessage = message;
+				subsInfo->retryTime = 0;
 			}
+			message = NULL;
 		}
 
 LOOP:
@@ -2309,7 +2845,7 @@ LOOP:
 		pthread_mutex_unlock(&subsInfo->notificationlock);
 		subsnode = list_next(soapCntx->subscriptionMemList, subsnode);
 	}
-	pthread_mutex_unlock(&soap->lockSubs);
+	u_mutex_unlock(&soap->lockSubs);
 }
 
 
@@ -2324,20 +2860,39 @@ ws_get_soap_context(SoapH soap)
 }
 
 
+/* caller holds soap->lockEntries if the context is shared */
+static void
+remove_context_entry(WsContextH cntx, const char *name)
+{
+	hnode_t *hn = hash_lookup(cntx->entries, name);
+	if (hn) {
+		debug("Found context entry: %s", name);
+		hash_delete_free(cntx->entries, hn);
+	}
+}
+
 int
 ws_remove_context_val(WsContextH cntx, char *name)
 {
 	int retVal = 1;
 	if (cntx && name) {
-		hnode_t        *hn;
-		u_lock(cntx->soap);
-		hn = hash_lookup(cntx->entries, name);
-		if (hn) {
-			debug("Found context entry: %s", name);
-			hash_delete_free(cntx->entries, hn);
+		int shared = WS_CONTEXT_SHARED(cntx);
+		if (shared) {
+			/* mostly there is nothing to remove, readers do not wait */
+			u_rwlock_rdlock(&cntx->soap->lockEntries);
+			retVal = hash_lookup(cntx->entries, name) == NULL;
+			u_rwlock_unlock(&cntx->soap->lockEntries);
+			if (retVal)
+				return retVal;
+			u_rwlock_wrlock(&cntx->soap->lockEntries);
+		}
+		retVal = 1;
+		if (hash_lookup(cntx->entries, name)) {
+			remove_context_entry(cntx, name);
 			retVal = 0;
 		}
-		u_unlock(cntx->soap);
+		if (shared)
+			u_rwlock_unlock(&cntx->soap->lockEntries);
 	}
 	return retVal;
 }
@@ -2366,7 +2921,7 @@ WsContextH
 ws_create_ep_context(SoapH soap,
 		     WsXmlDocH doc)
 {
-	WsContextH      cntx = ws_create_context(soap);
+	WsContextH      cntx = ws_create_request_context(soap);
 	if (cntx)
 		ws_set_context_xml_doc_val(cntx, WSFW_INDOC, doc);
 	return cntx;
@@ -2377,7 +2932,11 @@ int
 ws_destroy_context(WsContextH cntx)
 {
 	int             retVal = 1;
-	if (cntx && cntx->owner) {
+	if (cntx && cntx->owner && cntx->arena) {
+		ws_serializer_cleanup(cntx->serializercntx);
+		u_arena_destroy(cntx->arena);
+		retVal = 0;
+	} else if (cntx && cntx->owner) {
 		ws_clear_context_entries(cntx);
 		ws_clear_context_enuminfos(cntx);
 		ws_serializer_cleanup(cntx->serializercntx);
@@ -2385,6 +2944,10 @@ ws_destroy_context(WsContextH cntx)
 			list_destroy_nodes(cntx->subscriptionMemList);
 			list_destroy(cntx->subscriptionMemList);
 		}
+		if(cntx->subscriptionHash) {
+			hash_free_nodes(cntx->subscriptionHash);
+			hash_destroy(cntx->subscriptionHash);
+		}
 		u_free(cntx);
 		retVal = 0;
 	}
@@ -2418,13 +2981,16 @@ get_context_val(WsContextH cntx, const char *name)
 {
 	const char *val = NULL;
 	if (cntx && name) {
-		u_lock(cntx->soap);
+		int shared = WS_CONTEXT_SHARED(cntx);
+		if (shared)
+			u_rwlock_rdlock(&cntx->soap->lockEntries);
 		if (cntx->entries) {
 			hnode_t *hn = hash_lookup(cntx->entries, name);
 			if (hn)
 				val = hnode_get(hn);
 		}
-		u_unlock(cntx->soap);
+		if (shared)
+			u_rwlock_unlock(&cntx->soap->lockEntries);
 	}
 	return val;
 }
@@ -2544,10 +3110,14 @@ create_op_entry(SoapH soap,
 		SoapDispatchH dispatch,
 		WsmanMessage * data)
 {
-	op_t *entry = (op_t *) u_zalloc(sizeof(op_t));
-	if (entry) {
+	WsContextH cntx = ws_create_request_context(soap);
+	op_t *entry = NULL;
+
+	/* the operation lives in the arena of its context */
+	if (cntx) {
+		entry = u_arena_zalloc(cntx->arena, sizeof(op_t));
 		entry->dispatch = dispatch;
-		entry->cntx = ws_create_context(soap);
+		entry->cntx = cntx;
 		entry->data = data;
 		// entry->processed_headers = list_create(LISTCOUNT_T_MAX);
 	}
@@ -2568,20 +3138,23 @@ destroy_op_entry(op_t * entry)
 	if (soap == NULL) {
 		goto NULL_SOAP;
 	}
-	u_lock(soap);
-	if (soap->dispatchList && list_contains(soap->dispatchList, &entry->dispatch->node)) {
-		list_delete(soap->dispatchList, &entry->dispatch->node);
+	/* the list is only created while registering the plugins */
+	if (soap->dispatchList) {
+		u_mutex_lock(&soap->lockDispatch);
+		if (list_contains(soap->dispatchList, &entry->dispatch->node)) {
+			list_delete(soap->dispatchList, &entry->dispatch->node);
+		}
+		u_mutex_unlock(&soap->lockDispatch);
 	}
-	u_unlock(soap);
 
 NULL_SOAP:
 	destroy_dispatch_entry(entry->dispatch);
-	ws_destroy_context(entry->cntx);
 #if 0
 	list_destroy_nodes(entry->processed_headers);
 	list_destroy(entry->processed_headers);
 #endif
-	u_free(entry);
+	/* releases the entry too */
+	ws_destroy_context(entry->cntx);
 }
 
 void
@@ -2593,7 +3166,7 @@ destroy_dispatch_entry(SoapDispatchH entry)
 		return;
 	}
 
-	u_lock(entry->soap);
+	u_mutex_lock(&entry->soap->lockDispatch);
 	entry->usageCount--;
 	usageCount = entry->usageCount;
 	dlist = entry->soap->dispatchList;
@@ -2602,7 +3175,7 @@ destroy_dispatch_entry(SoapDispatchH entry)
 		lnode_t *n = list_delete(dlist, &entry->node);
 		lnode_destroy(n);
 	}
-	u_unlock(entry->soap);
+	u_mutex_unlock(&entry->soap->lockDispatch);
 
 	if (!usageCount) {
 		if (entry->inboundFilterList) {
@@ -2658,9 +3231,18 @@ soap_destroy(SoapH soap)
 		list_destroy_nodes(soap->outboundFilterList);
 		list_destroy(soap->outboundFilterList);
 	}
+#ifdef ENABLE_EVENTING_SUPPORT
+	if (soap->eventpoolOpSet)
+		soap->eventpoolOpSet->finalize(NULL);
+#endif
 	ws_xml_parser_destroy();
 
 	ws_destroy_context(soap->cntx);
+	u_mutex_destroy(&soap->lockDispatch);
+	u_mutex_destroy(&soap->lockMsgIds);
+	u_mutex_destroy(&soap->lockEnum);
+	u_rwlock_destroy(&soap->lockEntries);
+	u_mutex_destroy(&soap->lockSubs);
 	u_free(soap);
 
 	return;
@@ -31,6 +31,21 @@
 /**
  * @author Liang Hou
  */
+
+/*
+ * All subscriptions live in a single file, subscriptions.db, inside the
+ * repository directory.  The file is a log: every Subscribe, Renew and
+ * Unsubscribe appends one checksummed record and fsyncs it.  Replay keeps
+ * the latest record of each uuid in an in-memory index, so Get and Search
+ * never touch the directory.  Renew appends a small record with the new
+ * expiration time only; Get and Load splice it into the stored Subscribe
+ * request.  Once more than half of the file is superseded records, the
+ * live ones are written to a temporary file, fsynced and renamed over the
+ * log.
+ *
+ * Subscriptions left behind as uuid:<id> files by older versions are
+ * imported on startup.
+ */
 #ifdef HAVE_CONFIG_H
 #include <wsman_config.h>
 #endif
@@ -38,6 +53,17 @@
 #include "stdlib.h"
 #include "stdio.h"
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_DIRENT_H
 #include <dirent.h>
 #endif
@@ -47,6 +73,45 @@
 #include "wsman-types.h"
 #include "wsman-xml-api.h"
 #include "wsman-xml-binding.h"
+#include "wsman-xml.h"
+
+#define SUBS_STORE_FILE		"subscriptions.db"
+#define SUBS_STORE_MAGIC	0x53574f4cU /* "OWSL" */
+
+#define SUBS_RECORD_SAVE	1 // the Subscribe request
+#define SUBS_RECORD_EXPIRES	2 // a new expiration time
+#define SUBS_RECORD_DELETE	3
+
+#define SUBS_COMPACT_MIN	(64 * 1024)
+
+#define SUBS_ALIGN(n)	(((n) + 7) & ~((size_t)7))
+
+struct subs_record {
+	uint32_t magic;
+	uint32_t type;
+	uint32_t length; // whole record including this header, 8 byte aligned
+	uint32_t header_checksum; // over this header, both checksums zeroed
+	uint32_t checksum; // over the payload
+	uint32_t doc_len; // payload length
+	uint32_t expires_off; // SAVE: Expires text within the document
+	uint32_t expires_len; // SAVE: 0 if the subscription doesn't expire
+	char uuid[EUIDLEN];
+};
+
+struct subs_index_entry {
+	char uuid[EUIDLEN];
+	off_t offset; // of the SAVE record
+	uint32_t length;
+	uint32_t doc_len;
+	uint32_t expires_off;
+	uint32_t expires_len;
+	uint32_t renew_length; // of the latest EXPIRES record, 0 if none
+	char *expires; // and its text
+	off_t new_offset; // used while compacting
+	uint32_t new_length;
+	uint32_t new_doc_len;
+	uint32_t new_expires_len;
+};
 
 int LocalSubscriptionOpInit (char * uri_repository, void *opaqueData);
 int LocalSubscriptionOpFinalize (char * uri_repository, void *opaqueData);
@@ -71,202 +136,638 @@ struct __SubsRepositoryOpSet subscription_repository_op_set = {
 
 static int LocalSubscriptionInitFlag = 0;
 
+static pthread_mutex_t subs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *subs_dir = NULL;
+static char *subs_file = NULL;
+static int subs_fd = -1;
+static hash_t *subs_index = NULL;
+static off_t subs_tail = 0; // end of the last record
+static off_t subs_dead = 0; // bytes taken by superseded or damaged records
+
 SubsRepositoryOpSetH wsman_get_subsrepos_opset()
 {
 	return &subscription_repository_op_set;
 }
 
-int LocalSubscriptionOpInit (char * uri_repository, void *opaqueData)
+static uint32_t subs_hash(uint32_t h, const void *data, size_t len)
 {
-	LocalSubscriptionInitFlag = 1;
+	const unsigned char *p = data;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	return h;
+}
 
+static uint32_t subs_header_checksum(const struct subs_record *rec)
+{
+	struct subs_record header = *rec;
+	header.header_checksum = 0;
+	header.checksum = 0;
+	return subs_hash(2166136261U, &header, sizeof(header));
+}
+
+/* just past the start tag of the first element called name, NULL if none */
+static const char *subs_find_start_tag(const char *p, const char *end, const char *name)
+{
+	size_t name_len = strlen(name);
+	while ((p = memchr(p, '<', end - p)) != NULL) {
+		const char *tag = ++p, *local;
+		if (p >= end || *p == '/' || *p == '?' || *p == '!')
+			continue;
+		while (p < end && *p != '>' && *p != '/' && !isspace((unsigned char)*p))
+			p++;
+		local = memchr(tag, ':', p - tag);
+		local = local ? local + 1 : tag;
+		if ((size_t)(p - local) != name_len || strncmp(local, name, name_len))
+			continue;
+		p = memchr(p, '>', end - p);
+		if (p == NULL)
+			return NULL;
+		if (p[-1] != '/')
+			return p + 1;
+	}
+	return NULL;
+}
+
+/* the text of Subscribe/Expires, that is what Renew changes */
+static int subs_expires_slot(const char *doc, size_t len, uint32_t *off, uint32_t *slot_len)
+{
+	const char *end = doc + len, *text, *p;
+
+	text = subs_find_start_tag(doc, end, WSEVENT_SUBSCRIBE);
+	if (text)
+		text = subs_find_start_tag(text, end, WSEVENT_EXPIRES);
+	if (text == NULL || (p = memchr(text, '<', end - text)) == NULL || p == text)
+		return 0;
+	*off = text - doc;
+	*slot_len = p - text;
+	return 1;
+}
+
+static int subs_pread(off_t offset, void *buf, size_t len)
+{
+	char *p = buf;
+	while (len) {
+		ssize_t n = pread(subs_fd, p, len, offset);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		offset += n;
+		len -= n;
+	}
 	return 0;
 }
 
+static int subs_pwrite(int fd, off_t offset, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t n = pwrite(fd, p, len, offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static struct subs_index_entry *subs_lookup(const char *uuid)
+{
+	hnode_t *hn = hash_lookup(subs_index, (void *)uuid);
+	return hn ? (struct subs_index_entry *)hnode_get(hn) : NULL;
+}
+
+static void subs_index_drop(struct subs_index_entry *entry)
+{
+	hnode_t *hn = hash_lookup(subs_index, entry->uuid);
+	subs_dead += entry->length + entry->renew_length;
+	if (hn)
+		hash_delete_free(subs_index, hn);
+	u_free(entry->expires);
+	u_free(entry);
+}
+
+/* bring the index up to date with a record at offset, the latest one wins */
+static void subs_apply(const struct subs_record *rec, const char *payload, off_t offset)
+{
+	struct subs_index_entry *entry = subs_lookup(rec->uuid);
+
+	switch (rec->type) {
+	case SUBS_RECORD_SAVE:
+		if (entry) {
+			subs_dead += entry->length + entry->renew_length;
+			u_free(entry->expires);
+		} else {
+			entry = u_zalloc(sizeof(*entry));
+			memcpy(entry->uuid, rec->uuid, EUIDLEN);
+			if (!hash_alloc_insert(subs_index, entry->uuid, entry)) {
+				u_free(entry);
+				return;
+			}
+		}
+		entry->offset = offset;
+		entry->length = rec->length;
+		entry->doc_len = rec->doc_len;
+		entry->expires_off = rec->expires_off;
+		entry->expires_len = rec->expires_len;
+		entry->renew_length = 0;
+		entry->expires = NULL;
+		break;
+	case SUBS_RECORD_EXPIRES:
+		if (entry == NULL || entry->expires_len == 0) {
+			subs_dead += rec->length;
+			break;
+		}
+		subs_dead += entry->renew_length;
+		entry->renew_length = rec->length;
+		u_free(entry->expires);
+		entry->expires = u_strndup(payload, rec->doc_len);
+		break;
+	case SUBS_RECORD_DELETE:
+		subs_dead += rec->length;
+		if (entry)
+			subs_index_drop(entry);
+		break;
+	default:
+		subs_dead += rec->length;
+		break;
+	}
+}
+
+/* a record of type for uuid with payload, *len set to its size */
+static char *subs_record_build(uint32_t type, const char *uuid,
+		const char *payload, size_t payload_len, size_t *len)
+{
+	struct subs_record *rec;
+	char *buf;
+
+	*len = SUBS_ALIGN(sizeof(*rec) + payload_len);
+	buf = u_zalloc(*len);
+	rec = (struct subs_record *)buf;
+	rec->magic = SUBS_STORE_MAGIC;
+	rec->type = type;
+	rec->length = *len;
+	rec->doc_len = payload_len;
+	strncpy(rec->uuid, uuid, EUIDLEN - 1);
+	if (payload_len) {
+		memcpy(buf + sizeof(*rec), payload, payload_len);
+		if (type == SUBS_RECORD_SAVE)
+			subs_expires_slot(payload, payload_len, &rec->expires_off,
+					&rec->expires_len);
+	}
+	rec->checksum = subs_hash(2166136261U, payload, payload_len);
+	rec->header_checksum = subs_header_checksum(rec);
+	return buf;
+}
+
+/* append a record at the end of the log, fsynced if sync is set */
+static int subs_append(uint32_t type, const char *uuid, const char *payload,
+		size_t payload_len, int sync)
+{
+	size_t len;
+	char *buf = subs_record_build(type, uuid, payload, payload_len, &len);
+	int retVal = 0;
+
+	if (subs_pwrite(subs_fd, subs_tail, buf, len) || (sync && fsync(subs_fd))) {
+		error("Can't write %s: %s", subs_file, strerror(errno));
+		/* don't leave half a record behind */
+		if (ftruncate(subs_fd, subs_tail))
+			error("Can't truncate %s: %s", subs_file, strerror(errno));
+		retVal = -1;
+	} else {
+		subs_apply((struct subs_record *)buf, buf + sizeof(struct subs_record),
+				subs_tail);
+		subs_tail += len;
+	}
+	u_free(buf);
+	return retVal;
+}
+
+/*
+ * Records whose header checks out but whose payload does not are skipped
+ * by their length; where no header checks out, the next one is searched
+ * for record by record alignment.  Nothing after a damaged record is lost.
+ */
+static void subs_replay(void)
+{
+	struct stat st;
+	char *base;
+	off_t offset = 0, skipped = 0;
+
+	if (fstat(subs_fd, &st) || st.st_size == 0)
+		return;
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, subs_fd, 0);
+	if (base == MAP_FAILED) {
+		error("Can't map %s: %s", subs_file, strerror(errno));
+		return;
+	}
+	while (offset + (off_t)sizeof(struct subs_record) <= st.st_size) {
+		struct subs_record *rec = (struct subs_record *)(base + offset);
+		const char *payload = (char *)(rec + 1);
+		if (rec->magic != SUBS_STORE_MAGIC ||
+				rec->header_checksum != subs_header_checksum(rec) ||
+				rec->length != SUBS_ALIGN(sizeof(*rec) + rec->doc_len) ||
+				offset + rec->length > st.st_size) {
+			skipped += 8;
+			offset += 8;
+			continue;
+		}
+		if (skipped) {
+			error("%s: %lu damaged bytes before %lu skipped", subs_file,
+					(unsigned long)skipped, (unsigned long)offset);
+			subs_dead += skipped;
+			skipped = 0;
+		}
+		if (memchr(rec->uuid, '\0', EUIDLEN) == NULL ||
+				rec->expires_off + rec->expires_len > rec->doc_len ||
+				rec->checksum != subs_hash(2166136261U, payload, rec->doc_len)) {
+			error("%s: damaged record at %lu skipped", subs_file,
+					(unsigned long)offset);
+			subs_dead += rec->length;
+		} else {
+			subs_apply(rec, payload, offset);
+		}
+		offset += rec->length;
+		subs_tail = offset;
+	}
+	munmap(base, st.st_size);
+	/* a torn append at the end, the next one goes in its place */
+	if (subs_tail < st.st_size) {
+		error("%s: %lu bytes at the end dropped", subs_file,
+				(unsigned long)(st.st_size - subs_tail));
+		if (ftruncate(subs_fd, subs_tail))
+			error("Can't truncate %s: %s", subs_file, strerror(errno));
+	}
+}
+
+/* caller holds subs_lock; the stored document with the latest expiration time */
+static unsigned char *subs_read_doc(struct subs_index_entry *entry, uint32_t *len)
+{
+	unsigned char *buf = u_malloc(entry->doc_len + 1);
+	unsigned char *doc;
+	size_t expires_len, tail_len;
+
+	if (subs_pread(entry->offset + sizeof(struct subs_record), buf, entry->doc_len)) {
+		error("Can't read %s: %s", subs_file, strerror(errno));
+		u_free(buf);
+		return NULL;
+	}
+	buf[entry->doc_len] = '\0';
+	*len = entry->doc_len;
+	if (entry->expires == NULL)
+		return buf;
+	expires_len = strlen(entry->expires);
+	tail_len = entry->doc_len - entry->expires_off - entry->expires_len;
+	*len = entry->expires_off + expires_len + tail_len;
+	doc = u_malloc(*len + 1);
+	memcpy(doc, buf, entry->expires_off);
+	memcpy(doc + entry->expires_off, entry->expires, expires_len);
+	memcpy(doc + entry->expires_off + expires_len,
+		buf + entry->expires_off + entry->expires_len, tail_len);
+	doc[*len] = '\0';
+	u_free(buf);
+	return doc;
+}
+
+static int subs_sync_dir(void)
+{
+	int retVal, fd = open(subs_dir, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	retVal = fsync(fd);
+	close(fd);
+	return retVal;
+}
+
+/*
+ * Write one SAVE record per live subscription, renewals folded in, to a
+ * temporary file, fsync it and rename it over the log.
+ */
+static void subs_compact(void)
+{
+	char *tmp;
+	int fd;
+	off_t offset = 0;
+	hscan_t hs;
+	hnode_t *hn;
+
+	if (subs_dead < SUBS_COMPACT_MIN || subs_dead < subs_tail / 2)
+		return;
+	tmp = u_strdup_printf("%s.tmp", subs_file);
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		error("Can't open %s: %s", tmp, strerror(errno));
+		u_free(tmp);
+		return;
+	}
+	hash_scan_begin(&hs, subs_index);
+	while ((hn = hash_scan_next(&hs))) {
+		struct subs_index_entry *entry = (struct subs_index_entry *)hnode_get(hn);
+		struct subs_record *rec;
+		unsigned char *doc;
+		uint32_t doc_len;
+		size_t len;
+		char *buf;
+		int r;
+
+		if ((doc = subs_read_doc(entry, &doc_len)) == NULL)
+			goto ERR;
+		buf = subs_record_build(SUBS_RECORD_SAVE, entry->uuid, (char *)doc,
+				doc_len, &len);
+		rec = (struct subs_record *)buf;
+		entry->new_offset = offset;
+		entry->new_length = rec->length;
+		entry->new_doc_len = rec->doc_len;
+		entry->new_expires_len = rec->expires_len;
+		r = subs_pwrite(fd, offset, buf, len);
+		u_free(buf);
+		u_free(doc);
+		if (r)
+			goto ERR;
+		offset += len;
+	}
+	if (fsync(fd) || rename(tmp, subs_file))
+		goto ERR;
+	if (subs_sync_dir())
+		error("Can't sync %s: %s", subs_dir, strerror(errno));
+	close(subs_fd);
+	subs_fd = fd;
+	hash_scan_begin(&hs, subs_index);
+	while ((hn = hash_scan_next(&hs))) {
+		struct subs_index_entry *entry = (struct subs_index_entry *)hnode_get(hn);
+		entry->offset = entry->new_offset;
+		entry->length = entry->new_length;
+		entry->doc_len = entry->new_doc_len;
+		entry->expires_len = entry->new_expires_len;
+		entry->renew_length = 0;
+		u_free(entry->expires);
+		entry->expires = NULL;
+	}
+	debug("%s compacted from %lu to %lu bytes", subs_file,
+			(unsigned long)subs_tail, (unsigned long)offset);
+	subs_tail = offset;
+	subs_dead = 0;
+	u_free(tmp);
+	return;
+ERR:
+	error("Can't compact %s: %s", subs_file, strerror(errno));
+	close(fd);
+	unlink(tmp);
+	u_free(tmp);
+}
+
+static int subs_legacy_filter(const struct dirent *d)
+{
+	return strncmp(d->d_name, "uuid:", 5) == 0 && strlen(d->d_name) >= 41;
+}
+
+/* move uuid:<id> files written by older versions into the store */
+static void subs_import_legacy(const char *uri_repository)
+{
+	struct dirent **namelist;
+	int n, i, imported = 0;
+
+	n = scandir(uri_repository, &namelist, subs_legacy_filter, alphasort);
+	if (n < 0)
+		return;
+	for (i = 0; i < n; i++) {
+		char *subs_path = u_strdup_printf("%s/%s", uri_repository, namelist[i]->d_name);
+		struct stat st;
+		char *doc = NULL;
+		int fd = open(subs_path, O_RDONLY);
+		if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+			doc = u_malloc(st.st_size);
+			if (read(fd, doc, st.st_size) == st.st_size &&
+					subs_lookup(namelist[i]->d_name + 5) == NULL &&
+					subs_append(SUBS_RECORD_SAVE, namelist[i]->d_name + 5,
+						doc, st.st_size, 0) == 0)
+				imported++;
+		} else {
+			error("Can't read %s: %s", subs_path, strerror(errno));
+		}
+		if (fd >= 0)
+			close(fd);
+		u_free(doc);
+		u_free(subs_path);
+	}
+	/* the old files go once the records are on disk */
+	if (imported && fsync(subs_fd)) {
+		error("Can't write %s: %s", subs_file, strerror(errno));
+		n = 0;
+	}
+	for (i = 0; i < n; i++) {
+		char *subs_path = u_strdup_printf("%s/%s", uri_repository,
+				namelist[i]->d_name);
+		if (subs_lookup(namelist[i]->d_name + 5)) {
+			debug("subscription file %s imported", namelist[i]->d_name);
+			unlink(subs_path);
+		}
+		u_free(subs_path);
+	}
+	for (i = 0; i < n; i++)
+		u_free(namelist[i]);
+	u_free(namelist);
+}
+
+static void subs_close(void)
+{
+	hscan_t hs;
+	hnode_t *hn;
+	if (subs_fd >= 0)
+		close(subs_fd);
+	subs_fd = -1;
+	if (subs_index) {
+		hash_scan_begin(&hs, subs_index);
+		while ((hn = hash_scan_next(&hs))) {
+			struct subs_index_entry *entry = (struct subs_index_entry *)hnode_get(hn);
+			hash_scan_delfree(subs_index, hn);
+			u_free(entry->expires);
+			u_free(entry);
+		}
+		hash_destroy(subs_index);
+		subs_index = NULL;
+	}
+	u_free(subs_file);
+	subs_file = NULL;
+	u_free(subs_dir);
+	subs_dir = NULL;
+	subs_tail = subs_dead = 0;
+}
+
+int LocalSubscriptionOpInit (char * uri_repository, void *opaqueData)
+{
+	int retVal = 0;
+
+	pthread_mutex_lock(&subs_lock);
+	subs_close();
+	LocalSubscriptionInitFlag = 0;
+	subs_dir = u_strdup(uri_repository);
+	subs_file = u_strdup_printf("%s/" SUBS_STORE_FILE, uri_repository);
+	subs_fd = open(subs_file, O_RDWR | O_CREAT, 0600);
+	if (subs_fd < 0) {
+		error("Can't open %s: %s", subs_file, strerror(errno));
+		subs_close();
+		retVal = -1;
+		goto DONE;
+	}
+	subs_index = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+	subs_replay();
+	subs_import_legacy(uri_repository);
+	subs_compact();
+	debug("%s: %lu subscriptions", subs_file, (unsigned long)hash_count(subs_index));
+	LocalSubscriptionInitFlag = 1;
+DONE:
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
+}
+
 int LocalSubscriptionOpFinalize(char * uri_repository, void *opaqueData)
 {
-        return (LocalSubscriptionInitFlag == 0) ? -1 : 0;
+	int retVal;
+
+	pthread_mutex_lock(&subs_lock);
+	retVal = (LocalSubscriptionInitFlag == 0) ? -1 : 0;
+	subs_close();
+	LocalSubscriptionInitFlag = 0;
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
 }
 
 int LocalSubscriptionOpGet(char * uri_repository, char * uuid, unsigned char  **subscriptionDoc, int *len)
 {
-	unsigned char block[512];
-	unsigned char *buf = NULL;
-	int count,m;
-	int pre_count;
-        char *subs_path;
-        FILE *fp;
-
-	count = m = 0;
+	struct subs_index_entry *entry;
+	uint32_t doc_len;
+	int retVal = -1;
+
 	*subscriptionDoc = NULL;
+	pthread_mutex_lock(&subs_lock);
 	if (LocalSubscriptionInitFlag == 0)
-          return -1;
-	subs_path = u_strdup_printf ("%s/uuid:%s", uri_repository, uuid);
-	fp = fopen(subs_path, "r");
-	if (fp == NULL) {
-          error("Can't open %s: %s", subs_path, strerror(errno));
-          u_free(subs_path);
-          return -1;
-        }
-	u_free(subs_path);
-	while (!feof(fp)) {
-          memset(block, 0, 512);
-          m = fread(block, 1, 511, fp);
-          if (m > 0) {
-            debug("read [%s] from file, len = %d",block, m);
-            pre_count = count;
-            count += m;
-            debug("buf = %0x, count = %d", buf, count);
-            buf = u_realloc(buf, count);
-            memcpy(buf+pre_count, block, m);
-          }
+		goto DONE;
+	entry = subs_lookup(uuid);
+	if (entry == NULL) {
+		debug("subscription %s not in the repository", uuid);
+		goto DONE;
 	}
-	fclose(fp);
-	*subscriptionDoc = buf;
-	*len = count;
-	return 0;
+	*subscriptionDoc = subs_read_doc(entry, &doc_len);
+	if (*subscriptionDoc) {
+		*len = doc_len;
+		retVal = 0;
+	}
+DONE:
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
 }
 
 int LocalSubscriptionOpSearch(char * uri_repository, char * uuid)
 {
-  char *subs_path;
-  FILE *fp;
-	if (LocalSubscriptionInitFlag == 0)
-          return -1;
-	subs_path = u_strdup_printf ("%s/uuid:%s", uri_repository, uuid);
-	fp = fopen(subs_path, "r");
-	if (fp == NULL) {
-          error("Can't open %s: %s", subs_path, strerror(errno));
-          u_free(subs_path);
-          return -1;
-        }
-	u_free(subs_path);
-	fclose(fp);
-	return 0;
+	int retVal = -1;
+
+	pthread_mutex_lock(&subs_lock);
+	if (LocalSubscriptionInitFlag && subs_lookup(uuid))
+		retVal = 0;
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
 }
 
 int LocalSubscriptionOpLoad (char * uri_repository, list_t * subscription_list)
 {
-	struct dirent **namelist;
-	int n, m, count;
-	int pre_count;
-	char block[512];
-	unsigned char *buf = NULL;
+	hscan_t hs;
+	hnode_t *hn;
+	int retVal = 0;
 
-	if (LocalSubscriptionInitFlag == 0)
-          return -1;
 	if (subscription_list == NULL)
-          return -1;
-	if (0 > (n = scandir (uri_repository, &namelist, 0, alphasort))) {
-       	  return -1;
-    	}
-        else {
-        	while (n--) {
-                        char *subs_path;
-                        FILE *subs;
-        		lnode_t *node;
-
-			if (strstr(namelist[n]->d_name,"uuid") == NULL || strlen(namelist[n]->d_name) < 41) {
-				u_free(namelist[n]);
-				continue;
-			}
-			subs_path = u_strdup_printf ("%s/%s", uri_repository, namelist[n]->d_name);
-			subs = fopen(subs_path, "r");
-                        if (subs == NULL) {
-                          error("Can't open %s: %s", subs_path, strerror(errno));
-                          u_free(subs_path);
-                          return -1;
-                        }
-			u_free(subs_path);
-			count = 0;
-			buf = NULL;
-			while (!feof(subs)) {
-				memset(block, 0, 512);
-				m = fread(block, 1, 511, subs);
-				if (m > 0) {
-					pre_count = count;
-					count += m;
-					buf = u_realloc(buf, count);
-					memcpy(buf+pre_count, block, m);
-				}
-			}
-			fclose(subs);
-			SubsRepositoryEntryH entry = u_malloc(sizeof(*entry));
-			if (entry) {
-				entry->strdoc = buf;
-				entry->len = count;
-				entry->uuid = u_strdup(namelist[n]->d_name);
-				node = lnode_create(entry);
-            			list_append(subscription_list, node);
-            			debug("subscription file found: %s", namelist[n]->d_name );
-			} else {
-				u_free(buf);
-			}
-            		u_free(namelist[n]);
-        	}
-                u_free(namelist);
-    	}
-	return 0;
+		return -1;
+	pthread_mutex_lock(&subs_lock);
+	if (LocalSubscriptionInitFlag == 0) {
+		retVal = -1;
+		goto DONE;
+	}
+	hash_scan_begin(&hs, subs_index);
+	while ((hn = hash_scan_next(&hs))) {
+		struct subs_index_entry *stored = (struct subs_index_entry *)hnode_get(hn);
+		SubsRepositoryEntryH entry;
+		uint32_t doc_len;
+		unsigned char *buf = subs_read_doc(stored, &doc_len);
+		if (buf == NULL)
+			continue;
+		entry = u_malloc(sizeof(*entry));
+		entry->strdoc = buf;
+		entry->len = doc_len;
+		entry->uuid = u_strdup_printf("uuid:%s", stored->uuid);
+		list_append(subscription_list, lnode_create(entry));
+	}
+	debug("%lu subscriptions loaded from %s",
+		(unsigned long)list_count(subscription_list), subs_file);
+DONE:
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
 }
 
 int LocalSubscriptionOpSave (char * uri_repository, char * uuid, unsigned char *subscriptionDoc)
 {
-	char buf[U_NAME_MAX];
-        FILE *subsfile;
+	int retVal = -1;
 
-	if (LocalSubscriptionInitFlag == 0)
-          return -1;
-	snprintf(buf, U_NAME_MAX, "%s/uuid:%s", uri_repository, uuid);
-	subsfile = fopen(buf, "w");
-	if (subsfile == NULL) {
-          error("Can't open %s: %s", buf, strerror(errno));
-          return -1;
-        }
-	fprintf(subsfile, "%s", subscriptionDoc);
-	fclose(subsfile);
-	return 0;
+	pthread_mutex_lock(&subs_lock);
+	if (LocalSubscriptionInitFlag) {
+		retVal = subs_append(SUBS_RECORD_SAVE, uuid, (char *)subscriptionDoc,
+				strlen((char *)subscriptionDoc), 1);
+		subs_compact();
+	}
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
 }
 
+/* only the new expiration time is written, the stored request is left alone */
 int LocalSubscriptionOpUpdate(char * uri_repository, char * uuid, char *expire)
 {
-	char buf[U_NAME_MAX];
-	WsXmlDocH doc= NULL;
-	char *temp;
-	int len = 0;
+	struct subs_index_entry *entry;
+	int retVal = -1;
 
+	pthread_mutex_lock(&subs_lock);
 	if (LocalSubscriptionInitFlag == 0)
-          return -1;
-	snprintf(buf, U_NAME_MAX, "%s/uuid:%s", uri_repository, uuid);
-	doc = xml_parser_file_to_doc( buf, "UTF-8", 0);
-	if (doc) {
-		FILE *subsfile;
-		WsXmlNodeH node = ws_xml_get_child(ws_xml_get_soap_body(doc),
-			0, XML_NS_EVENTING, WSEVENT_SUBSCRIBE);
-		node = ws_xml_get_child(node, 0, XML_NS_EVENTING, WSEVENT_EXPIRES);
-		ws_xml_set_node_text(node, expire);
-		ws_xml_dump_memory_enc(doc, &temp, &len, "UTF-8");
-		subsfile = fopen(buf, "w");
-                if (subsfile == NULL) {
-                  error("Can't open %s: %s", buf, strerror(errno));
-                  return -1;
-                }
-		fprintf(subsfile, "%s", temp);
-		fclose(subsfile);
-		ws_xml_free_memory(temp);
-		ws_xml_destroy_doc(doc);
+		goto DONE;
+	entry = subs_lookup(uuid);
+	if (entry == NULL) {
+		debug("subscription %s not in the repository", uuid);
+		goto DONE;
 	}
-	return 0;
+	if (entry->expires_len == 0 || expire == NULL || *expire == '\0' ||
+			strpbrk(expire, "<&")) {
+		error("subscription %s: expiration time can't be updated", uuid);
+		goto DONE;
+	}
+	retVal = subs_append(SUBS_RECORD_EXPIRES, uuid, expire, strlen(expire), 1);
+	subs_compact();
+DONE:
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
 }
 
 int LocalSubscriptionOpDelete (char * uri_repository, char * uuid)
 {
-	char buf[U_NAME_MAX];
+	int retVal = 0;
 
-	if (LocalSubscriptionInitFlag == 0)
-          return -1;
-	snprintf(buf, U_NAME_MAX, "%s/uuid:%s", uri_repository, uuid);
-	if (unlink(buf)) {
-		debug("unlink %s failed! %s", buf, strerror(errno));
+	pthread_mutex_lock(&subs_lock);
+	if (LocalSubscriptionInitFlag == 0) {
+		retVal = -1;
+		goto DONE;
 	}
-	return 0;
+	if (subs_lookup(uuid) == NULL) {
+		debug("subscription %s not in the repository", uuid);
+		goto DONE;
+	}
+	retVal = subs_append(SUBS_RECORD_DELETE, uuid, NULL, 0, 1);
+	subs_compact();
+DONE:
+	pthread_mutex_unlock(&subs_lock);
+	return retVal;
 }
@@ -156,6 +156,11 @@ void wsman_transport_close_transport(WsManClient * cl)
 	}
 }
 
+void wsman_transport_flush_connections(void)
+{
+	/* WinHTTP pools connections by itself */
+}
+
 
 static void *init_win_transport(WsManClient * cl)
 {
@@ -277,6 +282,7 @@ wsmc_handler(WsManClient * cl, WsXmlDocH rqstDoc, void *user_data)
 	HINTERNET request = NULL;
 	unsigned long flags = 0;
 	char *buf = NULL;
+	char *post = NULL;
 	int errLen;
 	DWORD dwStatusCode = 0;
 	DWORD dwSupportedSchemes;
@@ -352,7 +358,14 @@ wsmc_handler(WsManClient * cl, WsXmlDocH rqstDoc, void *user_data)
 		goto DONE;
 	}
 
-	ws_xml_dump_memory_enc(rqstDoc, &buf, &errLen, cl->content_encoding);
+	if (rqstDoc) {
+		ws_xml_dump_memory_enc(rqstDoc, &buf, &errLen, cl->content_encoding);
+		post = buf;
+	} else {
+		/* already serialized by the caller */
+		post = u_buf_ptr((u_buf_t *)user_data);
+		errLen = (int)u_buf_len((u_buf_t *)user_data);
+	}
 	updated = 0;
 	ws_auth = wsmc_transport_get_auth_value(cl);
 	if(ws_auth  == AUTH_SCHEME_NTLM)
@@ -413,7 +426,7 @@ wsmc_handler(WsManClient * cl, WsXmlDocH rqstDoc, void *user_data)
 	while (!bDone) {
 		bResult = WinHttpSendRequest(request,
 				WINHTTP_NO_ADDITIONAL_HEADERS,
-				(DWORD) 0, (LPVOID) buf,
+				(DWORD) 0, (LPVOID) post,
 				(DWORD) errLen,
 				(DWORD) errLen,
 				(DWORD_PTR) NULL);
@@ -697,6 +710,72 @@ DONE:
 	}
 }
 
+
+/*
+ * WinHTTP has no counterpart of curl's multi interface: asynchronous
+ * requests are performed right away and their callbacks are called
+ * from the next wsman_async_run().
+ */
+struct _WsManAsync {
+	list_t *completed;
+};
+
+typedef struct {
+	WsManClient *cl;
+	wsman_async_callback_t callback;
+	void *data;
+} win_async_request;
+
+WsManAsync *wsman_async_new(void)
+{
+	WsManAsync *async = u_zalloc(sizeof(*async));
+	async->completed = list_create(LISTCOUNT_T_MAX);
+	return async;
+}
+
+int wsman_async_send_request(WsManAsync *async, WsManClient *cl, WsXmlDocH request,
+		wsman_async_callback_t callback, void *data)
+{
+	win_async_request *req;
+	if (wsman_send_request(cl, request))
+		return 1;
+	req = u_zalloc(sizeof(*req));
+	req->cl = cl;
+	req->callback = callback;
+	req->data = data;
+	list_append(async->completed, lnode_create(req));
+	return 0;
+}
+
+int wsman_async_run(WsManAsync *async, int timeout)
+{
+	lnode_t *node;
+	win_async_request *req;
+	while (!list_isempty(async->completed)) {
+		node = list_del_first(async->completed);
+		req = (win_async_request *)lnode_get(node);
+		lnode_destroy(node);
+		if (req->callback)
+			req->callback(req->cl, req->data);
+		u_free(req);
+	}
+	return 0;
+}
+
+int wsman_async_pending(WsManAsync *async)
+{
+	return list_count(async->completed);
+}
+
+void wsman_async_destroy(WsManAsync *async)
+{
+	if (async == NULL)
+		return;
+	wsman_async_run(async, 0);
+	list_destroy(async->completed);
+	u_free(async);
+}
+
 // in future change this to return a list of certs...
 BOOL find_cert(const _TCHAR * oid,
 		const _TCHAR * certName,
@@ -40,6 +40,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include <ctype.h>
 #include <assert.h>
@@ -54,44 +55,143 @@
 #include "wsman-xml-api.h"
 #include "wsman-soap.h"
 #include "wsman-xml.h"
+#include "wsman-xml-binding.h"
 
 #include "wsman-dispatcher.h"
 #include "wsman-xml-serializer.h"
 #include "wsman-xml-serialize.h"
 #include "wsman-soap-envelope.h"
 
-struct __WsSerializerMemEntry {
-	char buf[0];
-};
-
-typedef struct __WsSerializerMemEntry WsSerializerMemEntry;
+/*
+ * Buffers of a malloc based context are kept in an open addressing
+ * table keyed by their address, so that a single buffer is found and
+ * released in O(1) and a pointer the context never handed out is
+ * refused without touching the memory it points to.
+ */
+#define SER_TABLE_MIN	64
 
 struct __WsSerializerContext
 {
-	pthread_mutex_t lock;
-	list_t *WsSerializerAllocList;
+	u_mutex_t lock;
+	void **table;
+	size_t tsize;		/* power of two, 0 without table */
+	size_t count;
+	u_arena_t *arena;
 };
 
+static size_t
+ser_table_hash(const void *ptr, size_t tsize)
+{
+	uintptr_t h = (uintptr_t) ptr >> 4;
+	h ^= h >> 16;
+	h *= 0x45d9f3bUL;
+	h ^= h >> 16;
+	return h & (tsize - 1);
+}
+
+static size_t
+ser_table_find(WsSerializerContextH serctx, const void *ptr)
+{
+	size_t i = ser_table_hash(ptr, serctx->tsize);
+	while (serctx->table[i] && serctx->table[i] != ptr)
+		i = (i + 1) & (serctx->tsize - 1);
+	return i;
+}
+
+static int
+ser_table_grow(WsSerializerContextH serctx)
+{
+	void **old = serctx->table;
+	size_t i, osize = serctx->tsize;
+	size_t nsize = osize ? osize * 2 : SER_TABLE_MIN;
+
+	serctx->table = u_zalloc(nsize * sizeof(void *));
+	if (serctx->table == NULL) {
+		serctx->table = old;
+		return 0;
+	}
+	serctx->tsize = nsize;
+	for (i = 0; i < osize; i++) {
+		if (old[i])
+			serctx->table[ser_table_find(serctx, old[i])] = old[i];
+	}
+	u_free(old);
+	return 1;
+}
+
+static int
+ser_table_insert(WsSerializerContextH serctx, void *ptr)
+{
+	/* keep the load below 1/2 */
+	if (2 * (serctx->count + 1) > serctx->tsize &&
+			!ser_table_grow(serctx))
+		return 0;
+	serctx->table[ser_table_find(serctx, ptr)] = ptr;
+	serctx->count++;
+	return 1;
+}
+
+/* backward shift deletion, no tombstones are left behind */
+static int
+ser_table_remove(WsSerializerContextH serctx, const void *ptr)
+{
+	size_t mask = serctx->tsize - 1;
+	size_t i, j, k;
+
+	if (serctx->tsize == 0)
+		return 0;
+	i = ser_table_find(serctx, ptr);
+	if (serctx->table[i] == NULL)
+		return 0;
+	j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (serctx->table[j] == NULL)
+			break;
+		k = ser_table_hash(serctx->table[j], serctx->tsize);
+		/* leave j where it is if its home lies cyclically in (i, j] */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		serctx->table[i] = serctx->table[j];
+		i = j;
+	}
+	serctx->table[i] = NULL;
+	serctx->count--;
+	return 1;
+}
+
 WsSerializerContextH ws_serializer_init()
 {
 	WsSerializerContextH serializercntx = NULL;
-	serializercntx = u_malloc(sizeof(struct __WsSerializerContext));
+	serializercntx = u_zalloc(sizeof(struct __WsSerializerContext));
 	if(serializercntx == NULL) return NULL;
-	serializercntx->WsSerializerAllocList = list_create(LISTCOUNT_T_MAX);
-	if(serializercntx->WsSerializerAllocList == NULL) {
-		u_free(serializercntx);
-		return NULL;
-	}
-	u_init_lock(serializercntx);
+	u_mutex_init(&serializercntx->lock, "serializer");
+	return serializercntx;
+}
+
+/*
+ * Serializer context taking its memory from an arena: single
+ * allocations are never freed, everything goes away with the arena.
+ * Such a context belongs to one request and is used without locking.
+ */
+WsSerializerContextH ws_serializer_init_arena(u_arena_t *arena)
+{
+	WsSerializerContextH serializercntx;
+	serializercntx = u_arena_alloc(arena, sizeof(struct __WsSerializerContext));
+	if(serializercntx == NULL) return NULL;
+	serializercntx->table = NULL;
+	serializercntx->tsize = 0;
+	serializercntx->count = 0;
+	serializercntx->arena = arena;
 	return serializercntx;
 }
 
 int ws_serializer_cleanup(WsSerializerContextH serctx)
 {
-	if(serctx && serctx->WsSerializerAllocList) {
+	if(serctx && serctx->arena == NULL) {
 		ws_serializer_free_all(serctx);
-                u_destroy_lock(serctx);
-		list_destroy(serctx->WsSerializerAllocList);
+		u_free(serctx->table);
+		u_mutex_destroy(&serctx->lock);
 		u_free(serctx);
 	}
 	return 0;
@@ -131,16 +231,45 @@ xml_serializer_add_child(XmlSerializationData * data, char *value)
 
 
 
+static int same_str(const char *a, const char *b)
+{
+	return a == b || (a && b && !strcmp(a, b));
+}
+
+/*
+ * Elements are looked up by index. Walking the children from the first
+ * one for every index makes arrays quadratic, so the last child found is
+ * kept and the next index continues from there.
+ */
 WsXmlNodeH xml_serializer_get_child(XmlSerializationData * data)
 {
 	WsXmlNodeH node;
 	const char *name = data->elementInfo->name;
 	const char *ns = data->elementInfo->ns;
+	XmlSerializerCursor *cur = &data->cursor;
 
 	TRACE_ENTER;
 	debug("name = %s:%s in %s [%d]", ns, name,
 	      ws_xml_get_node_local_name(data->xmlNode), data->index);
-	node = ws_xml_get_child(data->xmlNode, data->index, ns, name);
+	if (cur->child && cur->parent == data->xmlNode && (ns || name) &&
+	    (data->index == cur->index || data->index == cur->index + 1) &&
+	    same_str(cur->qname.name, name) && same_str(cur->qname.ns, ns)) {
+		node = cur->child;
+		if (data->index != cur->index) {
+			do {
+				node = xml_parser_get_next_child(node);
+			} while (node && !ws_xml_match_qname(node, &cur->qname));
+		}
+	} else {
+		ws_xml_qname_init(&cur->qname, ns, name);
+		node = ws_xml_get_child_qname(data->xmlNode, data->index,
+					      &cur->qname);
+	}
+	cur->child = node;
+	if (node) {
+		cur->parent = data->xmlNode;
+		cur->index = data->index;
+	}
 #if 0
 	if (g_NameNameAliaseTable) {
 		int index = 0;
@@ -161,17 +290,15 @@ WsXmlNodeH xml_serializer_get_child(XmlSerializationData * data)
 	return node;
 }
 
-static int get_struct_align(void)
-{
-	typedef struct {
-		XML_TYPE_UINT8 a;
-		struct {
-			char x;
-			void *y;
-		} b;
-	} dummy;
-	return (char *) &(((dummy *) NULL)->b) - (char *) NULL;
-}
+typedef struct {
+	XML_TYPE_UINT8 a;
+	struct {
+		char x;
+		void *y;
+	} b;
+} struct_align_dummy;
+
+#define get_struct_align() offsetof(struct_align_dummy, b)
 
 
 static int
@@ -1192,42 +1319,44 @@ static XmlSerialiseDynamicSizeData *make_dyn_size_data(XmlSerializationData
 {
 	XmlSerialiseDynamicSizeData *dyn =
 	    (XmlSerialiseDynamicSizeData *) data->elementBuf;
-	int savedIndex = data->index;
+	unsigned int count;
 	int size;
 
 	TRACE_ENTER;
-	data->index = 0;
-	while (xml_serializer_get_child(data) != NULL) {
-		data->index++;
-	}
-	dyn->count = data->index;
-	data->index = savedIndex;
-	if (dyn->count < DATA_MIN_COUNT(data)) {
-		error("not enough (%d < %d) elements %s", dyn->count,
+	/* the count is only stored once accepted, freeing a rejected
+	 * array must not walk items that were never allocated */
+	count = ws_xml_get_child_count_by_qname(data->xmlNode,
+			data->elementInfo->ns, DATA_ELNAME(data));
+	if (count < DATA_MIN_COUNT(data)) {
+		error("not enough (%d < %d) elements %s", count,
 		      DATA_MIN_COUNT(data), DATA_ELNAME(data));
 		*retValp = WS_ERR_XML_PARSING;
 		dyn = NULL;
 		goto DONE;
 	}
 	if ((DATA_MAX_COUNT(data) > 0)
-	    && dyn->count > DATA_MAX_COUNT(data)) {
-		error("too many (%d > %d) elements %s", dyn->count,
+	    && count > DATA_MAX_COUNT(data)) {
+		error("too many (%d > %d) elements %s", count,
 		      DATA_MAX_COUNT(data), DATA_ELNAME(data));
 		*retValp = WS_ERR_XML_PARSING;
 		dyn = NULL;
 		goto DONE;
 	}
-	debug("count = %d of %d sizes", dyn->count, DATA_SIZE(data));
-	if (dyn->count == 0) {
+	debug("count = %d of %d sizes", count, DATA_SIZE(data));
+	if (count == 0) {
+		dyn->count = 0;
 		goto DONE;
 	}
 
-	size = DATA_SIZE(data) * dyn->count;
+	/* room for the items, not for their descriptors */
+	size = ((XmlSerializerInfo *) data->elementInfo->extData)->size * count;
 	dyn->data = xml_serializer_alloc(data, size, 1);
 	if (dyn->data == NULL) {
 		error("no memory");
 		*retValp = WS_ERR_INSUFFICIENT_RESOURCES;
 		dyn = NULL;
+	} else {
+		dyn->count = count;
 	}
 
       DONE:
@@ -1319,7 +1448,7 @@ int do_serialize_dyn_size_array(XmlSerializationData * data)
 	myinfo.name = data->elementInfo->name;
 	myinfo.ns = data->elementInfo->ns;
 
-	data->stopper = (char *) dyn->data + DATA_SIZE(data) * dyn->count;
+	data->stopper = (char *) dyn->data + myinfo.size * dyn->count;
 	data->elementInfo = &myinfo;
 	DATA_BUF(data) = dyn->data;
 	data->index = 0;
@@ -1367,6 +1496,7 @@ int do_serialize_struct(XmlSerializationData * data)
 	size_t struct_size;
 	int savedLocalIndex;
 	char *savedLocalElementBuf;
+	XmlSerializerCursor savedCursor;
 	WsXmlNodeH child;
 
 	TRACE_ENTER;
@@ -1445,6 +1575,7 @@ int do_serialize_struct(XmlSerializationData * data)
 			}
 			data->xmlNode = child;
 		}
+		savedCursor = data->cursor;
 
 		debug("before for loop. Struct %s = %p",
 		      savedElement->name ? savedElement->name : "NULL", DATA_BUF(data));
@@ -1474,6 +1605,7 @@ int do_serialize_struct(XmlSerializationData * data)
 		data->mode = savedMode;
 		data->xmlNode = savedXmlNode;
 		data->elementInfo = savedElement;
+		data->cursor = savedCursor;
 		handle_attrs(data, child, 0);
 		data->elementBuf = savedLocalElementBuf + struct_size;
 	}
@@ -1902,68 +2034,74 @@ int ws_deserialize_datetime(const char *text, XML_DATETIME * tmx)
 
 void *ws_serializer_alloc(WsSerializerContextH serctx, int size)
 {
-	WsSerializerMemEntry *ptr = NULL;
+	void *ptr;
 	TRACE_ENTER;
-	if ((ptr = (WsSerializerMemEntry *) u_malloc(sizeof(WsSerializerMemEntry) + size)) != NULL) {
-		lnode_t *node;
-		u_lock(serctx);
-		if ((node = lnode_create(ptr)) == NULL) {
+	if (serctx->arena) {
+		ptr = u_arena_alloc(serctx->arena, size);
+		TRACE_EXIT;
+		return ptr;
+	}
+	if ((ptr = u_malloc(size)) != NULL) {
+		u_mutex_lock(&serctx->lock);
+		if (!ser_table_insert(serctx, ptr)) {
 			u_free(ptr);
 			ptr = NULL;
-		} else {
-			list_append(serctx->WsSerializerAllocList, node);
 		}
-		u_unlock(serctx);
+		u_mutex_unlock(&serctx->lock);
 	}
 	TRACE_EXIT;
-	return ptr ? ptr->buf : NULL;
+	return ptr;
 }
 
 
-static int do_serializer_free(WsSerializerContextH serctx, void *ptr)
-{
-	lnode_t *node = NULL;
-	lnode_t *node2 = NULL;
-	TRACE_ENTER;
-	if (serctx) {
-		u_lock(serctx);
-		node = list_first(serctx->WsSerializerAllocList);
-		while (node != NULL) {
-			WsSerializerMemEntry *entry =
-			    (WsSerializerMemEntry *) node->list_data;
-
-			if (entry && (!ptr || ptr == entry->buf)) {
-				u_free(entry);
-				node2 = node;
-				node = list_delete2(serctx->WsSerializerAllocList, node);
-				lnode_destroy (node2);
-				if (ptr != NULL) {
-					break;
-				}
-			}
-			else
-				node = list_next(serctx->WsSerializerAllocList, node);
-		}
-		u_unlock(serctx);
-	}
-	TRACE_EXIT;
-	return (node != NULL);
-}
-
+/*
+ * Releases ptr if it came from ws_serializer_alloc() on serctx, refuses
+ * anything else. A request context owns its memory until it is
+ * destroyed, freeing there is a no-op.
+ */
 int ws_serializer_free(WsSerializerContextH serctx, void *ptr)
 {
-	int retVal = 0;
+	int found;
 	TRACE_ENTER;
-	if (ptr != NULL)
-		retVal = do_serializer_free(serctx, ptr);
+	if (serctx == NULL || ptr == NULL) {
+		TRACE_EXIT;
+		return 0;
+	}
+	if (serctx->arena) {
+		/* released with the arena */
+		TRACE_EXIT;
+		return 1;
+	}
+	u_mutex_lock(&serctx->lock);
+	found = ser_table_remove(serctx, ptr);
+	u_mutex_unlock(&serctx->lock);
+	if (!found) {
+		error("%p does not belong to this serializer", ptr);
+		TRACE_EXIT;
+		return 0;
+	}
+	u_free(ptr);
 	TRACE_EXIT;
-	return retVal;
+	return 1;
 }
 
 void ws_serializer_free_all(WsSerializerContextH serctx)
 {
+	size_t i;
 	TRACE_ENTER;
-	do_serializer_free(serctx, NULL);
+	if (serctx == NULL || serctx->arena) {
+		TRACE_EXIT;
+		return;
+	}
+	u_mutex_lock(&serctx->lock);
+	for (i = 0; i < serctx->tsize; i++) {
+		if (serctx->table[i]) {
+			u_free(serctx->table[i]);
+			serctx->table[i] = NULL;
+		}
+	}
+	serctx->count = 0;
+	u_mutex_unlock(&serctx->lock);
 	TRACE_EXIT;
 }
 
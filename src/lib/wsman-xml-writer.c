@@ -0,0 +1,479 @@
+/*******************************************************************************
+ * Copyright (C) 2004-2006 Intel Corp. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of Intel Corp. nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Intel Corp. OR THE CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <wsman_config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "u/libu.h"
+#include "wsman-xml-api.h"
+#include "wsman-xml.h"
+#include "wsman-xml-binding.h"
+#include "wsman-xml-writer.h"
+
+
+/* A namespace declaration in scope, the default namespace has prefix "" */
+struct writer_ns {
+	char *uri;
+	char *prefix;
+};
+
+struct writer_element {
+	char *qname;
+	int nsCount;		/* declarations in scope outside of it */
+};
+
+struct _WsXmlWriter {
+	WsXmlNodeH parent;
+	u_buf_t *buf;
+	int startTag;		/* innermost start tag not closed yet */
+	int error;
+	struct writer_element *elements;
+	int depth;
+	int elementsSize;
+	struct writer_ns *ns;
+	int nsCount;
+	int nsSize;
+};
+
+
+static void put(WsXmlWriter *writer, const char *str, size_t len)
+{
+	if (len > 0 && u_buf_append(writer->buf, (void *) str, len))
+		writer->error = 1;
+}
+
+static void put_str(WsXmlWriter *writer, const char *str)
+{
+	put(writer, str, strlen(str));
+}
+
+static void put_escaped(WsXmlWriter *writer, const char *str, int inAttr)
+{
+	const char *run = str;
+
+	for (; *str; str++) {
+		const char *ent;
+
+		switch (*str) {
+		case '&': ent = "&amp;"; break;
+		case '<': ent = "&lt;"; break;
+		case '>': ent = "&gt;"; break;
+		case '\r': ent = "&#13;"; break;
+		case '"': ent = inAttr ? "&quot;" : NULL; break;
+		case '\n': ent = inAttr ? "&#10;" : NULL; break;
+		case '\t': ent = inAttr ? "&#9;" : NULL; break;
+		default: ent = NULL; break;
+		}
+		if (ent) {
+			put(writer, run, str - run);
+			put_str(writer, ent);
+			run = str + 1;
+		}
+	}
+	put(writer, run, str - run);
+}
+
+static void close_start_tag(WsXmlWriter *writer)
+{
+	if (writer->startTag) {
+		put(writer, ">", 1);
+		writer->startTag = 0;
+	}
+}
+
+static int prefix_in_scope(WsXmlWriter *writer, const char *prefix, int from)
+{
+	int i;
+
+	for (i = from; i < writer->nsCount; i++) {
+		if (!strcmp(writer->ns[i].prefix, prefix))
+			return 1;
+	}
+	return 0;
+}
+
+/* Prefix bound to uri that no inner declaration hides */
+static const char *find_prefix(WsXmlWriter *writer, const char *uri)
+{
+	int i;
+
+	for (i = writer->nsCount - 1; i >= 0; i--) {
+		struct writer_ns *ns = &writer->ns[i];
+
+		if (ns->prefix[0] && !strcmp(ns->uri, uri) &&
+		    !prefix_in_scope(writer, ns->prefix, i + 1))
+			return ns->prefix;
+	}
+	return NULL;
+}
+
+static int push_ns(WsXmlWriter *writer, const char *uri, const char *prefix)
+{
+	if (writer->nsCount == writer->nsSize) {
+		int size = writer->nsSize ? writer->nsSize * 2 : 16;
+		struct writer_ns *ns = u_realloc(writer->ns, size * sizeof(*ns));
+
+		if (ns == NULL) {
+			writer->error = 1;
+			return -1;
+		}
+		writer->ns = ns;
+		writer->nsSize = size;
+	}
+	writer->ns[writer->nsCount].uri = u_strdup(uri);
+	writer->ns[writer->nsCount].prefix = u_strdup(prefix);
+	writer->nsCount++;
+	return 0;
+}
+
+/*
+ * New prefix for uri, declared on the parent node so that every element
+ * written shares it, as with nodes added to the tree
+ */
+static const char *new_prefix(WsXmlWriter *writer, const char *uri)
+{
+	struct writer_ns ns;
+	char prefix[16];
+	int i = 0;
+
+	ws_xml_make_default_prefix(writer->parent, uri, prefix,
+				   sizeof(prefix));
+	while (prefix[0] == 0 || prefix_in_scope(writer, prefix, 0))
+		snprintf(prefix, sizeof(prefix), "w%d", ++i);
+	if (ws_xml_ns_add(writer->parent, uri, prefix) == NULL) {
+		writer->error = 1;
+		return NULL;
+	}
+	if (push_ns(writer, uri, prefix))
+		return NULL;
+
+	/* goes below the declarations of the open elements */
+	ns = writer->ns[writer->nsCount - 1];
+	memmove(&writer->ns[1], &writer->ns[0],
+		(writer->nsCount - 1) * sizeof(ns));
+	writer->ns[0] = ns;
+	for (i = 0; i < writer->depth; i++)
+		writer->elements[i].nsCount++;
+	return ns.prefix;
+}
+
+static int add_parent_ns(WsXmlNodeH node, WsXmlNsH ns, void *data)
+{
+	WsXmlWriter *writer = (WsXmlWriter *) data;
+	char *prefix = ws_xml_get_ns_prefix(ns);
+	char *uri = ws_xml_get_ns_uri(ns);
+
+	if (prefix == NULL)
+		prefix = "";
+	/* inner declarations come first and hide the outer ones */
+	if (uri && !prefix_in_scope(writer, prefix, 0))
+		push_ns(writer, uri, prefix);
+	return 0;
+}
+
+/**
+ * Create a writer for content that goes under a node
+ * @param parent Node the content is put under by ws_xml_writer_flush()
+ * @return Writer, NULL on error
+ */
+WsXmlWriter *ws_xml_writer_new(WsXmlNodeH parent)
+{
+	WsXmlWriter *writer;
+
+	if (parent == NULL)
+		return NULL;
+	writer = u_zalloc(sizeof(*writer));
+	if (writer == NULL)
+		return NULL;
+	if (u_buf_create(&writer->buf)) {
+		u_free(writer);
+		return NULL;
+	}
+	writer->parent = parent;
+	ws_xml_ns_enum(parent, add_parent_ns, writer, 1);
+	return writer;
+}
+
+/**
+ * Destroy a writer, dropping what was not flushed
+ * @param writer Writer
+ */
+void ws_xml_writer_destroy(WsXmlWriter *writer)
+{
+	int i;
+
+	if (writer == NULL)
+		return;
+	for (i = 0; i < writer->depth; i++)
+		u_free(writer->elements[i].qname);
+	for (i = 0; i < writer->nsCount; i++) {
+		u_free(writer->ns[i].uri);
+		u_free(writer->ns[i].prefix);
+	}
+	u_free(writer->elements);
+	u_free(writer->ns);
+	u_buf_free(writer->buf);
+	u_free(writer);
+}
+
+/**
+ * Start an element
+ * @param writer Writer
+ * @param nsUri Namespace URI, NULL for none
+ * @param name Local name
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_writer_start_element(WsXmlWriter *writer,
+		const char *nsUri, const char *name)
+{
+	struct writer_element *element;
+	const char *prefix = NULL;
+
+	if (name == NULL || writer->error)
+		return -1;
+	if (writer->depth == writer->elementsSize) {
+		int size = writer->elementsSize ? writer->elementsSize * 2 : 16;
+		element = u_realloc(writer->elements, size * sizeof(*element));
+		if (element == NULL)
+			return -1;
+		writer->elements = element;
+		writer->elementsSize = size;
+	}
+	close_start_tag(writer);
+	if (nsUri && (prefix = find_prefix(writer, nsUri)) == NULL &&
+	    (prefix = new_prefix(writer, nsUri)) == NULL)
+		return -1;
+	element = &writer->elements[writer->depth];
+	element->nsCount = writer->nsCount;
+	element->qname = prefix ? u_strdup_printf("%s:%s", prefix, name) :
+		u_strdup(name);
+	writer->depth++;
+	writer->startTag = 1;
+
+	put(writer, "<", 1);
+	put_str(writer, element->qname);
+	if (nsUri == NULL) {
+		int i;
+
+		/* leave a default namespace of the parent */
+		for (i = writer->nsCount - 1; i >= 0; i--) {
+			if (writer->ns[i].prefix[0] == 0)
+				break;
+		}
+		if (i >= 0 && writer->ns[i].uri[0]) {
+			push_ns(writer, "", "");
+			put(writer, " xmlns=\"\"", 9);
+		}
+	}
+	return writer->error ? -1 : 0;
+}
+
+/**
+ * Add an attribute to the element just started
+ * @param writer Writer
+ * @param nsUri Namespace URI, NULL for none
+ * @param name Local name
+ * @param val Value
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_writer_add_attr(WsXmlWriter *writer,
+		const char *nsUri, const char *name, const char *val)
+{
+	const char *prefix = NULL;
+
+	if (!writer->startTag || name == NULL || writer->error)
+		return -1;
+	if (nsUri && (prefix = find_prefix(writer, nsUri)) == NULL &&
+	    (prefix = new_prefix(writer, nsUri)) == NULL)
+		return -1;
+	put(writer, " ", 1);
+	if (prefix) {
+		put_str(writer, prefix);
+		put(writer, ":", 1);
+	}
+	put_str(writer, name);
+	put(writer, "=\"", 2);
+	if (val)
+		put_escaped(writer, val, 1);
+	put(writer, "\"", 1);
+	return writer->error ? -1 : 0;
+}
+
+/**
+ * Add text to the current element
+ * @param writer Writer
+ * @param text Text, escaped as needed
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_writer_add_text(WsXmlWriter *writer, const char *text)
+{
+	if (writer->depth == 0 || writer->error)
+		return -1;
+	close_start_tag(writer);
+	if (text)
+		put_escaped(writer, text, 0);
+	return writer->error ? -1 : 0;
+}
+
+/**
+ * End the current element
+ * @param writer Writer
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_writer_end_element(WsXmlWriter *writer)
+{
+	struct writer_element *element;
+
+	if (writer->depth == 0 || writer->error)
+		return -1;
+	element = &writer->elements[writer->depth - 1];
+	if (writer->startTag) {
+		put(writer, "/>", 2);
+		writer->startTag = 0;
+	} else {
+		put(writer, "</", 2);
+		put_str(writer, element->qname);
+		put(writer, ">", 1);
+	}
+	while (writer->nsCount > element->nsCount) {
+		writer->nsCount--;
+		u_free(writer->ns[writer->nsCount].uri);
+		u_free(writer->ns[writer->nsCount].prefix);
+	}
+	u_free(element->qname);
+	writer->depth--;
+	return writer->error ? -1 : 0;
+}
+
+/**
+ * Add an element with text only
+ * @param writer Writer
+ * @param nsUri Namespace URI, NULL for none
+ * @param name Local name
+ * @param text Text, NULL for an empty element
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_writer_add_element(WsXmlWriter *writer,
+		const char *nsUri, const char *name, const char *text)
+{
+	if (ws_xml_writer_start_element(writer, nsUri, name))
+		return -1;
+	if (text && ws_xml_writer_add_text(writer, text))
+		return -1;
+	return ws_xml_writer_end_element(writer);
+}
+
+/**
+ * Add a copy of a node of another document, as ws_xml_duplicate_tree()
+ * would add it to the parent
+ * @param writer Writer
+ * @param node Node to copy
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_writer_add_node(WsXmlWriter *writer, WsXmlNodeH node)
+{
+	WsXmlNodeH child;
+	WsXmlAttrH attr;
+	char *text;
+	int i;
+
+	if (node == NULL)
+		return -1;
+	if (ws_xml_writer_start_element(writer, ws_xml_get_node_name_ns(node),
+					ws_xml_get_node_local_name(node)))
+		return -1;
+	for (i = 0; (attr = ws_xml_get_node_attr(node, i)) != NULL; i++) {
+		if (ws_xml_writer_add_attr(writer, ws_xml_get_attr_ns(attr),
+					   ws_xml_get_attr_name(attr),
+					   ws_xml_get_attr_value(attr)))
+			return -1;
+	}
+	for (i = 0; (child = ws_xml_get_child(node, i, NULL, NULL)) != NULL;
+	     i++) {
+		if (ws_xml_writer_add_node(writer, child))
+			return -1;
+	}
+	/* text only where there are no children, as in the tree */
+	if (i == 0 && (text = ws_xml_get_node_text(node)) != NULL && *text &&
+	    ws_xml_writer_add_text(writer, text))
+		return -1;
+	return ws_xml_writer_end_element(writer);
+}
+
+/**
+ * Get the size of the text written and not flushed yet
+ * @param writer Writer
+ * @return Size in bytes, as UTF-8
+ */
+size_t ws_xml_writer_get_size(WsXmlWriter *writer)
+{
+	return u_buf_len(writer->buf);
+}
+
+/**
+ * Drop what was written after the given size, e.g. the last element when
+ * it does not fit in the envelope
+ * @param writer Writer
+ * @param size Size from ws_xml_writer_get_size() between elements
+ * @return 0 on success, -1 if an element is still open
+ */
+int ws_xml_writer_set_size(WsXmlWriter *writer, size_t size)
+{
+	if (writer->depth > 0 || size > u_buf_len(writer->buf))
+		return -1;
+	u_buf_set_len(writer->buf, size);
+	return 0;
+}
+
+/**
+ * Put what was written under the parent node and start over
+ * @param writer Writer
+ * @return 0 on success, -1 on error or if an element is still open
+ */
+int ws_xml_writer_flush(WsXmlWriter *writer)
+{
+	char *markup;
+
+	if (writer->depth > 0 || writer->error)
+		return -1;
+	if (u_buf_len(writer->buf) == 0)
+		return 0;
+	markup = u_buf_steal(writer->buf);
+	if (xml_parser_node_add_markup(writer->parent, markup) == NULL) {
+		u_free(markup);
+		return -1;
+	}
+	return 0;
+}
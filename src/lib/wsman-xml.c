@@ -228,13 +228,7 @@ void ws_xml_ns_enum(WsXmlNodeH node,
 
 
 
-/**
- * Create an empty envelope with a <b>Header</b> and a <b>Body</b>
- * @param soap Soap handler
- * @param soapVersion The SOAP version to be used for creating the envelope
- * @return An XMl document
- */
-WsXmlDocH ws_xml_create_envelope( void )
+static WsXmlDocH build_envelope(void)
 {
 	WsXmlDocH doc = NULL;
 
@@ -252,6 +246,30 @@ WsXmlDocH ws_xml_create_envelope( void )
 	return doc;
 }
 
+/* Never changed once built, envelopes are copies of it */
+static WsXmlDocH envelope_template = NULL;
+static pthread_once_t envelope_once = PTHREAD_ONCE_INIT;
+
+static void build_envelope_template(void)
+{
+	envelope_template = build_envelope();
+}
+
+/**
+ * Create an empty envelope with a <b>Header</b> and a <b>Body</b>
+ * @param soap Soap handler
+ * @param soapVersion The SOAP version to be used for creating the envelope
+ * @return An XMl document
+ */
+WsXmlDocH ws_xml_create_envelope( void )
+{
+	pthread_once(&envelope_once, build_envelope_template);
+	if (envelope_template == NULL)
+		return build_envelope();
+	return ws_xml_create_doc_by_import(
+			ws_xml_get_doc_root(envelope_template));
+}
+
 
 /**
  * Duplicate an XML document
@@ -376,6 +394,185 @@ void ws_xml_dump_memory_enc(WsXmlDocH doc, char **buf, int *ptrSize,
 	xml_parser_doc_to_memory(doc, buf, ptrSize, encoding);
 }
 
+/**
+ * Dump XML document contents into a buffer, as ws_xml_dump_memory_enc()
+ * does, without an intermediate copy
+ * @param doc XML document
+ * @param buf The target buffer, its content is replaced
+ * @param encoding The encoding to be used
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_dump_buf_enc(WsXmlDocH doc, u_buf_t *buf, const char *encoding)
+{
+	return xml_parser_doc_dump_buf_enc(doc, buf, encoding);
+}
+
+
+/*
+ * Markers are "@@openwsman-<uuid>-<id>@@", the uuid drawn for each
+ * template so that no text of the document can pass for one.
+ */
+#define TEMPLATE_MARKER_PREFIX	"@@openwsman-"
+
+/**
+ * Create a template, see ws_xml_template_compile()
+ * @return Template, NULL on error
+ */
+WsXmlTemplate *ws_xml_template_new(void)
+{
+	WsXmlTemplate *t = u_zalloc(sizeof(*t));
+	char uuid[64] = "";
+
+	if (t == NULL)
+		return NULL;
+	/* the return value differs between the implementations */
+	generate_uuid(uuid, sizeof(uuid), 1);
+	if (uuid[0] == 0) {
+		u_free(t);
+		return NULL;
+	}
+	snprintf(t->marker, sizeof(t->marker), TEMPLATE_MARKER_PREFIX "%s-", uuid);
+	return t;
+}
+
+/**
+ * Destroy a template
+ * @param t Template
+ */
+void ws_xml_template_destroy(WsXmlTemplate *t)
+{
+	if (t == NULL)
+		return;
+	u_free(t->slots);
+	u_free(t->buf);
+	u_free(t);
+}
+
+/**
+ * Get the marker of a slot, to be put in the document as element text
+ * or attribute value before it is compiled
+ * @param t Template
+ * @param id Slot number
+ * @param buf Where the marker goes
+ * @param size Size of buf
+ * @return buf
+ */
+char *ws_xml_template_marker(WsXmlTemplate *t, unsigned int id,
+		char *buf, size_t size)
+{
+	snprintf(buf, size, "%s%u@@", t->marker, id);
+	return buf;
+}
+
+static int template_repeats_slot(WsXmlTemplate *t)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < t->nslots; i++) {
+		for (j = i + 1; j < t->nslots; j++) {
+			if (t->slots[i].id == t->slots[j].id)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Serialize a document holding the markers of slots 0 to nslots - 1
+ * as UTF-8 and find them, each has to be there exactly once
+ * @param t Template
+ * @param doc XML document
+ * @param nslots Number of slots
+ * @return 0 on success, -1 on error
+ */
+int ws_xml_template_compile(WsXmlTemplate *t, WsXmlDocH doc,
+		unsigned int nslots)
+{
+	size_t prefixlen = strlen(t->marker);
+	const char *p;
+	char *buf = NULL, *end;
+	unsigned long id;
+	int len = 0;
+
+	u_free(t->buf);
+	u_free(t->slots);
+	t->buf = NULL;
+	t->nslots = 0;
+	t->slots = u_zalloc((nslots ? nslots : 1) * sizeof(*t->slots));
+	if (t->slots == NULL)
+		return -1;
+	ws_xml_dump_memory_enc(doc, &buf, &len, "UTF-8");
+	if (buf == NULL)
+		return -1;
+	t->buf = u_strndup(buf, len);
+	t->len = len;
+	ws_xml_free_memory(buf);
+	if (t->buf == NULL)
+		return -1;
+
+	for (p = t->buf; (p = strstr(p, t->marker)) != NULL; p = end + 2) {
+		id = strtoul(p + prefixlen, &end, 10);
+		if (end == p + prefixlen || strncmp(end, "@@", 2) ||
+				id >= nslots || t->nslots == nslots) {
+			error("unexpected marker in template");
+			return -1;
+		}
+		t->slots[t->nslots].at = p - t->buf;
+		t->slots[t->nslots].end = end + 2 - t->buf;
+		t->slots[t->nslots].id = id;
+		t->nslots++;
+	}
+	if (t->nslots != nslots || template_repeats_slot(t)) {
+		error("template lost or repeated a marker");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Get a slot of a compiled template
+ * @param t Template
+ * @param id Slot number
+ * @return Slot, NULL if there is no such slot
+ */
+const WsXmlTemplateSlot *ws_xml_template_slot(WsXmlTemplate *t,
+		unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->nslots; i++) {
+		if (t->slots[i].id == id)
+			return &t->slots[i];
+	}
+	return NULL;
+}
+
+/**
+ * Append text to a buffer, escaped for element text and attribute values
+ * @param buf Buffer
+ * @param str Text
+ */
+void ws_xml_buf_append_escaped(u_buf_t *buf, const char *str)
+{
+	const char *run = str, *ent;
+
+	for (; *str; str++) {
+		switch (*str) {
+		case '&': ent = "&amp;"; break;
+		case '<': ent = "&lt;"; break;
+		case '>': ent = "&gt;"; break;
+		case '"': ent = "&quot;"; break;
+		default: continue;
+		}
+		if (str > run)
+			u_buf_append(buf, (void *) run, str - run);
+		u_buf_append(buf, (void *) ent, strlen(ent));
+		run = str + 1;
+	}
+	if (str > run)
+		u_buf_append(buf, (void *) run, str - run);
+}
+
 
 
 /**
@@ -560,6 +757,92 @@ WsXmlDocH ws_xml_read_memory( const char *buf, size_t size, const char *encoding
 }
 
 
+/**
+ * Start parsing a document that arrives in pieces
+ * @param encoding Document encoding
+ * @param callback Called with each enumeration item as soon as it is
+ * complete; the item is freed afterwards. A non-zero return stops parsing.
+ * @param data Callback data
+ * @return Parser handle
+ */
+WsXmlStreamParser *ws_xml_stream_new(const char *encoding,
+		WsXmlEnumCallback callback, void *data)
+{
+	return xml_parser_stream_new(encoding, callback, data);
+}
+
+/**
+ * Feed the next piece of the document
+ * @param parser Parser handle
+ * @param buf Text buffer
+ * @param size Buffer size
+ * @return 0 to go on, non-zero once the callback stopped parsing
+ */
+int ws_xml_stream_push(WsXmlStreamParser *parser, const char *buf, size_t size)
+{
+	return xml_parser_stream_push(parser, buf, size);
+}
+
+/**
+ * Finish parsing and free the parser
+ * @param parser Parser handle
+ * @return XML document without the items handed out, NULL on error
+ */
+WsXmlDocH ws_xml_stream_finish(WsXmlStreamParser *parser)
+{
+	return xml_parser_stream_finish(parser);
+}
+
+/**
+ * Read a SOAP envelope up to the first element of its Body
+ * @param buf Text buffer with the envelope
+ * @param size Buffer size
+ * @param encoding Buffer encoding
+ * @param rest Set to the parser for the rest of the buffer, which must be
+ * finished with ws_xml_read_envelope_rest() or ws_xml_read_envelope_abort()
+ * @return XML document with the header complete, NULL on error
+ */
+WsXmlDocH ws_xml_read_envelope_head(const char *buf, size_t size,
+		const char *encoding, WsXmlStreamParser **rest)
+{
+	return xml_parser_envelope_head(buf, size, encoding, rest);
+}
+
+/**
+ * Read the rest of an envelope into its document and free the parser
+ * @param rest Parser from ws_xml_read_envelope_head()
+ * @return 1 if the whole envelope is well-formed, 0 if not
+ */
+int ws_xml_read_envelope_rest(WsXmlStreamParser *rest)
+{
+	return xml_parser_envelope_rest(rest);
+}
+
+/**
+ * Free the parser of an envelope without reading the rest
+ * @param rest Parser from ws_xml_read_envelope_head()
+ */
+void ws_xml_read_envelope_abort(WsXmlStreamParser *rest)
+{
+	xml_parser_envelope_abort(rest);
+}
+
+/**
+ * Check a document is well-formed without building it
+ * @param buf Text buffer
+ * @param size Buffer size
+ * @param encoding Encoding of the buffer, NULL to detect it
+ * @param callback Called with each start tag, non-zero stops the scan
+ * @param data Callback data
+ * @return 1 if the whole document is well-formed, 0 if not or stopped
+ */
+int ws_xml_scan_memory(const char *buf, size_t size, const char *encoding,
+		WsXmlScanCallback callback, void *data)
+{
+	return xml_parser_scan_memory(buf, size, encoding, callback, data);
+}
+
+
 WsXmlDocH ws_xml_read_file(const char *filename,
 			   const char *encoding, unsigned long options)
 {
@@ -667,7 +950,7 @@ void ws_xml_destroy_doc(WsXmlDocH doc)
 static int find_in_tree_callback(WsXmlNodeH node, void *_data)
 {
 	FindInTreeCallbackData *data = (FindInTreeCallbackData *) _data;
-	int retVal = ws_xml_is_node_qname(node, data->ns, data->name);
+	int retVal = ws_xml_match_qname(node, &data->qname);
 
 	if (retVal)
 		data->node = node;
@@ -689,8 +972,7 @@ WsXmlNodeH ws_xml_find_in_tree(WsXmlNodeH head, const char *nsUri,
 	FindInTreeCallbackData data;
 
 	data.node = NULL;
-	data.ns = nsUri;
-	data.name = localName;
+	ws_xml_qname_init(&data.qname, nsUri, localName);
 
 	ws_xml_enum_tree(head, find_in_tree_callback, &data, bRecursive);
 
@@ -752,26 +1034,29 @@ WsXmlNodeH
 ws_xml_get_child(WsXmlNodeH parent,
 		 int index, const char *nsUri, const char *localName)
 {
-	WsXmlNodeH node = NULL;
+	WsXmlQName qname;
 
-	if (parent && index >= 0) {
-		if (nsUri == NULL && localName == NULL)
-			node = xml_parser_node_get(parent, index);
-		else {
-			int count = 0;
-			node = xml_parser_get_first_child(parent);
-			while (node != NULL) {
-				if (ws_xml_is_node_qname (node, nsUri, localName)) {
-					if (count == index)
-						break;
-					count++;
-				}
-				node = xml_parser_get_next_child(node);
-			}
-		}
-	}
+	if (parent == NULL || index < 0)
+		return NULL;
+	if (nsUri == NULL && localName == NULL)
+		return xml_parser_node_get(parent, index);
+	ws_xml_qname_init(&qname, nsUri, localName);
+	return ws_xml_get_child_qname(parent, index, &qname);
+}
 
-	return node;
+/**
+ * Get XML child of a node by prepared qualified name
+ * @param parent Parent node
+ * @param index Index among the children with that name
+ * @param qname Qualified name from ws_xml_qname_init()
+ * @return Result XML node
+ */
+WsXmlNodeH
+ws_xml_get_child_qname(WsXmlNodeH parent, int index, const WsXmlQName *qname)
+{
+	if (parent == NULL || index < 0)
+		return NULL;
+	return xml_parser_get_child_qname(parent, index, qname);
 }
 
 /**
@@ -799,6 +1084,46 @@ int ws_xml_is_node_qname(WsXmlNodeH node, const char *nsUri,
 	return retVal;
 }
 
+/**
+ * Get the interned copy of a well-known namespace URI or local name
+ * @param str Name to look up
+ * @return Interned name, NULL if it is not a well-known name
+ */
+const char *ws_xml_intern(const char *str)
+{
+	return xml_parser_intern(str);
+}
+
+/**
+ * Prepare a qualified name for ws_xml_match_qname()
+ * @param qname Qualified name to set
+ * @param nsUri Namespace URI, NULL for any
+ * @param name Local name, NULL for any
+ */
+void ws_xml_qname_init(WsXmlQName *qname, const char *nsUri,
+		       const char *name)
+{
+	qname->ns = nsUri;
+	qname->name = name;
+	qname->internedNs = nsUri ? xml_parser_intern(nsUri) : NULL;
+	qname->internedName = name ? xml_parser_intern(name) : NULL;
+}
+
+/**
+ * Match an XML node against a prepared qualified name
+ * @param node XML node
+ * @param qname Qualified name from ws_xml_qname_init()
+ * @return Returns 1 if the node has this qualified name
+ * @brief Same as ws_xml_is_node_qname(), well-known names are compared
+ * by pointer
+ */
+int ws_xml_match_qname(WsXmlNodeH node, const WsXmlQName *qname)
+{
+	if (!node)
+		return 0;
+	return xml_parser_node_is_qname(node, qname);
+}
+
 
 /**
  * Count number of XML node children with same qualified name
@@ -814,6 +1139,7 @@ ws_xml_get_child_count_by_qname(WsXmlNodeH parent,
       const char *nsUri, const char *name)
 {
 	WsXmlNodeH node;
+	WsXmlQName qname;
 	int count;
 
 	if (!parent)
@@ -821,10 +1147,11 @@ ws_xml_get_child_count_by_qname(WsXmlNodeH parent,
 	if (nsUri == NULL && name == NULL) {
 		return ws_xml_get_child_count(parent);
 	}
+	ws_xml_qname_init(&qname, nsUri, name);
 	node = xml_parser_get_first_child(parent);
 	count = 0;
 	while (node != NULL) {
-		if (ws_xml_is_node_qname(node, nsUri, name)) {
+		if (ws_xml_match_qname(node, &qname)) {
 			count++;
 		}
 		node = xml_parser_get_next_child(node);
@@ -1483,13 +1810,15 @@ void ws_xml_set_ns(WsXmlNodeH r, const char* namespace, const char* prefix)
 	xml_parser_set_ns(r, ns, prefix);
 }
 
+/* 1 if the document does not fit in size bytes or cannot be dumped */
 int check_envelope_size(WsXmlDocH doc, unsigned int size, const char *charset)
 {
-	char *buf;
-	int len;
+	size_t len;
 	if(size == 0) return 0; 
-	ws_xml_dump_memory_enc(doc, &buf, &len, charset);
-	ws_xml_free_memory(buf);
+	if(xml_parser_doc_dump_size(doc, charset, &len)) {
+		error("envelope could not be dumped to measure it");
+		return 1;
+	}
 	if(len > size) return 1;
 	return 0;
 }
@@ -99,6 +99,9 @@ static int max_threads = 1;
 static unsigned long enumIdleTimeout = 100;
 static char *thread_stack_size="0";
 static int max_connections_per_thread=20;
+static int compression_threshold = 4096;
+static int compression_level = 1;
+static int lock_profile = 0;
 
 static char *config_file = NULL;
 
@@ -206,6 +209,9 @@ int wsmand_read_config(dictionary * ini)
 	uri_subscription_repository = iniparser_getstring(ini, "server:subs_repository", DEFAULT_SUBSCRIPTION_REPOSITORY);
         max_connections_per_thread = iniparser_getint(ini, "server:max_connections_per_thread", iniparser_getint(ini, "server:max_connextions_per_thread", 20));
         thread_stack_size = iniparser_getstring(ini, "server:thread_stack_size", "0");
+	compression_threshold = iniparser_getint(ini, "server:compression_threshold", 4096);
+	compression_level = iniparser_getint(ini, "server:compression_level", 1);
+	lock_profile = iniparser_getboolean(ini, "server:lock_profile", 0);
 #ifdef ENABLE_EVENTING_SUPPORT
 	wsman_server_set_subscription_repos(uri_subscription_repository);
 #endif
@@ -217,6 +223,26 @@ int wsmand_options_get_max_connections_per_thread(void)
         return max_connections_per_thread;
 }
 
+int wsmand_options_get_compression_threshold(void)
+{
+	return compression_threshold;
+}
+
+int wsmand_options_get_compression_level(void)
+{
+	/* higher levels cost much more CPU for little gain on XML */
+	if (compression_level < 1)
+		return 1;
+	if (compression_level > 6)
+		return 6;
+	return compression_level;
+}
+
+int wsmand_options_get_lock_profile(void)
+{
+	return lock_profile;
+}
+
 unsigned int wsmand_options_get_thread_stack_size(void)
 {
         errno=0;
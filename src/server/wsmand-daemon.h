@@ -95,6 +95,9 @@ char *wsmand_options_get_identify_file(void);
 char *wsmand_options_get_anon_identify_file(void);
 unsigned int wsmand_options_get_thread_stack_size(void);
 int wsmand_options_get_max_connections_per_thread(void);
+int wsmand_options_get_compression_threshold(void);
+int wsmand_options_get_compression_level(void);
+int wsmand_options_get_lock_profile(void);
 
 const char **wsmand_options_get_argv(void);
 int wsmand_read_config(dictionary * ini);
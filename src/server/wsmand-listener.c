@@ -35,6 +35,9 @@
  */
 
 #define _GNU_SOURCE
+
+/* most room made up front from the Content-Length of a request */
+#define MAX_REQUEST_PREALLOC (1024 * 1024)
 #ifdef HAVE_CONFIG_H
 #include "wsman_config.h"
 #endif
@@ -81,6 +84,9 @@
 #include <pthread.h>
 #endif
 #include <sys/socket.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 
 static pthread_mutex_t shttpd_mutex;
@@ -138,6 +144,83 @@ char *get_request_encoding(struct shttpd_arg *arg) {
 	return encoding;
 }
 
+#ifdef HAVE_ZLIB
+/*
+ * Pick the content coding of the response from the Accept-Encoding
+ * request header, gzip before deflate. NULL if neither is accepted.
+ */
+static
+const char *get_response_content_coding(struct shttpd_arg *arg) {
+	const char *accept, *p, *e;
+	int deflate = 0;
+
+	accept = shttpd_get_header(arg, "Accept-Encoding");
+	if (accept == NULL) {
+		return NULL;
+	}
+	for (p = accept; *p; p = *e ? e + 1 : e) {
+		const char *q;
+		size_t len;
+
+		while (*p == ' ' || *p == '\t')
+			p++;
+		e = strchr(p, ',');
+		if (e == NULL)
+			e = p + strlen(p);
+		for (len = 0; p + len < e && p[len] != ';' &&
+				p[len] != ' ' && p[len] != '\t'; len++)
+			;
+		/* "q=0" refuses the coding */
+		q = memchr(p, ';', e - p);
+		if (q && (q = strstr(q, "q=")) != NULL && q < e &&
+				strtod(q + 2, NULL) == 0)
+			continue;
+		if ((len == 4 && strncasecmp(p, "gzip", 4) == 0) ||
+				(len == 6 && strncasecmp(p, "x-gzip", 6) == 0))
+			return "gzip";
+		if (len == 7 && strncasecmp(p, "deflate", 7) == 0)
+			deflate = 1;
+	}
+	return deflate ? "deflate" : NULL;
+}
+
+/*
+ * Compress the response in place. Left untouched if zlib fails or
+ * the result would not be smaller.
+ */
+static
+void compress_response(char **response, size_t *len, const char *coding) {
+	z_stream z;
+	char *out;
+	uLong bound;
+
+	memset(&z, 0, sizeof(z));
+	/* window bits + 16 writes a gzip header instead of a zlib one */
+	if (deflateInit2(&z, wsmand_options_get_compression_level(), Z_DEFLATED,
+			strcmp(coding, "gzip") == 0 ? 15 + 16 : 15, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		error("deflateInit2 failed: %s", z.msg ? z.msg : "");
+		return;
+	}
+	bound = deflateBound(&z, *len);
+	out = u_malloc(bound);
+	z.next_in = (Bytef *) *response;
+	z.avail_in = *len;
+	z.next_out = (Bytef *) out;
+	z.avail_out = bound;
+	if (deflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out >= *len) {
+		u_free(out);
+	} else {
+		debug("%s encoded response: %lu -> %lu bytes", coding,
+				(unsigned long) *len, (unsigned long) z.total_out);
+		u_free(*response);
+		*response = out;
+		*len = z.total_out;
+	}
+	deflateEnd(&z);
+}
+#endif
+
 static
 void server_callback(struct shttpd_arg *arg)
 {
@@ -147,6 +230,10 @@ void server_callback(struct shttpd_arg *arg)
 	int k;
 	int status = WSMAN_STATUS_OK;
 	char *request_uri;
+#ifdef HAVE_ZLIB
+	const char *coding;
+	int threshold;
+#endif
 
 	char *fault_reason = NULL;
 	struct state {
@@ -172,7 +259,8 @@ void server_callback(struct shttpd_arg *arg)
         	/* New request. Allocate a state structure */
         	arg->state = state = calloc(1, sizeof(*state));
 	        state->cl = strtoul(s, NULL, 10);
-		u_buf_create(&(state->request));
+		u_buf_create_sized(&(state->request),
+			state->cl < MAX_REQUEST_PREALLOC ? state->cl : MAX_REQUEST_PREALLOC);
 	}
 
 	state = arg->state;
@@ -215,7 +303,7 @@ void server_callback(struct shttpd_arg *arg)
 			}
 			encoding = get_request_encoding(arg);
 
-			u_buf_set(wsman_msg->request, u_buf_ptr(state->request), u_buf_len(state->request));
+			u_buf_adopt(wsman_msg->request, state->request);
 #ifdef SHTTPD_GSS
 	        }
 		else {
@@ -297,7 +385,7 @@ void server_callback(struct shttpd_arg *arg)
 			goto DONE;
 		}
 		soap = (SoapH) arg->user_data;
-		u_buf_set(cimxml_msg->request, u_buf_ptr(state->request), u_buf_len(state->request));
+		u_buf_adopt(cimxml_msg->request, state->request);
 		cntx = u_malloc(sizeof(cimxml_context));
 		cntx->soap = soap;
 		cntx->uuid = uuid;
@@ -305,6 +393,14 @@ void server_callback(struct shttpd_arg *arg)
 		status = cimxml_msg->http_code;
 		cim_error_code = cimxml_msg->status.code;
 		cim_error = cimxml_msg->status.fault_msg;
+		if (status == WSMAN_STATUS_SERVICE_UNAVAILABLE) {
+			/* indication queue is full, let the CIMOM retry */
+			shttpd_printf(arg, "HTTP/1.1 %d Service Unavailable\r\n", status);
+			shttpd_printf(arg, "Retry-After: 1\r\n");
+			shttpd_printf(arg, "Content-Length: 0\r\n\r\n");
+			cimxml_message_destroy(cimxml_msg);
+			goto CONTINUE;
+		}
 		if (cim_error) {
 			shttpd_printf(arg, "HTTP/1.1 %d %s\r\n", status, fault_reason);
 			shttpd_printf(arg, "CIMError:%d:%s\r\n", cim_error_code, cim_error);
@@ -375,6 +471,18 @@ DONE:
 		} else {
 			shttpd_printf(arg, "Content-Type: application/soap+xml;charset=%s\r\n", encoding);
 		}
+#ifdef HAVE_ZLIB
+		threshold = wsmand_options_get_compression_threshold();
+		if (threshold > 0 && state->len > (size_t) threshold &&
+				(coding = get_response_content_coding(arg)) != NULL) {
+			size_t len = state->len;
+			/* the whole response is built already, one pass is enough */
+			compress_response(&state->response, &state->len, coding);
+			if (state->len != len)
+				shttpd_printf(arg, "Content-Encoding: %s\r\n", coding);
+			shttpd_printf(arg, "Vary: Accept-Encoding\r\n");
+		}
+#endif
     		shttpd_printf(arg, "Content-Length: %d\r\n", state->len);
 #ifdef SHTTPD_GSS
 	}
@@ -680,5 +788,8 @@ WsManListenerH *wsmand_start_server(dictionary * ini)
 	while (continue_working) {
 		shttpd_poll(httpd_ctx, 1000);
 	}
+#ifdef ENABLE_EVENTING_SUPPORT
+	wsman_event_shutdown(cntx->soap);
+#endif
 	return listener;
 }
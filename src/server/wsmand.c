@@ -139,6 +139,16 @@ static void signal_handler(int sig_num)
 
 
 
+static void lock_profile_handler(void *data)
+{
+	char *report = u_lock_profile_report();
+
+	if (report) {
+		message("Lock contention, times in usecs:\n%s", report);
+		u_free(report);
+	}
+}
+
 static void sighup_handler(int sig_num)
 {
 	if (wsmand_options_get_debug_level() == 0) {
@@ -289,6 +299,11 @@ int main(int argc, char **argv)
 	sigaction(SIGHUP, &sig_action, NULL);
 
 	initialize_logging();
+
+	if (wsmand_options_get_lock_profile()) {
+		u_lock_profile(1);
+		wsmand_shutdown_add_handler(lock_profile_handler, NULL);
+	}
 	
 	listener = wsmand_start_server(ini);
   
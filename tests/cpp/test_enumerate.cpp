@@ -0,0 +1,73 @@
+//----------------------------------------------------------------------------
+//
+//  File:       test_enumerate.cpp
+//
+//  License:    BSD-3-Clause
+//
+//  Contents:   OpenWsmanClient::Enumerate with a visitor: complete runs
+//              and early stops
+//
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+
+#include "OpenWsmanClient.h"
+#include "test_server.h"
+
+using namespace WsmanClientNamespace;
+
+#define RESOURCE_URI "http://schemas.dmtf.org/wbem/wscim/1/cim-schema/2/CIM_Test"
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+
+// Stops after the given number of items, 0 never stops
+class CountingVisitor : public EnumerationVisitor
+{
+	public:
+		unsigned int visited, stopAfter;
+		CountingVisitor(unsigned int stopAfter) : visited(0), stopAfter(stopAfter) {}
+		bool Visit(WsXmlNodeH item)
+		{
+			visited++;
+			return stopAfter == 0 || visited < stopAfter;
+		}
+};
+
+static void Run(TestServer &server, const string &path, unsigned int stopAfter,
+		unsigned int expectVisited, unsigned int maxPulls, unsigned int expectReleases)
+{
+	TestServer::Endpoint endpoint;
+	endpoint.itemsPerResponse = 2;
+	endpoint.pullResponses = 3;
+	server.SetEndpoint(path, endpoint);
+
+	OpenWsmanClient client("127.0.0.1", server.Port(), path, "http", "basic");
+	CountingVisitor visitor(stopAfter);
+	client.Enumerate(RESOURCE_URI, visitor, WsmanOptions());
+	check(visitor.visited == expectVisited);
+	check(server.Requests(path, "Enumerate") == 1);
+	check(server.Requests(path, "Pull") <= maxPulls);
+	check(server.Requests(path, "Release") == expectReleases);
+}
+
+int main(int argc, char **argv)
+{
+	TestServer server;
+
+	// all 2 + 3 * 2 items, the enumeration ends by itself
+	Run(server, "/complete", 0, 8, 3, 0);
+	// stopped on the Enumerate response: released without a Pull
+	Run(server, "/stop-enumerate", 1, 1, 0, 1);
+	// stopped on the first Pull response, at most one more in flight
+	Run(server, "/stop-pull", 3, 3, 2, 1);
+	if (failed)
+		printf("%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
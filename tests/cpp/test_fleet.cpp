@@ -0,0 +1,173 @@
+//----------------------------------------------------------------------------
+//
+//  File:       test_fleet.cpp
+//
+//  License:    BSD-3-Clause
+//
+//  Contents:   WsmanFleet scheduling: in-flight limit, per-request
+//              timeout, retries and enumeration
+//
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "OpenWsmanClient.h"
+#include "WsmanFleet.h"
+#include "test_server.h"
+
+using namespace WsmanClientNamespace;
+
+#define RESOURCE_URI "http://schemas.dmtf.org/wbem/wscim/1/cim-schema/2/CIM_Test"
+
+#define check(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static int failed = 0;
+
+class Recorder : public WsmanFleetHandler
+{
+	public:
+		vector<unsigned int> results, errors, done;
+		Recorder(size_t n) : results(n), errors(n), done(n) {}
+		void OnResult(size_t endpoint, const string &result) { results[endpoint]++; }
+		void OnError(size_t endpoint, const WsmanClientException &e) { errors[endpoint]++; }
+		void OnDone(size_t endpoint) { done[endpoint]++; }
+};
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void DeleteClients(vector<OpenWsmanClient *> &clients)
+{
+	for (size_t i = 0; i < clients.size(); i++)
+		delete clients[i];
+	clients.clear();
+}
+
+// never more requests on the wire than asked for
+static void TestInFlight(TestServer &server)
+{
+	TestServer::Endpoint slow;
+	vector<OpenWsmanClient *> clients;
+	size_t i;
+
+	slow.delayMsecs = 100;
+	server.SetEndpoint("/inflight", slow);
+	for (i = 0; i < 6; i++)
+		clients.push_back(new OpenWsmanClient("127.0.0.1", server.Port(),
+				"/inflight", "http", "basic"));
+	Recorder recorder(clients.size());
+	WsmanFleet fleet(clients, 2);
+	fleet.Get(RESOURCE_URI, WsmanOptions(), recorder);
+	for (i = 0; i < clients.size(); i++) {
+		check(recorder.results[i] == 1);
+		check(recorder.done[i] == 1);
+		check(recorder.errors[i] == 0);
+	}
+	check(server.Requests("/inflight", "Get") == 6);
+	check(server.MaxConcurrent() == 2);
+	DeleteClients(clients);
+}
+
+// the fleet timeout holds for a client whose connection is reused,
+// and the client keeps its own afterwards
+static void TestTimeout(TestServer &server)
+{
+	TestServer::Endpoint endpoint;
+	vector<OpenWsmanClient *> clients;
+	double start;
+
+	server.SetEndpoint("/timeout", endpoint);
+	clients.push_back(new OpenWsmanClient("127.0.0.1", server.Port(),
+			"/timeout", "http", "basic"));
+	clients[0]->Get(RESOURCE_URI);
+
+	endpoint.delayMsecs = 2500;
+	server.SetEndpoint("/timeout", endpoint);
+	Recorder recorder(1);
+	WsmanFleet fleet(clients, 1, 1);
+	start = Now();
+	fleet.Get(RESOURCE_URI, WsmanOptions(), recorder);
+	check(Now() - start < 2.0);
+	check(recorder.errors[0] == 1);
+	check(recorder.results[0] == 0);
+
+	try {
+		clients[0]->Get(RESOURCE_URI);
+	} catch (WsmanClientException &e) {
+		printf("client lost its timeout: %s\n", e.what());
+		failed++;
+	}
+	DeleteClients(clients);
+}
+
+static void TestRetries(TestServer &server)
+{
+	TestServer::Endpoint flaky, broken;
+	vector<OpenWsmanClient *> clients;
+
+	flaky.failFirst = 2;
+	broken.failFirst = 100;
+	server.SetEndpoint("/flaky", flaky);
+	server.SetEndpoint("/broken", broken);
+	clients.push_back(new OpenWsmanClient("127.0.0.1", server.Port(),
+			"/flaky", "http", "basic"));
+	clients.push_back(new OpenWsmanClient("127.0.0.1", server.Port(),
+			"/broken", "http", "basic"));
+	Recorder recorder(clients.size());
+	WsmanFleet fleet(clients, 4, 0, 2);
+	fleet.Get(RESOURCE_URI, WsmanOptions(), recorder);
+	check(recorder.results[0] == 1 && recorder.done[0] == 1);
+	check(recorder.errors[0] == 0);
+	check(server.Requests("/flaky") == 3);
+	check(recorder.errors[1] == 1 && recorder.done[1] == 0);
+	check(server.Requests("/broken") == 3);
+	DeleteClients(clients);
+}
+
+static void TestEnumerate(TestServer &server)
+{
+	TestServer::Endpoint endpoint;
+	vector<OpenWsmanClient *> clients;
+	size_t i;
+
+	endpoint.itemsPerResponse = 2;
+	endpoint.pullResponses = 2;
+	server.SetEndpoint("/enumerate", endpoint);
+	for (i = 0; i < 3; i++)
+		clients.push_back(new OpenWsmanClient("127.0.0.1", server.Port(),
+				"/enumerate", "http", "basic"));
+	Recorder recorder(clients.size());
+	WsmanFleet fleet(clients, 2);
+	fleet.Enumerate(RESOURCE_URI, WsmanOptions(), recorder);
+	for (i = 0; i < clients.size(); i++) {
+		check(recorder.results[i] == 6);
+		check(recorder.done[i] == 1);
+		check(recorder.errors[i] == 0);
+	}
+	check(server.Requests("/enumerate", "Enumerate") == 3);
+	check(server.Requests("/enumerate", "Pull") == 6);
+	DeleteClients(clients);
+}
+
+int main(int argc, char **argv)
+{
+	TestServer server;
+
+	TestInFlight(server);
+	TestTimeout(server);
+	TestRetries(server);
+	TestEnumerate(server);
+	if (failed)
+		printf("%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
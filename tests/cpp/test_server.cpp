@@ -0,0 +1,274 @@
+//----------------------------------------------------------------------------
+//
+//  File:       test_server.cpp
+//
+//  License:    BSD-3-Clause
+//
+//  Contents:   Canned WS-Management endpoint on the loopback interface,
+//              for client tests that need something to talk to
+//
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "test_server.h"
+
+#define NS_SOAP		"http://www.w3.org/2003/05/soap-envelope"
+#define NS_ENUM		"http://schemas.xmlsoap.org/ws/2004/09/enumeration"
+#define NS_WSMAN	"http://schemas.dmtf.org/wbem/wsman/1/wsman.xsd"
+
+struct Connection
+{
+	TestServer *server;
+	int fd;
+};
+
+static void *ServeConnection(void *arg)
+{
+	Connection *c = (Connection *)arg;
+	c->server->Serve(c->fd);
+	delete c;
+	return NULL;
+}
+
+void *TestServer::Accept(void *arg)
+{
+	TestServer *server = (TestServer *)arg;
+	int fd;
+
+	while ((fd = accept(server->listener, NULL, NULL)) >= 0) {
+		Connection *c = new Connection;
+		pthread_t thread;
+		c->server = server;
+		c->fd = fd;
+		pthread_mutex_lock(&server->lock);
+		server->connections.insert(fd);
+		server->connectionThreads++;
+		pthread_mutex_unlock(&server->lock);
+		pthread_create(&thread, NULL, ServeConnection, c);
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+TestServer::TestServer()
+	: listener(-1), port(0), concurrent(0), maxConcurrent(0),
+	  connectionThreads(0)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	pthread_mutex_init(&lock, NULL);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) ||
+			listen(listener, 64) ||
+			getsockname(listener, (struct sockaddr *)&addr, &len)) {
+		perror("test server");
+		exit(1);
+	}
+	port = ntohs(addr.sin_port);
+	pthread_create(&acceptor, NULL, Accept, this);
+}
+
+TestServer::~TestServer()
+{
+	shutdown(listener, SHUT_RDWR);
+	close(listener);
+	pthread_join(acceptor, NULL);
+	// kick connections kept alive by the clients
+	pthread_mutex_lock(&lock);
+	for (set<int>::iterator i = connections.begin(); i != connections.end(); ++i)
+		shutdown(*i, SHUT_RDWR);
+	pthread_mutex_unlock(&lock);
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		unsigned int left = connectionThreads;
+		pthread_mutex_unlock(&lock);
+		if (left == 0)
+			break;
+		usleep(10000);
+	}
+	pthread_mutex_destroy(&lock);
+}
+
+void TestServer::SetEndpoint(const string &path, const Endpoint &endpoint)
+{
+	pthread_mutex_lock(&lock);
+	endpoints[path] = endpoint;
+	pthread_mutex_unlock(&lock);
+}
+
+unsigned int TestServer::Requests(const string &path, const string &action)
+{
+	unsigned int n = 0;
+	pthread_mutex_lock(&lock);
+	for (map<string, unsigned int>::iterator i = requests.begin();
+			i != requests.end(); ++i) {
+		if (i->first == path + " " + action ||
+				(action.empty() && i->first.compare(0, path.length() + 1, path + " ") == 0))
+			n += i->second;
+	}
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+unsigned int TestServer::MaxConcurrent()
+{
+	pthread_mutex_lock(&lock);
+	unsigned int n = maxConcurrent;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+// Text of the first element named name, prefixed or not
+static string ElementText(const string &body, const string &name)
+{
+	size_t at = 0;
+	while ((at = body.find(name, at)) != string::npos) {
+		char before = at ? body[at - 1] : 0;
+		at += name.length();
+		if ((before != '<' && before != ':') || at >= body.length() ||
+				(body[at] != '>' && body[at] != ' '))
+			continue;
+		size_t start = body.find('>', at);
+		size_t end = start == string::npos ? start : body.find('<', start);
+		if (end == string::npos)
+			return string();
+		return body.substr(start + 1, end - start - 1);
+	}
+	return string();
+}
+
+static string Items(const string &path, unsigned int response, unsigned int count)
+{
+	string items;
+	char item[128];
+	for (unsigned int i = 0; i < count; i++) {
+		snprintf(item, sizeof(item), "<p:Item xmlns:p=\"urn:test\">%s:%u:%u</p:Item>",
+				path.c_str(), response, i);
+		items += item;
+	}
+	return items;
+}
+
+string TestServer::Answer(const string &path, const string &body, int &status)
+{
+	string action = ElementText(body, "Action");
+	size_t slash = action.rfind('/');
+	if (slash != string::npos)
+		action = action.substr(slash + 1);
+
+	pthread_mutex_lock(&lock);
+	Endpoint endpoint = endpoints[path];
+	unsigned int seen = 0;
+	for (map<string, unsigned int>::iterator i = requests.begin();
+			i != requests.end(); ++i) {
+		if (i->first.compare(0, path.length() + 1, path + " ") == 0)
+			seen += i->second;
+	}
+	requests[path + " " + action]++;
+	pthread_mutex_unlock(&lock);
+
+	if (endpoint.delayMsecs)
+		usleep(endpoint.delayMsecs * 1000);
+	status = seen < endpoint.failFirst ? 503 : 200;
+	if (status != 200)
+		return string();
+
+	string response;
+	char context[32];
+	if (action == "Enumerate") {
+		response = "<n:EnumerateResponse>";
+		if (endpoint.pullResponses)
+			response += "<n:EnumerationContext>1</n:EnumerationContext>";
+		response += "<w:Items>" + Items(path, 0, endpoint.itemsPerResponse) + "</w:Items>";
+		if (!endpoint.pullResponses)
+			response += "<w:EndOfSequence/>";
+		response += "</n:EnumerateResponse>";
+	} else if (action == "Pull") {
+		unsigned int n = atoi(ElementText(body, "EnumerationContext").c_str());
+		response = "<n:PullResponse>";
+		if (n < endpoint.pullResponses) {
+			snprintf(context, sizeof(context), "%u", n + 1);
+			response += string("<n:EnumerationContext>") + context +
+				"</n:EnumerationContext>";
+		}
+		response += "<n:Items>" + Items(path, n, endpoint.itemsPerResponse) + "</n:Items>";
+		if (n >= endpoint.pullResponses)
+			response += "<n:EndOfSequence/>";
+		response += "</n:PullResponse>";
+	} else if (action != "Release") {
+		response = Items(path, 0, 1);
+	}
+	return "<s:Envelope xmlns:s=\"" NS_SOAP "\" xmlns:n=\"" NS_ENUM "\" "
+		"xmlns:w=\"" NS_WSMAN "\"><s:Header/><s:Body>" + response +
+		"</s:Body></s:Envelope>";
+}
+
+void TestServer::Serve(int fd)
+{
+	string in;
+	char buf[4096];
+	ssize_t n;
+
+	for (;;) {
+		size_t end;
+		while ((end = in.find("\r\n\r\n")) == string::npos) {
+			if ((n = recv(fd, buf, sizeof(buf), 0)) <= 0)
+				goto DONE;
+			in.append(buf, n);
+		}
+		string head = in.substr(0, end + 2);
+		size_t length = 0;
+		for (size_t at = 0; at < head.length(); at = head.find("\r\n", at) + 2) {
+			if (strncasecmp(head.c_str() + at, "Content-Length:", 15) == 0)
+				length = atoi(head.c_str() + at + 15);
+		}
+		while (in.length() < end + 4 + length) {
+			if ((n = recv(fd, buf, sizeof(buf), 0)) <= 0)
+				goto DONE;
+			in.append(buf, n);
+		}
+		size_t sp = head.find(' ');
+		string path = head.substr(sp + 1, head.find(' ', sp + 1) - sp - 1);
+		string body = in.substr(end + 4, length);
+		in.erase(0, end + 4 + length);
+
+		pthread_mutex_lock(&lock);
+		if (++concurrent > maxConcurrent)
+			maxConcurrent = concurrent;
+		pthread_mutex_unlock(&lock);
+
+		int status;
+		string answer = Answer(path, body, status);
+		snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\n"
+				"Content-Type: application/soap+xml;charset=UTF-8\r\n"
+				"Content-Length: %u\r\n\r\n",
+				status, status == 200 ? "OK" : "Service Unavailable",
+				(unsigned int)answer.length());
+		string out = buf + answer;
+
+		pthread_mutex_lock(&lock);
+		concurrent--;
+		pthread_mutex_unlock(&lock);
+		if (send(fd, out.c_str(), out.length(), MSG_NOSIGNAL) != (ssize_t)out.length())
+			break;
+	}
+DONE:
+	pthread_mutex_lock(&lock);
+	connections.erase(fd);
+	connectionThreads--;
+	pthread_mutex_unlock(&lock);
+	close(fd);
+}
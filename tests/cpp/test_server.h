@@ -0,0 +1,72 @@
+//----------------------------------------------------------------------------
+//
+//  File:       test_server.h
+//
+//  License:    BSD-3-Clause
+//
+//  Contents:   Canned WS-Management endpoint on the loopback interface,
+//              for client tests that need something to talk to
+//
+//----------------------------------------------------------------------------
+
+#ifndef __TEST_SERVER_H
+#define __TEST_SERVER_H
+
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <string>
+
+using namespace std;
+
+// Answers Get and Invoke with one element, Enumerate with an optimized
+// response of itemsPerResponse items and Pull with as many more, for
+// pullResponses Pulls. Each connection is served by its own thread.
+class TestServer
+{
+	public:
+		// How an endpoint, told apart by its path, behaves
+		struct Endpoint
+		{
+			unsigned int delayMsecs;	// before each answer
+			unsigned int failFirst;		// answered with 503
+			unsigned int itemsPerResponse;
+			unsigned int pullResponses;
+			Endpoint() : delayMsecs(0), failFirst(0),
+				itemsPerResponse(2), pullResponses(1) {}
+		};
+
+		TestServer();
+		~TestServer();
+
+		int Port() const { return port; }
+		void SetEndpoint(const string &path, const Endpoint &endpoint);
+
+		// requests seen for path with an action ending in action, or
+		// for all actions if empty
+		unsigned int Requests(const string &path, const string &action = string());
+		unsigned int MaxConcurrent();
+
+		// Serving a connection, public for the thread entry point
+		void Serve(int fd);
+
+	private:
+		int listener;
+		int port;
+		pthread_t acceptor;
+		pthread_mutex_t lock;
+		map<string, Endpoint> endpoints;
+		map<string, unsigned int> requests;	// path + " " + action
+		unsigned int concurrent;
+		unsigned int maxConcurrent;
+		set<int> connections;
+		unsigned int connectionThreads;
+
+		static void *Accept(void *arg);
+		string Answer(const string &path, const string &body, int &status);
+
+		TestServer(const TestServer &);
+		TestServer &operator =(const TestServer &);
+};
+
+#endif
@@ -136,14 +136,14 @@ static void test_basic_types(void)
 	    SER_DYN_ARRAY("shorts", 0, 1000, uint16),
 	    SER_END_ITEMS(Sample_Servie);
 
-	WsContextH cntx;
+	WsSerializerContextH cntx;
 	WsXmlDocH doc;
 	WsXmlNodeH node;
 	int retval;
 
-	cntx = ws_create_runtime(NULL);
+	cntx = ws_serializer_init();
 	CU_ASSERT_PTR_NOT_NULL(cntx);
-	doc = ws_xml_create_doc(cntx->soap, NULL, "example");
+	doc = ws_xml_create_doc(NULL, "example");
 	node = ws_xml_get_doc_root(doc);
 
 	retval = ws_serialize(cntx, node, &servie, Sample_Servie_TypeInfo,
@@ -202,14 +202,14 @@ static void test_static_struct(void)
 	    SER_STR("STRING", 1),
 	SER_END_ITEMS(Sample);
 
-	WsContextH cntx;
+	WsSerializerContextH cntx;
 	WsXmlDocH doc;
 	WsXmlNodeH node;
 	int retval;
 
-	cntx = ws_create_runtime(NULL);
+	cntx = ws_serializer_init();
 	CU_ASSERT_PTR_NOT_NULL(cntx);
-	doc = ws_xml_create_doc(cntx->soap, NULL, "example");
+	doc = ws_xml_create_doc(NULL, "example");
 	CU_ASSERT_PTR_NOT_NULL(doc);
 	node = ws_xml_get_doc_root(doc);
 	CU_ASSERT_PTR_NOT_NULL(node);
@@ -231,6 +231,155 @@ static void test_static_struct(void)
 }
 
 
+/* Items bigger than the array descriptor, at both ends of the allowed count */
+typedef struct {
+	XML_TYPE_STR name;
+	XML_TYPE_UINT32 id;
+	XML_TYPE_STR value;
+	XML_TYPE_STR extra;
+} DynItem;
+
+typedef struct {
+	XML_TYPE_DYN_ARRAY items;
+} DynSample;
+
+typedef DynSample DynAny;
+
+SER_START_ITEMS(DynItem)
+    SER_STR("name", 1),
+    SER_UINT32("id", 1),
+    SER_STR("value", 1),
+    SER_STR("extra", 1),
+SER_END_ITEMS(DynItem);
+
+SER_START_ITEMS(DynSample)
+    SER_DYN_ARRAY("item", 1, 3, DynItem),
+SER_END_ITEMS(DynSample);
+
+/* same layout, any count, to produce documents out of bounds */
+SER_START_ITEMS(DynAny)
+    SER_DYN_ARRAY("item", 0, 10, DynItem),
+SER_END_ITEMS(DynAny);
+
+static void *dyn_round_trip(WsSerializerContextH cntx, unsigned int count,
+		XmlSerializerInfo *in, XmlSerializerInfo *out)
+{
+	DynItem items[4] = {
+		{"name 0", 0, "value 0", "extra 0"},
+		{"name 1", 1, "value 1", "extra 1"},
+		{"name 2", 2, "value 2", "extra 2"},
+		{"name 3", 3, "value 3", "extra 3"},
+	};
+	DynSample sample;
+	WsXmlDocH doc = ws_xml_create_doc(NULL, "example");
+	WsXmlNodeH node = ws_xml_get_doc_root(doc);
+	void *result;
+
+	sample.items.count = count;
+	sample.items.data = items;
+	CU_ASSERT_TRUE(ws_serialize(cntx, node, &sample, in,
+			CLASSNAME, NULL, NULL, 0) >= 0);
+	result = ws_deserialize(cntx, ws_xml_get_doc_root(doc), out,
+			CLASSNAME, NULL, NULL, 0, 0);
+	ws_xml_destroy_doc(doc);
+	return result;
+}
+
+static void check_dyn_items(DynSample *sample, unsigned int count)
+{
+	DynItem *items;
+	unsigned int i;
+	char buf[32];
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sample);
+	CU_ASSERT_EQUAL(sample->items.count, count);
+	items = (DynItem *) sample->items.data;
+	for (i = 0; i < count && i < sample->items.count; i++) {
+		CU_ASSERT_EQUAL(items[i].id, i);
+		sprintf(buf, "name %u", i);
+		CU_ASSERT_STRING_EQUAL(items[i].name, buf);
+		sprintf(buf, "value %u", i);
+		CU_ASSERT_STRING_EQUAL(items[i].value, buf);
+		sprintf(buf, "extra %u", i);
+		CU_ASSERT_STRING_EQUAL(items[i].extra, buf);
+	}
+}
+
+static void test_dyn_array_bounds(void)
+{
+	WsSerializerContextH cntx = ws_serializer_init();
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(cntx);
+	CU_ASSERT_TRUE(sizeof(DynItem) > sizeof(XML_TYPE_DYN_ARRAY));
+	/* minimum and maximum count */
+	check_dyn_items(dyn_round_trip(cntx, 1, DynSample_TypeInfo,
+			DynSample_TypeInfo), 1);
+	check_dyn_items(dyn_round_trip(cntx, 3, DynSample_TypeInfo,
+			DynSample_TypeInfo), 3);
+	/* one below and one above */
+	CU_ASSERT_PTR_NULL(dyn_round_trip(cntx, 0, DynAny_TypeInfo,
+			DynSample_TypeInfo));
+	CU_ASSERT_PTR_NULL(dyn_round_trip(cntx, 4, DynAny_TypeInfo,
+			DynSample_TypeInfo));
+	ws_serializer_cleanup(cntx);
+}
+
+/* Arrays whose elements are interleaved, and nested structs using the
+ * same element names, resolve to the right instances */
+static void test_interleaved_arrays(void)
+{
+	typedef struct {
+		XML_TYPE_UINT16 a;
+		XML_TYPE_UINT16 b;
+	} Inner;
+
+	typedef struct {
+		XML_TYPE_DYN_ARRAY a;
+		XML_TYPE_DYN_ARRAY b;
+		Inner inner[2];
+	} Sample;
+
+	SER_TYPEINFO_UINT16;
+
+	SER_START_ITEMS(Inner)
+	    SER_UINT16("a", 1),
+	    SER_UINT16("b", 1),
+	SER_END_ITEMS(Inner);
+
+	SER_START_ITEMS(Sample)
+	    SER_DYN_ARRAY("a", 0, 10, uint16),
+	    SER_DYN_ARRAY("b", 0, 10, uint16),
+	    SER_STRUCT("inner", 2, Inner),
+	SER_END_ITEMS(Sample);
+
+	static const char *xml =
+		"<example><" CLASSNAME ">"
+		"<a>1</a><b>2</b><inner><a>10</a><b>11</b></inner>"
+		"<a>3</a><inner><b>13</b><a>12</a></inner><b>4</b><a>5</a>"
+		"</" CLASSNAME "></example>";
+	WsSerializerContextH cntx = ws_serializer_init();
+	WsXmlDocH doc = ws_xml_read_memory(xml, strlen(xml), NULL, 0);
+	Sample *sample;
+	XML_TYPE_UINT16 *a, *b;
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(doc);
+	sample = (Sample *) ws_deserialize(cntx, ws_xml_get_doc_root(doc),
+			Sample_TypeInfo, CLASSNAME, NULL, NULL, 0, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sample);
+	CU_ASSERT_EQUAL(sample->a.count, 3);
+	CU_ASSERT_EQUAL(sample->b.count, 2);
+	a = (XML_TYPE_UINT16 *) sample->a.data;
+	b = (XML_TYPE_UINT16 *) sample->b.data;
+	if (sample->a.count == 3 && sample->b.count == 2) {
+		CU_ASSERT_TRUE(a[0] == 1 && a[1] == 3 && a[2] == 5);
+		CU_ASSERT_TRUE(b[0] == 2 && b[1] == 4);
+	}
+	CU_ASSERT_TRUE(sample->inner[0].a == 10 && sample->inner[0].b == 11);
+	CU_ASSERT_TRUE(sample->inner[1].a == 12 && sample->inner[1].b == 13);
+	ws_xml_destroy_doc(doc);
+	ws_serializer_cleanup(cntx);
+}
+
 /* The main() function for setting up and running the tests.
  * Returns a CUE_SUCCESS on successful running, another
  * CUnit error code on failure.
@@ -253,7 +402,9 @@ int main()
    /* add the tests to the suite */
    /* NOTE - ORDER IS IMPORTANT - MUST TEST fread() AFTER fprintf() */
    if ( (NULL == CU_add_test(pSuite, "test of static struct array", test_static_struct)) ||
-    	(NULL == CU_add_test(pSuite, "test of basic_types", test_basic_types)) )
+    	(NULL == CU_add_test(pSuite, "test of basic_types", test_basic_types)) ||
+    	(NULL == CU_add_test(pSuite, "test of dynamic array bounds", test_dyn_array_bounds)) ||
+    	(NULL == CU_add_test(pSuite, "test of interleaved arrays", test_interleaved_arrays)) )
    {
       CU_cleanup_registry();
       return CU_get_error();
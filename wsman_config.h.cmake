@@ -139,6 +139,11 @@
 #define HAVE_LIBCRYPT 1
 #endif
 
+/* zlib library present */
+#if @HAVE_ZLIB@
+#define HAVE_ZLIB 1
+#endif
+
 /* Define to 1 if you have the `nsl' library (-lnsl). */
 #if @HAVE_LIBNSL@
 #define HAVE_LIBNSL 1